@@ -11,6 +11,7 @@
 #include <memory>
 #include <vector>
 #include "conf.h"
+#include "compilation/rope.h"
 #include "compilation/token.h"
 #include "visitors/visitor.h"
 
@@ -41,6 +42,9 @@ namespace cherie::compiler::ast
 		[[nodiscard]] bool is_a(const node_type type) const { return type_ == type; }
 
 		virtual void accept(visitor* visitor) = 0;
+
+		size_t line = 0;
+		size_t column = 0;
 	private:
 		node_type type_ = node_type::none;
 	};
@@ -62,13 +66,34 @@ namespace cherie::compiler::ast
 		NODE_ACCEPT
 	};
 
+	/* a function body that was only scanned, it is parsed when the function is first called */
+	struct deferred_body
+	{
+		types::string source; // from the opening brace to the closing one
+		size_t line = 1;
+		size_t column = 0;
+		size_t tokens = 0;
+		std::vector<types::string> names; // every identifier in it
+	};
+
 	struct function_definition final
 		: node
 	{
 		std::string function_name;
+		std::vector<types::string> parameters;
 		std::unique_ptr<statement_block> body;
+		std::unique_ptr<deferred_body> deferred; // set instead of body until it is parsed
+
+		NODE_ACCEPT
+	};
 
+	/* a function defined inside a block, it can read the variables around it */
+	struct function_statement final
+		: statement
+	{
 		NODE_ACCEPT
+
+		std::unique_ptr<function_definition> definition;
 	};
 	
 	struct if_statement final
@@ -91,29 +116,40 @@ namespace cherie::compiler::ast
 		std::unique_ptr<statement_block> block;
 	};
 
+	struct return_statement final
+		: statement
+	{
+		NODE_ACCEPT
+
+		std::vector<std::unique_ptr<expression>> values; // return a, b;
+	};
+
 	struct assignment_statement final
 		: statement
 	{
 		NODE_ACCEPT
 
 		bool immutable = false;
+		bool declaration = true; // false for `x = ...` on an existing variable
 		types::string variable_name;
 		// Type one day
 		std::unique_ptr<expression> value;
 	};
 	
-	struct expression
+	struct multiple_assignment_statement final
 		: statement
 	{
 		NODE_ACCEPT
-	};
 
-	struct unary_expression
-		: expression
+		bool immutable = false;
+		bool declaration = true;
+		std::vector<types::string> variable_names; // let a, b = f();
+		std::unique_ptr<call_expression> value;
+	};
+	
+	struct expression
+		: statement
 	{
-		token_type operation;
-		std::unique_ptr<expression> rhs;
-		
 		NODE_ACCEPT
 	};
 
@@ -135,6 +171,15 @@ namespace cherie::compiler::ast
 		NODE_ACCEPT
 	};
 
+	struct unary_expression
+		: primary_expression
+	{
+		token_type operation;
+		std::unique_ptr<expression> rhs;
+		
+		NODE_ACCEPT
+	};
+
 	struct call_expression
 		: primary_expression
 	{
@@ -160,6 +205,61 @@ namespace cherie::compiler::ast
 		std::unique_ptr<primary_expression> rhs;
 	};
 
+	/* { name: value, ... }, the names in the order given make the object's shape */
+	struct object_literal
+		: primary_expression
+	{
+		NODE_ACCEPT
+
+		std::vector<std::pair<types::string, std::unique_ptr<expression>>> fields;
+	};
+
+	/* [element, ...], an array of integers, or of doubles if any element is one */
+	struct array_literal
+		: primary_expression
+	{
+		NODE_ACCEPT
+
+		std::vector<std::unique_ptr<expression>> elements;
+	};
+
+	struct field_expression
+		: primary_expression
+	{
+		NODE_ACCEPT
+
+		std::unique_ptr<expression> object;
+		types::string field;
+	};
+
+	struct field_assignment_statement final
+		: statement
+	{
+		NODE_ACCEPT
+
+		std::unique_ptr<field_expression> target;
+		std::unique_ptr<expression> value;
+	};
+
+	/* container[key] */
+	struct index_expression
+		: primary_expression
+	{
+		NODE_ACCEPT
+
+		std::unique_ptr<expression> container;
+		std::unique_ptr<expression> key;
+	};
+
+	struct index_assignment_statement final
+		: statement
+	{
+		NODE_ACCEPT
+
+		std::unique_ptr<index_expression> target;
+		std::unique_ptr<expression> value;
+	};
+
 	struct variable
 		: primary_expression
 	{
@@ -174,12 +274,12 @@ namespace cherie::compiler::ast
 	struct string_literal
 		: primary_expression
 	{
-		explicit string_literal(types::string value)
+		explicit string_literal(rope value)
 			: value(std::move(value)) {}
 
 		NODE_ACCEPT
 		
-		types::string value;
+		rope value;
 	};
 
 	struct number_literal
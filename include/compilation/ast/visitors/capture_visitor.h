@@ -0,0 +1,203 @@
+/*
+ * File Name: capture_visitor.h
+ * Author(s): P. Kamara
+ *
+ * Finds the variables a nested function reads from around it.
+ */
+
+#pragma once
+
+#include <unordered_set>
+#include "compilation/ast/node.h"
+
+namespace cherie::compiler::ast
+{
+	/**
+	 * The names a function refers to without declaring them, in order of
+	 * first use, including whatever the functions nested in it need from
+	 * further out. Declarations are not tracked per block, so a name the
+	 * function declares anywhere counts as its own. The builder keeps the
+	 * names that resolve to local variables around the definition, those
+	 * are the captures.
+	 */
+	class capture_visitor final : public visitor
+	{
+		std::unordered_set<types::string> declared_;
+		std::unordered_set<types::string> seen_;
+		std::vector<types::string> referenced_;
+
+		void reference(const types::string& name)
+		{
+			if (seen_.insert(name).second)
+			{
+				referenced_.push_back(name);
+			}
+		}
+	public:
+		[[nodiscard]] std::vector<types::string> captures() const
+		{
+			std::vector<types::string> free;
+			for (const auto& name : referenced_)
+			{
+				if (!declared_.count(name))
+				{
+					free.push_back(name);
+				}
+			}
+			return free;
+		}
+
+		FINAL_VISITOR(function_definition)
+		{
+			declared_.insert(node->function_name); // calls to itself are not captures
+			declared_.insert(node->parameters.begin(), node->parameters.end());
+			node->body->accept(this);
+		}
+
+		FINAL_VISITOR(function_statement)
+		{
+			capture_visitor inner;
+			node->definition->accept(&inner);
+			for (const auto& name : inner.captures())
+			{
+				reference(name);
+			}
+			declared_.insert(node->definition->function_name);
+		}
+
+		FINAL_VISITOR(statement_block)
+		{
+			for (const auto& stmt : node->statements)
+			{
+				stmt->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(variable)
+		{
+			reference(node->value);
+		}
+
+		FINAL_VISITOR(assignment_statement)
+		{
+			node->value->accept(this);
+			if (node->declaration)
+			{
+				declared_.insert(node->variable_name);
+			}
+			else
+			{
+				reference(node->variable_name);
+			}
+		}
+
+		FINAL_VISITOR(multiple_assignment_statement)
+		{
+			node->value->accept(this);
+			for (const auto& name : node->variable_names)
+			{
+				if (node->declaration)
+				{
+					declared_.insert(name);
+				}
+				else
+				{
+					reference(name);
+				}
+			}
+		}
+
+		FINAL_VISITOR(call_expression)
+		{
+			reference(node->function_name);
+			for (const auto& argument : node->arguments)
+			{
+				argument->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(binary_expression)
+		{
+			node->lhs->accept(this);
+			node->rhs->accept(this);
+		}
+
+		FINAL_VISITOR(unary_expression)
+		{
+			node->rhs->accept(this);
+		}
+
+		FINAL_VISITOR(return_statement)
+		{
+			for (const auto& value : node->values)
+			{
+				value->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(if_statement)
+		{
+			node->condition->accept(this);
+			node->main_block->accept(this);
+			if (node->else_block)
+			{
+				node->else_block->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(while_statement)
+		{
+			node->condition->accept(this);
+			node->block->accept(this);
+		}
+
+		FINAL_VISITOR(object_literal)
+		{
+			for (const auto& [name, value] : node->fields)
+			{
+				value->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(array_literal)
+		{
+			for (const auto& element : node->elements)
+			{
+				element->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(field_expression)
+		{
+			node->object->accept(this);
+		}
+
+		FINAL_VISITOR(field_assignment_statement)
+		{
+			node->target->accept(this);
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(index_expression)
+		{
+			node->container->accept(this);
+			node->key->accept(this);
+		}
+
+		FINAL_VISITOR(index_assignment_statement)
+		{
+			node->target->accept(this);
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(program) {}
+		FINAL_VISITOR(boolean_literal) {}
+		FINAL_VISITOR(number_literal) {}
+		FINAL_VISITOR(string_literal) {}
+		FINAL_VISITOR(primary_expression) {}
+		FINAL_VISITOR(multiplicative_expression) {}
+		FINAL_VISITOR(additive_expression) {}
+		FINAL_VISITOR(expression) {}
+		FINAL_VISITOR(statement) {}
+	};
+}
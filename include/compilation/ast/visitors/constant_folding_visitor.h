@@ -0,0 +1,495 @@
+/*
+ * File Name: constant_folding_visitor.h
+ * Author(s): P. Kamara
+ *
+ * Folds constant expressions, propagates consts and prunes dead branches.
+ */
+
+#pragma once
+
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include "compilation/ast/node.h"
+
+namespace cherie::compiler::ast
+{
+	using constant = std::variant<types::integer, types::floating_point, bool, rope>;
+
+	/**
+	 * Every expression visit leaves its compile-time value (if any) in result_,
+	 * and parents swap constant children for literals. Statement blocks are
+	 * rebuilt so that if/while statements with a constant condition can be
+	 * replaced by the branch that is taken, or dropped entirely.
+	 */
+	class constant_folding_visitor final : public visitor
+	{
+		std::vector<std::unordered_map<types::string, std::optional<constant>>> scopes_;
+		std::optional<constant> result_;
+		size_t folded_ = 0;
+		size_t pruned_ = 0;
+
+		static bool is_literal(const node* node)
+		{
+			return dynamic_cast<const number_literal*>(node) || dynamic_cast<const string_literal*>(node) || dynamic_cast<const boolean_literal*>(node);
+		}
+
+		static primary_expression* make_literal(const constant& value, const node* origin)
+		{
+			primary_expression* literal = nullptr;
+			switch (value.index())
+			{
+				case 0: literal = new number_literal(std::get<types::integer>(value)); break;
+				case 1: literal = new number_literal(std::get<types::floating_point>(value)); break;
+				case 2: literal = new boolean_literal(std::get<bool>(value)); break;
+				default: literal = new string_literal(std::get<rope>(value)); break;
+			}
+			literal->line = origin->line;
+			literal->column = origin->column;
+			return literal;
+		}
+
+		static std::optional<bool> truth(const expression* node)
+		{
+			if (const auto* boolean = dynamic_cast<const boolean_literal*>(node))
+			{
+				return boolean->value;
+			}
+
+			if (const auto* number = dynamic_cast<const number_literal*>(node))
+			{
+				if (std::holds_alternative<types::integer>(number->value))
+				{
+					return std::get<types::integer>(number->value) != 0;
+				}
+				return std::get<types::floating_point>(number->value) != 0;
+			}
+			return std::nullopt;
+		}
+
+		static bool declares_variables(const statement_block* block)
+		{
+			for (const auto& stmt : block->statements)
+			{
+				if (const auto* assignment = dynamic_cast<const assignment_statement*>(stmt.get()); assignment && assignment->declaration)
+				{
+					return true;
+				}
+				if (const auto* multiple = dynamic_cast<const multiple_assignment_statement*>(stmt.get()); multiple && multiple->declaration)
+				{
+					return true;
+				}
+				if (dynamic_cast<const function_statement*>(stmt.get()))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		static std::optional<constant> evaluate_unary(const token_type operation, const constant& value)
+		{
+			switch (operation)
+			{
+				case token_type::SUBTRACT:
+				{
+					if (std::holds_alternative<types::integer>(value))
+					{
+						return static_cast<types::integer>(0ull - static_cast<unsigned long long>(std::get<types::integer>(value)));
+					}
+					if (std::holds_alternative<types::floating_point>(value))
+					{
+						return static_cast<types::floating_point>(-static_cast<double>(std::get<types::floating_point>(value)));
+					}
+					return std::nullopt;
+				}
+				case token_type::NOT:
+				{
+					if (std::holds_alternative<bool>(value))
+					{
+						return !std::get<bool>(value);
+					}
+					return std::nullopt;
+				}
+				default:
+				{
+					return std::nullopt;
+				}
+			}
+		}
+
+		static std::optional<constant> evaluate_binary(const token_type operation, const constant& lhs, const constant& rhs)
+		{
+			if (std::holds_alternative<rope>(lhs) && std::holds_alternative<rope>(rhs))
+			{
+				if (operation != token_type::ADD)
+				{
+					return std::nullopt;
+				}
+				return std::get<rope>(lhs) + std::get<rope>(rhs); // joined when the text is read, if ever
+			}
+
+			if (std::holds_alternative<types::integer>(lhs) && std::holds_alternative<types::integer>(rhs))
+			{
+				// wrap like the VM does rather than invoking signed overflow here
+				const auto a = static_cast<unsigned long long>(std::get<types::integer>(lhs));
+				const auto b = static_cast<unsigned long long>(std::get<types::integer>(rhs));
+				switch (operation)
+				{
+					case token_type::ADD: return static_cast<types::integer>(a + b);
+					case token_type::SUBTRACT: return static_cast<types::integer>(a - b);
+					case token_type::MULTIPLY: return static_cast<types::integer>(a * b);
+					case token_type::DIVIDE:
+					{
+						const auto dividend = std::get<types::integer>(lhs);
+						const auto divisor = std::get<types::integer>(rhs);
+						if (divisor == 0 || (divisor == -1 && dividend == std::numeric_limits<types::integer>::min()))
+						{
+							return std::nullopt; // leave it for the runtime error
+						}
+						return dividend / divisor;
+					}
+					default: return std::nullopt;
+				}
+			}
+
+			// the VM computes in double, so fold in double too, whatever precision literals were read in
+			const auto as_double = [](const constant& value) -> std::optional<double>
+			{
+				if (std::holds_alternative<types::integer>(value))
+				{
+					return static_cast<double>(std::get<types::integer>(value));
+				}
+				if (std::holds_alternative<types::floating_point>(value))
+				{
+					return static_cast<double>(std::get<types::floating_point>(value));
+				}
+				return std::nullopt;
+			};
+
+			const auto a = as_double(lhs);
+			const auto b = as_double(rhs);
+			if (!a || !b)
+			{
+				return std::nullopt;
+			}
+
+			double result;
+			switch (operation)
+			{
+				case token_type::ADD: result = *a + *b; break;
+				case token_type::SUBTRACT: result = *a - *b; break;
+				case token_type::MULTIPLY: result = *a * *b; break;
+				case token_type::DIVIDE: result = *a / *b; break;
+				default: return std::nullopt;
+			}
+			return static_cast<types::floating_point>(result);
+		}
+
+		std::optional<constant> evaluate(node* node)
+		{
+			result_.reset();
+			node->accept(this);
+
+			auto value = std::move(result_);
+			result_.reset();
+			return value;
+		}
+
+		template<typename T>
+		std::optional<constant> fold(std::unique_ptr<T>& slot)
+		{
+			auto value = evaluate(slot.get());
+			if (value && !is_literal(slot.get()))
+			{
+				slot.reset(make_literal(*value, slot.get()));
+				folded_++;
+			}
+			return value;
+		}
+
+		template<typename Container>
+		void fold_statement(std::unique_ptr<statement> stmt, Container& out)
+		{
+			const auto value = evaluate(stmt.get());
+
+			if (dynamic_cast<expression*>(stmt.get()))
+			{
+				if (value)
+				{
+					pruned_++; // a constant expression statement has no effect
+					return;
+				}
+			}
+			else if (auto* conditional = dynamic_cast<if_statement*>(stmt.get()))
+			{
+				if (const auto taken = truth(conditional->condition.get()); taken && conditional->elseif_blocks.empty())
+				{
+					pruned_++;
+					auto& block = *taken ? conditional->main_block : conditional->else_block;
+					if (!block)
+					{
+						return;
+					}
+
+					if (!declares_variables(block.get()))
+					{
+						for (auto& inner : block->statements)
+						{
+							out.emplace_back(std::move(inner));
+						}
+						return;
+					}
+
+					// keep the block's scope, but leave only the branch that is taken
+					conditional->main_block = std::move(block);
+					conditional->else_block.reset();
+					conditional->condition.reset(make_literal(true, conditional->condition.get()));
+				}
+			}
+			else if (auto* loop = dynamic_cast<while_statement*>(stmt.get()))
+			{
+				if (const auto taken = truth(loop->condition.get()); taken && !*taken)
+				{
+					pruned_++;
+					return;
+				}
+			}
+
+			out.emplace_back(std::move(stmt));
+		}
+
+		void fold_block(statement_block* block)
+		{
+			if (!block)
+			{
+				return;
+			}
+
+			scopes_.emplace_back();
+			std::vector<std::unique_ptr<statement>> statements;
+			for (auto& stmt : block->statements)
+			{
+				fold_statement(std::move(stmt), statements);
+			}
+			block->statements = std::move(statements);
+			scopes_.pop_back();
+		}
+	public:
+		[[nodiscard]] size_t folded() const { return folded_; }
+		[[nodiscard]] size_t pruned() const { return pruned_; }
+
+		FINAL_VISITOR(program)
+		{
+			scopes_.emplace_back();
+			decltype(node->body) body;
+			for (auto& element : node->body)
+			{
+				if (std::holds_alternative<std::unique_ptr<statement>>(element))
+				{
+					fold_statement(std::move(std::get<std::unique_ptr<statement>>(element)), body);
+				}
+				else
+				{
+					std::get<std::unique_ptr<function_definition>>(element)->accept(this);
+					body.emplace_back(std::move(element));
+				}
+			}
+			node->body = std::move(body);
+			scopes_.pop_back();
+		}
+
+		FINAL_VISITOR(boolean_literal)
+		{
+			result_ = node->value;
+		}
+
+		FINAL_VISITOR(number_literal)
+		{
+			if (std::holds_alternative<types::integer>(node->value))
+			{
+				result_ = std::get<types::integer>(node->value);
+			}
+			else
+			{
+				result_ = std::get<types::floating_point>(node->value);
+			}
+		}
+
+		FINAL_VISITOR(string_literal)
+		{
+			result_ = node->value;
+		}
+
+		FINAL_VISITOR(variable)
+		{
+			for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope)
+			{
+				if (const auto binding = scope->find(node->value); binding != scope->end())
+				{
+					result_ = binding->second;
+					return;
+				}
+			}
+		}
+
+		FINAL_VISITOR(binary_expression)
+		{
+			const auto lhs = fold(node->lhs);
+			const auto rhs = fold(node->rhs);
+			if (lhs && rhs)
+			{
+				result_ = evaluate_binary(node->operation, *lhs, *rhs);
+			}
+		}
+
+		FINAL_VISITOR(unary_expression)
+		{
+			if (const auto rhs = fold(node->rhs))
+			{
+				result_ = evaluate_unary(node->operation, *rhs);
+			}
+		}
+
+		FINAL_VISITOR(call_expression)
+		{
+			for (auto& argument : node->arguments)
+			{
+				fold(argument);
+			}
+			result_.reset();
+		}
+
+		FINAL_VISITOR(object_literal)
+		{
+			for (auto& [name, value] : node->fields)
+			{
+				fold(value);
+			}
+			result_.reset();
+		}
+
+		FINAL_VISITOR(array_literal)
+		{
+			for (auto& element : node->elements)
+			{
+				fold(element);
+			}
+			result_.reset();
+		}
+
+		FINAL_VISITOR(field_expression)
+		{
+			fold(node->object);
+			result_.reset();
+		}
+
+		FINAL_VISITOR(field_assignment_statement)
+		{
+			node->target->accept(this);
+			fold(node->value);
+			result_.reset();
+		}
+
+		FINAL_VISITOR(index_expression)
+		{
+			fold(node->container);
+			fold(node->key);
+			result_.reset();
+		}
+
+		FINAL_VISITOR(index_assignment_statement)
+		{
+			node->target->accept(this);
+			fold(node->value);
+			result_.reset();
+		}
+
+		FINAL_VISITOR(assignment_statement)
+		{
+			const auto value = fold(node->value);
+			if (node->declaration)
+			{
+				scopes_.back()[node->variable_name] = node->immutable ? value : std::nullopt;
+			}
+			result_.reset();
+		}
+
+		FINAL_VISITOR(if_statement)
+		{
+			fold(node->condition);
+			fold_block(node->main_block.get());
+			fold_block(node->else_block.get());
+			result_.reset();
+		}
+
+		FINAL_VISITOR(while_statement)
+		{
+			fold(node->condition);
+			fold_block(node->block.get());
+			result_.reset();
+		}
+
+		FINAL_VISITOR(return_statement)
+		{
+			for (auto& value : node->values)
+			{
+				fold(value);
+			}
+			result_.reset();
+		}
+
+		FINAL_VISITOR(multiple_assignment_statement)
+		{
+			node->value->accept(this);
+			if (node->declaration)
+			{
+				for (const auto& name : node->variable_names)
+				{
+					scopes_.back()[name] = std::nullopt;
+				}
+			}
+			result_.reset();
+		}
+
+		FINAL_VISITOR(function_definition)
+		{
+			// a function only sees its own parameters and locals
+			auto outer = std::move(scopes_);
+			scopes_.clear();
+			scopes_.emplace_back();
+			for (const auto& parameter : node->parameters)
+			{
+				scopes_.back()[parameter] = std::nullopt;
+			}
+			fold_block(node->body.get());
+			scopes_ = std::move(outer);
+		}
+
+		FINAL_VISITOR(function_statement)
+		{
+			// captured variables are copies, so consts around it still hold inside
+			const auto& definition = *node->definition;
+			scopes_.back()[definition.function_name] = std::nullopt;
+			scopes_.emplace_back();
+			for (const auto& parameter : definition.parameters)
+			{
+				scopes_.back()[parameter] = std::nullopt;
+			}
+			fold_block(definition.body.get());
+			scopes_.pop_back();
+			result_.reset();
+		}
+
+		FINAL_VISITOR(statement_block)
+		{
+			fold_block(node);
+		}
+
+		FINAL_VISITOR(primary_expression) {}
+		FINAL_VISITOR(multiplicative_expression) {}
+		FINAL_VISITOR(additive_expression) {}
+		FINAL_VISITOR(expression) {}
+		FINAL_VISITOR(statement) {}
+	};
+}
@@ -0,0 +1,162 @@
+/*
+ * File Name: escape_visitor.h
+ * Author(s): P. Kamara
+ *
+ * Decides whether a nested function needs a closure.
+ */
+
+#pragma once
+
+#include "compilation/ast/node.h"
+
+namespace cherie::compiler::ast
+{
+	/**
+	 * A nested function escapes when its name is used as a value (stored,
+	 * passed or returned) or called from inside another nested function.
+	 * Either way it outlives the frame that defined it, so its captures
+	 * have to be copied into a closure. Otherwise every call is a direct
+	 * one and the captures can travel as extra arguments. Visit the
+	 * statements that follow the definition in its block and its own body.
+	 * Shadowing is not tracked, which only makes the answer conservative.
+	 */
+	class escape_visitor final : public visitor
+	{
+		const types::string& name_;
+		size_t depth_ = 0;
+		bool escapes_ = false;
+	public:
+		explicit escape_visitor(const types::string& name)
+			: name_(name) {}
+
+		[[nodiscard]] bool escapes() const { return escapes_; }
+
+		FINAL_VISITOR(function_definition)
+		{
+			node->body->accept(this);
+		}
+
+		FINAL_VISITOR(function_statement)
+		{
+			depth_++;
+			node->definition->body->accept(this);
+			depth_--;
+		}
+
+		FINAL_VISITOR(statement_block)
+		{
+			for (const auto& stmt : node->statements)
+			{
+				stmt->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(variable)
+		{
+			escapes_ |= node->value == name_;
+		}
+
+		FINAL_VISITOR(assignment_statement)
+		{
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(multiple_assignment_statement)
+		{
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(call_expression)
+		{
+			escapes_ |= depth_ != 0 && node->function_name == name_;
+			for (const auto& argument : node->arguments)
+			{
+				argument->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(binary_expression)
+		{
+			node->lhs->accept(this);
+			node->rhs->accept(this);
+		}
+
+		FINAL_VISITOR(unary_expression)
+		{
+			node->rhs->accept(this);
+		}
+
+		FINAL_VISITOR(return_statement)
+		{
+			for (const auto& value : node->values)
+			{
+				value->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(if_statement)
+		{
+			node->condition->accept(this);
+			node->main_block->accept(this);
+			if (node->else_block)
+			{
+				node->else_block->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(while_statement)
+		{
+			node->condition->accept(this);
+			node->block->accept(this);
+		}
+
+		FINAL_VISITOR(object_literal)
+		{
+			for (const auto& [name, value] : node->fields)
+			{
+				value->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(array_literal)
+		{
+			for (const auto& element : node->elements)
+			{
+				element->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(field_expression)
+		{
+			node->object->accept(this);
+		}
+
+		FINAL_VISITOR(field_assignment_statement)
+		{
+			node->target->accept(this);
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(index_expression)
+		{
+			node->container->accept(this);
+			node->key->accept(this);
+		}
+
+		FINAL_VISITOR(index_assignment_statement)
+		{
+			node->target->accept(this);
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(program) {}
+		FINAL_VISITOR(boolean_literal) {}
+		FINAL_VISITOR(number_literal) {}
+		FINAL_VISITOR(string_literal) {}
+		FINAL_VISITOR(primary_expression) {}
+		FINAL_VISITOR(multiplicative_expression) {}
+		FINAL_VISITOR(additive_expression) {}
+		FINAL_VISITOR(expression) {}
+		FINAL_VISITOR(statement) {}
+	};
+}
@@ -0,0 +1,765 @@
+/*
+ * File Name: inlining_visitor.h
+ * Author(s): P. Kamara
+ *
+ * Substitutes small, non-recursive function bodies at their call sites.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "compilation/ast/node.h"
+
+namespace cherie::compiler::ast
+{
+	/**
+	 * A function can be inlined when its body is straight-line code (local
+	 * assignments followed by a single-valued `return value;`), it only
+	 * reads its own parameters and locals, it is not part of a call cycle
+	 * and its size in nodes stays within the budget.
+	 *
+	 * The callee's parameters and locals are renamed to fresh names (which
+	 * the lexer can never produce) and declared in front of the statement
+	 * holding the call, and the call is replaced by a copy of the returned
+	 * expression. Literal and variable arguments are substituted directly
+	 * instead of being bound. Calls in a while condition are evaluated on
+	 * every iteration, so they are only inlined when nothing needs declaring.
+	 *
+	 * Functions are processed callees first, so helpers calling helpers
+	 * collapse completely.
+	 *
+	 * Variables shadow functions, so a name that is declared as a variable
+	 * or parameter anywhere in the program is never treated as a call to
+	 * the function of that name, neither at call sites nor inside bodies.
+	 */
+	class inlining_visitor final : public visitor
+	{
+		enum class visit_state : std::uint8_t
+		{
+			pending,
+			active,
+			done,
+		};
+
+		struct callee
+		{
+			function_definition* definition = nullptr;
+			visit_state state = visit_state::pending;
+			bool recursive = false;
+			bool inlinable = false;
+			std::unordered_set<types::string> reassigned; // parameters the body writes to
+		};
+
+		struct substitution
+		{
+			std::unordered_map<types::string, types::string> names;
+			std::unordered_map<types::string, const expression*> values;
+		};
+
+		size_t budget_;
+		size_t inlined_ = 0;
+		size_t renamed_ = 0;
+
+		std::unordered_map<types::string, callee> functions_;
+		std::unordered_set<types::string> variables_; // every declared variable and parameter name
+		std::vector<callee*> stack_;
+
+		std::vector<std::unique_ptr<statement>> pending_;
+		bool prelude_allowed_ = true;
+		std::unique_ptr<primary_expression> replacement_;
+
+		static size_t size(const expression* node)
+		{
+			if (const auto* binary = dynamic_cast<const binary_expression*>(node))
+			{
+				return 1 + size(binary->lhs.get()) + size(binary->rhs.get());
+			}
+			if (const auto* unary = dynamic_cast<const unary_expression*>(node))
+			{
+				return 1 + size(unary->rhs.get());
+			}
+			if (const auto* call = dynamic_cast<const call_expression*>(node))
+			{
+				auto total = static_cast<size_t>(1);
+				for (const auto& argument : call->arguments)
+				{
+					total += size(argument.get());
+				}
+				return total;
+			}
+			if (const auto* literal = dynamic_cast<const object_literal*>(node))
+			{
+				auto total = static_cast<size_t>(1);
+				for (const auto& [name, value] : literal->fields)
+				{
+					total += size(value.get());
+				}
+				return total;
+			}
+			if (const auto* literal = dynamic_cast<const array_literal*>(node))
+			{
+				auto total = static_cast<size_t>(1);
+				for (const auto& element : literal->elements)
+				{
+					total += size(element.get());
+				}
+				return total;
+			}
+			if (const auto* access = dynamic_cast<const field_expression*>(node))
+			{
+				return 1 + size(access->object.get());
+			}
+			if (const auto* index = dynamic_cast<const index_expression*>(node))
+			{
+				return 1 + size(index->container.get()) + size(index->key.get());
+			}
+			return 1;
+		}
+
+		static void collect_variables(const statement_block* block, std::unordered_set<types::string>& names)
+		{
+			for (const auto& stmt : block->statements)
+			{
+				collect_variables(stmt.get(), names);
+			}
+		}
+
+		static void collect_variables(const statement* stmt, std::unordered_set<types::string>& names)
+		{
+			if (const auto* assignment = dynamic_cast<const assignment_statement*>(stmt); assignment && assignment->declaration)
+			{
+				names.insert(assignment->variable_name);
+			}
+			else if (const auto* multiple = dynamic_cast<const multiple_assignment_statement*>(stmt); multiple && multiple->declaration)
+			{
+				names.insert(multiple->variable_names.begin(), multiple->variable_names.end());
+			}
+			else if (const auto* conditional = dynamic_cast<const if_statement*>(stmt))
+			{
+				collect_variables(conditional->main_block.get(), names);
+				if (conditional->else_block)
+				{
+					collect_variables(conditional->else_block.get(), names);
+				}
+			}
+			else if (const auto* loop = dynamic_cast<const while_statement*>(stmt))
+			{
+				collect_variables(loop->block.get(), names);
+			}
+			else if (const auto* nested = dynamic_cast<const function_statement*>(stmt))
+			{
+				names.insert(nested->definition->function_name);
+				collect_variables(nested->definition.get(), names);
+			}
+		}
+
+		static void collect_variables(const function_definition* definition, std::unordered_set<types::string>& names)
+		{
+			names.insert(definition->parameters.begin(), definition->parameters.end());
+			if (definition->body)
+			{
+				collect_variables(definition->body.get(), names);
+			}
+		}
+
+		/* a name that is neither a function nor a variable, map() and the like, which read what stores can change */
+		bool is_builtin(const call_expression* call) const
+		{
+			return !functions_.count(call->function_name) && !variables_.count(call->function_name);
+		}
+
+		/* fields and map entries can change, so they are only read where the call was, never ahead of it in the prelude */
+		bool reads_only(const expression* node, const std::unordered_set<types::string>& bound, const bool fields = false) const
+		{
+			if (const auto* name = dynamic_cast<const variable*>(node))
+			{
+				return bound.count(name->value) != 0;
+			}
+			if (const auto* binary = dynamic_cast<const binary_expression*>(node))
+			{
+				return reads_only(binary->lhs.get(), bound, fields) && reads_only(binary->rhs.get(), bound, fields);
+			}
+			if (const auto* unary = dynamic_cast<const unary_expression*>(node))
+			{
+				return reads_only(unary->rhs.get(), bound, fields);
+			}
+			if (const auto* call = dynamic_cast<const call_expression*>(node))
+			{
+				if (variables_.count(call->function_name))
+				{
+					return false; // may call a value
+				}
+				if (is_builtin(call) && !fields)
+				{
+					return false;
+				}
+				for (const auto& argument : call->arguments)
+				{
+					if (!reads_only(argument.get(), bound, fields))
+					{
+						return false;
+					}
+				}
+			}
+			if (const auto* literal = dynamic_cast<const object_literal*>(node))
+			{
+				for (const auto& [name, value] : literal->fields)
+				{
+					if (!reads_only(value.get(), bound, fields))
+					{
+						return false;
+					}
+				}
+			}
+			if (const auto* literal = dynamic_cast<const array_literal*>(node))
+			{
+				for (const auto& element : literal->elements)
+				{
+					if (!reads_only(element.get(), bound, fields))
+					{
+						return false;
+					}
+				}
+			}
+			if (const auto* access = dynamic_cast<const field_expression*>(node))
+			{
+				return fields && reads_only(access->object.get(), bound, fields);
+			}
+			if (const auto* index = dynamic_cast<const index_expression*>(node))
+			{
+				return fields && reads_only(index->container.get(), bound, fields) && reads_only(index->key.get(), bound, fields);
+			}
+			return true;
+		}
+
+		bool reads_fields(const expression* node) const
+		{
+			if (dynamic_cast<const field_expression*>(node) || dynamic_cast<const index_expression*>(node))
+			{
+				return true;
+			}
+			if (const auto* binary = dynamic_cast<const binary_expression*>(node))
+			{
+				return reads_fields(binary->lhs.get()) || reads_fields(binary->rhs.get());
+			}
+			if (const auto* unary = dynamic_cast<const unary_expression*>(node))
+			{
+				return reads_fields(unary->rhs.get());
+			}
+			if (const auto* call = dynamic_cast<const call_expression*>(node))
+			{
+				return is_builtin(call) || std::any_of(call->arguments.begin(), call->arguments.end(), [this](const auto& argument) { return reads_fields(argument.get()); });
+			}
+			if (const auto* literal = dynamic_cast<const object_literal*>(node))
+			{
+				return std::any_of(literal->fields.begin(), literal->fields.end(), [this](const auto& field) { return reads_fields(field.second.get()); });
+			}
+			if (const auto* literal = dynamic_cast<const array_literal*>(node))
+			{
+				return std::any_of(literal->elements.begin(), literal->elements.end(), [this](const auto& element) { return reads_fields(element.get()); });
+			}
+			return false;
+		}
+
+		static primary_expression* clone(const expression* node, const substitution& substitution)
+		{
+			primary_expression* copy = nullptr;
+			if (const auto* name = dynamic_cast<const variable*>(node))
+			{
+				if (const auto value = substitution.values.find(name->value); value != substitution.values.end())
+				{
+					return clone(value->second, {});
+				}
+				const auto renamed = substitution.names.find(name->value);
+				copy = new variable(renamed != substitution.names.end() ? renamed->second : name->value);
+			}
+			else if (const auto* number = dynamic_cast<const number_literal*>(node))
+			{
+				copy = std::holds_alternative<types::integer>(number->value)
+					? new number_literal(std::get<types::integer>(number->value))
+					: new number_literal(std::get<types::floating_point>(number->value));
+			}
+			else if (const auto* boolean = dynamic_cast<const boolean_literal*>(node))
+			{
+				copy = new boolean_literal(boolean->value);
+			}
+			else if (const auto* string = dynamic_cast<const string_literal*>(node))
+			{
+				copy = new string_literal(string->value);
+			}
+			else if (const auto* unary = dynamic_cast<const unary_expression*>(node))
+			{
+				auto* result = new unary_expression();
+				result->operation = unary->operation;
+				result->rhs = std::unique_ptr<expression>(clone(unary->rhs.get(), substitution));
+				copy = result;
+			}
+			else if (const auto* binary = dynamic_cast<const binary_expression*>(node))
+			{
+				copy = new binary_expression(binary->operation, clone(binary->lhs.get(), substitution), clone(binary->rhs.get(), substitution));
+			}
+			else if (const auto* call = dynamic_cast<const call_expression*>(node))
+			{
+				auto* result = new call_expression();
+				result->function_name = call->function_name;
+				for (const auto& argument : call->arguments)
+				{
+					result->arguments.push_back(std::unique_ptr<expression>(clone(argument.get(), substitution)));
+				}
+				copy = result;
+			}
+			else if (const auto* literal = dynamic_cast<const object_literal*>(node))
+			{
+				auto* result = new object_literal();
+				for (const auto& [name, value] : literal->fields)
+				{
+					result->fields.emplace_back(name, std::unique_ptr<expression>(clone(value.get(), substitution)));
+				}
+				copy = result;
+			}
+			else if (const auto* literal = dynamic_cast<const array_literal*>(node))
+			{
+				auto* result = new array_literal();
+				for (const auto& element : literal->elements)
+				{
+					result->elements.emplace_back(clone(element.get(), substitution));
+				}
+				copy = result;
+			}
+			else if (const auto* access = dynamic_cast<const field_expression*>(node))
+			{
+				auto* result = new field_expression();
+				result->object = std::unique_ptr<expression>(clone(access->object.get(), substitution));
+				result->field = access->field;
+				copy = result;
+			}
+			else if (const auto* index = dynamic_cast<const index_expression*>(node))
+			{
+				auto* result = new index_expression();
+				result->container = std::unique_ptr<expression>(clone(index->container.get(), substitution));
+				result->key = std::unique_ptr<expression>(clone(index->key.get(), substitution));
+				copy = result;
+			}
+			copy->line = node->line;
+			copy->column = node->column;
+			return copy;
+		}
+
+		static bool is_trivial(const expression* node)
+		{
+			return dynamic_cast<const variable*>(node) || dynamic_cast<const number_literal*>(node) || dynamic_cast<const boolean_literal*>(node) || dynamic_cast<const string_literal*>(node);
+		}
+
+		void analyse(callee& callee) const
+		{
+			const auto& statements = callee.definition->body->statements;
+			if (callee.recursive || statements.empty())
+			{
+				return;
+			}
+
+			const auto* result = dynamic_cast<const return_statement*>(statements.back().get());
+			if (!result || result->values.size() != 1)
+			{
+				return;
+			}
+
+			std::unordered_set<types::string> bound(callee.definition->parameters.begin(), callee.definition->parameters.end());
+			auto total = size(result->values.front().get());
+			for (auto index = static_cast<size_t>(0); index + 1 < statements.size(); index++)
+			{
+				const auto* assignment = dynamic_cast<const assignment_statement*>(statements[index].get());
+				if (!assignment || !reads_only(assignment->value.get(), bound))
+				{
+					return;
+				}
+
+				if (assignment->declaration)
+				{
+					bound.insert(assignment->variable_name);
+				}
+				else if (!bound.count(assignment->variable_name))
+				{
+					return;
+				}
+				total += 1 + size(assignment->value.get());
+			}
+
+			if (total > budget_ || !reads_only(result->values.front().get(), bound, true))
+			{
+				return;
+			}
+
+			for (auto index = static_cast<size_t>(0); index + 1 < statements.size(); index++)
+			{
+				const auto* assignment = static_cast<const assignment_statement*>(statements[index].get());
+				if (!assignment->declaration)
+				{
+					callee.reassigned.insert(assignment->variable_name);
+				}
+			}
+			callee.inlinable = true;
+		}
+
+		callee* prepare(const types::string& name)
+		{
+			const auto found = functions_.find(name);
+			if (found == functions_.end())
+			{
+				return nullptr;
+			}
+
+			auto& callee = found->second;
+			if (callee.state == visit_state::active)
+			{
+				// every function on the stack from the callee up is part of the cycle
+				for (auto frame = stack_.rbegin(); frame != stack_.rend(); ++frame)
+				{
+					(*frame)->recursive = true;
+					if (*frame == &callee)
+					{
+						break;
+					}
+				}
+			}
+			else if (callee.state == visit_state::pending)
+			{
+				process(callee);
+			}
+			return &callee;
+		}
+
+		void process(callee& callee)
+		{
+			callee.state = visit_state::active;
+			stack_.push_back(&callee);
+
+			auto pending = std::move(pending_);
+			const auto prelude_allowed = prelude_allowed_;
+			inline_block(callee.definition->body.get());
+			pending_ = std::move(pending);
+			prelude_allowed_ = prelude_allowed;
+
+			stack_.pop_back();
+			callee.state = visit_state::done;
+			analyse(callee);
+		}
+
+		bool expand(call_expression* node, const callee& callee)
+		{
+			const auto& definition = *callee.definition;
+			if (node->arguments.size() != definition.parameters.size())
+			{
+				return false; // left for the call itself to report
+			}
+
+			const auto& statements = definition.body->statements;
+			const auto id = renamed_++;
+			const auto fresh = [&](const types::string& name)
+			{
+				return definition.function_name + "." + std::to_string(id) + "." + name;
+			};
+
+			substitution substitution;
+			std::vector<std::unique_ptr<statement>> prelude;
+			for (auto index = static_cast<size_t>(0); index < definition.parameters.size(); index++)
+			{
+				const auto& parameter = definition.parameters[index];
+				const auto* argument = node->arguments[index].get();
+				if (is_trivial(argument) && !callee.reassigned.count(parameter))
+				{
+					substitution.values[parameter] = argument;
+					continue;
+				}
+				if (reads_fields(argument))
+				{
+					return false; // bound ahead of the statement, it would read the fields too early
+				}
+
+				auto* binding = new assignment_statement();
+				binding->immutable = !callee.reassigned.count(parameter);
+				binding->variable_name = substitution.names[parameter] = fresh(parameter);
+				binding->value = std::unique_ptr<expression>(clone(argument, {}));
+				binding->line = node->line;
+				binding->column = node->column;
+				prelude.emplace_back(binding);
+			}
+
+			for (auto index = static_cast<size_t>(0); index + 1 < statements.size(); index++)
+			{
+				const auto* assignment = static_cast<const assignment_statement*>(statements[index].get());
+
+				auto* copy = new assignment_statement();
+				copy->immutable = assignment->immutable;
+				copy->declaration = assignment->declaration;
+				copy->value = std::unique_ptr<expression>(clone(assignment->value.get(), substitution));
+				if (assignment->declaration)
+				{
+					substitution.names[assignment->variable_name] = fresh(assignment->variable_name);
+				}
+				copy->variable_name = substitution.names.at(assignment->variable_name);
+				copy->line = assignment->line;
+				copy->column = assignment->column;
+				prelude.emplace_back(copy);
+			}
+
+			if (!prelude.empty() && !prelude_allowed_)
+			{
+				return false;
+			}
+
+			const auto* result = static_cast<const return_statement*>(statements.back().get());
+			replacement_.reset(clone(result->values.front().get(), substitution));
+			replacement_->line = node->line;
+			replacement_->column = node->column;
+
+			for (auto& binding : prelude)
+			{
+				pending_.emplace_back(std::move(binding));
+			}
+			inlined_++;
+			return true;
+		}
+
+		template<typename T>
+		void rewrite(std::unique_ptr<T>& slot)
+		{
+			if (!slot)
+			{
+				return;
+			}
+
+			slot->accept(this);
+			if (replacement_)
+			{
+				slot.reset(replacement_.release());
+			}
+		}
+
+		template<typename Container>
+		void inline_statement(std::unique_ptr<statement> stmt, Container& out)
+		{
+			pending_.clear();
+			prelude_allowed_ = true;
+			stmt->accept(this);
+
+			if (auto* call = dynamic_cast<call_expression*>(stmt.get()); call && replacement_)
+			{
+				stmt.reset(replacement_.release()); // a call used as a statement
+			}
+
+			auto prelude = std::move(pending_);
+			pending_.clear();
+			for (auto& binding : prelude)
+			{
+				out.emplace_back(std::move(binding));
+			}
+			out.emplace_back(std::move(stmt));
+		}
+
+		void inline_block(statement_block* block)
+		{
+			if (!block)
+			{
+				return;
+			}
+
+			auto pending = std::move(pending_);
+			const auto prelude_allowed = prelude_allowed_;
+
+			std::vector<std::unique_ptr<statement>> statements;
+			for (auto& stmt : block->statements)
+			{
+				inline_statement(std::move(stmt), statements);
+			}
+			block->statements = std::move(statements);
+
+			pending_ = std::move(pending);
+			prelude_allowed_ = prelude_allowed;
+		}
+		void declare(program* node)
+		{
+			for (auto& element : node->body)
+			{
+				if (std::holds_alternative<std::unique_ptr<function_definition>>(element))
+				{
+					auto* definition = std::get<std::unique_ptr<function_definition>>(element).get();
+					if (definition->body) // deferred bodies are too large to inline anyway
+					{
+						functions_[definition->function_name].definition = definition;
+					}
+					collect_variables(definition, variables_);
+				}
+				else
+				{
+					collect_variables(std::get<std::unique_ptr<statement>>(element).get(), variables_);
+				}
+			}
+		}
+	public:
+		/* budget is the largest callee, in AST nodes, that will be inlined */
+		explicit inlining_visitor(const size_t budget)
+			: budget_(budget) {}
+
+		[[nodiscard]] size_t inlined() const { return inlined_; }
+
+		/* inlines into a deferred body that was parsed after the program was visited */
+		void inline_into(program* node, function_definition* definition)
+		{
+			declare(node);
+			process(functions_[definition->function_name]);
+		}
+
+		FINAL_VISITOR(program)
+		{
+			declare(node);
+			for (auto& [name, callee] : functions_)
+			{
+				if (callee.state == visit_state::pending)
+				{
+					process(callee);
+				}
+			}
+
+			decltype(node->body) body;
+			for (auto& element : node->body)
+			{
+				if (std::holds_alternative<std::unique_ptr<statement>>(element))
+				{
+					inline_statement(std::move(std::get<std::unique_ptr<statement>>(element)), body);
+				}
+				else
+				{
+					body.emplace_back(std::move(element));
+				}
+			}
+			node->body = std::move(body);
+		}
+
+		FINAL_VISITOR(call_expression)
+		{
+			auto* callee = variables_.count(node->function_name) ? nullptr : prepare(node->function_name);
+
+			for (auto& argument : node->arguments)
+			{
+				rewrite(argument);
+			}
+
+			if (callee && callee->inlinable)
+			{
+				expand(node, *callee);
+			}
+		}
+
+		FINAL_VISITOR(binary_expression)
+		{
+			rewrite(node->lhs);
+			rewrite(node->rhs);
+		}
+
+		FINAL_VISITOR(unary_expression)
+		{
+			rewrite(node->rhs);
+		}
+
+		FINAL_VISITOR(assignment_statement)
+		{
+			rewrite(node->value);
+		}
+
+		FINAL_VISITOR(return_statement)
+		{
+			for (auto& value : node->values)
+			{
+				rewrite(value);
+			}
+		}
+
+		FINAL_VISITOR(multiple_assignment_statement)
+		{
+			// every result is needed, so only the arguments are candidates
+			if (!variables_.count(node->value->function_name))
+			{
+				prepare(node->value->function_name);
+			}
+			for (auto& argument : node->value->arguments)
+			{
+				rewrite(argument);
+			}
+		}
+
+		FINAL_VISITOR(object_literal)
+		{
+			for (auto& [name, value] : node->fields)
+			{
+				rewrite(value);
+			}
+		}
+
+		FINAL_VISITOR(array_literal)
+		{
+			for (auto& element : node->elements)
+			{
+				rewrite(element);
+			}
+		}
+
+		FINAL_VISITOR(field_expression)
+		{
+			rewrite(node->object);
+		}
+
+		FINAL_VISITOR(field_assignment_statement)
+		{
+			rewrite(node->target->object);
+			rewrite(node->value);
+		}
+
+		FINAL_VISITOR(index_expression)
+		{
+			rewrite(node->container);
+			rewrite(node->key);
+		}
+
+		FINAL_VISITOR(index_assignment_statement)
+		{
+			rewrite(node->target->container);
+			rewrite(node->target->key);
+			rewrite(node->value);
+		}
+
+		FINAL_VISITOR(if_statement)
+		{
+			rewrite(node->condition);
+			inline_block(node->main_block.get());
+			inline_block(node->else_block.get());
+		}
+
+		FINAL_VISITOR(while_statement)
+		{
+			prelude_allowed_ = false;
+			rewrite(node->condition);
+			prelude_allowed_ = true;
+			inline_block(node->block.get());
+		}
+
+		FINAL_VISITOR(statement_block)
+		{
+			inline_block(node);
+		}
+
+		FINAL_VISITOR(function_definition) {}
+		FINAL_VISITOR(function_statement) {} // left alone, its body is lowered as its own function
+		FINAL_VISITOR(boolean_literal) {}
+		FINAL_VISITOR(number_literal) {}
+		FINAL_VISITOR(string_literal) {}
+		FINAL_VISITOR(variable) {}
+		FINAL_VISITOR(primary_expression) {}
+		FINAL_VISITOR(multiplicative_expression) {}
+		FINAL_VISITOR(additive_expression) {}
+		FINAL_VISITOR(expression) {}
+		FINAL_VISITOR(statement) {}
+	};
+}
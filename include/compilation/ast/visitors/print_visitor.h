@@ -21,6 +21,11 @@ namespace cherie::compiler::ast
 				{
 					std::get<std::unique_ptr<statement>>(stmt)->accept(this);
 				}
+				else
+				{
+					std::get<std::unique_ptr<function_definition>>(stmt)->accept(this);
+					printf("\n");
+				}
 			}
 		}
 
@@ -38,7 +43,7 @@ namespace cherie::compiler::ast
 			}
 			else
 			{
-				printf("%f", std::get<types::floating_point>(node->value));
+				printf("%Lf", std::get<types::floating_point>(node->value));
 			}
 		}
 
@@ -79,6 +84,7 @@ namespace cherie::compiler::ast
 		FINAL_VISITOR(unary_expression)
 		{
 			printf("(%s", get_op_symbol(node->operation));
+			node->rhs->accept(this);
 			printf(")");
 		}
 
@@ -99,14 +105,59 @@ namespace cherie::compiler::ast
 
 		FINAL_VISITOR(function_definition)
 		{
-			node->accept(this);
+			printf("fn %s(", node->function_name.c_str());
+			for (size_t param_idx = 0; param_idx < node->parameters.size(); param_idx++)
+			{
+				printf(param_idx + 1 < node->parameters.size() ? "%s," : "%s", node->parameters.at(param_idx).c_str());
+			}
+			printf(") {\n");
+			if (node->deferred)
+			{
+				printf("    /* not parsed yet */\n");
+			}
+			else
+			{
+				for (const auto& stmt : node->body->statements)
+				{
+					printf("    ");
+					stmt->accept(this);
+					printf("\n");
+				}
+			}
+			printf("}");
+		}
+
+		FINAL_VISITOR(function_statement)
+		{
+			node->definition->accept(this);
+		}
+
+		FINAL_VISITOR(return_statement)
+		{
+			printf("return");
+			for (size_t value_idx = 0; value_idx < node->values.size(); value_idx++)
+			{
+				printf(value_idx ? ", " : " ");
+				node->values.at(value_idx)->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(multiple_assignment_statement)
+		{
+			printf("%s", node->declaration ? node->immutable ? "const " : "let " : "");
+			for (size_t name_idx = 0; name_idx < node->variable_names.size(); name_idx++)
+			{
+				printf(name_idx + 1 < node->variable_names.size() ? "%s, " : "%s = ", node->variable_names.at(name_idx).c_str());
+			}
+			node->value->accept(this);
+			printf("\n");
 		}
 
 		FINAL_VISITOR(call_expression)
 		{
 			printf("%s(", node->function_name.c_str());
 
-			for (auto arg_idx = 0; arg_idx < node->arguments.size(); arg_idx++)
+			for (size_t arg_idx = 0; arg_idx < node->arguments.size(); arg_idx++)
 			{
 				node->arguments.at(arg_idx)->accept(this);
 				if (arg_idx + 1 < node->arguments.size())
@@ -134,7 +185,59 @@ namespace cherie::compiler::ast
 
 		FINAL_VISITOR(assignment_statement)
 		{
-			printf("let %s = ", node->variable_name.c_str());
+			printf("%s%s = ", node->declaration ? node->immutable ? "const " : "let " : "", node->variable_name.c_str());
+			node->value->accept(this);
+			printf("\n");
+		}
+
+		FINAL_VISITOR(object_literal)
+		{
+			printf("{");
+			for (size_t field_idx = 0; field_idx < node->fields.size(); field_idx++)
+			{
+				printf(field_idx ? ", %s: " : " %s: ", node->fields.at(field_idx).first.c_str());
+				node->fields.at(field_idx).second->accept(this);
+			}
+			printf(node->fields.empty() ? "}" : " }");
+		}
+
+		FINAL_VISITOR(array_literal)
+		{
+			printf("[");
+			for (size_t element_idx = 0; element_idx < node->elements.size(); element_idx++)
+			{
+				printf(element_idx ? ", " : "");
+				node->elements.at(element_idx)->accept(this);
+			}
+			printf("]");
+		}
+
+		FINAL_VISITOR(field_expression)
+		{
+			node->object->accept(this);
+			printf(".%s", node->field.c_str());
+		}
+
+		FINAL_VISITOR(field_assignment_statement)
+		{
+			node->target->accept(this);
+			printf(" = ");
+			node->value->accept(this);
+			printf("\n");
+		}
+
+		FINAL_VISITOR(index_expression)
+		{
+			node->container->accept(this);
+			printf("[");
+			node->key->accept(this);
+			printf("]");
+		}
+
+		FINAL_VISITOR(index_assignment_statement)
+		{
+			node->target->accept(this);
+			printf(" = ");
 			node->value->accept(this);
 			printf("\n");
 		}
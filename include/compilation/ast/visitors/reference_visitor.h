@@ -0,0 +1,203 @@
+/*
+ * File Name: reference_visitor.h
+ * Author(s): P. Kamara
+ *
+ * Collects the variable names that function bodies refer to.
+ */
+
+#pragma once
+
+#include <unordered_set>
+#include "compilation/ast/node.h"
+
+namespace cherie::compiler::ast
+{
+	/**
+	 * Every name a function body reads, assigns or calls without declaring
+	 * it first, including the bodies of nested functions. The compiler
+	 * intersects these with the program's top-level declarations to decide
+	 * which variables need a global slot; the rest stay in registers of the
+	 * main chunk. Locals of one function may shadow a top-level name used in
+	 * another, so this over-approximates, which only costs a global slot.
+	 * Deferred bodies have not been parsed, every identifier in them counts.
+	 */
+	class reference_visitor final : public visitor
+	{
+		bool in_function_ = false;
+		std::unordered_set<types::string> names_;
+
+		void reference(const types::string& name)
+		{
+			if (in_function_)
+			{
+				names_.insert(name);
+			}
+		}
+	public:
+		[[nodiscard]] const std::unordered_set<types::string>& names() const
+		{
+			return names_;
+		}
+
+		FINAL_VISITOR(program)
+		{
+			for (const auto& element : node->body)
+			{
+				if (std::holds_alternative<std::unique_ptr<function_definition>>(element))
+				{
+					std::get<std::unique_ptr<function_definition>>(element)->accept(this);
+				}
+				else
+				{
+					std::get<std::unique_ptr<statement>>(element)->accept(this); // for functions nested in its blocks
+				}
+			}
+		}
+
+		FINAL_VISITOR(function_definition)
+		{
+			const auto in_function = in_function_;
+			in_function_ = true;
+			if (node->deferred)
+			{
+				names_.insert(node->deferred->names.begin(), node->deferred->names.end());
+			}
+			else
+			{
+				node->body->accept(this);
+			}
+			in_function_ = in_function;
+		}
+
+		FINAL_VISITOR(function_statement)
+		{
+			node->definition->accept(this);
+		}
+
+		FINAL_VISITOR(statement_block)
+		{
+			for (const auto& stmt : node->statements)
+			{
+				stmt->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(variable)
+		{
+			reference(node->value);
+		}
+
+		FINAL_VISITOR(assignment_statement)
+		{
+			if (!node->declaration)
+			{
+				reference(node->variable_name);
+			}
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(multiple_assignment_statement)
+		{
+			if (!node->declaration)
+			{
+				for (const auto& name : node->variable_names)
+				{
+					reference(name);
+				}
+			}
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(call_expression)
+		{
+			reference(node->function_name); // a variable can hold a function
+			for (const auto& argument : node->arguments)
+			{
+				argument->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(binary_expression)
+		{
+			node->lhs->accept(this);
+			node->rhs->accept(this);
+		}
+
+		FINAL_VISITOR(unary_expression)
+		{
+			node->rhs->accept(this);
+		}
+
+		FINAL_VISITOR(return_statement)
+		{
+			for (const auto& value : node->values)
+			{
+				value->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(if_statement)
+		{
+			node->condition->accept(this);
+			node->main_block->accept(this);
+			if (node->else_block)
+			{
+				node->else_block->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(while_statement)
+		{
+			node->condition->accept(this);
+			node->block->accept(this);
+		}
+
+		FINAL_VISITOR(object_literal)
+		{
+			for (const auto& [name, value] : node->fields)
+			{
+				value->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(array_literal)
+		{
+			for (const auto& element : node->elements)
+			{
+				element->accept(this);
+			}
+		}
+
+		FINAL_VISITOR(field_expression)
+		{
+			node->object->accept(this);
+		}
+
+		FINAL_VISITOR(field_assignment_statement)
+		{
+			node->target->accept(this);
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(index_expression)
+		{
+			node->container->accept(this);
+			node->key->accept(this);
+		}
+
+		FINAL_VISITOR(index_assignment_statement)
+		{
+			node->target->accept(this);
+			node->value->accept(this);
+		}
+
+		FINAL_VISITOR(boolean_literal) {}
+		FINAL_VISITOR(number_literal) {}
+		FINAL_VISITOR(string_literal) {}
+		FINAL_VISITOR(primary_expression) {}
+		FINAL_VISITOR(multiplicative_expression) {}
+		FINAL_VISITOR(additive_expression) {}
+		FINAL_VISITOR(expression) {}
+		FINAL_VISITOR(statement) {}
+	};
+}
@@ -15,9 +15,12 @@ namespace cherie::compiler::ast
 	struct while_statement;
 	struct variable;
 	struct assignment_statement;
+	struct return_statement;
+	struct multiple_assignment_statement;
 	struct if_statement;
 	struct call_expression;
 	struct function_definition;
+	struct function_statement;
 	struct statement_block;
 	struct statement;
 	struct expression;
@@ -26,6 +29,12 @@ namespace cherie::compiler::ast
 	struct multiplicative_expression;
 	struct primary_expression;
 	struct binary_expression;
+	struct object_literal;
+	struct array_literal;
+	struct field_expression;
+	struct field_assignment_statement;
+	struct index_expression;
+	struct index_assignment_statement;
 	struct string_literal;
 	struct number_literal;
 	struct boolean_literal;
@@ -54,5 +63,14 @@ namespace cherie::compiler::ast
 		VIRTUAL_VISITOR(assignment_statement)
 		VIRTUAL_VISITOR(variable)
 		VIRTUAL_VISITOR(while_statement)
+		VIRTUAL_VISITOR(return_statement)
+		VIRTUAL_VISITOR(multiple_assignment_statement)
+		VIRTUAL_VISITOR(function_statement)
+		VIRTUAL_VISITOR(object_literal)
+		VIRTUAL_VISITOR(array_literal)
+		VIRTUAL_VISITOR(field_expression)
+		VIRTUAL_VISITOR(field_assignment_statement)
+		VIRTUAL_VISITOR(index_expression)
+		VIRTUAL_VISITOR(index_assignment_statement)
 	};
 }
\ No newline at end of file
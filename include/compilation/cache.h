@@ -0,0 +1,66 @@
+/*
+ * File Name: cache.h
+ * Author(s): P. Kamara
+ *
+ * On-disk cache of compiled images.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "conf.h"
+#include "compilation/compiler.h"
+#include "vm/image.h"
+
+namespace cherie::compiler
+{
+	/**
+	 * Compiled images stored under a 128-bit hash of everything that decides
+	 * their contents: the source, the compiler version, the image format and
+	 * every option. A hit maps the stored image and skips the lexer, parser
+	 * and code generator entirely; a miss compiles the source, writes the
+	 * image to a temporary file and renames it into place, so readers in
+	 * other threads or processes only ever see whole entries. A hit marks
+	 * its entry as recently used, and after every store the least recently
+	 * used entries are removed until the directory fits the capacity.
+	 * Next to every entry lies a 128-bit hash of its bytes; entries that fail
+	 * to map or validate, or whose bytes no longer match that hash, are
+	 * removed and compiled again, and when the directory cannot be written
+	 * the image is served from memory.
+	 */
+	class cache
+	{
+		std::filesystem::path directory_;
+		std::uintmax_t capacity_;
+		std::atomic<size_t> hits_ = 0;
+		std::atomic<size_t> misses_ = 0;
+		std::atomic<size_t> evictions_ = 0;
+
+		bool store(const std::filesystem::path& entry, const std::string& bytes) const;
+		static bool write_file(const std::filesystem::path& path, const std::string& bytes);
+		void evict(const std::filesystem::path& keep);
+	public:
+		struct statistics
+		{
+			size_t hits = 0;
+			size_t misses = 0;
+			size_t evictions = 0;
+		};
+
+		static constexpr std::uintmax_t default_capacity = 256ull << 20;
+
+		explicit cache(std::filesystem::path directory, std::uintmax_t capacity = default_capacity);
+
+		/* the image of source compiled with options, compiled and stored first on a miss */
+		[[nodiscard]] std::shared_ptr<const vm::image> load(const types::string& source, const options& options = {});
+
+		[[nodiscard]] statistics stats() const { return { hits_, misses_, evictions_ }; }
+
+		/* name of the entry for source and options, 32 hex digits */
+		[[nodiscard]] static std::string key(const types::string& source, const options& options);
+	};
+}
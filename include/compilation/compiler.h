@@ -0,0 +1,120 @@
+/*
+ * File Name: compiler.h
+ * Author(s): P. Kamara
+ *
+ * Compilation pipeline: source -> AST -> IR -> bytecode.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <ostream>
+#include "conf.h"
+#include "compilation/ast/node.h"
+#include "compilation/ir/builder.h"
+#include "compilation/ir/codegen.h"
+#include "compilation/peephole.h"
+
+namespace cherie::compiler
+{
+	constexpr std::uint32_t version = 5; // bump whenever the generated code changes, it keys cached images
+
+	struct options
+	{
+		/* driver */
+		bool lazy_functions = true; // top-level bodies over the inline budget compile on their first call, see unit
+		bool parallel = true;       // optimise and emit functions on work_pool::shared()
+
+		/* AST */
+		bool inlining = true;
+		size_t inline_budget = 32; // largest callee inlined, in AST nodes
+
+		/* AST and IR */
+		bool constant_folding = true;
+
+		/* IR */
+		bool copy_propagation = true;
+		bool common_subexpression_elimination = true;
+		bool global_value_numbering = true;
+		bool dead_code_elimination = true;
+
+		/* IR loops */
+		bool loop_invariant_code_motion = true;
+		bool strength_reduction = true;
+		bool loop_unrolling = true;
+		size_t unroll_max_trip_count = 8;
+		size_t unroll_max_instructions = 64;
+
+		/* bytecode */
+		bool peephole = true;
+		peephole::rule_set peephole_rules = peephole::all_rules;
+	};
+
+	/* what the optimisation stages did, filled in when asked for */
+	struct report
+	{
+		size_t calls_inlined = 0;
+		size_t loops_unrolled = 0;
+		size_t invariants_hoisted = 0;
+		size_t induction_variables_reduced = 0;
+		peephole::statistics peephole;
+	};
+
+	/**
+	 * A program whose larger top-level functions may still be source. With
+	 * lazy_functions the parser only scans the extent of a body that is
+	 * longer than the inline budget (in tokens) and notes the names in it,
+	 * and the function table gets a stub with function_info::deferred as
+	 * its entry. The first call to a stub compiles the body together with
+	 * the functions nested in it. Several states can share a unit and race
+	 * to call the same function, it is compiled once and they all link the
+	 * same code.
+	 */
+	class unit
+	{
+	public:
+		struct function
+		{
+			ir::bytecode code;                  // the function, followed by the ones nested in it, and every field and shape so far
+			std::vector<std::uint32_t> indices; // where each of them goes in the function table
+		};
+
+		explicit unit(const types::string& source, const options& options = {});
+
+		/* the main chunk and everything compiled up front */
+		[[nodiscard]] const ir::bytecode& program() const { return program_; }
+
+		/* compiles a deferred function, or returns it if it already is, safe to call from several threads */
+		[[nodiscard]] const function& compile(std::uint32_t index);
+
+		[[nodiscard]] size_t deferred() const; // functions still waiting for their first call
+		[[nodiscard]] report statistics() const;
+	private:
+		options options_;
+		std::unique_ptr<ast::program> tree_;
+		std::vector<ast::function_definition*> definitions_; // function i + 1
+		ir::module module_;
+		ir::bytecode program_;
+		std::vector<std::unique_ptr<function>> compiled_; // indexed like definitions_
+		report report_;
+		mutable std::mutex mutex_;
+	};
+
+	/* shifts the jump target, constant index or field site of an instruction that moves to entry, in a pool that grows by constants and after sites other ones */
+	void relocate(vm::i64& instruction, std::uint32_t entry, std::uint32_t constants, std::uint32_t sites);
+
+	/* writes a program out as a vm::image, it cannot have deferred functions */
+	void write_image(std::ostream& out, const ir::bytecode& code);
+
+	/**
+	 * Writes a program out as a C++ translation unit that defines the
+	 * vm::native_program symbol, for state_raw::load. Every function
+	 * becomes a C++ function over the VM's registers and jumps become
+	 * gotos, so nothing is decoded or dispatched at run time. It cannot
+	 * have deferred functions.
+	 */
+	void write_native(std::ostream& out, const ir::bytecode& code, const std::string& symbol);
+
+	/* compiles every function up front */
+	[[nodiscard]] ir::bytecode compile(const types::string& source, const options& options = {}, report* report = nullptr);
+}
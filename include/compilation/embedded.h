@@ -0,0 +1,1047 @@
+/*
+ * File Name: embedded.h
+ * Author(s): P. Kamara
+ *
+ * Compile-time compiler for scripts embedded in the host.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+
+#include "conf.h"
+#include "definitions.h"
+#include "exceptions.h"
+#include "vm/instruction.h"
+
+namespace cherie::compiler::embedded
+{
+	using source_view = std::basic_string_view<types::che_char>;
+
+	constexpr size_t max_registers = 256; // register operands are 8 bits wide
+	constexpr size_t max_symbols = 512;
+	constexpr size_t max_functions = 64;
+
+	struct function_entry
+	{
+		source_view name;
+		std::uint32_t entry = 0;
+		std::uint32_t parameters = 0;
+		std::uint32_t frame_size = 0;
+	};
+
+	/* what the state loads, see state_raw::load */
+	struct program_view
+	{
+		const vm::i64* code;
+		const std::uint32_t* lines; // line of every instruction
+		size_t size;
+		const source_view* globals;
+		size_t global_count;
+		const function_entry* functions; // [0] is the main chunk
+		size_t function_count;
+	};
+
+	template <size_t Instructions, size_t Globals, size_t Functions>
+	struct program
+	{
+		std::array<vm::i64, Instructions> code;
+		std::array<std::uint32_t, Instructions> lines {};
+		std::array<source_view, Globals> globals {};
+		std::array<function_entry, Functions> functions {};
+
+		constexpr operator program_view() const
+		{
+			return { code.data(), lines.data(), Instructions, globals.data(), Globals, functions.data(), Functions };
+		}
+	};
+
+	struct extent
+	{
+		size_t instructions = 0;
+		size_t globals = 0;
+		size_t functions = 0;
+	};
+
+	/* not a constant expression, so an error in a script evaluated at compile time stops the host's build */
+	[[noreturn]] inline void fail(const char* message, const size_t line)
+	{
+		parser_error("%s on line %d", message, static_cast<int>(line));
+		std::abort(); // parser_error always throws
+	}
+
+	struct location
+	{
+		size_t offset = 0;
+		size_t line = 1;
+	};
+
+	struct lexeme
+	{
+		token_type type = token_type::NONE;
+		source_view text;
+		vm::vm_register value = 0;
+		size_t offset = 0;
+		size_t line = 1;
+	};
+
+	/* the lexer's rules for the tokens an embedded script can use, one token of lookahead */
+	class scanner
+	{
+		source_view source_;
+		size_t offset_ = 0;
+		size_t line_ = 1;
+		lexeme current_;
+
+		[[nodiscard]] constexpr types::che_char at(const size_t offset) const
+		{
+			return offset < source_.size() ? source_[offset] : 0;
+		}
+
+		static constexpr bool is_digit(const types::che_char atom)
+		{
+			return atom >= '0' && atom <= '9';
+		}
+
+		static constexpr bool is_identifier(const types::che_char atom)
+		{
+			return atom == '_' || is_digit(atom) || (atom >= 'a' && atom <= 'z') || (atom >= 'A' && atom <= 'Z');
+		}
+
+		static constexpr int hex_digit(const types::che_char atom)
+		{
+			if (is_digit(atom))
+			{
+				return atom - '0';
+			}
+			if (atom >= 'a' && atom <= 'f')
+			{
+				return atom - 'a' + 10;
+			}
+			return atom >= 'A' && atom <= 'F' ? atom - 'A' + 10 : -1;
+		}
+
+		constexpr void skip_space()
+		{
+			while (offset_ < source_.size())
+			{
+				const auto atom = source_[offset_];
+				if (atom == '\n')
+				{
+					line_++;
+					offset_++;
+				}
+				else if (atom == ' ' || atom == '\t' || atom == '\r')
+				{
+					offset_++;
+				}
+				else if (atom == '/' && at(offset_ + 1) == '/')
+				{
+					while (offset_ < source_.size() && source_[offset_] != '\n')
+					{
+						offset_++;
+					}
+				}
+				else if (atom == '/' && at(offset_ + 1) == '*')
+				{
+					const auto line = line_;
+					offset_ += 2;
+					while (!(at(offset_) == '*' && at(offset_ + 1) == '/'))
+					{
+						if (offset_ >= source_.size())
+						{
+							fail("unfinished long comment", line);
+						}
+						line_ += source_[offset_++] == '\n';
+					}
+					offset_ += 2;
+				}
+				else
+				{
+					return;
+				}
+			}
+		}
+
+		static constexpr token_type keyword(const source_view text)
+		{
+			constexpr std::pair<const types::che_char*, token_type> keywords[] = {
+				{ CHE_STR("while"), token_type::WHILE },
+				{ CHE_STR("if"), token_type::IF },
+				{ CHE_STR("and"), token_type::AND },
+				{ CHE_STR("or"), token_type::OR },
+				{ CHE_STR("not"), token_type::NOT },
+				{ CHE_STR("let"), token_type::LET },
+				{ CHE_STR("const"), token_type::CONST },
+				{ CHE_STR("fn"), token_type::FUNCTION },
+				{ CHE_STR("else"), token_type::ELSE },
+				{ CHE_STR("true"), token_type::TRUE },
+				{ CHE_STR("false"), token_type::FALSE },
+				{ CHE_STR("return"), token_type::RETURN },
+				{ CHE_STR("string"), token_type::TYPE_STRING },
+				{ CHE_STR("number"), token_type::TYPE_NUMBER },
+			};
+			for (const auto& entry : keywords)
+			{
+				if (text == entry.first)
+				{
+					return entry.second;
+				}
+			}
+			return token_type::IDENTIFIER;
+		}
+
+		constexpr vm::vm_register number(const types::che_char first)
+		{
+			const auto hex = first == '0' && (at(offset_) == 'x' || at(offset_) == 'X');
+			const auto base = hex ? 16ull : 10ull;
+			offset_ += hex;
+
+			auto value = hex ? 0ull : static_cast<unsigned long long>(first - '0');
+			auto digits = hex ? 0 : 1;
+			for (; is_identifier(at(offset_)) || at(offset_) == '.'; offset_++, digits++)
+			{
+				const auto digit = hex ? hex_digit(at(offset_)) : is_digit(at(offset_)) ? at(offset_) - '0' : -1;
+				if (at(offset_) == '.')
+				{
+					fail("floating point literals are not supported in embedded scripts", line_);
+				}
+				if (digit < 0)
+				{
+					fail("unexpected character in number literal", line_);
+				}
+				if (value > (static_cast<unsigned long long>(INT64_MAX) - digit) / base)
+				{
+					fail("integer literal is too large", line_);
+				}
+				value = value * base + digit;
+			}
+			if (digits == 0)
+			{
+				fail("hex literal without digits", line_);
+			}
+			return static_cast<vm::vm_register>(value);
+		}
+
+		constexpr token_type symbol(const types::che_char atom)
+		{
+			const auto assigns = at(offset_) == '=';
+			offset_ += assigns;
+			switch (atom)
+			{
+				case '=': return assigns ? token_type::EQUALS : token_type::ASSIGN;
+				case '+': return assigns ? token_type::ADD_ASSIGN : token_type::ADD;
+				case '-': return assigns ? token_type::SUBTRACT_ASSIGN : token_type::SUBTRACT;
+				case '*': return assigns ? token_type::MULTIPLY_ASSIGN : token_type::MULTIPLY;
+				case '/': return assigns ? token_type::DIVIDE_ASSIGN : token_type::DIVIDE;
+				default: break;
+			}
+			offset_ -= assigns;
+			switch (atom)
+			{
+				case '(': return token_type::OPEN_PARENTHESIS;
+				case ')': return token_type::CLOSE_PARENTHESIS;
+				case '{': return token_type::OPEN_BRACE;
+				case '}': return token_type::CLOSE_BRACE;
+				case '!': return token_type::EXCLAMATION_MARK;
+				case ',': return token_type::COMMA;
+				case ';': return token_type::SEMICOLON;
+				case '"': fail("string literals are not supported in embedded scripts", line_);
+				default: fail("unknown symbol", line_);
+			}
+		}
+
+		constexpr lexeme scan()
+		{
+			skip_space();
+			lexeme token;
+			token.offset = offset_;
+			token.line = line_;
+			if (offset_ >= source_.size())
+			{
+				token.type = token_type::EOF;
+				return token;
+			}
+
+			const auto begin = offset_;
+			const auto atom = source_[offset_++];
+			if (is_digit(atom))
+			{
+				token.type = token_type::LITERAL;
+				token.value = number(atom);
+			}
+			else if (is_identifier(atom))
+			{
+				while (is_identifier(at(offset_)))
+				{
+					offset_++;
+				}
+				token.type = keyword(source_.substr(begin, offset_ - begin));
+			}
+			else
+			{
+				token.type = symbol(atom);
+			}
+			token.text = source_.substr(begin, offset_ - begin);
+			return token;
+		}
+	public:
+		constexpr explicit scanner(const source_view source)
+			: source_(source)
+		{
+			current_ = scan();
+		}
+
+		[[nodiscard]] constexpr const lexeme& peek() const { return current_; }
+
+		constexpr lexeme next()
+		{
+			const auto token = current_;
+			current_ = scan();
+			return token;
+		}
+
+		constexpr lexeme expect(const token_type type, const char* message)
+		{
+			if (current_.type != type)
+			{
+				fail(message, current_.line);
+			}
+			return next();
+		}
+
+		/* where the next token starts, to come back to it with seek */
+		[[nodiscard]] constexpr location position() const
+		{
+			return { current_.offset, current_.line };
+		}
+
+		constexpr void seek(const location position)
+		{
+			offset_ = position.offset;
+			line_ = position.line;
+			current_ = scan();
+		}
+	};
+
+	/**
+	 * Compiles the source in a single pass, straight from tokens to
+	 * instructions, so it can run inside a constant expression. It covers
+	 * the integer and boolean part of the language: let and const,
+	 * assignment, if and while, and top-level functions called by name.
+	 * Their parameters and results are integers. Top-level declarations
+	 * of the main chunk are globals, as they are for the full compiler,
+	 * and everything else lives in registers. Constant subexpressions are
+	 * folded and constant right operands use the immediate opcodes. The
+	 * main chunk is emitted first, the functions after it. A Capacity of
+	 * zero only counts, which is how measure sizes the arrays.
+	 */
+	template <size_t Capacity>
+	class single_pass_compiler
+	{
+		enum class storage : std::uint8_t { global, local, function };
+
+		struct symbol
+		{
+			source_view name;
+			storage kind = storage::local;
+			std::uint32_t index = 0; // global, register or function
+			bool immutable = false;
+			bool boolean = false;
+		};
+
+		/* a value that is either known here or sitting in a register */
+		struct operand
+		{
+			bool constant = false;
+			bool boolean = false;
+			vm::vm_register value = 0;
+			size_t location = 0;
+		};
+
+		static constexpr std::uint32_t main_chunk = 0;
+
+		scanner scanner_;
+		std::array<vm::i64, Capacity> code_;
+		std::array<std::uint32_t, Capacity> lines_ {};
+		size_t size_ = 0;
+
+		std::array<symbol, max_symbols> symbols_ {};
+		size_t symbol_count_ = 0;
+		size_t scope_ = 0; // first symbol of the innermost scope
+		std::array<source_view, max_symbols> globals_ {};
+		size_t global_count_ = 0;
+		std::array<function_entry, max_functions> functions_ {};
+		std::array<location, max_functions> bodies_ {}; // where each function's parameter list starts
+		size_t function_count_ = 1;
+
+		size_t next_ = 0; // first free register
+		size_t high_ = 0; // registers the current function touches
+		size_t depth_ = 0;
+		bool in_function_ = false;
+		size_t line_ = 1;
+
+		constexpr size_t emit(const vm::opcode op, const std::int64_t a = 0, const size_t source = 0, const size_t destination = 0)
+		{
+			if constexpr (Capacity != 0)
+			{
+				code_[size_] = vm::i64::encode(op, static_cast<std::int32_t>(a), static_cast<std::int16_t>(source), static_cast<std::int8_t>(destination));
+				lines_[size_] = static_cast<std::uint32_t>(line_);
+			}
+			return size_++;
+		}
+
+		constexpr void patch(const size_t at, const size_t target)
+		{
+			if constexpr (Capacity != 0)
+			{
+				// through raw, the only member a constant expression may read
+				constexpr auto field = 0xffffffffull << 8;
+				code_[at] = vm::i64((code_[at].raw & ~field) | static_cast<std::uint64_t>(target) << 8);
+			}
+		}
+
+		static constexpr bool fits(const vm::vm_register value)
+		{
+			return value >= INT32_MIN && value <= INT32_MAX;
+		}
+
+		static constexpr vm::vm_register wrap(const unsigned long long value)
+		{
+			return static_cast<vm::vm_register>(value);
+		}
+
+		constexpr size_t allocate()
+		{
+			if (next_ >= max_registers)
+			{
+				fail("expression needs too many registers", line_);
+			}
+			high_ = next_ + 1 > high_ ? next_ + 1 : high_;
+			return next_++;
+		}
+
+		constexpr void load_constant(const size_t destination, const vm::vm_register value)
+		{
+			if (fits(value))
+			{
+				emit(vm::opcode::load, value, 0, destination);
+				return;
+			}
+
+			// high * 2^32 + low, there is no constant pool to load it from
+			const auto low = static_cast<std::int32_t>(static_cast<std::uint32_t>(value));
+			const auto high = wrap(static_cast<unsigned long long>(value) - static_cast<unsigned long long>(static_cast<vm::vm_register>(low))) >> 32;
+			emit(vm::opcode::load, high, 0, destination);
+			emit(vm::opcode::mulrs, 1 << 16, destination, destination);
+			emit(vm::opcode::mulrs, 1 << 16, destination, destination);
+			if (low != 0)
+			{
+				emit(vm::opcode::addrs, low, destination, destination);
+			}
+		}
+
+		/* the register holding value, a new one for constants */
+		constexpr size_t materialise(const operand& value)
+		{
+			if (!value.constant)
+			{
+				return value.location;
+			}
+			const auto destination = allocate();
+			load_constant(destination, value.value);
+			return destination;
+		}
+
+		constexpr void place(const operand& value, const size_t destination)
+		{
+			if (value.constant)
+			{
+				load_constant(destination, value.value);
+			}
+			else if (value.location != destination)
+			{
+				emit(vm::opcode::move, 0, value.location, destination);
+			}
+		}
+
+		constexpr void emit_tag(const size_t location, const bool boolean)
+		{
+			emit(vm::opcode::tag, static_cast<std::int64_t>(boolean ? vm::value_type::boolean : vm::value_type::integer), 0, location);
+		}
+
+		constexpr void declare(const source_view name, const storage kind, const std::uint32_t index, const bool immutable, const bool boolean)
+		{
+			for (auto at = scope_; at < symbol_count_; at++)
+			{
+				if (symbols_[at].name == name)
+				{
+					fail("name is already declared in this scope", line_);
+				}
+			}
+			if (symbol_count_ == max_symbols)
+			{
+				fail("too many names", line_);
+			}
+			symbols_[symbol_count_++] = { name, kind, index, immutable, boolean };
+		}
+
+		[[nodiscard]] constexpr const symbol& find(const source_view name) const
+		{
+			for (auto at = symbol_count_; at > 0; at--)
+			{
+				if (symbols_[at - 1].name == name)
+				{
+					return symbols_[at - 1];
+				}
+			}
+			fail("name is not declared", line_);
+		}
+
+		constexpr operand read(const symbol& variable)
+		{
+			switch (variable.kind)
+			{
+				case storage::local:
+					return { false, variable.boolean, 0, variable.index };
+				case storage::global:
+				{
+					const auto destination = allocate();
+					emit(vm::opcode::getg, variable.index, 0, destination);
+					return { false, variable.boolean, 0, destination };
+				}
+				default:
+					fail("a function can only be called", line_);
+			}
+		}
+
+		constexpr void write(const symbol& variable, const operand& value)
+		{
+			if (variable.kind == storage::function)
+			{
+				fail("cannot assign to a function", line_);
+			}
+			if (variable.boolean != value.boolean)
+			{
+				fail("cannot change the type of a variable in an embedded script", line_);
+			}
+			if (variable.kind == storage::local)
+			{
+				return place(value, variable.index);
+			}
+			const auto location = materialise(value);
+			emit_tag(location, value.boolean);
+			emit(vm::opcode::setg, variable.index, location);
+		}
+
+		constexpr operand call(const source_view name)
+		{
+			const auto& callee = find(name);
+			if (callee.kind != storage::function)
+			{
+				fail("called value is not a function", line_);
+			}
+
+			const auto base = next_;
+			size_t arguments = 0;
+			scanner_.expect(token_type::OPEN_PARENTHESIS, "expected '('");
+			while (scanner_.peek().type != token_type::CLOSE_PARENTHESIS)
+			{
+				if (arguments != 0)
+				{
+					scanner_.expect(token_type::COMMA, "expected ',' or ')'");
+				}
+				next_ = base + arguments;
+				const auto argument = expression();
+				if (argument.boolean)
+				{
+					fail("functions take integers in embedded scripts", line_);
+				}
+				next_ = base + arguments;
+				place(argument, allocate());
+				arguments++;
+			}
+			scanner_.next();
+
+			if (arguments != functions_[callee.index].parameters)
+			{
+				fail("wrong number of arguments", line_);
+			}
+			next_ = base;
+			emit(vm::opcode::call, callee.index, 1, allocate());
+			return { false, false, 0, base };
+		}
+
+		constexpr operand primary()
+		{
+			const auto token = scanner_.next();
+			line_ = token.line;
+			switch (token.type)
+			{
+				case token_type::LITERAL: return { true, false, token.value };
+				case token_type::TRUE: return { true, true, 1 };
+				case token_type::FALSE: return { true, true, 0 };
+				case token_type::IDENTIFIER:
+				{
+					if (scanner_.peek().type == token_type::OPEN_PARENTHESIS)
+					{
+						return call(token.text);
+					}
+					return read(find(token.text));
+				}
+				case token_type::OPEN_PARENTHESIS:
+				{
+					const auto value = expression();
+					scanner_.expect(token_type::CLOSE_PARENTHESIS, "expected ')'");
+					return value;
+				}
+				case token_type::SUBTRACT:
+				case token_type::NOT:
+				case token_type::EXCLAMATION_MARK:
+				{
+					const auto negate = token.type == token_type::SUBTRACT;
+					const auto mark = next_;
+					const auto value = primary();
+					if (value.constant)
+					{
+						return { true, !negate, negate ? wrap(0ull - static_cast<unsigned long long>(value.value)) : value.value == 0 };
+					}
+					next_ = mark;
+					const auto destination = allocate();
+					emit(negate ? vm::opcode::neg : vm::opcode::lnot, 0, value.location, destination);
+					return { false, !negate, 0, destination };
+				}
+				default:
+					fail("expected an expression", token.line);
+			}
+		}
+
+		constexpr operand binary(const token_type operation, const operand& lhs, const operand& rhs, const size_t mark)
+		{
+			if (lhs.constant && rhs.constant && !(operation == token_type::DIVIDE && rhs.value == 0))
+			{
+				const auto a = static_cast<unsigned long long>(lhs.value);
+				const auto b = static_cast<unsigned long long>(rhs.value);
+				switch (operation)
+				{
+					case token_type::ADD: return { true, false, wrap(a + b) };
+					case token_type::SUBTRACT: return { true, false, wrap(a - b) };
+					case token_type::MULTIPLY: return { true, false, wrap(a * b) };
+					default: return { true, false, rhs.value == -1 ? wrap(0ull - a) : lhs.value / rhs.value };
+				}
+			}
+
+			// constant on the right, or on the left of an operation that does not mind
+			auto left = lhs;
+			auto right = rhs;
+			if (left.constant && !right.constant && (operation == token_type::ADD || operation == token_type::MULTIPLY))
+			{
+				left = rhs;
+				right = lhs;
+			}
+			const auto immediate = operation == token_type::SUBTRACT ? wrap(0ull - static_cast<unsigned long long>(right.value)) : right.value;
+			if (right.constant && !left.constant && fits(immediate) && !(operation == token_type::DIVIDE && immediate == 0))
+			{
+				constexpr vm::opcode immediates[] = { vm::opcode::addrs, vm::opcode::addrs, vm::opcode::mulrs, vm::opcode::divrs };
+				next_ = mark;
+				const auto destination = allocate();
+				emit(immediates[static_cast<size_t>(operation) - static_cast<size_t>(token_type::ADD)], immediate, left.location, destination);
+				return { false, false, 0, destination };
+			}
+
+			constexpr vm::opcode registers[] = { vm::opcode::addr, vm::opcode::subr, vm::opcode::mulr, vm::opcode::divr };
+			const auto a = materialise(left);
+			const auto b = materialise(right);
+			next_ = mark;
+			const auto destination = allocate();
+			emit(registers[static_cast<size_t>(operation) - static_cast<size_t>(token_type::ADD)], b, a, destination);
+			return { false, false, 0, destination };
+		}
+
+		constexpr operand multiplicative()
+		{
+			const auto mark = next_;
+			auto value = primary();
+			while (scanner_.peek().type == token_type::MULTIPLY || scanner_.peek().type == token_type::DIVIDE)
+			{
+				const auto operation = scanner_.next().type;
+				value = binary(operation, value, primary(), mark);
+			}
+			return value;
+		}
+
+		constexpr operand expression()
+		{
+			const auto mark = next_;
+			auto value = multiplicative();
+			while (scanner_.peek().type == token_type::ADD || scanner_.peek().type == token_type::SUBTRACT)
+			{
+				const auto operation = scanner_.next().type;
+				value = binary(operation, value, multiplicative(), mark);
+			}
+			return value;
+		}
+
+		/* the register a condition is in, and a jump on it to be patched */
+		constexpr size_t branch_unless()
+		{
+			scanner_.expect(token_type::OPEN_PARENTHESIS, "expected '('");
+			const auto mark = next_;
+			const auto condition = materialise(expression());
+			scanner_.expect(token_type::CLOSE_PARENTHESIS, "expected ')'");
+			next_ = mark;
+			return emit(vm::opcode::jz, 0, condition);
+		}
+
+		constexpr void block()
+		{
+			scanner_.expect(token_type::OPEN_BRACE, "expected '{'");
+			const auto symbols = symbol_count_;
+			const auto scope = scope_;
+			const auto registers = next_;
+			scope_ = symbol_count_;
+			depth_++;
+			while (scanner_.peek().type != token_type::CLOSE_BRACE)
+			{
+				if (scanner_.peek().type == token_type::EOF)
+				{
+					fail("block is not closed", line_);
+				}
+				statement();
+			}
+			scanner_.next();
+			depth_--;
+			symbol_count_ = symbols;
+			scope_ = scope;
+			next_ = registers;
+		}
+
+		constexpr void declaration()
+		{
+			const auto immutable = scanner_.next().type == token_type::CONST;
+			const auto name = scanner_.expect(token_type::IDENTIFIER, "expected a name").text;
+			if (scanner_.peek().type == token_type::COMMA)
+			{
+				fail("multiple assignment is not supported in embedded scripts", line_);
+			}
+			scanner_.expect(token_type::ASSIGN, "expected '='");
+
+			const auto mark = next_;
+			const auto value = expression();
+			if (!in_function_ && depth_ == 0)
+			{
+				const auto location = materialise(value);
+				emit_tag(location, value.boolean);
+				emit(vm::opcode::setg, global_count_, location);
+				next_ = mark;
+				declare(name, storage::global, static_cast<std::uint32_t>(global_count_), immutable, value.boolean);
+				globals_[global_count_++] = name;
+				return;
+			}
+
+			next_ = mark;
+			const auto location = allocate();
+			place(value, location);
+			declare(name, storage::local, static_cast<std::uint32_t>(location), immutable, value.boolean);
+		}
+
+		constexpr void assignment(const lexeme& target)
+		{
+			const auto& variable = find(target.text);
+			const auto operation = scanner_.next().type;
+			if (variable.immutable)
+			{
+				fail("cannot assign to a constant", line_);
+			}
+
+			const auto mark = next_;
+			if (operation == token_type::ASSIGN)
+			{
+				write(variable, expression());
+				next_ = mark;
+				return;
+			}
+
+			// x op= y is x = x op y
+			constexpr token_type operations[] = { token_type::ADD, token_type::SUBTRACT, token_type::MULTIPLY, token_type::DIVIDE };
+			if (operation < token_type::ADD_ASSIGN || operation > token_type::DIVIDE_ASSIGN)
+			{
+				fail("expected an assignment", line_);
+			}
+			const auto current = read(variable);
+			const auto rhs = expression();
+			write(variable, binary(operations[static_cast<size_t>(operation) - static_cast<size_t>(token_type::ADD_ASSIGN)], current, rhs, mark));
+			next_ = mark;
+		}
+
+		constexpr void if_statement()
+		{
+			scanner_.next();
+			const auto skip = branch_unless();
+			block();
+			if (scanner_.peek().type != token_type::ELSE)
+			{
+				return patch(skip, size_);
+			}
+
+			scanner_.next();
+			const auto end = emit(vm::opcode::jmp);
+			patch(skip, size_);
+			scanner_.peek().type == token_type::IF ? if_statement() : block();
+			patch(end, size_);
+		}
+
+		constexpr void while_statement()
+		{
+			scanner_.next();
+			const auto top = size_;
+			const auto exit = branch_unless();
+			block();
+			emit(vm::opcode::jmp, top);
+			patch(exit, size_);
+		}
+
+		constexpr void return_statement()
+		{
+			scanner_.next();
+			if (scanner_.peek().type == token_type::SEMICOLON)
+			{
+				emit(vm::opcode::ret, 0, 0, 0);
+				return;
+			}
+
+			const auto mark = next_;
+			const auto value = expression();
+			if (value.boolean && in_function_)
+			{
+				fail("functions return integers in embedded scripts", line_);
+			}
+			const auto location = materialise(value);
+			emit_tag(location, value.boolean);
+			emit(vm::opcode::ret, 0, 1, location);
+			next_ = mark;
+			if (scanner_.peek().type == token_type::COMMA)
+			{
+				fail("multiple results are not supported in embedded scripts", line_);
+			}
+		}
+
+		constexpr void skip_function()
+		{
+			scanner_.next();
+			while (scanner_.peek().type != token_type::OPEN_BRACE)
+			{
+				scanner_.next();
+			}
+			for (size_t depth = 0;;)
+			{
+				const auto token = scanner_.next();
+				if (token.type == token_type::EOF)
+				{
+					fail("function body is not closed", token.line);
+				}
+				depth += token.type == token_type::OPEN_BRACE;
+				depth -= token.type == token_type::CLOSE_BRACE;
+				if (depth == 0)
+				{
+					return;
+				}
+			}
+		}
+
+		constexpr void statement()
+		{
+			const auto token = scanner_.peek();
+			line_ = token.line;
+			switch (token.type)
+			{
+				case token_type::LET:
+				case token_type::CONST:
+					declaration();
+					break;
+				case token_type::IF:
+					return if_statement();
+				case token_type::WHILE:
+					return while_statement();
+				case token_type::RETURN:
+					return_statement();
+					break;
+				case token_type::FUNCTION:
+					if (in_function_ || depth_ != 0)
+					{
+						fail("nested functions are not supported in embedded scripts", token.line);
+					}
+					return skip_function();
+				case token_type::IDENTIFIER:
+				{
+					const auto target = scanner_.next();
+					if (scanner_.peek().type == token_type::OPEN_PARENTHESIS)
+					{
+						const auto mark = next_;
+						call(target.text);
+						next_ = mark;
+						break;
+					}
+					assignment(target);
+					break;
+				}
+				default:
+				{
+					const auto mark = next_;
+					static_cast<void>(expression());
+					next_ = mark;
+					break;
+				}
+			}
+			scanner_.expect(token_type::SEMICOLON, "expected ';'");
+		}
+
+		/* finds every top-level function first, so calls can come before definitions */
+		constexpr void declare_functions()
+		{
+			for (size_t depth = 0; scanner_.peek().type != token_type::EOF;)
+			{
+				const auto token = scanner_.next();
+				depth += token.type == token_type::OPEN_BRACE;
+				depth -= token.type == token_type::CLOSE_BRACE;
+				if (token.type != token_type::FUNCTION || depth != 0)
+				{
+					continue;
+				}
+
+				line_ = token.line;
+				if (function_count_ == max_functions)
+				{
+					fail("too many functions", line_);
+				}
+				const auto name = scanner_.expect(token_type::IDENTIFIER, "expected a function name").text;
+				bodies_[function_count_] = scanner_.position();
+
+				std::uint32_t parameters = 0;
+				scanner_.expect(token_type::OPEN_PARENTHESIS, "expected '('");
+				for (; scanner_.peek().type == token_type::IDENTIFIER; parameters++)
+				{
+					scanner_.next();
+					if (scanner_.peek().type == token_type::COMMA)
+					{
+						scanner_.next();
+					}
+				}
+				scanner_.expect(token_type::CLOSE_PARENTHESIS, "expected ')'");
+				declare(name, storage::function, static_cast<std::uint32_t>(function_count_), true, false);
+				functions_[function_count_++] = { name, 0, parameters, 0 };
+			}
+		}
+
+		constexpr void function(const size_t index)
+		{
+			scanner_.seek(bodies_[index]);
+			const auto symbols = symbol_count_;
+			scope_ = symbol_count_;
+			in_function_ = true;
+			next_ = 0;
+			high_ = 0;
+
+			functions_[index].entry = static_cast<std::uint32_t>(size_);
+			scanner_.expect(token_type::OPEN_PARENTHESIS, "expected '('");
+			while (scanner_.peek().type == token_type::IDENTIFIER)
+			{
+				const auto parameter = scanner_.next().text;
+				declare(parameter, storage::local, static_cast<std::uint32_t>(allocate()), false, false);
+				if (scanner_.peek().type == token_type::COMMA)
+				{
+					scanner_.next();
+				}
+			}
+			scanner_.expect(token_type::CLOSE_PARENTHESIS, "expected ')'");
+			block();
+			emit(vm::opcode::ret, 0, 0, 0);
+
+			functions_[index].frame_size = static_cast<std::uint32_t>(high_);
+			symbol_count_ = symbols;
+		}
+	public:
+		constexpr explicit single_pass_compiler(const source_view source)
+			: scanner_(source)
+		{
+			functions_[main_chunk].name = CHE_STR("main");
+		}
+
+		constexpr void compile()
+		{
+			const auto start = scanner_.position();
+			declare_functions();
+			scanner_.seek(start);
+
+			while (scanner_.peek().type != token_type::EOF)
+			{
+				statement();
+			}
+			emit(vm::opcode::halt);
+			functions_[main_chunk].frame_size = static_cast<std::uint32_t>(high_);
+
+			for (size_t index = 1; index < function_count_; index++)
+			{
+				function(index);
+			}
+		}
+
+		[[nodiscard]] constexpr extent size() const
+		{
+			return { size_, global_count_, function_count_ };
+		}
+
+		template <size_t Globals, size_t Functions>
+		[[nodiscard]] constexpr program<Capacity, Globals, Functions> result() const
+		{
+			program<Capacity, Globals, Functions> output;
+			for (size_t pc = 0; pc < Capacity; pc++)
+			{
+				output.code[pc] = code_[pc];
+				output.lines[pc] = lines_[pc];
+			}
+			for (size_t index = 0; index < Globals; index++)
+			{
+				output.globals[index] = globals_[index];
+			}
+			for (size_t index = 0; index < Functions; index++)
+			{
+				output.functions[index] = functions_[index];
+			}
+			return output;
+		}
+	};
+
+	/* the sizes compile needs, see CHERIE_EMBED */
+	constexpr extent measure(const source_view source)
+	{
+		single_pass_compiler<0> compiler(source);
+		compiler.compile();
+		return compiler.size();
+	}
+
+	template <size_t Instructions, size_t Globals, size_t Functions>
+	constexpr program<Instructions, Globals, Functions> compile(const source_view source)
+	{
+		single_pass_compiler<Instructions> compiler(source);
+		compiler.compile();
+		return compiler.template result<Globals, Functions>();
+	}
+}
+
+/**
+ * Compiles a string literal while the host is being compiled:
+ *
+ * constexpr auto script = CHERIE_EMBED("let total = 0; ...");
+ * state->load(script);
+ *
+ * Errors in the script are errors in the host, reported where the
+ * compiler gave up evaluating the constant expression.
+ */
+#define CHERIE_EMBED(source) ::cherie::compiler::embedded::compile< \
+	::cherie::compiler::embedded::measure(source).instructions, \
+	::cherie::compiler::embedded::measure(source).globals, \
+	::cherie::compiler::embedded::measure(source).functions>(source)
@@ -0,0 +1,52 @@
+/*
+ * File Name: analysis.h
+ * Author(s): P. Kamara
+ *
+ * Control flow analyses over the IR.
+ */
+
+#pragma once
+
+#include "compilation/ir/ir.h"
+
+namespace cherie::compiler::ir
+{
+	/* reachable blocks only, entry first */
+	[[nodiscard]] std::vector<block_id> reverse_postorder(const function& function);
+
+	struct dominator_tree
+	{
+		std::vector<block_id> immediate_dominator; // no_block for the entry and unreachable blocks
+		std::vector<std::vector<block_id>> children;
+
+		[[nodiscard]] bool dominates(block_id dominator, block_id block) const;
+	};
+
+	/* Cooper, Harvey & Kennedy, "A Simple, Fast Dominance Algorithm" */
+	[[nodiscard]] dominator_tree compute_dominators(const function& function);
+
+	struct loop
+	{
+		block_id header = no_block;
+		block_id preheader = no_block;  // sole entry from outside, if it only jumps to the header
+		std::vector<block_id> latches;   // sources of back edges
+		std::vector<block_id> blocks;    // header first, then the rest in reverse postorder
+		std::vector<bool> contains;      // indexed by block
+
+		[[nodiscard]] bool has(const block_id block) const { return contains[block]; }
+	};
+
+	/* natural loops, innermost first; loops sharing a header are merged */
+	[[nodiscard]] std::vector<loop> find_loops(const function& function, const dominator_tree& dominators);
+
+	/**
+	 * Forward type inference over the SSA graph. Constants carry their type
+	 * from the builder; everything else is derived from its operands, with
+	 * phis joining their incoming types. Starting from unknown and iterating
+	 * to a fixed point lets loop-carried values stay precise.
+	 */
+	void infer_types(function& function);
+
+	/* gives every edge from a multi-successor block into a multi-predecessor block its own block */
+	void split_critical_edges(function& function);
+}
@@ -0,0 +1,146 @@
+/*
+ * File Name: builder.h
+ * Author(s): P. Kamara
+ *
+ * Lowers the AST into SSA form.
+ */
+
+#pragma once
+
+#include <map>
+#include <unordered_map>
+#include "compilation/ast/node.h"
+#include "compilation/ir/ir.h"
+#include "vm/shape.h"
+
+namespace cherie::compiler::ir
+{
+	struct callable
+	{
+		std::uint32_t index; // into the linked function table
+		size_t parameters;
+	};
+	using function_table = std::unordered_map<types::string, callable>;
+	struct global
+	{
+		std::uint32_t index; // into the VM's global array
+		bool immutable;      // every top-level declaration is const
+	};
+	using global_table = std::unordered_map<types::string, global>;
+
+	struct nested_function
+	{
+		ast::function_definition* definition;
+		std::uint32_t index;
+		std::vector<types::string> captures; // variables around the definition it reads, copied when it is defined
+		bool escapes; // needs a closure, otherwise it is called directly with its captures as extra arguments
+	};
+
+	/* what every function of a program can refer to */
+	struct module
+	{
+		function_table functions; // top-level definitions
+		global_table globals;
+		std::vector<nested_function> nested; // found while lowering the functions holding them
+		std::uint32_t function_count = 1;    // indices handed out so far, the main chunk included
+		vm::object_layout layout;            // the fields and shapes handed out so far
+		std::unordered_map<types::string, std::uint32_t> field_ids;
+		std::map<std::vector<std::uint32_t>, std::uint32_t> shape_ids;
+	};
+
+	/**
+	 * Single pass SSA construction, following Braun et al., "Simple and
+	 * Efficient Construction of Static Single Assignment Form" (CC 2013):
+	 * variables are looked up per block on demand, phis are placed lazily and
+	 * trivial ones are removed as soon as a block is sealed.
+	 */
+	class builder final : public ast::visitor
+	{
+		struct variable_info
+		{
+			types::string name;
+			bool immutable = false;
+			std::unordered_map<block_id, value_id> definitions;
+			std::uint32_t global = no_global; // globals are loaded and stored instead of renamed
+			bool captured = false;
+			std::uint32_t callee = no_function; // a nested function that is only ever called directly
+			std::vector<value_id> captures = {}; // passed to it after the declared arguments
+		};
+		static constexpr std::uint32_t no_global = ~std::uint32_t(0);
+		static constexpr std::uint32_t no_function = ~std::uint32_t(0);
+		static constexpr size_t no_variable = SIZE_MAX;
+
+		function& function_;
+		module& module_;
+		const function_table& functions_;
+		const global_table& globals_;
+		bool escapes_ = false; // of the nested function about to be lowered
+		bool in_function_ = false;
+		block_id current_ = 0;
+		value_id result_ = no_value;
+
+		std::vector<variable_info> variables_;
+		std::vector<std::unordered_map<types::string, size_t>> scopes_;
+		std::vector<bool> sealed_;
+		std::unordered_map<block_id, std::vector<std::pair<size_t, value_id>>> incomplete_phis_;
+
+		block_id new_block();
+		void seal(block_id block);
+		value_id emit(const ast::node* source, opcode op, std::vector<value_id> operands = {}, std::int64_t immediate = 0);
+		void terminate(const ast::node* source, opcode op, std::vector<block_id> successors, std::vector<value_id> operands = {});
+
+		size_t find(const types::string& name) const;
+		size_t resolve(const ast::node* source, const types::string& name) const;
+		void write_variable(size_t variable, block_id block, value_id value);
+		value_id read_variable(size_t variable, block_id block);
+		value_id read_variable_recursive(size_t variable, block_id block);
+		value_id load(const ast::node* source, size_t variable);
+		value_id add_phi_operands(size_t variable, value_id phi);
+		value_id try_remove_trivial_phi(value_id phi);
+
+		void declare_globals();
+		void declare_captures(ast::function_definition* definition, const nested_function& nested);
+		void assign(const ast::node* source, const types::string& name, bool declaration, bool immutable, value_id value);
+		const callable& resolve_call(const ast::call_expression* call) const;
+		std::vector<value_id> lower_arguments(ast::call_expression* call);
+		value_id lower_call(ast::call_expression* call, bool tail);
+		std::uint32_t field_id(const types::string& name);
+		std::uint32_t shape_id(std::vector<std::uint32_t> fields);
+
+		value_id lower(ast::node* node);
+		void lower_block(ast::statement_block* block);
+	public:
+		builder(function& function, module& module);
+
+		/* lowers a function body; the program itself is lowered by visiting it */
+		void build(ast::function_definition* definition, const nested_function* nested = nullptr);
+
+		FINAL_VISITOR(ast::program);
+		FINAL_VISITOR(ast::boolean_literal);
+		FINAL_VISITOR(ast::number_literal);
+		FINAL_VISITOR(ast::string_literal);
+		FINAL_VISITOR(ast::binary_expression);
+		FINAL_VISITOR(ast::primary_expression);
+		FINAL_VISITOR(ast::multiplicative_expression);
+		FINAL_VISITOR(ast::additive_expression);
+		FINAL_VISITOR(ast::unary_expression);
+		FINAL_VISITOR(ast::expression);
+		FINAL_VISITOR(ast::statement);
+		FINAL_VISITOR(ast::statement_block);
+		FINAL_VISITOR(ast::function_definition);
+		FINAL_VISITOR(ast::call_expression);
+		FINAL_VISITOR(ast::if_statement);
+		FINAL_VISITOR(ast::assignment_statement);
+		FINAL_VISITOR(ast::variable);
+		FINAL_VISITOR(ast::while_statement);
+		FINAL_VISITOR(ast::return_statement);
+		FINAL_VISITOR(ast::multiple_assignment_statement);
+		FINAL_VISITOR(ast::function_statement);
+		FINAL_VISITOR(ast::object_literal);
+		FINAL_VISITOR(ast::array_literal);
+		FINAL_VISITOR(ast::field_expression);
+		FINAL_VISITOR(ast::field_assignment_statement);
+		FINAL_VISITOR(ast::index_expression);
+		FINAL_VISITOR(ast::index_assignment_statement);
+	};
+}
@@ -0,0 +1,41 @@
+/*
+ * File Name: codegen.h
+ * Author(s): P. Kamara
+ *
+ * Generates register bytecode from the IR.
+ */
+
+#pragma once
+
+#include "compilation/ir/ir.h"
+#include "vm/function_info.h"
+#include "vm/instruction.h"
+#include "vm/line_table.h"
+#include "vm/shape.h"
+
+namespace cherie::compiler::ir
+{
+	struct bytecode
+	{
+		std::vector<vm::i64> program;
+		std::vector<std::int64_t> constants;
+		vm::line_table lines;
+		std::vector<vm::function_info> functions;
+		std::vector<std::string> globals;
+		vm::object_layout layout; // only the sites until the program is linked
+	};
+
+	/**
+	 * Leaves SSA by splitting critical edges and turning phis into parallel
+	 * copies at the end of each predecessor. Registers are handed out by a
+	 * linear scan over one live interval per value (no holes, no spilling);
+	 * parameters are pinned to the registers their arguments arrive in.
+	 * The register above the allocated ones is kept back as scratch for
+	 * breaking copy cycles, and callee windows start right above it. The
+	 * output describes the function in a single functions entry.
+	 */
+	[[nodiscard]] bytecode generate(function& function);
+
+	constexpr size_t register_count = 256;
+	constexpr size_t scratch_register = register_count - 1;
+}
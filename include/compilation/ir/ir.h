@@ -0,0 +1,188 @@
+/*
+ * File Name: ir.h
+ * Author(s): P. Kamara
+ *
+ * SSA intermediate representation.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "vm/line_table.h"
+
+namespace cherie::compiler::ir
+{
+	using value_id = std::uint32_t;
+	using block_id = std::uint32_t;
+
+	constexpr value_id no_value = UINT32_MAX;
+	constexpr block_id no_block = UINT32_MAX;
+
+	enum class opcode : std::uint8_t
+	{
+		nop,         // removed instruction, never in a block
+		constant,    // immediate
+		copy,        // operands[0]
+		phi,         // operands[i] flows in from predecessors[i]
+		add,         // operands[0] + operands[1]
+		sub,         // operands[0] - operands[1]
+		mul,         // operands[0] * operands[1]
+		div,         // operands[0] / operands[1], traps on zero
+		neg,         // -operands[0]
+		logical_not, // operands[0] == 0
+		parameter,   // argument number immediate, entry block only
+		call,        // function immediate with operands as arguments, defines the first result
+		result,      // result number immediate (>= 1) of the call in operands[0], right after it
+		load_global, // global number immediate
+		store_global,// global number immediate = operands[0]
+		make_closure,    // closure of function immediate over the operands
+		load_upvalue,    // upvalue number immediate of the running closure
+		current_closure, // the running closure itself
+		call_value,      // calls the closure in the last operand with the others as arguments, defines the first result
+		make_object, // object of shape immediate with the operands as its fields
+		load_field,  // field immediate of the object in operands[0]
+		store_field, // field immediate of the object in operands[0] = operands[1]
+		make_map,    // a new empty map
+		load_entry,  // the value of key operands[1] in the map in operands[0]
+		has_entry,   // whether the map in operands[0] has the key operands[1]
+		next_entry,  // the position in the map in operands[0] after operands[1], -1 past the last
+		entry_key,   // the key at position operands[1] of the map in operands[0]
+		store_entry, // key operands[1] of the map in operands[0] = operands[2]
+		make_array,  // array of the operands
+		run_kernel,  // array builtin immediate, see vm/array.h, over the operands
+		/* terminators */
+		jump,        // -> successors[0]
+		branch,      // operands[0] ? successors[0] : successors[1]
+		halt,
+		ret,         // returns the operands
+		tail_call,   // like call, but returns whatever the callee returns
+		tail_call_value, // like call_value, but returns whatever the callee returns
+	};
+
+	/**
+	 * Inferred static type of a value. unknown is the optimistic starting
+	 * point of inference, dynamic means the value can have more than one
+	 * type at runtime and needs the VM's generic opcodes. Floating point
+	 * constants keep the bits of a double in `immediate`.
+	 */
+	enum class value_type : std::uint8_t
+	{
+		unknown,
+		integer,
+		floating,
+		boolean,
+		dynamic,
+	};
+
+	struct instruction
+	{
+		opcode op = opcode::nop;
+		value_type type = value_type::unknown;
+		std::vector<value_id> operands;
+		std::int64_t immediate = 0;
+		block_id block = no_block;
+		vm::source_position position;
+
+		[[nodiscard]] bool is_terminator() const { return op >= opcode::jump; }
+	};
+
+	struct basic_block
+	{
+		std::vector<value_id> instructions; // phis first, terminator last
+		std::vector<block_id> predecessors;
+		std::vector<block_id> successors;
+	};
+
+	/**
+	 * Values and instructions are the same thing: an instruction's index in
+	 * `values` is the SSA value it defines. Removed instructions stay in
+	 * `values` as nops so ids remain stable.
+	 */
+	struct function
+	{
+		std::string name;
+		size_t parameters = 0;
+		size_t upvalues = 0; // captured values it reads through load_upvalue
+		std::vector<instruction> values;
+		std::vector<basic_block> blocks;
+
+		block_id add_block()
+		{
+			blocks.emplace_back();
+			return static_cast<block_id>(blocks.size() - 1);
+		}
+
+		value_id append(const block_id block, instruction instruction)
+		{
+			instruction.block = block;
+			values.push_back(std::move(instruction));
+			const auto id = static_cast<value_id>(values.size() - 1);
+			blocks[block].instructions.push_back(id);
+			return id;
+		}
+
+		value_id insert_phi(const block_id block)
+		{
+			instruction phi;
+			phi.op = opcode::phi;
+			phi.block = block;
+			values.push_back(std::move(phi));
+			const auto id = static_cast<value_id>(values.size() - 1);
+
+			auto& instructions = blocks[block].instructions;
+			auto position = instructions.begin();
+			while (position != instructions.end() && values[*position].op == opcode::phi)
+			{
+				++position;
+			}
+			instructions.insert(position, id);
+			return id;
+		}
+
+		void add_edge(const block_id from, const block_id to)
+		{
+			blocks[from].successors.push_back(to);
+			blocks[to].predecessors.push_back(from);
+		}
+
+		/* removes the edge and the matching operand of every phi in `to` */
+		void remove_edge(block_id from, block_id to);
+
+		[[nodiscard]] bool terminated(const block_id block) const
+		{
+			const auto& instructions = blocks[block].instructions;
+			return !instructions.empty() && values[instructions.back()].is_terminator();
+		}
+
+		/* rewrites every operand equal to `from`; O(n), meant for batch use */
+		void replace_uses(value_id from, value_id to);
+
+		/* drops nops from the block lists */
+		void compact();
+
+		[[nodiscard]] size_t instruction_count() const;
+	};
+
+	[[nodiscard]] bool has_side_effects(const function& function, const instruction& instruction);
+
+	/* integer arithmetic with the VM's wrapping semantics; nothing for division by zero */
+	[[nodiscard]] std::optional<std::int64_t> evaluate(opcode op, std::int64_t lhs, std::int64_t rhs = 0);
+
+	[[nodiscard]] double as_double(std::int64_t bits);
+	[[nodiscard]] std::int64_t from_double(double value);
+
+	/* integers and booleans share a representation, arithmetic on them yields integers */
+	[[nodiscard]] inline bool is_integral(const value_type type)
+	{
+		return type == value_type::integer || type == value_type::boolean;
+	}
+
+	[[nodiscard]] const char* type_name(value_type type);
+	[[nodiscard]] const char* opcode_name(opcode op);
+	void print(const function& function, std::FILE* out = stdout);
+}
@@ -0,0 +1,31 @@
+/*
+ * File Name: loops.h
+ * Author(s): P. Kamara
+ *
+ * Loop optimisations over the IR. Like the scalar passes, each one returns
+ * how many changes it made.
+ */
+
+#pragma once
+
+#include "compilation/ir/ir.h"
+
+namespace cherie::compiler::ir
+{
+	/* moves pure instructions whose operands are all defined outside a loop into its preheader */
+	size_t hoist_loop_invariants(function& function);
+
+	/**
+	 * Replaces i * k, where i is a header phi stepped by a constant on the
+	 * back edge and k is a constant, with a new phi that starts at init * k
+	 * and is stepped by step * k.
+	 */
+	size_t reduce_induction_variables(function& function);
+
+	/**
+	 * Fully unrolls single-block loops whose exit condition can be evaluated
+	 * at compile time, as long as the trip count and the unrolled size stay
+	 * under the given limits.
+	 */
+	size_t unroll_loops(function& function, size_t max_trip_count = 8, size_t max_instructions = 64);
+}
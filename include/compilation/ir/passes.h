@@ -0,0 +1,32 @@
+/*
+ * File Name: passes.h
+ * Author(s): P. Kamara
+ *
+ * Scalar optimisations over the IR. Each pass returns how many
+ * instructions it removed or replaced.
+ */
+
+#pragma once
+
+#include "compilation/ir/ir.h"
+
+namespace cherie::compiler::ir
+{
+	/* evaluates instructions whose operands are all constants, and branches on constants */
+	size_t fold_constants(function& function);
+
+	/* forwards copies, and phis whose incoming values are all the same */
+	size_t propagate_copies(function& function);
+
+	/* hash-based redundancy elimination within each basic block */
+	size_t eliminate_common_subexpressions(function& function);
+
+	/* hash-based redundancy elimination scoped over the dominator tree */
+	size_t number_values(function& function);
+
+	/* empties blocks that cannot be reached, dropping their edges and the phi operands they feed */
+	size_t remove_unreachable_blocks(function& function);
+
+	/* removes unreachable blocks and instructions whose values are never used */
+	size_t eliminate_dead_code(function& function);
+}
@@ -16,6 +16,7 @@ namespace cherie::compiler
 	{
         size_t line_ = 1;
         size_t column_ = 0;
+        size_t offset_ = 0; // characters read so far
 
         types::string current_lexeme_;
         std::unique_ptr<types::istream> stream_;
@@ -45,12 +46,18 @@ namespace cherie::compiler
         token_type tokenize(token& token_reference);
 	public:
         explicit lexer(types::string source);
+        /* for a piece of a larger source that starts at line, column */
+        lexer(types::string source, size_t line, size_t column);
 		
         token_type next_token();
         token_type peek_token();
 
         [[nodiscard]] size_t line() const { return line_;  }
         [[nodiscard]] size_t column() const { return column_;  }
+        [[nodiscard]] size_t offset() const { return offset_;  }
+
+        /* the source between two offsets */
+        [[nodiscard]] types::string text(const size_t begin, const size_t end) const { return source_.substr(begin, end - begin); }
 
         [[nodiscard]] token token_value() const { return current_token_; }
         [[nodiscard]] token peeked_token_value() const { return peeked_token_; }
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include "lexer.h"
 #include "ast/node.h"
 
@@ -15,6 +16,7 @@ namespace cherie::compiler
 	class parser
 	{
         std::unique_ptr<lexer> lexer_;
+        size_t defer_above_; // top-level bodies with more tokens are only scanned
 
         template<typename T>
         T get_token_value()
@@ -30,6 +32,15 @@ namespace cherie::compiler
 		
         void expect(token_type type) const;
 
+        template<typename T, typename... Args>
+        T* make_node(Args&&... args)
+        {
+            auto* node = new T(std::forward<Args>(args)...);
+            node->line = lexer_->line();
+            node->column = lexer_->column();
+            return node;
+        }
+
         template<typename T>
         T expect_and_get(const token_type type)
         {
@@ -38,21 +49,34 @@ namespace cherie::compiler
         }
 
         ast::call_expression* parse_call_expression();
+        ast::object_literal* parse_object_literal();
+        ast::array_literal* parse_array_literal();
+        ast::primary_expression* parse_operand();
         ast::primary_expression* parse_primary_expression();
         ast::multiplicative_expression* parse_multiplicative_expression();
         ast::additive_expression* parse_additive_expression();
         ast::expression* parse_expression();
 		
-        ast::function_definition* parse_function_definition();
+        ast::function_definition* parse_function_definition(bool top_level = false);
+        std::unique_ptr<ast::deferred_body> scan_function_body(const types::string& name);
         ast::statement_block* parse_statement_block();
 
-        ast::assignment_statement* parse_assignment_statement();
+        ast::statement* parse_assignment_statement();
+        ast::multiple_assignment_statement* parse_multiple_assignment(std::vector<types::string> names);
+        ast::statement* parse_reassignment(ast::variable* target);
+        ast::statement* parse_store(ast::primary_expression* target);
         ast::while_statement* parse_while_statement();
+        ast::return_statement* parse_return_statement();
         ast::if_statement* parse_if_statement();
         ast::statement* parse_statement();
 	public:
-        explicit parser(lexer* lexer);
+        static constexpr size_t never_defer = SIZE_MAX;
+
+        explicit parser(lexer* lexer, size_t defer_above = never_defer);
 		
         ast::program* parse();
+
+        /* a deferred function body, from a lexer over its source */
+        ast::statement_block* parse_body();
 	};
 }
@@ -0,0 +1,50 @@
+/*
+ * File Name: peephole.h
+ * Author(s): P. Kamara
+ *
+ * Peephole optimiser over emitted bytecode.
+ */
+
+#pragma once
+
+#include <array>
+#include <bitset>
+#include "compilation/ir/codegen.h"
+
+namespace cherie::compiler::peephole
+{
+	enum class rule : std::uint8_t
+	{
+		redundant_move,  // move r, r / move a, b; move b, a
+		push_pop,        // pushr a; pop b -> move b, a / pushi k; pop b -> load b, k
+		fold_immediate,  // load t, k; addr d, s, t -> addrs d, s, k (and mulrs, divrs)
+		jump_threading,  // jumps to jumps, to the next instruction or to halt; unreachable code
+		dead_write,      // writes to registers that are never read again
+		count,
+	};
+
+	constexpr auto rule_count = static_cast<size_t>(rule::count);
+	using rule_set = std::bitset<rule_count>;
+	const rule_set all_rules = rule_set().set();
+
+	struct statistics
+	{
+		size_t instructions_before = 0;
+		size_t instructions_after = 0;
+		size_t passes = 0;
+		std::array<size_t, rule_count> applied = {}; // rewrites per rule
+
+		[[nodiscard]] size_t removed() const { return instructions_before - instructions_after; }
+	};
+
+	/**
+	 * Rules look at a window of one or two instructions and rewrite them in
+	 * place, replacing anything they delete with a nop. After every pass the
+	 * nops (including ones codegen left behind) are squeezed out, and jump
+	 * targets and the line table are remapped. Passes repeat until no rule
+	 * fires, since one rewrite often exposes another.
+	 */
+	statistics optimise(ir::bytecode& bytecode, const rule_set& rules = all_rules);
+
+	[[nodiscard]] const char* rule_name(rule rule);
+}
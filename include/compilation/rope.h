@@ -0,0 +1,64 @@
+/*
+ * File Name: rope.h
+ * Author(s): P. Kamara
+ *
+ * Interned strings that concatenate lazily.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include "conf.h"
+
+namespace cherie::compiler
+{
+	/**
+	 * An immutable string for the constants the compiler works with. Joining
+	 * two ropes only makes a node over both, so a chain of concatenations
+	 * costs constant time per step, and the characters are put together the
+	 * first time someone reads them, after which the node keeps the result
+	 * and lets go of the pieces it was made of.
+	 * Flat text is interned in a table shared by every thread: ropes that
+	 * spell the same characters end up with the same buffer, so comparing
+	 * two of them is a pointer comparison once they are flat, and copying
+	 * one is a reference count. The table only holds strings that some rope
+	 * still uses, and std::string keeps short ones inline as it is.
+	 */
+	class rope
+	{
+		struct piece
+		{
+			std::shared_ptr<const types::string> text; // set for leaves
+			mutable std::shared_ptr<const piece> left;  // dropped once flattened, other threads read both with std::atomic_load
+			mutable std::shared_ptr<const piece> right;
+			size_t size = 0;
+			mutable std::once_flag flattened;
+			mutable std::shared_ptr<const types::string> flat;
+
+			piece() = default;
+			piece(const piece&) = delete;
+			piece& operator=(const piece&) = delete;
+			~piece();
+		};
+
+		std::shared_ptr<const piece> root_;
+
+		static std::shared_ptr<const types::string> intern(types::string text);
+		static const types::string& flatten(const piece& node);
+	public:
+		rope() = default;
+		explicit rope(types::string text);
+
+		[[nodiscard]] size_t size() const { return root_ ? root_->size : 0; }
+		[[nodiscard]] bool empty() const { return size() == 0; }
+
+		/* the characters, joined and interned the first time */
+		[[nodiscard]] const types::string& str() const;
+		[[nodiscard]] const types::che_char* c_str() const { return str().c_str(); }
+
+		friend rope operator+(const rope& lhs, const rope& rhs);
+		friend bool operator==(const rope& lhs, const rope& rhs);
+		friend bool operator!=(const rope& lhs, const rope& rhs) { return !(lhs == rhs); }
+	};
+}
@@ -69,6 +69,7 @@ namespace cherie::compiler
     	{ CHE_STR("let"), token_type::LET },
     	{ CHE_STR("const"), token_type::CONST },
     	{ CHE_STR("fn"), token_type::FUNCTION },
+    	{ CHE_STR("else"), token_type::ELSE },
     	{ CHE_STR("true"), token_type::TRUE },
     	{ CHE_STR("false"), token_type::FALSE },
 		{ CHE_STR("return"), token_type::RETURN },
@@ -0,0 +1,82 @@
+/*
+ * File Name: work_pool.h
+ * Author(s): P. Kamara
+ *
+ * Work-stealing thread pool for the compiler.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cherie::compiler
+{
+	/**
+	 * Every worker owns a queue, and so do the threads that hand in work.
+	 * A batch of tasks is dealt round robin over the queues. Owners take
+	 * from the back of their own queue and an idle thread steals from the
+	 * front of the others, so a batch of uneven tasks (one huge function
+	 * and many small ones) still keeps every core busy. The thread that
+	 * hands in a batch works on it too until it is done. If tasks throw,
+	 * the exception of the lowest index is rethrown, so errors do not
+	 * depend on the schedule.
+	 */
+	class work_pool
+	{
+		struct batch
+		{
+			const std::function<void(size_t)>* task;
+			std::atomic<size_t> remaining;
+			std::mutex mutex;
+			std::condition_variable done;
+			std::exception_ptr error;
+			size_t error_index = SIZE_MAX;
+		};
+
+		struct job
+		{
+			batch* owner;
+			size_t index;
+		};
+
+		struct queue
+		{
+			std::mutex mutex;
+			std::deque<job> jobs;
+		};
+
+		std::vector<std::unique_ptr<queue>> queues_; // one per worker, the last one for callers
+		std::vector<std::thread> workers_;
+		std::mutex sleep_mutex_;
+		std::condition_variable wake_;
+		std::atomic<size_t> queued_ = 0;
+		bool stopping_ = false;
+
+		bool run_one(size_t home);
+		static void execute(const job& job);
+		void work(size_t home);
+	public:
+		explicit work_pool(size_t workers);
+		~work_pool();
+
+		work_pool(const work_pool&) = delete;
+		work_pool& operator=(const work_pool&) = delete;
+
+		/* runs task(0) .. task(count - 1) and returns when all of them have */
+		void run(size_t count, const std::function<void(size_t)>& task);
+
+		[[nodiscard]] size_t workers() const { return workers_.size(); }
+
+		/* one worker per core besides the calling thread, started on first use */
+		static work_pool& shared();
+	};
+}
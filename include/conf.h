@@ -9,6 +9,9 @@
 #include <string>
 
 //#define CHERIE_UNICODE
+// set by the CMake options of the same name, uncomment them where the build does not use CMake
+//#define CHERIE_PROFILER // instruction-counter sampling profiler (vm/profiler.h), adds a countdown to every dispatch
+//#define CHERIE_TELEMETRY // per-opcode counters and VM statistics (vm/telemetry.h)
 
 namespace cherie
 {
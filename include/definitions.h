@@ -46,8 +46,16 @@ namespace cherie
             { token_type::SUBTRACT, "-" },
             { token_type::MULTIPLY, "*" },
             { token_type::DIVIDE, "/" },
+            { token_type::NOT, "not " },
             { token_type::CLOSE_PARENTHESIS, ")" },
             { token_type::SEMICOLON, ";" },
+            { token_type::OPEN_BRACE, "{" },
+            { token_type::CLOSE_BRACE, "}" },
+            { token_type::COMMA, "," },
+            { token_type::COLON, ":" },
+            { token_type::DOT, "." },
+            { token_type::OPEN_BRACKET, "[" },
+            { token_type::CLOSE_BRACKET, "]" },
 			{ token_type::EOF, "EOF" }
         };
 		
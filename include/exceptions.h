@@ -27,6 +27,20 @@ namespace cherie
 			: std::exception(what.c_str()) {}
 	};
 
+	struct codegen_exception final
+		: std::exception
+	{
+		explicit codegen_exception(const std::string& what)
+			: std::exception(what.c_str()) {}
+	};
+
+	struct runtime_exception final
+		: std::exception
+	{
+		explicit runtime_exception(const std::string& what)
+			: std::exception(what.c_str()) {}
+	};
+
 	template <typename... Args>
 	void lexer_error(const std::string& format, Args... args)
 	{
@@ -42,4 +56,20 @@ namespace cherie
 		sprintf_s(str, format.c_str(), args...);
 		throw parser_exception(str);
 	}
+
+	template <typename... Args>
+	void codegen_error(const std::string& format, Args... args)
+	{
+		char str[_MAX_PATH];
+		sprintf_s(str, format.c_str(), args...);
+		throw codegen_exception(str);
+	}
+
+	template <typename... Args>
+	void runtime_error(const std::string& format, Args... args)
+	{
+		char str[_MAX_PATH];
+		sprintf_s(str, format.c_str(), args...);
+		throw runtime_exception(str);
+	}
 }
\ No newline at end of file
@@ -8,6 +8,11 @@
 #pragma once
 
 #include <memory>
+#include "conf.h"
+#include "compilation/compiler.h"
+#include "compilation/embedded.h"
+#include "vm/image.h"
+#include "vm/native.h"
 #include "vm/virtual_machine.h"
 
 namespace cherie
@@ -15,7 +20,28 @@ namespace cherie
 	struct state_raw
         : vm::virtual_machine
 	{
-		
+		/* compiles source, replacing the currently loaded program */
+		void load(const types::string& source, const compiler::options& options = {});
+
+		/* runs a program other states may share, whichever calls a deferred function first compiles it */
+		void load(std::shared_ptr<compiler::unit> unit);
+
+		/* runs a compiled image in place, see vm::image::map */
+		void load(std::shared_ptr<const vm::image> image);
+
+		/* runs a script compiled with the host, see CHERIE_EMBED */
+		void load(const compiler::embedded::program_view& program);
+
+		/* runs a program translated to C++ by compiler::write_native and linked into the host */
+		void load(const vm::native_program& program);
+
+		/* safe to call from another thread while the state runs; empty without CHERIE_TELEMETRY */
+		[[nodiscard]] vm::telemetry_snapshot telemetry() const;
+	protected:
+		void load_function(std::uint32_t function) override;
+	private:
+		std::shared_ptr<compiler::unit> unit_;
+		std::shared_ptr<const vm::image> image_;
 	};
     using state = std::unique_ptr<state_raw>;
 }
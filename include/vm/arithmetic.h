@@ -0,0 +1,45 @@
+/*
+ * File Name: arithmetic.h
+ * Author(s): P. Kamara
+ *
+ * Value arithmetic shared by the interpreter and native code.
+ */
+
+#pragma once
+
+#include <cstring>
+
+#include "instruction.h"
+
+namespace cherie::vm
+{
+	/* integer arithmetic wraps on overflow, as the constant folder assumes */
+	inline vm_register wrapping_add(const vm_register a, const vm_register b)
+	{
+		return static_cast<vm_register>(static_cast<unsigned long long>(a) + static_cast<unsigned long long>(b));
+	}
+
+	inline vm_register wrapping_subtract(const vm_register a, const vm_register b)
+	{
+		return static_cast<vm_register>(static_cast<unsigned long long>(a) - static_cast<unsigned long long>(b));
+	}
+
+	inline vm_register wrapping_multiply(const vm_register a, const vm_register b)
+	{
+		return static_cast<vm_register>(static_cast<unsigned long long>(a) * static_cast<unsigned long long>(b));
+	}
+
+	inline double as_double(const vm_register value)
+	{
+		double result;
+		std::memcpy(&result, &value, sizeof(result));
+		return result;
+	}
+
+	inline vm_register from_double(const double value)
+	{
+		vm_register result;
+		std::memcpy(&result, &value, sizeof(result));
+		return result;
+	}
+}
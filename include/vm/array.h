@@ -0,0 +1,92 @@
+/*
+ * File Name: array.h
+ * Author(s): P. Kamara
+ *
+ * Packed numeric arrays.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "closure.h"
+
+namespace cherie::vm
+{
+	/**
+	 * Arrays hold either integers or doubles, unboxed and next to each
+	 * other, and their tag says which. An array is laid out like a closure
+	 * without upvalues: its length is where a closure keeps its function
+	 * and the elements follow the header, so the collector moves them along
+	 * with the array without ever looking at them.
+	 *
+	 * The builtins that work on whole arrays are kernels over the elements,
+	 * run with AVX2 where the processor has it, SSE2 where the target has it
+	 * and plain loops otherwise. Sums and dot products of doubles add into
+	 * eight partial sums whichever of them runs, so results do not depend on
+	 * the machine, although they may round differently from adding in order.
+	 */
+	using array = closure;
+
+	/* the builtin a vec instruction runs, its Ia */
+	enum class kernel : std::uint8_t
+	{
+		fill,   // fill(n, x): n copies of the number x
+		len,    // len(a): the elements of an array or the entries of a map
+		sum,
+		min,
+		max,
+		dot,
+		add,    // element-wise, either side may be a number instead of an array
+		sub,
+		mul,
+		div,
+		filter, // filter(a, low, high): the elements from low to high, in order
+		sort,   // sort(a): sorts a in place and returns it
+	};
+
+	/* the builtin's name, for error messages */
+	[[nodiscard]] const char* kernel_name(kernel op);
+
+	/* how many registers from Ibs on the builtin reads */
+	[[nodiscard]] std::uint32_t kernel_arity(kernel op);
+
+	constexpr std::uint32_t kernel_count = static_cast<std::uint32_t>(kernel::sort) + 1;
+
+	/* the most elements an array can have, its allocation has to fit in a heap header */
+	constexpr std::uint32_t max_array_length = (UINT32_MAX >> 3) - 8;
+
+	[[nodiscard]] inline bool is_array(const value_type tag) { return tag == value_type::integers || tag == value_type::floats; }
+	[[nodiscard]] inline std::uint32_t length(const array* target) { return target->function; }
+	[[nodiscard]] inline vm_register* integers(array* target) { return target->values(); }
+	[[nodiscard]] inline double* floats(array* target) { return reinterpret_cast<double*>(target->values()); }
+
+	/* integer kernels wrap on overflow like the rest of integer arithmetic, min and max need a count above zero */
+	[[nodiscard]] vm_register sum(const vm_register* values, size_t count);
+	[[nodiscard]] double sum(const double* values, size_t count);
+	[[nodiscard]] vm_register minimum(const vm_register* values, size_t count);
+	[[nodiscard]] double minimum(const double* values, size_t count);
+	[[nodiscard]] vm_register maximum(const vm_register* values, size_t count);
+	[[nodiscard]] double maximum(const double* values, size_t count);
+	[[nodiscard]] vm_register dot(const vm_register* lhs, const vm_register* rhs, size_t count);
+	[[nodiscard]] double dot(const double* lhs, const double* rhs, size_t count);
+
+	/**
+	 * out = lhs op rhs for add, sub, mul or div, where a side that is a
+	 * scalar points at its single value. Integer division returns false on
+	 * a zero divisor, leaving out partly written.
+	 */
+	bool elementwise(kernel op, const vm_register* lhs, bool lhs_scalar, const vm_register* rhs, bool rhs_scalar, vm_register* out, size_t count);
+	void elementwise(kernel op, const double* lhs, bool lhs_scalar, const double* rhs, bool rhs_scalar, double* out, size_t count);
+
+	/* how many elements are from low to high, then copies those to out, which has room for exactly that many */
+	[[nodiscard]] size_t count_between(const vm_register* values, size_t count, vm_register low, vm_register high);
+	[[nodiscard]] size_t count_between(const double* values, size_t count, double low, double high);
+	void copy_between(const vm_register* values, size_t count, vm_register low, vm_register high, vm_register* out, size_t kept);
+	void copy_between(const double* values, size_t count, double low, double high, double* out, size_t kept);
+
+	/* ascending, NaNs last */
+	void sort(vm_register* values, size_t count);
+	void sort(double* values, size_t count);
+}
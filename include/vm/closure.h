@@ -0,0 +1,65 @@
+/*
+ * File Name: closure.h
+ * Author(s): P. Kamara
+ *
+ * Function values.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+
+#include "instruction.h"
+
+namespace cherie::vm
+{
+	/**
+	 * A function together with copies of the variables it captured. The
+	 * upvalues and their tags sit in one flat array right behind the header,
+	 * so a closure is a single allocation and reading an upvalue is a single
+	 * indexed load. Functions that capture nothing share one closure each.
+	 */
+	struct closure
+	{
+		std::uint32_t function;
+		std::uint32_t size;
+
+		struct deleter
+		{
+			void operator()(closure* closure) const
+			{
+				::operator delete(closure);
+			}
+		};
+		using pointer = std::unique_ptr<closure, deleter>;
+
+		[[nodiscard]] static pointer create(const std::uint32_t function, const std::uint32_t size)
+		{
+			auto* memory = ::operator new(sizeof(closure) + size * (sizeof(vm_register) + sizeof(value_type)));
+			return pointer(new (memory) closure{ function, size });
+		}
+
+		[[nodiscard]] vm_register* values()
+		{
+			return reinterpret_cast<vm_register*>(this + 1);
+		}
+
+		[[nodiscard]] value_type* tags()
+		{
+			return reinterpret_cast<value_type*>(values() + size);
+		}
+
+		[[nodiscard]] const vm_register* values() const
+		{
+			return reinterpret_cast<const vm_register*>(this + 1);
+		}
+
+		[[nodiscard]] const value_type* tags() const
+		{
+			return reinterpret_cast<const value_type*>(values() + size);
+		}
+	};
+	static_assert(sizeof(closure) % alignof(vm_register) == 0);
+}
@@ -0,0 +1,25 @@
+/*
+ * File Name: function_info.h
+ * Author(s): P. Kamara
+ *
+ * Function table entries.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace cherie::vm
+{
+	struct function_info
+	{
+		static constexpr std::uint32_t deferred = UINT32_MAX; // entry of a function compiled on its first call
+
+		std::string name;
+		std::uint32_t entry = 0;      // pc of the first instruction
+		std::uint32_t parameters = 0; // arrive in R[0..parameters)
+		std::uint32_t frame_size = 0; // registers the function touches, including its callees' arguments
+		std::uint32_t upvalues = 0;   // values its closures capture
+	};
+}
@@ -0,0 +1,186 @@
+/*
+ * File Name: heap.h
+ * Author(s): P. Kamara
+ *
+ * Garbage collected heap.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "closure.h"
+#include "instruction.h"
+
+namespace cherie::vm
+{
+	/**
+	 * A generational heap for values that outlive the register they were
+	 * made in. New objects are bump allocated in a nursery; when it fills
+	 * up, a minor collection copies whatever the roots and the remembered
+	 * set still reach into the old space and empties the nursery in one
+	 * go, so temporaries cost nothing to free. The old space is a set of
+	 * separately allocated objects, collected by an incremental mark and
+	 * sweep once it has grown to twice what was live after the last cycle.
+	 * Objects too large for the nursery go straight to the old space; once
+	 * a nursery's worth of them has been allocated while the old space is
+	 * due for a major cycle, allocate() asks for a collection as it does
+	 * when the nursery is full, so the cycle still gets its slices.
+	 *
+	 * The owner drives a minor collection with begin_minor, trace() on
+	 * every root, then finish_minor. A major cycle is begin_marking and the
+	 * roots, then slices of mark() between which the script runs, the roots
+	 * again and finish_marking once mark() has nothing grey left, and
+	 * slices of sweep(). Closures never change after they are made, but
+	 * object fields do: a store passes the value to write_barrier, which
+	 * marks it while a cycle is marking, so a marked object never points at
+	 * one that is not. Otherwise an object can only lose a reference from a
+	 * root, and tracing the roots a second time at the end covers that;
+	 * objects made while marking start out marked.
+	 *
+	 * In region mode allocate() bump allocates from chunks that are added as
+	 * they fill up, and nothing is ever collected. release_region rewinds
+	 * them all at once, after the owner has traced whatever has to outlive
+	 * the region between begin_release and it; those objects are copied to
+	 * the old space first.
+	 *
+	 * Old objects that are written a nursery reference have to be passed to
+	 * write_barrier. Values are only traced when their tag says function,
+	 * object, map or array, and those tags are exact (see value_type), but
+	 * registers above the running frame keep what the last call left in
+	 * them, so a candidate is still looked up in the heap before it is
+	 * followed. Such a register is dead, rewriting it does no harm.
+	 */
+	class heap
+	{
+	public:
+		enum class phase
+		{
+			idle,
+			marking,
+			sweeping,
+		};
+
+	private:
+		struct header
+		{
+			std::uint32_t bytes; // the whole allocation, this header included
+			std::uint32_t flags;
+		};
+		static_assert(sizeof(header) % alignof(vm_register) == 0);
+
+		enum flag : std::uint32_t
+		{
+			marked = 1,
+			remembered = 2,
+			forwarded = 4, // a nursery object that was promoted, the closure holds its new address
+		};
+
+		std::unique_ptr<std::uint64_t[]> nursery_;
+		size_t nursery_size_;
+		size_t top_ = 0;
+		std::vector<std::uint64_t> starts_; // a bit per nursery word, set where a closure starts
+		std::unordered_set<closure*> old_;
+		size_t old_bytes_ = 0;
+		size_t large_bytes_ = 0; // allocated old since the last minor collection
+		size_t major_threshold_;
+		phase phase_ = phase::idle;
+		std::vector<closure*> remembered_; // old objects that may point into the nursery
+		std::vector<closure*> promoted_;   // promoted by the running minor collection, their upvalues not traced yet
+		std::vector<closure*> grey_;       // marked, their upvalues not traced yet
+		std::vector<closure*> sweep_;      // the old space as marking finished
+		size_t swept_ = 0;
+		bool minor_ = false;
+
+		std::vector<std::unique_ptr<std::uint64_t[]>> chunks_; // the region, kept for the next one once released
+		std::vector<size_t> chunk_sizes_;
+		size_t chunk_ = 0;        // the chunk being allocated from
+		size_t chunk_top_ = 0;
+		size_t region_bytes_ = 0; // allocated since the region began
+		bool region_ = false;
+		bool releasing_ = false;
+
+		size_t minor_collections_ = 0;
+		size_t major_collections_ = 0;
+		size_t promoted_bytes_ = 0;
+		size_t promoted_before_ = 0;
+
+		[[nodiscard]] static header* header_of(closure* object) { return reinterpret_cast<header*>(object) - 1; }
+		[[nodiscard]] bool in_nursery(const closure* object) const;
+		[[nodiscard]] bool starts_object(const closure* object) const;
+		[[nodiscard]] bool in_region(const closure* object) const;
+		closure* place(std::uint32_t function, std::uint32_t size, size_t bytes);
+		closure* allocate_region(size_t bytes);
+		closure* allocate_old(size_t bytes);
+		closure* promote(closure* object);
+		void mark_object(closure* object);
+		void free_old(closure* object);
+	public:
+		struct statistics
+		{
+			size_t minor_collections = 0;
+			size_t major_collections = 0;
+			size_t promoted_bytes = 0;
+			size_t nursery_bytes = 0;
+			size_t old_bytes = 0;
+			size_t region_bytes = 0;
+		};
+
+		static constexpr size_t default_nursery_size = 256 << 10;
+		static constexpr size_t minimum_major_threshold = 1 << 20;
+
+		explicit heap(size_t nursery_size = default_nursery_size);
+		~heap();
+		heap(const heap&) = delete;
+		heap& operator=(const heap&) = delete;
+
+		/* bytes a closure with size upvalues takes up, header included */
+		[[nodiscard]] static size_t allocation_size(std::uint32_t size);
+
+		/* a closure with room for size upvalues, null when the heap has to be collected first */
+		[[nodiscard]] closure* allocate(std::uint32_t function, std::uint32_t size);
+
+		/* likewise, a closure without upvalues followed by bytes the collector moves but never reads */
+		[[nodiscard]] closure* allocate_data(std::uint32_t function, size_t bytes);
+
+		/* call after storing a value in an object that may already be old */
+		void write_barrier(closure* object);
+
+		/* likewise, for a field store into an object that marking may already have traced */
+		void write_barrier(closure* object, vm_register value, value_type tag);
+
+		[[nodiscard]] bool needs_major() const { return old_bytes_ > major_threshold_; }
+
+		/* the script allocates faster than the cycle gets through the old space, the rest of it should not wait */
+		[[nodiscard]] bool behind() const { return old_bytes_ > major_threshold_ * 2; }
+
+		[[nodiscard]] phase cycle() const { return phase_; }
+
+		void begin_minor();
+		size_t finish_minor(); // bytes freed
+
+		void begin_marking();
+		[[nodiscard]] bool mark(std::chrono::steady_clock::time_point deadline); // true once nothing grey is left
+		void finish_marking(); // after the roots have been traced again
+		size_t sweep(std::chrono::steady_clock::time_point deadline); // bytes freed, idle again once everything is swept
+
+		void trace(vm_register& value, value_type tag);
+		void trace(closure*& object);
+
+		/* allocate from a region from now on, or from the nursery again once it has been released */
+		void begin_region() { region_ = true; }
+		[[nodiscard]] bool in_region_mode() const { return region_; }
+
+		void begin_release();
+		size_t release_region(); // bytes freed
+
+		/* frees every object */
+		void clear();
+
+		[[nodiscard]] statistics stats() const { return { minor_collections_, major_collections_, promoted_bytes_, top_, old_bytes_, region_bytes_ }; }
+	};
+}
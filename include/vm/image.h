@@ -0,0 +1,130 @@
+/*
+ * File Name: image.h
+ * Author(s): P. Kamara
+ *
+ * Bytecode image files.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "function_info.h"
+#include "instruction.h"
+#include "line_table.h"
+#include "shape.h"
+
+namespace cherie::vm
+{
+	/**
+	 * An image is a header followed by sections at 8-byte aligned offsets:
+	 *
+	 * program     the instructions, exactly as the VM executes them
+	 * constants   the constant pool, one vm_register each
+	 * functions   one image_function per function table entry
+	 * globals     one string table offset per global
+	 * strings     NUL-terminated names, referred to by offset
+	 * lines       the encoded line table
+	 * fields      one string table offset per object field
+	 * shapes      each shape's size followed by its field ids
+	 * sites       the field id of each field access site
+	 *
+	 * Numbers are stored in the byte order of the machine that wrote the
+	 * image, and a reader only accepts its own order, so the program and the
+	 * constant pool can be executed straight from a read-only mapping. Every
+	 * process running the same image shares those pages. Only the function
+	 * table, the global names, the line table and the object layout are
+	 * copied out.
+	 */
+	struct image_header
+	{
+		static constexpr char signature[8] = { 'C', 'H', 'E', 'R', 'I', 'E', 'B', 'C' };
+		static constexpr std::uint32_t current_version = 2;
+		static constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t byte_order;
+		std::uint32_t opcode_count; // images of another instruction set are refused
+		std::uint32_t function_count;
+		std::uint32_t global_count;
+		std::uint32_t line_entries;
+		std::uint32_t field_count;
+		std::uint32_t shape_count;
+		std::uint32_t shapes_size; // in ids, sizes included
+		std::uint32_t site_count;
+		std::uint64_t program_offset;
+		std::uint64_t program_size; // in instructions
+		std::uint64_t constants_offset;
+		std::uint64_t constants_size; // in values
+		std::uint64_t functions_offset;
+		std::uint64_t globals_offset;
+		std::uint64_t strings_offset;
+		std::uint64_t strings_size; // in bytes
+		std::uint64_t lines_offset;
+		std::uint64_t lines_size; // in bytes
+		std::uint64_t fields_offset;
+		std::uint64_t shapes_offset;
+		std::uint64_t sites_offset;
+		std::uint64_t file_size;
+	};
+	static_assert(sizeof(image_header) % 8 == 0);
+
+	struct image_function
+	{
+		std::uint32_t name; // offset into the string table
+		std::uint32_t entry;
+		std::uint32_t parameters;
+		std::uint32_t frame_size;
+		std::uint32_t upvalues;
+	};
+
+	/**
+	 * A validated, read-only image, mapped from a file or held in memory.
+	 * Files are opened read-only and mapped shared, so the page cache backs
+	 * every process that maps the same image. Validation reads every
+	 * instruction: its registers have to lie in its function's frame, its
+	 * jumps in its function, and every index it holds in the table it
+	 * indexes, so a damaged image is refused instead of executed.
+	 */
+	class image
+	{
+		const std::uint8_t* data_ = nullptr;
+		size_t size_ = 0;
+		void* file_ = nullptr;    // platform handles of a mapped image
+		void* mapping_ = nullptr;
+		std::vector<std::uint8_t> owned_; // bytes of an image read into memory
+
+		/* compiled functions address their registers with an 8-bit operand */
+		static constexpr std::uint32_t max_frame_size = 256;
+
+		image() = default;
+		void validate() const;
+		void validate_program(const std::vector<std::uint32_t>& shape_sizes) const;
+		[[nodiscard]] const char* string(std::uint32_t offset) const;
+	public:
+		~image();
+		image(const image&) = delete;
+		image& operator=(const image&) = delete;
+
+		/* maps an image file */
+		[[nodiscard]] static std::shared_ptr<const image> map(const std::string& path);
+		/* takes an image that is already in memory */
+		[[nodiscard]] static std::shared_ptr<const image> from_bytes(std::vector<std::uint8_t> bytes);
+
+		static void write(std::ostream& out, const std::vector<i64>& program, const std::vector<vm_register>& constants, const std::vector<function_info>& functions, const std::vector<std::string>& globals, const line_table& lines, const object_layout& layout);
+
+		[[nodiscard]] const image_header& header() const { return *reinterpret_cast<const image_header*>(data_); }
+		[[nodiscard]] const i64* program() const { return reinterpret_cast<const i64*>(data_ + header().program_offset); }
+		[[nodiscard]] const vm_register* constants() const { return reinterpret_cast<const vm_register*>(data_ + header().constants_offset); }
+
+		[[nodiscard]] std::vector<function_info> functions() const;
+		[[nodiscard]] std::vector<std::string> globals() const;
+		[[nodiscard]] line_table lines() const;
+		[[nodiscard]] object_layout layout() const;
+	};
+}
@@ -29,12 +29,106 @@ namespace cherie::vm
 		pushi, // S ++ Ia            push immeidate value onto stack
 		pop,   // R[Ic] = ( S -- )   pop value off stack into register
 		load,  // R[Ic] = Ia
-		addrs, // add immediate value into 
+		loadk, // R[Ic] = K[Ia]       load from the constant pool
+		move,  // R[Ic] = R[Ibs]
+		addrs, // R[Ic] = R[Ibs] + Ia
+		mulrs, // R[Ic] = R[Ibs] * Ia
+		divrs, // R[Ic] = R[Ibs] / Ia, Ia != 0
 		adds,  // S ++ ( (S --) + S )
-		addr, // 
+		subs,  // S ++ ( (S --) - S )
+		muls,  // S ++ ( (S --) * S )
+		divs,  // S ++ ( (S --) / S )
+		addr,  // R[Ic] = R[Ibs] + R[Ia]
+		subr,  // R[Ic] = R[Ibs] - R[Ia]
+		mulr,  // R[Ic] = R[Ibs] * R[Ia]
+		divr,  // R[Ic] = R[Ibs] / R[Ia]
+		neg,   // R[Ic] = -R[Ibs]
+		lnot,  // R[Ic] = R[Ibs] == 0
+		/* floating point, registers hold the bits of a double */
+		addf,  // R[Ic] = R[Ibs] + R[Ia]
+		subf,  // R[Ic] = R[Ibs] - R[Ia]
+		mulf,  // R[Ic] = R[Ibs] * R[Ia]
+		divf,  // R[Ic] = R[Ibs] / R[Ia]
+		negf,  // R[Ic] = -R[Ibs]
+		lnotf, // R[Ic] = R[Ibs] == 0.0
+		itof,  // R[Ic] = double(R[Ibs])
+		/* generic, dispatch on the tags in T[] for values whose type is not known statically */
+		tag,   // T[Ic] = Ia
+		movev, // R[Ic] = R[Ibs], T[Ic] = T[Ibs]
+		addv,  // R[Ic] = R[Ibs] + R[Ia]
+		subv,  // R[Ic] = R[Ibs] - R[Ia]
+		mulv,  // R[Ic] = R[Ibs] * R[Ia]
+		divv,  // R[Ic] = R[Ibs] / R[Ia]
+		negv,  // R[Ic] = -R[Ibs]
+		lnotv, // R[Ic] = !R[Ibs]
+		/* globals live in a flat array, indices are resolved by the compiler */
+		getg,  // R[Ic] = G[Ia], T[Ic] = GT[Ia]
+		setg,  // G[Ia] = R[Ibs], GT[Ia] = T[Ibs]
+		/* closures copy what they capture into a flat upvalue array U */
+		closure, // R[Ic] = closure of F[Ia] over R[Ibs..Ibs+upvalues)
+		getu,    // R[Ic] = U[Ia], T[Ic] = UT[Ia] of the running closure
+		self,    // R[Ic] = the running closure
+		/* objects have a fixed shape, each field access site Ia has its own cache of where the field is */
+		object,  // R[Ic] = object of shape Ia over R[Ibs..Ibs+fields)
+		getf,    // R[Ic] = R[Ibs].field of site Ia, tag included
+		setf,    // R[Ic].field of site Ia = R[Ibs], tag included
+		/* maps are hash tables keyed by numbers and booleans, positions number their keys in insertion order */
+		map,     // R[Ic] = a new empty map
+		getk,    // R[Ic] = R[Ibs][R[Ia]], tag included
+		hask,    // R[Ic] = whether R[Ibs] has the key R[Ia]
+		nextk,   // R[Ic] = the position in R[Ibs] after R[Ia], -1 past the last
+		keyk,    // R[Ic] = the key at position R[Ia] of R[Ibs]
+		setk,    // R[Ic][R[Ibs]] = R[Ia], tag included
+		/* arrays of integers or doubles, getk and setk index them too */
+		array,   // R[Ic] = array of R[Ibs..Ibs+Ia), of doubles if any of them is one
+		vec,     // R[Ic] = kernel Ia over R[Ibs..), see array.h
+		jmp,   // pc = Ia
+		jz,    // if R[Ibs] == 0: pc = Ia
+		jnz,   // if R[Ibs] != 0: pc = Ia
+		/* calls, R[Ic] onwards becomes the callee's register window */
+		call,     // call F[Ia] with its arguments in R[Ic..], Ibs results come back in R[Ic..]
+		ret,      // return R[Ic..Ic+Ibs) to the caller
+		tailcall, // call F[Ia] with its arguments in R[Ic..], reusing this frame
+		callv,     // like call, for the closure in R[Ic+Ia] with Ia arguments
+		tailcallv, // like tailcall, for the closure in R[Ic+Ia] with Ia arguments
 		halt, // stops VM
+		count, // number of opcodes, not an instruction
 	};
 
+	/**
+	 * Runtime type tag. Whether a number is an integer, a double or a
+	 * boolean is only kept up to date for registers used by generic opcodes,
+	 * but the heap tags are exact: whatever writes a reference tags it, and
+	 * typed opcodes, which only ever write numbers, clear a heap tag left on
+	 * their destination, so the collector never takes a number for a
+	 * reference.
+	 */
+	enum class value_type : std::uint8_t
+	{
+		integer,
+		floating,
+		boolean,
+		function, // the register holds a closure*
+		object,   // the register holds an object*, see shape.h
+		map,      // the register holds a map*, see map.h
+		integers, // the register holds an array* of integers, see array.h
+		floats,   // the register holds an array* of doubles
+	};
+
+	/* the tag of a register a typed opcode has written a number into */
+	constexpr value_type untagged(const value_type tag)
+	{
+		return tag > value_type::boolean ? value_type::integer : tag;
+	}
+
+	/* typed opcodes that write a number into R[Ic] */
+	constexpr bool writes_number(const opcode op)
+	{
+		return op == opcode::pop || (op >= opcode::load && op <= opcode::divrs) || (op >= opcode::addr && op <= opcode::itof);
+	}
+
+	using vm_register = signed long long;
+
 	enum class addressing_mode
 	{
 		imm,
@@ -113,10 +207,14 @@ namespace cherie::vm
 			uint64_t raw = 0;
 		};
 
-		explicit i64() = default;
+		constexpr explicit i64()
+			: raw(0) {}
 		
 		explicit i64(const opcode op)
-			: op(op) {}
+			: raw(0)
+		{
+			this->op = op;
+		}
 
 		explicit i64(const opcode op, const int56_t al)
 			: op(op), al(al) {}
@@ -126,6 +224,23 @@ namespace cherie::vm
 
 		explicit i64(const opcode op, const int32_t a, const int16_t bs, const int8_t c = 0)
 			: op(op), a(a), bs(bs), c(c) {}
+
+		constexpr explicit i64(const std::uint64_t raw)
+			: raw(raw) {}
+
+		/* the layout of i64(op, a, bs, c) on a little-endian machine, usable in constant expressions */
+		[[nodiscard]] static constexpr i64 encode(const opcode op, const std::int32_t a = 0, const std::int16_t bs = 0, const std::int8_t c = 0)
+		{
+			return i64(static_cast<std::uint64_t>(op)
+				| static_cast<std::uint64_t>(static_cast<std::uint32_t>(a)) << 8
+				| static_cast<std::uint64_t>(static_cast<std::uint16_t>(bs)) << 40
+				| static_cast<std::uint64_t>(static_cast<std::uint8_t>(c)) << 56);
+		}
+
+		/* register operands are unsigned, immediates in `a` are signed */
+		[[nodiscard]] std::uint8_t rc() const { return static_cast<std::uint8_t>(c); }
+		[[nodiscard]] std::uint16_t rbs() const { return static_cast<std::uint16_t>(bs); }
+		[[nodiscard]] std::int32_t sa() const { return static_cast<std::int32_t>(a); }
 	};
 	static_assert(sizeof(i64) == 8);
 }
@@ -0,0 +1,52 @@
+/*
+ * File Name: line_table.h
+ * Author(s): P. Kamara
+ *
+ * Compact pc -> source position table.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cherie::vm
+{
+	struct source_position
+	{
+		std::size_t line = 0;
+		std::size_t column = 0;
+	};
+
+	/**
+	 * Entries are only recorded when the position changes, and each one is
+	 * stored as three LEB128 varints relative to the previous entry:
+	 *
+	 * pc delta, zig-zagged line delta, column
+	 *
+	 * so a typical entry costs three bytes.
+	 */
+	class line_table
+	{
+		std::vector<std::uint8_t> data_;
+		std::size_t last_pc_ = 0;
+		source_position last_position_ = {};
+		std::size_t entries_ = 0;
+	public:
+		void add(std::size_t pc, source_position position);
+		void clear();
+
+		/* takes an encoded table as written out, for reading only, nothing can be added after it */
+		void assign(const std::uint8_t* data, std::size_t size, std::size_t entries);
+
+		/* position of the instruction at pc, or {0, 0} if unknown */
+		[[nodiscard]] source_position find(std::size_t pc) const;
+
+		/* position of every pc below count in one pass, for rewriting the table */
+		[[nodiscard]] std::vector<source_position> expand(std::size_t count) const;
+
+		[[nodiscard]] std::size_t entries() const { return entries_; }
+		[[nodiscard]] const std::vector<std::uint8_t>& data() const { return data_; }
+	};
+}
@@ -0,0 +1,92 @@
+/*
+ * File Name: map.h
+ * Author(s): P. Kamara
+ *
+ * Hash maps.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "closure.h"
+
+namespace cherie::vm
+{
+	/**
+	 * A map is a closure with a single slot, which holds its table once
+	 * something has been stored, and the number of entries where a closure
+	 * keeps its function. Growing swaps the table for a larger one, so the
+	 * map itself never moves for it.
+	 *
+	 * Tables are open addressing hash tables after Abseil's SwissTable and
+	 * closures too: the first slots pack a control byte per entry, eight to
+	 * a slot, the next ones the entries in the order their keys were
+	 * inserted, two to a slot, and each entry's key and value follow with
+	 * their tags. A
+	 * control byte is either empty or seven bits of the key's hash, and a
+	 * lookup checks them sixteen at a time, with SSE2 where the target has
+	 * it, only comparing the keys whose byte matched. Entries are never
+	 * removed, so there are no tombstones, and a table grows to twice its
+	 * size once it is seven eighths full.
+	 *
+	 * Positions number the keys in the order they were inserted, and
+	 * growing keeps that order, so a walk sees every key once, keys stored
+	 * while it runs included.
+	 *
+	 * Keys are numbers and booleans, compared by their tag and bits. Heap
+	 * values are refused, the collector moves them and their address is no
+	 * use as a hash. A floating point key that holds an integer is stored
+	 * as that integer, so 2 and 4 / 2.0 find the same entry.
+	 */
+	using map = closure;
+
+	class map_table
+	{
+		closure* table_;
+
+		[[nodiscard]] std::uint8_t* control() const { return reinterpret_cast<std::uint8_t*>(table_->values()); }
+		[[nodiscard]] std::uint32_t* order() const { return reinterpret_cast<std::uint32_t*>(table_->values() + capacity() / 8); }
+		[[nodiscard]] std::uint32_t slot(const std::uint32_t entry) const { return capacity() / 8 + capacity() / 2 + entry * 2; }
+	public:
+		static constexpr std::uint32_t group_size = 16;
+		static constexpr std::uint32_t minimum_capacity = group_size;
+		static constexpr std::uint32_t not_found = UINT32_MAX;
+
+		explicit map_table(closure* table)
+			: table_(table) {}
+
+		/* upvalues a table with room for capacity entries takes, allocate it with capacity as its function */
+		[[nodiscard]] static std::uint32_t size_for(const std::uint32_t capacity) { return capacity / 8 + capacity / 2 + capacity * 2; }
+
+		/* entries it takes before it has to grow */
+		[[nodiscard]] static std::uint32_t limit(const std::uint32_t capacity) { return capacity - capacity / 8; }
+
+		[[nodiscard]] closure* get() const { return table_; }
+		[[nodiscard]] std::uint32_t capacity() const { return table_->function; }
+
+		/* empties a table fresh from the heap */
+		void clear();
+
+		/* the entry holding the key, not_found if there is none */
+		[[nodiscard]] std::uint32_t find(vm_register key, value_type tag) const;
+
+		/* claims an entry for a key the table does not hold yet and has room for, the position-th key inserted */
+		std::uint32_t insert(vm_register key, value_type tag, std::uint32_t position);
+
+		/* the entry of the key inserted at position */
+		[[nodiscard]] std::uint32_t at(const std::uint32_t position) const { return order()[position]; }
+
+		[[nodiscard]] vm_register& key(const std::uint32_t entry) const { return table_->values()[slot(entry)]; }
+		[[nodiscard]] value_type& key_tag(const std::uint32_t entry) const { return table_->tags()[slot(entry)]; }
+		[[nodiscard]] vm_register& value(const std::uint32_t entry) const { return table_->values()[slot(entry) + 1]; }
+		[[nodiscard]] value_type& value_tag(const std::uint32_t entry) const { return table_->tags()[slot(entry) + 1]; }
+	};
+
+	/* brings a value into the form keys are stored in, false if it cannot be a key */
+	[[nodiscard]] bool normalise_key(vm_register& key, value_type& tag);
+
+	/* a key as error messages show it */
+	[[nodiscard]] std::string describe_key(vm_register key, value_type tag);
+}
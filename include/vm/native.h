@@ -0,0 +1,198 @@
+/*
+ * File Name: native.h
+ * Author(s): P. Kamara
+ *
+ * Programs translated to C++ ahead of time.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "arithmetic.h"
+#include "closure.h"
+#include "exceptions.h"
+#include "virtual_machine.h"
+
+namespace cherie::vm
+{
+	/* a function written out by compiler::write_native, leaves its results in r[0..) and returns how many */
+	using native_function = std::uint32_t(*)(virtual_machine& vm, vm_register* r, value_type* t);
+
+	struct native_function_entry
+	{
+		const char* name;
+		std::uint32_t parameters;
+		std::uint32_t frame_size;
+		std::uint32_t upvalues;
+		native_function code;
+	};
+
+	/* what a translated program exports, see state_raw::load */
+	struct native_program
+	{
+		const native_function_entry* functions; // [0] is the main chunk
+		size_t function_count;
+		const char* const* globals;
+		size_t global_count;
+		const std::uint8_t* lines; // the encoded line table of the bytecode it was translated from
+		size_t lines_size;
+		size_t line_entries;
+		const char* const* fields; // the object_layout, shapes flattened as their size followed by their field ids
+		size_t field_count;
+		const std::uint32_t* shapes;
+		size_t shapes_size;
+		const std::uint32_t* sites;
+		size_t site_count;
+	};
+
+	/**
+	 * What translated code calls back into. Native functions work on the
+	 * same value stack, tags, globals and closures as the interpreter, and
+	 * anything that can fail goes through the interpreter's own helpers.
+	 * Before such an instruction the code records its bytecode pc with at(),
+	 * so errors name the same line they would when interpreted. The running
+	 * closure stays in the virtual machine rather than a C++ local, where
+	 * the collector can find it and move it.
+	 */
+	struct native_runtime
+	{
+		static void at(virtual_machine& vm, vm_register* r, value_type* t, const std::uint32_t pc)
+		{
+			vm.registers.pc = pc + 1;
+			vm.registers.gpr = r;
+			vm.registers.tags = t;
+		}
+
+		[[nodiscard]] static vm_register* globals(virtual_machine& vm) { return vm.globals_.data(); }
+		[[nodiscard]] static value_type* global_tags(virtual_machine& vm) { return vm.global_tags_.data(); }
+
+		[[nodiscard]] static vm_register divide(const virtual_machine& vm, const vm_register a, const vm_register b)
+		{
+			return vm.divide(a, b);
+		}
+
+		/* addv, subv, mulv and divv, on the registers at() set */
+		static void generic_arithmetic(virtual_machine& vm, const std::uint64_t instruction)
+		{
+			vm.generic_arithmetic(i64(instruction));
+		}
+
+		/* negv and lnotv, likewise */
+		static void generic_unary(virtual_machine& vm, const std::uint64_t instruction)
+		{
+			vm.generic_unary(i64(instruction));
+		}
+
+		[[nodiscard]] static closure* make_closure(virtual_machine& vm, const std::uint32_t function, const vm_register* values, const value_type* tags)
+		{
+			return vm.make_closure(function, values, tags);
+		}
+
+		[[nodiscard]] static object* make_object(virtual_machine& vm, const std::uint32_t shape, const vm_register* values, const value_type* tags)
+		{
+			return vm.make_object(shape, values, tags);
+		}
+
+		/* getf and setf on the registers at() set, through the same caches as the interpreter */
+		static void get_field(virtual_machine& vm, const std::uint64_t instruction)
+		{
+			vm.get_field(i64(instruction));
+		}
+
+		static void set_field(virtual_machine& vm, const std::uint64_t instruction)
+		{
+			vm.set_field(i64(instruction));
+		}
+
+		[[nodiscard]] static map* make_map(virtual_machine& vm)
+		{
+			return vm.make_map();
+		}
+
+		/* getk, hask, nextk, keyk and setk on the registers at() set */
+		static void map_access(virtual_machine& vm, const std::uint64_t instruction)
+		{
+			const i64 decoded(instruction);
+			switch (decoded.op)
+			{
+				case opcode::getk: vm.get_key(decoded); break;
+				case opcode::hask: vm.has_key(decoded); break;
+				case opcode::nextk: vm.next_key(decoded); break;
+				case opcode::keyk: vm.key_at(decoded); break;
+				default: vm.set_key(decoded); break;
+			}
+		}
+
+		/* array and vec on the registers at() set */
+		static void array_literal(virtual_machine& vm, const std::uint64_t instruction)
+		{
+			vm.array_literal(i64(instruction));
+		}
+
+		static void run_kernel(virtual_machine& vm, const std::uint64_t instruction)
+		{
+			vm.run_kernel(i64(instruction));
+		}
+
+		/* the closure a callv or tailcallv calls, after at() */
+		[[nodiscard]] static closure* callee(const virtual_machine& vm, const std::uint64_t instruction)
+		{
+			return vm.callee(i64(instruction));
+		}
+
+		[[nodiscard]] static native_function code(const virtual_machine& vm, const std::uint32_t function)
+		{
+			return vm.native_->functions[function].code;
+		}
+
+		/* the closure the running function was called through, null for direct calls */
+		[[nodiscard]] static closure* environment(const virtual_machine& vm) { return vm.environment_; }
+
+		/* the checks and bookkeeping of the interpreter's calls, after at() */
+		static void enter(virtual_machine& vm, const std::uint32_t function, vm_register* r, closure* environment)
+		{
+			if (vm.depth_ == vm.frames_.size())
+			{
+				runtime_error("call stack overflow on line %d", static_cast<int>(vm.lines.find(vm.registers.pc - 1).line));
+			}
+			vm.frames_[vm.depth_++] = { vm.registers.pc, vm.base_, 0, vm.environment_ };
+			vm.enter(static_cast<size_t>(r - vm.values_.data()), vm.functions[function]);
+			vm.environment_ = environment;
+		}
+
+		static void leave(virtual_machine& vm)
+		{
+			const auto& frame = vm.frames_[--vm.depth_];
+			vm.base_ = frame.base;
+			vm.environment_ = frame.environment;
+		}
+
+		/* a tail call back into the running function */
+		static void restart(virtual_machine& vm, closure* environment)
+		{
+			vm.environment_ = environment;
+		}
+
+		/* a caller reading more results than came back sees integer zeroes */
+		static void results(vm_register* r, value_type* t, const std::uint32_t returned, const std::uint32_t wanted)
+		{
+			for (auto index = returned; index < wanted; index++)
+			{
+				r[index] = 0;
+				t[index] = value_type::integer;
+			}
+		}
+
+		/* ret, moving the results to the start of the window */
+		[[nodiscard]] static std::uint32_t ret(vm_register* r, value_type* t, const std::uint32_t first, const std::uint32_t count)
+		{
+			for (std::uint32_t index = 0; index < count; index++)
+			{
+				r[index] = r[first + index];
+				t[index] = t[first + index];
+			}
+			return count;
+		}
+	};
+}
@@ -0,0 +1,62 @@
+/*
+ * File Name: perf_map.h
+ * Author(s): P. Kamara
+ *
+ * Linux perf symbol map (/tmp/perf-<pid>.map) and interpreter trampolines.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cherie::vm
+{
+	class virtual_machine;
+	using trampoline = void(*)(virtual_machine*);
+
+	/**
+	 * perf only symbolises addresses it finds in native code, so every script
+	 * function is given a tiny trampoline that sets up a frame and calls
+	 * into the interpreter. The trampoline's address range is written to the
+	 * perf map under the function's name and first line, and while the map
+	 * is enabled the interpreter enters each call through its callee's
+	 * trampoline, so samples taken inside virtual_machine::execute unwind
+	 * through one named Cherie frame per script call.
+	 *
+	 * Trampolines have no unwind tables, the target must not let exceptions
+	 * escape through them.
+	 */
+	class perf_map
+	{
+		std::mutex mutex_;
+		std::FILE* file_ = nullptr;
+		trampoline target_ = nullptr;
+
+		std::byte* arena_ = nullptr;
+		size_t arena_used_ = 0;
+		size_t arena_size_ = 0;
+		
+		std::unordered_map<std::string, trampoline> trampolines_;
+
+		bool allocate_arena();
+		
+		perf_map() = default;
+	public:
+		~perf_map();
+		perf_map(const perf_map&) = delete;
+		perf_map& operator=(const perf_map&) = delete;
+
+		static perf_map& get();
+
+		/* opens the map file; returns false if unsupported on this platform */
+		bool enable(trampoline target);
+		[[nodiscard]] bool enabled() const { return target_ != nullptr; }
+
+		/* returns (and registers on first use) the trampoline for symbol */
+		trampoline trampoline_for(const std::string& symbol);
+	};
+}
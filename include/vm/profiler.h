@@ -0,0 +1,51 @@
+/*
+ * File Name: profiler.h
+ * Author(s): P. Kamara
+ *
+ * Sampling profiler.
+ */
+
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "conf.h"
+#include "function_info.h"
+#include "line_table.h"
+
+namespace cherie::vm
+{
+	/**
+	 * Driven by an instruction countdown in the interpreter loop: every
+	 * `interval` retired instructions the pc of every frame is recorded, the
+	 * call each caller is in followed by the current pc. Samples are
+	 * aggregated by stack and only resolved to functions and source lines on
+	 * export.
+	 *
+	 * Compiled out entirely unless CHERIE_PROFILER is defined (see conf.h).
+	 */
+	class profiler
+	{
+		std::map<std::vector<size_t>, size_t> samples_;
+		size_t interval_ = 0;
+	public:
+		static constexpr size_t default_interval = 1000;
+		
+		void start(size_t interval = default_interval);
+		void stop();
+		void clear();
+
+		[[nodiscard]] bool running() const { return interval_ != 0; }
+		[[nodiscard]] size_t interval() const { return interval_; }
+		[[nodiscard]] size_t sample_count() const;
+
+		/* the outermost frame first */
+		void sample(const std::vector<size_t>& stack);
+
+		/* writes "function:line;function:line;... count" lines, as consumed by flamegraph.pl */
+		void write_folded(std::ostream& out, const std::vector<function_info>& functions, const line_table& lines) const;
+	};
+}
@@ -0,0 +1,72 @@
+/*
+ * File Name: shape.h
+ * Author(s): P. Kamara
+ *
+ * Object shapes and field caches.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "closure.h"
+
+namespace cherie::vm
+{
+	/**
+	 * Objects are laid out like closures, with the shape id where a closure
+	 * keeps its function: the field values and their tags sit in one flat
+	 * array behind the header, in the order the shape lists them. A shape is
+	 * the ordered list of field names an object literal spells out, and every
+	 * literal with the same names in the same order shares it, so a field is
+	 * at the same slot in all of their objects. Objects never change shape,
+	 * a field the shape lacks can be neither read nor written.
+	 */
+	using object = closure;
+
+	/* what the compiler tells the VM about objects, fields and shapes are numbered program-wide */
+	struct object_layout
+	{
+		std::vector<std::string> fields;                // names, by field id
+		std::vector<std::vector<std::uint32_t>> shapes; // field ids in slot order, by shape id
+		std::vector<std::uint32_t> sites;               // the field each getf and setf names, by site
+
+		/* shapes as images and translated programs store them, each one's size followed by its field ids */
+		[[nodiscard]] std::vector<std::uint32_t> flat_shapes() const
+		{
+			std::vector<std::uint32_t> flat;
+			for (const auto& shape : shapes)
+			{
+				flat.push_back(static_cast<std::uint32_t>(shape.size()));
+				flat.insert(flat.end(), shape.begin(), shape.end());
+			}
+			return flat;
+		}
+
+		void assign_shapes(const std::uint32_t* flat, const size_t size)
+		{
+			shapes.clear();
+			for (size_t index = 0; index < size; index += flat[index] + 1)
+			{
+				shapes.emplace_back(flat + index + 1, flat + index + 1 + flat[index]);
+			}
+		}
+	};
+
+	/**
+	 * The shapes a getf or setf site has seen and where they keep its field.
+	 * A monomorphic site only ever compares the first entry. Further shapes
+	 * fill the other entries; once those are taken as well the site is
+	 * megamorphic and shapes it has not cached are searched on every access.
+	 */
+	struct field_cache
+	{
+		static constexpr std::uint32_t ways = 4;
+		static constexpr std::uint32_t empty = UINT32_MAX; // never a shape id
+
+		std::uint32_t shapes[ways] = { empty, empty, empty, empty };
+		std::uint32_t slots[ways] = {};
+	};
+}
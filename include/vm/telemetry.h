@@ -0,0 +1,143 @@
+/*
+ * File Name: telemetry.h
+ * Author(s): P. Kamara
+ *
+ * VM execution counters.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "conf.h"
+#include "instruction.h"
+
+#ifdef CHERIE_TELEMETRY
+#define CHERIE_TELEMETRY_ONLY(...) __VA_ARGS__
+#else
+#define CHERIE_TELEMETRY_ONLY(...)
+#endif
+
+namespace cherie::vm
+{
+	constexpr auto opcode_count = static_cast<size_t>(opcode::count);
+
+	struct telemetry_snapshot
+	{
+		std::uint64_t runs = 0;
+		std::uint64_t run_time_ns = 0;
+		std::uint64_t instructions_retired = 0;
+		std::array<std::uint64_t, opcode_count> opcode_counts = {};
+		std::uint64_t max_stack_depth = 0; // values on the operand stack
+		std::uint64_t max_call_depth = 0;  // frames
+		std::uint64_t calls = 0;
+		std::uint64_t heap_allocations = 0;
+		std::uint64_t heap_bytes_allocated = 0;
+		std::uint64_t heap_bytes_live = 0;
+		std::uint64_t minor_collections = 0;
+		std::uint64_t major_collections = 0; // cycles started, each spread over several pauses
+		std::uint64_t gc_pauses = 0;
+		std::uint64_t gc_pause_ns = 0;
+		std::uint64_t gc_max_pause_ns = 0;
+	};
+
+	/**
+	 * Counters are only ever written by the thread executing the owning state,
+	 * so updates are plain relaxed load/store pairs (no locked instructions).
+	 * They are atomic purely so a monitoring thread can read a state while it
+	 * runs; a snapshot is not a consistent cut across counters.
+	 *
+	 * Everything here is compiled out unless CHERIE_TELEMETRY is defined.
+	 */
+	class telemetry
+	{
+		struct counter
+		{
+			std::atomic<std::uint64_t> value = 0;
+
+			void add(const std::uint64_t amount = 1)
+			{
+				value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+			}
+
+			void subtract(const std::uint64_t amount)
+			{
+				value.store(value.load(std::memory_order_relaxed) - amount, std::memory_order_relaxed);
+			}
+
+			void maximum(const std::uint64_t candidate)
+			{
+				if (candidate > value.load(std::memory_order_relaxed))
+				{
+					value.store(candidate, std::memory_order_relaxed);
+				}
+			}
+
+			[[nodiscard]] std::uint64_t get() const { return value.load(std::memory_order_relaxed); }
+		};
+
+		counter runs_;
+		counter run_time_ns_;
+		std::array<counter, opcode_count> opcodes_;
+		counter max_stack_depth_;
+		counter max_call_depth_;
+		counter calls_;
+		counter heap_allocations_;
+		counter heap_bytes_allocated_;
+		counter heap_bytes_live_;
+		counter minor_collections_;
+		counter major_collections_;
+		counter gc_pauses_;
+		counter gc_pause_ns_;
+		counter gc_max_pause_ns_;
+	public:
+		void retire(const opcode op) { opcodes_[static_cast<size_t>(op)].add(); }
+		void stack_depth(const size_t depth) { max_stack_depth_.maximum(depth); }
+		void call() { calls_.add(); }
+		void call(const size_t depth) { calls_.add(); max_call_depth_.maximum(depth); }
+		void run(const std::uint64_t nanoseconds) { runs_.add(); run_time_ns_.add(nanoseconds); }
+		
+		void allocation(const size_t bytes)
+		{
+			heap_allocations_.add();
+			heap_bytes_allocated_.add(bytes);
+			heap_bytes_live_.add(bytes);
+		}
+
+		void free(const size_t bytes) { heap_bytes_live_.subtract(bytes); }
+		void collection(const bool major) { (major ? major_collections_ : minor_collections_).add(); }
+
+		void pause(const std::uint64_t nanoseconds)
+		{
+			gc_pauses_.add();
+			gc_pause_ns_.add(nanoseconds);
+			gc_max_pause_ns_.maximum(nanoseconds);
+		}
+
+		[[nodiscard]] telemetry_snapshot snapshot() const
+		{
+			telemetry_snapshot result;
+			result.runs = runs_.get();
+			result.run_time_ns = run_time_ns_.get();
+			for (size_t op = 0; op < opcode_count; op++)
+			{
+				result.opcode_counts[op] = opcodes_[op].get();
+				result.instructions_retired += result.opcode_counts[op];
+			}
+			result.max_stack_depth = max_stack_depth_.get();
+			result.max_call_depth = max_call_depth_.get();
+			result.calls = calls_.get();
+			result.heap_allocations = heap_allocations_.get();
+			result.heap_bytes_allocated = heap_bytes_allocated_.get();
+			result.heap_bytes_live = heap_bytes_live_.get();
+			result.minor_collections = minor_collections_.get();
+			result.major_collections = major_collections_.get();
+			result.gc_pauses = gc_pauses_.get();
+			result.gc_pause_ns = gc_pause_ns_.get();
+			result.gc_max_pause_ns = gc_max_pause_ns_.get();
+			return result;
+		}
+	};
+}
@@ -6,27 +6,183 @@
  */
 
 #pragma once
+#include <chrono>
+#include <exception>
+#include <string>
 #include <vector>
 
+#include "array.h"
+#include "closure.h"
+#include "function_info.h"
+#include "heap.h"
 #include "instruction.h"
+#include "line_table.h"
+#include "map.h"
+#include "perf_map.h"
+#include "profiler.h"
+#include "shape.h"
+#include "telemetry.h"
 
 namespace cherie::vm
 {
-    using vm_register = signed long long;
+    struct native_program;
+
     struct register_table
     {
         vm_register pc;
-        vm_register gpr[9];
+        vm_register* gpr;  // window of the running function in the value stack
+        value_type* tags;
+    };
+
+    /* a value as a register holds it, the tag says how to read the bits */
+    struct tagged_value
+    {
+        vm_register value;
+        value_type tag;
+    };
+
+    struct call_frame
+    {
+        vm_register return_pc;
+        size_t base;
+        std::uint16_t results; // how many values the caller reads back
+        closure* environment;  // the caller's closure, if it runs in one
     };
 	
+	/**
+	 * Every function runs in a window of a single value stack that is
+	 * allocated once. A call places the arguments in the registers right
+	 * above the caller's own, and that is where the callee's window starts,
+	 * so arguments are never copied into a new frame and results come back
+	 * in the same registers. Tail calls move the arguments down to the
+	 * start of the current window and jump, keeping the frame.
+	 */
 	class virtual_machine
 	{
+        static constexpr size_t value_stack_size = 1 << 18;
+        static constexpr size_t max_call_depth = 1 << 16;
+        static constexpr size_t max_trampoline_depth = 256; // deeper calls stay in their caller's execute, the native stack is not that deep
+
         std::vector<vm_register> stack;
+        std::vector<vm_register> values_;
+        std::vector<value_type> tags_;
+        std::vector<call_frame> frames_;
+        std::vector<vm_register> globals_;
+        std::vector<value_type> global_tags_;
+        heap heap_;                             // every closure that captured something
+        std::vector<closure::pointer> statics_; // the shared closure of each function that captures nothing
+        closure* environment_ = nullptr;        // closure of the running function, null for direct calls
+        std::vector<field_cache> caches_;       // one per field access site
+        const i64* code_ = nullptr;             // the program being run, see bind()
+        const vm_register* pool_ = nullptr;
+        size_t depth_ = 0;
+        size_t base_ = 0;
+        size_t top_ = 0; // the highest register any frame has used since the run started, where the collector stops looking
         register_table registers = {};
-	//protected:
-        
+        std::vector<trampoline> trampolines_;   // per function, while perf symbols are written
+        bool perf_ = false;
+        size_t floor_ = 0;                      // frames below it belong to an execute further up the native stack
+        std::exception_ptr failure_;            // thrown under a trampoline, which cannot be unwound through
+#ifdef CHERIE_PROFILER
+        size_t profile_countdown_ = 0;
+        void take_sample();
+#endif
+
+        [[nodiscard]] vm_register divide(vm_register a, vm_register b) const;
+        void enter(size_t base, const function_info& function);
+        const function_info& resolve(std::uint32_t function);
+        void bind();
+        closure* make_closure(std::uint32_t function, const vm_register* values, const value_type* tags);
+        void collect();
+        void trace_roots();
+        void release_region();
+        closure* callee(const i64& instruction) const;
+        object* make_object(std::uint32_t shape, const vm_register* values, const value_type* tags);
+        object* receiver(std::uint16_t slot) const;
+        std::uint32_t find_field(std::uint32_t site, const object* target);
+        void get_field(const i64& instruction);
+        void set_field(const i64& instruction);
+        map* make_map();
+        map* container(std::uint16_t slot) const;
+        std::uint32_t find_key(const i64& instruction, map_table& table) const;
+        closure* grow(std::uint16_t slot);
+        void get_key(const i64& instruction);
+        void has_key(const i64& instruction);
+        void next_key(const i64& instruction);
+        void key_at(const i64& instruction);
+        void set_key(const i64& instruction);
+        array* make_array(vm_register length);
+        void array_literal(const i64& instruction);
+        std::uint32_t element_index(const array* target, std::uint16_t slot) const;
+        void get_element(const i64& instruction);
+        void set_element(const i64& instruction);
+        array* argument(kernel op, std::uint16_t slot) const;
+        void elementwise(kernel op, std::uint16_t first, std::uint16_t result);
+        void filter(std::uint16_t first, std::uint16_t result);
+        void run_kernel(const i64& instruction);
+
+        /* where the field of the site is in the target, a shape check and a load when the site has seen the shape first */
+        std::uint32_t field_slot(const std::uint32_t site, const object* target)
+        {
+            const auto& cache = caches_[site];
+            return cache.shapes[0] == target->function ? cache.slots[0] : find_field(site, target);
+        }
+        void check_arithmetic(value_type lhs, value_type rhs) const; // throws for anything but numbers and booleans
+        void generic_arithmetic(const i64& instruction);
+        void generic_unary(const i64& instruction);
+        void execute();
+        static void execute_trampoline(virtual_machine* vm);
+        trampoline trampoline_of(std::uint32_t function);
+        bool execute_through(std::uint32_t function);
+
+        friend struct native_runtime;
+	protected:
+#ifdef CHERIE_TELEMETRY
+        telemetry telemetry_;
+#endif
+
+        /* an image executed in place, run instead of program and constants when set */
+        const i64* mapped_program_ = nullptr;
+        const vm_register* mapped_constants_ = nullptr;
+
+        /* a program translated to C++ ahead of time, run instead of the interpreter when set */
+        const native_program* native_ = nullptr;
+
+        /* appends the code of a deferred function to the program and fills in its entry */
+        virtual void load_function(std::uint32_t function);
+
 	public:
+        virtual ~virtual_machine() = default;
+
         std::vector<i64> program;
+        std::vector<vm_register> constants;
+        std::vector<function_info> functions; // [0] is the main chunk
+        std::vector<std::string> globals;     // names, indexed like the global array
+        line_table lines;
+        object_layout layout;
+        std::string name = "main";
+
+        /* how long a collection may stop the script for, a major collection is spread over as many pauses as it needs */
+        std::chrono::microseconds gc_pause = std::chrono::microseconds(1000);
+
+        /**
+         * For scripts that run once and are thrown away: closures made by a
+         * run come from an arena that is rewound as a whole when it returns,
+         * so nothing is collected or freed one by one. What the globals
+         * still reach is moved to the heap first; closures left in other
+         * registers are gone.
+         */
+        bool region = false;
+#ifdef CHERIE_PROFILER
+        profiler sampler;
+#endif
+
+        /* a global as the last run left it, a runtime error if none has that name */
+        [[nodiscard]] tagged_value global(const std::string& name) const;
+
+        /* registers every script function with `perf` via /tmp/perf-<pid>.map, calls then enter them through their own native frame */
+        static bool enable_perf_map();
+		
         void run();
 	};
 }
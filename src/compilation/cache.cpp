@@ -0,0 +1,299 @@
+/*
+ * File Name: cache.cpp
+ * Author(s): P. Kamara
+ *
+ * On-disk cache of compiled images.
+ */
+
+#include "compilation/cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace cherie::compiler
+{
+	namespace
+	{
+		constexpr auto extension = ".chbc";
+		constexpr auto digest_extension = ".sum"; // murmur3 of the entry's bytes, written before the entry
+
+		std::uint64_t rotate(const std::uint64_t value, const int bits)
+		{
+			return value << bits | value >> (64 - bits);
+		}
+
+		std::uint64_t mix(std::uint64_t value)
+		{
+			value ^= value >> 33;
+			value *= 0xff51afd7ed558ccdull;
+			value ^= value >> 33;
+			value *= 0xc4ceb9fe1a85ec53ull;
+			value ^= value >> 33;
+			return value;
+		}
+
+		/* MurmurHash3 x64 128 (Austin Appleby, public domain) */
+		std::pair<std::uint64_t, std::uint64_t> murmur3(const std::uint8_t* data, const size_t size)
+		{
+			constexpr std::uint64_t c1 = 0x87c37b91114253d5ull;
+			constexpr std::uint64_t c2 = 0x4cf5ad432745937full;
+			std::uint64_t h1 = 0;
+			std::uint64_t h2 = 0;
+
+			const auto blocks = size / 16;
+			for (size_t block = 0; block < blocks; block++)
+			{
+				std::uint64_t k1;
+				std::uint64_t k2;
+				std::memcpy(&k1, data + block * 16, 8);
+				std::memcpy(&k2, data + block * 16 + 8, 8);
+
+				h1 ^= rotate(k1 * c1, 31) * c2;
+				h1 = (rotate(h1, 27) + h2) * 5 + 0x52dce729;
+				h2 ^= rotate(k2 * c2, 33) * c1;
+				h2 = (rotate(h2, 31) + h1) * 5 + 0x38495ab5;
+			}
+
+			const auto* tail = data + blocks * 16;
+			std::uint64_t k1 = 0;
+			std::uint64_t k2 = 0;
+			for (auto index = size % 16; index > 8; index--)
+			{
+				k2 ^= static_cast<std::uint64_t>(tail[index - 1]) << (index - 9) * 8;
+			}
+			for (auto index = std::min<size_t>(size % 16, 8); index > 0; index--)
+			{
+				k1 ^= static_cast<std::uint64_t>(tail[index - 1]) << (index - 1) * 8;
+			}
+			if (k2)
+			{
+				h2 ^= rotate(k2 * c2, 33) * c1;
+			}
+			if (k1)
+			{
+				h1 ^= rotate(k1 * c1, 31) * c2;
+			}
+
+			h1 ^= size;
+			h2 ^= size;
+			h1 += h2;
+			h2 += h1;
+			h1 = mix(h1);
+			h2 = mix(h2);
+			h1 += h2;
+			h2 += h1;
+			return { h1, h2 };
+		}
+
+		template <typename T>
+		void append(std::vector<std::uint8_t>& out, const T& value)
+		{
+			const auto* bytes = reinterpret_cast<const std::uint8_t*>(&value);
+			out.insert(out.end(), bytes, bytes + sizeof(T));
+		}
+
+		std::string digest(const std::uint8_t* data, const size_t size)
+		{
+			const auto [high, low] = murmur3(data, size);
+			std::string bytes(16, '\0');
+			std::memcpy(bytes.data(), &high, 8);
+			std::memcpy(bytes.data() + 8, &low, 8);
+			return bytes;
+		}
+
+		std::filesystem::path digest_path(std::filesystem::path entry)
+		{
+			return entry.replace_extension(digest_extension);
+		}
+
+		bool intact(const std::filesystem::path& entry, const vm::image& image)
+		{
+			std::ifstream in(digest_path(entry), std::ios::binary);
+			std::string stored(16, '\0');
+			if (!in.read(stored.data(), static_cast<std::streamsize>(stored.size())))
+			{
+				return false;
+			}
+			// the bytes that are executed, not a second read of the file
+			const auto* bytes = reinterpret_cast<const std::uint8_t*>(&image.header());
+			return stored == digest(bytes, image.header().file_size);
+		}
+	}
+
+	cache::cache(std::filesystem::path directory, const std::uintmax_t capacity)
+		: directory_(std::move(directory)), capacity_(capacity)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(directory_, error); // without it every load compiles
+	}
+
+	std::string cache::key(const types::string& source, const options& options)
+	{
+		// everything that changes the image, a new option has to be added here
+		std::vector<std::uint8_t> material;
+		append(material, version);
+		append(material, vm::image_header::current_version);
+		append(material, static_cast<std::uint32_t>(vm::opcode::count));
+		append(material, options.inlining);
+		append(material, static_cast<std::uint64_t>(options.inline_budget));
+		append(material, options.constant_folding);
+		append(material, options.copy_propagation);
+		append(material, options.common_subexpression_elimination);
+		append(material, options.global_value_numbering);
+		append(material, options.dead_code_elimination);
+		append(material, options.loop_invariant_code_motion);
+		append(material, options.strength_reduction);
+		append(material, options.loop_unrolling);
+		append(material, static_cast<std::uint64_t>(options.unroll_max_trip_count));
+		append(material, static_cast<std::uint64_t>(options.unroll_max_instructions));
+		append(material, options.peephole);
+		append(material, static_cast<std::uint64_t>(options.peephole_rules.to_ullong()));
+		const auto* text = reinterpret_cast<const std::uint8_t*>(source.data());
+		material.insert(material.end(), text, text + source.size() * sizeof(types::che_char));
+
+		const auto [high, low] = murmur3(material.data(), material.size());
+		char name[33];
+		std::snprintf(name, sizeof(name), "%016llx%016llx", static_cast<unsigned long long>(high), static_cast<unsigned long long>(low));
+		return name;
+	}
+
+	std::shared_ptr<const vm::image> cache::load(const types::string& source, const options& options)
+	{
+		const auto entry = directory_ / (key(source, options) + extension);
+		std::error_code error;
+		if (std::filesystem::exists(entry, error))
+		{
+			try
+			{
+				auto image = vm::image::map(entry.string());
+				if (intact(entry, *image))
+				{
+					std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), error); // recently used
+					++hits_;
+					return image;
+				}
+			}
+			catch (const std::exception&)
+			{
+				// written by an incompatible build, compiled again below
+			}
+			// damaged, or its digest is, a valid image with other contents would run the wrong program
+			std::filesystem::remove(entry, error);
+			std::filesystem::remove(digest_path(entry), error);
+		}
+
+		++misses_;
+		std::ostringstream out;
+		write_image(out, compile(source, options));
+		const auto bytes = out.str();
+		if (store(entry, bytes))
+		{
+			evict(entry);
+			try
+			{
+				return vm::image::map(entry.string());
+			}
+			catch (const std::exception&)
+			{
+				// evicted by another process in the meantime
+			}
+		}
+		return vm::image::from_bytes(std::vector<std::uint8_t>(bytes.begin(), bytes.end()));
+	}
+
+	bool cache::store(const std::filesystem::path& entry, const std::string& bytes) const
+	{
+		// the digest goes first, an entry is never in place without the digest of its bytes
+		const auto* data = reinterpret_cast<const std::uint8_t*>(bytes.data());
+		return write_file(digest_path(entry), digest(data, bytes.size())) && write_file(entry, bytes);
+	}
+
+	bool cache::write_file(const std::filesystem::path& path, const std::string& bytes)
+	{
+		// unique per writer, so racing threads and processes never share a temporary file
+		thread_local std::mt19937_64 generator(std::random_device{}());
+		auto temporary = path;
+		temporary += "." + std::to_string(generator()) + ".tmp";
+
+		std::error_code error;
+		{
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			if (!out.write(bytes.data(), static_cast<std::streamsize>(bytes.size())).flush())
+			{
+				out.close();
+				std::filesystem::remove(temporary, error);
+				return false;
+			}
+		}
+
+		std::filesystem::rename(temporary, path, error);
+		if (error)
+		{
+			// where a mapped file cannot be replaced, the file another writer left is just as good
+			std::filesystem::remove(temporary, error);
+			return std::filesystem::exists(path, error);
+		}
+		return true;
+	}
+
+	void cache::evict(const std::filesystem::path& keep)
+	{
+		struct entry
+		{
+			std::filesystem::path path;
+			std::filesystem::file_time_type used;
+			std::uintmax_t size;
+		};
+
+		std::vector<entry> entries;
+		std::uintmax_t total = 0;
+		std::error_code error;
+		for (const auto& file : std::filesystem::directory_iterator(directory_, error))
+		{
+			if (file.path().extension() == ".tmp")
+			{
+				// left by a writer that died, anything this old is not being written any more
+				if (const auto written = file.last_write_time(error); !error && written < std::filesystem::file_time_type::clock::now() - std::chrono::hours(1))
+				{
+					std::filesystem::remove(file.path(), error);
+				}
+				continue;
+			}
+			if (file.path().extension() != extension)
+			{
+				continue;
+			}
+			const auto size = file.file_size(error);
+			const auto used = file.last_write_time(error);
+			if (!error)
+			{
+				entries.push_back({ file.path(), used, size });
+				total += size;
+			}
+		}
+
+		std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b)
+		{
+			return a.used < b.used;
+		});
+		for (const auto& candidate : entries)
+		{
+			if (total <= capacity_)
+			{
+				break;
+			}
+			if (candidate.path != keep && std::filesystem::remove(candidate.path, error))
+			{
+				std::filesystem::remove(digest_path(candidate.path), error);
+				total -= candidate.size;
+				++evictions_;
+			}
+		}
+	}
+}
@@ -0,0 +1,429 @@
+/*
+ * File Name: compiler.cpp
+ * Author(s): P. Kamara
+ *
+ * Compilation pipeline: source -> AST -> IR -> bytecode.
+ */
+
+#include <algorithm>
+#include <deque>
+#include "exceptions.h"
+#include "compilation/compiler.h"
+#include "compilation/parser.h"
+#include "compilation/work_pool.h"
+#include "compilation/ast/visitors/constant_folding_visitor.h"
+#include "compilation/ast/visitors/inlining_visitor.h"
+#include "compilation/ast/visitors/reference_visitor.h"
+#include "compilation/ir/analysis.h"
+#include "compilation/ir/builder.h"
+#include "compilation/ir/loops.h"
+#include "compilation/ir/passes.h"
+#include "vm/image.h"
+
+namespace cherie::compiler
+{
+	namespace
+	{
+		void accumulate(peephole::statistics& total, const peephole::statistics& function)
+		{
+			total.instructions_before += function.instructions_before;
+			total.instructions_after += function.instructions_after;
+			total.passes = std::max(total.passes, function.passes);
+			for (size_t rule = 0; rule < peephole::rule_count; rule++)
+			{
+				total.applied[rule] += function.applied[rule];
+			}
+		}
+
+		/* appends a function, relocating its jumps, constant pool indices and field sites */
+		void link(ir::bytecode& output, const ir::bytecode& function)
+		{
+			const auto entry = static_cast<std::uint32_t>(output.program.size());
+			const auto constants = static_cast<std::uint32_t>(output.constants.size());
+			const auto sites = static_cast<std::uint32_t>(output.layout.sites.size());
+			const auto positions = function.lines.expand(function.program.size());
+			for (size_t pc = 0; pc < function.program.size(); pc++)
+			{
+				auto instruction = function.program[pc];
+				relocate(instruction, entry, constants, sites);
+				output.lines.add(output.program.size(), positions[pc]);
+				output.program.push_back(instruction);
+			}
+			output.constants.insert(output.constants.end(), function.constants.begin(), function.constants.end());
+			output.layout.sites.insert(output.layout.sites.end(), function.layout.sites.begin(), function.layout.sites.end());
+
+			for (auto info : function.functions)
+			{
+				info.entry += entry;
+				output.functions.push_back(std::move(info));
+			}
+		}
+
+		void optimise(ir::function& function, const options& options, report& report)
+		{
+			// the passes feed each other (unrolling exposes constants, numbering
+			// exposes copies, copies expose redundancy), so run them until
+			// nothing changes, with a small cap
+			for (auto round = 0; round < 8; round++)
+			{
+				ir::infer_types(function);
+
+				size_t changes = 0;
+				if (options.constant_folding)
+				{
+					changes += ir::fold_constants(function);
+				}
+				if (options.loop_unrolling)
+				{
+					const auto unrolled = ir::unroll_loops(function, options.unroll_max_trip_count, options.unroll_max_instructions);
+					report.loops_unrolled += unrolled;
+					changes += unrolled;
+				}
+				if (options.loop_invariant_code_motion)
+				{
+					const auto hoisted = ir::hoist_loop_invariants(function);
+					report.invariants_hoisted += hoisted;
+					changes += hoisted;
+				}
+				if (options.strength_reduction)
+				{
+					const auto reduced = ir::reduce_induction_variables(function);
+					report.induction_variables_reduced += reduced;
+					changes += reduced;
+				}
+				if (options.copy_propagation)
+				{
+					changes += ir::propagate_copies(function);
+				}
+				if (options.common_subexpression_elimination)
+				{
+					changes += ir::eliminate_common_subexpressions(function);
+				}
+				if (options.global_value_numbering)
+				{
+					changes += ir::number_values(function);
+				}
+				if (options.dead_code_elimination)
+				{
+					changes += ir::eliminate_dead_code(function);
+				}
+
+				if (changes == 0)
+				{
+					break;
+				}
+			}
+		}
+
+		ir::bytecode emit(ir::function& function, const options& options, report& report)
+		{
+			optimise(function, options, report);
+			auto code = ir::generate(function);
+			if (options.peephole)
+			{
+				accumulate(report.peephole, peephole::optimise(code, options.peephole_rules));
+			}
+			return code;
+		}
+
+		void fold(ast::node* node, const options& options)
+		{
+			if (options.constant_folding)
+			{
+				ast::constant_folding_visitor folder;
+				node->accept(&folder);
+			}
+		}
+
+		/* optimises and emits functions independently of each other, the result does not depend on the schedule */
+		std::vector<ir::bytecode> emit_all(std::vector<ir::function*>& functions, const options& options, report& report)
+		{
+			std::vector<ir::bytecode> code(functions.size());
+			std::vector<compiler::report> reports(functions.size());
+			const auto task = [&](const size_t index)
+			{
+				code[index] = emit(*functions[index], options, reports[index]);
+			};
+
+			if (options.parallel)
+			{
+				work_pool::shared().run(functions.size(), task);
+			}
+			else
+			{
+				for (size_t index = 0; index < functions.size(); index++)
+				{
+					task(index);
+				}
+			}
+
+			for (const auto& function : reports)
+			{
+				report.loops_unrolled += function.loops_unrolled;
+				report.invariants_hoisted += function.invariants_hoisted;
+				report.induction_variables_reduced += function.induction_variables_reduced;
+				accumulate(report.peephole, function.peephole);
+			}
+			return code;
+		}
+
+		/* lowers the functions nested in the ones just built, and any found in those */
+		void build_nested(ir::module& module, const size_t first, std::deque<ir::function>& functions)
+		{
+			for (auto index = first; index < module.nested.size(); index++)
+			{
+				const auto nested = module.nested[index];
+				auto& function = functions.emplace_back();
+				function.name = nested.definition->function_name;
+				ir::builder builder(function, module);
+				builder.build(nested.definition, &nested);
+			}
+		}
+	}
+
+	void relocate(vm::i64& instruction, const std::uint32_t entry, const std::uint32_t constants, const std::uint32_t sites)
+	{
+		switch (instruction.op)
+		{
+			case vm::opcode::jmp:
+			case vm::opcode::jz:
+			case vm::opcode::jnz:
+				instruction.a += entry;
+				break;
+			case vm::opcode::loadk:
+				instruction.a += constants;
+				break;
+			case vm::opcode::getf:
+			case vm::opcode::setf:
+				instruction.a += sites;
+				break;
+			default:
+				break;
+		}
+	}
+
+	unit::unit(const types::string& source, const options& options)
+		: options_(options)
+	{
+		const auto defer_above = !options.lazy_functions ? parser::never_defer : options.inlining ? options.inline_budget : 0;
+		parser parser(new lexer(source), defer_above);
+		tree_.reset(parser.parse());
+
+		// folding first shrinks callees under the budget, folding again
+		// afterwards specialises the inlined bodies to their arguments
+		fold(tree_.get(), options);
+		if (options.inlining)
+		{
+			ast::inlining_visitor inliner(options.inline_budget);
+			tree_->accept(&inliner);
+			report_.calls_inlined = inliner.inlined();
+			if (report_.calls_inlined != 0)
+			{
+				fold(tree_.get(), options);
+			}
+		}
+
+		// the main chunk is function 0, definitions follow in source order and
+		// nested ones after them, in the order the builders find them
+		auto& table = module_.functions;
+		for (const auto& element : tree_->body)
+		{
+			if (std::holds_alternative<std::unique_ptr<ast::function_definition>>(element))
+			{
+				auto* definition = std::get<std::unique_ptr<ast::function_definition>>(element).get();
+				const auto [_, inserted] = table.try_emplace(definition->function_name, ir::callable{ static_cast<std::uint32_t>(definitions_.size() + 1), definition->parameters.size() });
+				if (!inserted)
+				{
+					codegen_error("function '%s' is defined twice (line %d)", definition->function_name.c_str(), static_cast<int>(definition->line));
+				}
+				definitions_.push_back(definition);
+			}
+		}
+
+		// top-level variables that functions refer to get a slot in the global
+		// array, everything else lives in registers
+		ast::reference_visitor references;
+		tree_->accept(&references);
+
+		auto& globals = module_.globals;
+		for (const auto& element : tree_->body)
+		{
+			if (!std::holds_alternative<std::unique_ptr<ast::statement>>(element))
+			{
+				continue;
+			}
+
+			const auto* statement = std::get<std::unique_ptr<ast::statement>>(element).get();
+			std::vector<std::pair<types::string, bool>> declared;
+			if (const auto* assignment = dynamic_cast<const ast::assignment_statement*>(statement); assignment && assignment->declaration)
+			{
+				declared.emplace_back(assignment->variable_name, assignment->immutable);
+			}
+			else if (const auto* multiple = dynamic_cast<const ast::multiple_assignment_statement*>(statement); multiple && multiple->declaration)
+			{
+				for (const auto& name : multiple->variable_names)
+				{
+					declared.emplace_back(name, multiple->immutable);
+				}
+			}
+
+			for (const auto& [name, immutable] : declared)
+			{
+				if (!references.names().count(name))
+				{
+					continue;
+				}
+				const auto [global, inserted] = globals.try_emplace(name, ir::global{ static_cast<std::uint32_t>(program_.globals.size()), immutable });
+				if (inserted)
+				{
+					program_.globals.push_back(name);
+				}
+				global->second.immutable &= immutable;
+			}
+		}
+
+		module_.function_count = static_cast<std::uint32_t>(definitions_.size() + 1);
+		std::deque<ir::function> functions(definitions_.size() + 1);
+		functions[0].name = "main";
+		ir::builder main(functions[0], module_);
+		tree_->accept(&main);
+
+		for (size_t index = 0; index < definitions_.size(); index++)
+		{
+			functions[index + 1].name = definitions_[index]->function_name;
+			if (!definitions_[index]->deferred)
+			{
+				ir::builder builder(functions[index + 1], module_);
+				builder.build(definitions_[index]);
+			}
+		}
+		build_nested(module_, 0, functions);
+
+		const auto is_deferred = [&](const size_t index)
+		{
+			return index != 0 && index <= definitions_.size() && definitions_[index - 1]->deferred;
+		};
+
+		std::vector<ir::function*> compiled;
+		for (size_t index = 0; index < functions.size(); index++)
+		{
+			if (!is_deferred(index))
+			{
+				compiled.push_back(&functions[index]);
+			}
+		}
+		auto code = emit_all(compiled, options, report_);
+
+		compiled_.resize(definitions_.size());
+		for (size_t index = 0, next = 0; index < functions.size(); index++)
+		{
+			if (is_deferred(index))
+			{
+				vm::function_info stub;
+				stub.name = functions[index].name;
+				stub.entry = vm::function_info::deferred;
+				stub.parameters = static_cast<std::uint32_t>(definitions_[index - 1]->parameters.size());
+				program_.functions.push_back(std::move(stub));
+				continue;
+			}
+			link(program_, code[next++]);
+		}
+		program_.layout.fields = module_.layout.fields;
+		program_.layout.shapes = module_.layout.shapes;
+	}
+
+	const unit::function& unit::compile(const std::uint32_t index)
+	{
+		std::lock_guard lock(mutex_);
+		auto& compiled = compiled_.at(index - 1);
+		if (compiled)
+		{
+			return *compiled;
+		}
+
+		auto* definition = definitions_[index - 1];
+		parser parser(new lexer(definition->deferred->source, definition->deferred->line, definition->deferred->column));
+		definition->body.reset(parser.parse_body());
+		definition->deferred.reset();
+
+		fold(definition, options_);
+		if (options_.inlining)
+		{
+			ast::inlining_visitor inliner(options_.inline_budget);
+			inliner.inline_into(tree_.get(), definition);
+			report_.calls_inlined += inliner.inlined();
+			if (inliner.inlined() != 0)
+			{
+				fold(definition, options_);
+			}
+		}
+
+		const auto first = module_.nested.size();
+		std::deque<ir::function> functions(1);
+		functions[0].name = definition->function_name;
+		ir::builder builder(functions[0], module_);
+		builder.build(definition);
+		build_nested(module_, first, functions);
+
+		auto result = std::make_unique<function>();
+		result->indices.push_back(index);
+		for (auto nested = first; nested < module_.nested.size(); nested++)
+		{
+			result->indices.push_back(module_.nested[nested].index);
+		}
+		std::vector<ir::function*> lowered;
+		for (auto& function : functions)
+		{
+			lowered.push_back(&function);
+		}
+		for (const auto& code : emit_all(lowered, options_, report_))
+		{
+			link(result->code, code);
+		}
+		result->code.layout.fields = module_.layout.fields;
+		result->code.layout.shapes = module_.layout.shapes;
+
+		compiled = std::move(result);
+		return *compiled;
+	}
+
+	size_t unit::deferred() const
+	{
+		std::lock_guard lock(mutex_);
+		return static_cast<size_t>(std::count_if(definitions_.begin(), definitions_.end(), [](const ast::function_definition* definition)
+		{
+			return definition->deferred != nullptr;
+		}));
+	}
+
+	report unit::statistics() const
+	{
+		std::lock_guard lock(mutex_);
+		return report_;
+	}
+
+	void write_image(std::ostream& out, const ir::bytecode& code)
+	{
+		for (const auto& function : code.functions)
+		{
+			if (function.entry == vm::function_info::deferred)
+			{
+				codegen_error("function '%s' is not compiled yet and cannot be written to an image", function.name.c_str());
+			}
+		}
+		const std::vector<vm::vm_register> constants(code.constants.begin(), code.constants.end());
+		vm::image::write(out, code.program, constants, code.functions, code.globals, code.lines, code.layout);
+	}
+
+	ir::bytecode compile(const types::string& source, const options& options, report* report)
+	{
+		auto eager = options;
+		eager.lazy_functions = false;
+		const unit unit(source, eager);
+		if (report)
+		{
+			*report = unit.statistics();
+		}
+		return unit.program();
+	}
+}
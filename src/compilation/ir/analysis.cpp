@@ -0,0 +1,349 @@
+/*
+ * File Name: analysis.cpp
+ * Author(s): P. Kamara
+ *
+ * Control flow analyses over the IR.
+ */
+
+#include <algorithm>
+#include "compilation/ir/analysis.h"
+#include "vm/array.h"
+
+namespace cherie::compiler::ir
+{
+	std::vector<block_id> reverse_postorder(const function& function)
+	{
+		std::vector<block_id> order;
+		if (function.blocks.empty())
+		{
+			return order;
+		}
+		
+		std::vector<bool> visited(function.blocks.size(), false);
+		std::vector<std::pair<block_id, size_t>> stack = { { 0, 0 } };
+		visited[0] = true;
+		while (!stack.empty())
+		{
+			auto& [block, next_successor] = stack.back();
+			const auto& successors = function.blocks[block].successors;
+			if (next_successor < successors.size())
+			{
+				const auto successor = successors[next_successor++];
+				if (!visited[successor])
+				{
+					visited[successor] = true;
+					stack.emplace_back(successor, 0);
+				}
+				continue;
+			}
+			order.push_back(block);
+			stack.pop_back();
+		}
+		
+		std::reverse(order.begin(), order.end());
+		return order;
+	}
+
+	bool dominator_tree::dominates(const block_id dominator, block_id block) const
+	{
+		while (block != no_block)
+		{
+			if (block == dominator)
+			{
+				return true;
+			}
+			block = immediate_dominator[block];
+		}
+		return false;
+	}
+
+	dominator_tree compute_dominators(const function& function)
+	{
+		const auto order = reverse_postorder(function);
+		std::vector<size_t> rpo_index(function.blocks.size(), SIZE_MAX);
+		for (size_t index = 0; index < order.size(); index++)
+		{
+			rpo_index[order[index]] = index;
+		}
+
+		dominator_tree tree;
+		auto& idom = tree.immediate_dominator;
+		idom.assign(function.blocks.size(), no_block);
+		if (order.empty())
+		{
+			return tree;
+		}
+		idom[0] = 0;
+
+		const auto intersect = [&](block_id a, block_id b)
+		{
+			while (a != b)
+			{
+				while (rpo_index[a] > rpo_index[b]) a = idom[a];
+				while (rpo_index[b] > rpo_index[a]) b = idom[b];
+			}
+			return a;
+		};
+		
+		for (auto changed = true; changed;)
+		{
+			changed = false;
+			for (size_t index = 1; index < order.size(); index++)
+			{
+				const auto block = order[index];
+				auto dominator = no_block;
+				for (const auto predecessor : function.blocks[block].predecessors)
+				{
+					if (idom[predecessor] == no_block)
+					{
+						continue; // unreachable, or not processed yet
+					}
+					dominator = dominator == no_block ? predecessor : intersect(predecessor, dominator);
+				}
+
+				if (idom[block] != dominator)
+				{
+					idom[block] = dominator;
+					changed = true;
+				}
+			}
+		}
+
+		idom[0] = no_block;
+		tree.children.resize(function.blocks.size());
+		for (const auto block : order)
+		{
+			if (idom[block] != no_block)
+			{
+				tree.children[idom[block]].push_back(block);
+			}
+		}
+		return tree;
+	}
+
+	std::vector<loop> find_loops(const function& function, const dominator_tree& dominators)
+	{
+		const auto order = reverse_postorder(function);
+		std::vector<loop> loops;
+
+		for (const auto header : order)
+		{
+			loop current;
+			current.header = header;
+			current.contains.assign(function.blocks.size(), false);
+			current.contains[header] = true;
+
+			for (const auto predecessor : function.blocks[header].predecessors)
+			{
+				if (dominators.dominates(header, predecessor))
+				{
+					current.latches.push_back(predecessor);
+				}
+			}
+			if (current.latches.empty())
+			{
+				continue;
+			}
+
+			// everything that reaches a latch without passing through the header
+			std::vector<block_id> worklist = current.latches;
+			while (!worklist.empty())
+			{
+				const auto block = worklist.back();
+				worklist.pop_back();
+				if (current.contains[block])
+				{
+					continue;
+				}
+				current.contains[block] = true;
+				for (const auto predecessor : function.blocks[block].predecessors)
+				{
+					if (dominators.dominates(header, predecessor)) // skips unreachable blocks
+					{
+						worklist.push_back(predecessor);
+					}
+				}
+			}
+
+			for (const auto block : order)
+			{
+				if (current.contains[block])
+				{
+					current.blocks.push_back(block);
+				}
+			}
+
+			for (const auto predecessor : function.blocks[header].predecessors)
+			{
+				if (current.contains[predecessor])
+				{
+					continue;
+				}
+				if (current.preheader != no_block || function.blocks[predecessor].successors.size() != 1)
+				{
+					current.preheader = no_block;
+					break;
+				}
+				current.preheader = predecessor;
+			}
+			loops.push_back(std::move(current));
+		}
+
+		std::stable_sort(loops.begin(), loops.end(), [](const loop& a, const loop& b)
+		{
+			return a.blocks.size() < b.blocks.size();
+		});
+		return loops;
+	}
+
+	void infer_types(function& function)
+	{
+		const auto join = [](const value_type a, const value_type b)
+		{
+			if (a == value_type::unknown || a == b)
+			{
+				return b;
+			}
+			return b == value_type::unknown ? a : value_type::dynamic;
+		};
+
+		const auto arithmetic = [](const value_type a, const value_type b)
+		{
+			if (a == value_type::unknown || b == value_type::unknown)
+			{
+				return value_type::unknown;
+			}
+			if (a == value_type::dynamic || b == value_type::dynamic)
+			{
+				return value_type::dynamic;
+			}
+			return a == value_type::floating || b == value_type::floating ? value_type::floating : value_type::integer;
+		};
+
+		for (auto& instruction : function.values)
+		{
+			if (instruction.op != opcode::constant)
+			{
+				instruction.type = value_type::unknown;
+			}
+		}
+
+		const auto order = reverse_postorder(function);
+		for (auto changed = true; changed;)
+		{
+			changed = false;
+			for (const auto block : order)
+			{
+				for (const auto id : function.blocks[block].instructions)
+				{
+					auto& instruction = function.values[id];
+					const auto operand = [&](const size_t index) { return function.values[instruction.operands[index]].type; };
+
+					auto type = instruction.type;
+					switch (instruction.op)
+					{
+						case opcode::copy:
+							type = operand(0);
+							break;
+						case opcode::phi:
+							for (size_t index = 0; index < instruction.operands.size(); index++)
+							{
+								type = join(type, operand(index));
+							}
+							break;
+						case opcode::add:
+						case opcode::sub:
+						case opcode::mul:
+						case opcode::div:
+							type = arithmetic(operand(0), operand(1));
+							break;
+						case opcode::neg:
+							type = arithmetic(operand(0), value_type::integer);
+							break;
+						case opcode::logical_not:
+							type = value_type::boolean;
+							break;
+						case opcode::parameter:
+						case opcode::call:
+						case opcode::call_value:
+						case opcode::result:
+						case opcode::load_global:
+						case opcode::load_upvalue:
+							type = value_type::dynamic; // nothing is known across calls
+							break;
+						case opcode::make_closure:
+						case opcode::current_closure:
+						case opcode::make_object:
+						case opcode::load_field:
+						case opcode::make_map:
+						case opcode::load_entry:
+						case opcode::entry_key:
+						case opcode::make_array:
+							type = value_type::dynamic; // functions, objects, maps and arrays only have a runtime tag, fields and entries can hold anything
+							break;
+						case opcode::run_kernel:
+							type = instruction.immediate == static_cast<std::int64_t>(vm::kernel::len) ? value_type::integer : value_type::dynamic;
+							break;
+						case opcode::has_entry:
+							type = value_type::boolean;
+							break;
+						case opcode::next_entry:
+							type = value_type::integer;
+							break;
+						default:
+							break;
+					}
+
+					if (type != instruction.type)
+					{
+						instruction.type = type;
+						changed = true;
+					}
+				}
+			}
+		}
+
+		// phis that only see themselves, and values in unreachable code
+		for (auto& instruction : function.values)
+		{
+			if (instruction.type == value_type::unknown && instruction.op != opcode::nop && !instruction.is_terminator())
+			{
+				instruction.type = value_type::integer;
+			}
+		}
+	}
+
+	void split_critical_edges(function& function)
+	{
+		const auto block_count = static_cast<block_id>(function.blocks.size());
+		for (block_id from = 0; from < block_count; from++)
+		{
+			if (function.blocks[from].successors.size() < 2)
+			{
+				continue;
+			}
+
+			for (size_t successor = 0; successor < function.blocks[from].successors.size(); successor++)
+			{
+				const auto target = function.blocks[from].successors[successor];
+				if (function.blocks[target].predecessors.size() < 2)
+				{
+					continue;
+				}
+
+				const auto split = function.add_block(); // invalidates block references
+				function.blocks[from].successors[successor] = split;
+				
+				auto& predecessors = function.blocks[target].predecessors;
+				*std::find(predecessors.begin(), predecessors.end(), from) = split;
+				function.blocks[split].predecessors.push_back(from);
+				function.blocks[split].successors.push_back(target);
+
+				instruction jump;
+				jump.op = opcode::jump;
+				jump.position = function.values[function.blocks[from].instructions.back()].position;
+				function.append(split, std::move(jump));
+			}
+		}
+	}
+}
@@ -0,0 +1,751 @@
+/*
+ * File Name: builder.cpp
+ * Author(s): P. Kamara
+ *
+ * Lowers the AST into SSA form.
+ */
+
+#include <algorithm>
+#include "exceptions.h"
+#include "compilation/ast/visitors/capture_visitor.h"
+#include "compilation/ast/visitors/escape_visitor.h"
+#include "compilation/ir/builder.h"
+#include "vm/array.h"
+
+namespace cherie::compiler::ir
+{
+	namespace
+	{
+		struct builtin
+		{
+			opcode op;
+			size_t parameters;
+			vm::kernel kernel = vm::kernel::fill; // of run_kernel
+		};
+
+		/* called like functions, a function or variable of the same name hides them */
+		const std::unordered_map<types::string, builtin> builtins = {
+			{ "map", { opcode::make_map, 0 } },
+			{ "has", { opcode::has_entry, 2 } },
+			{ "next", { opcode::next_entry, 2 } },
+			{ "key", { opcode::entry_key, 2 } },
+			{ "fill", { opcode::run_kernel, 2, vm::kernel::fill } },
+			{ "len", { opcode::run_kernel, 1, vm::kernel::len } },
+			{ "sum", { opcode::run_kernel, 1, vm::kernel::sum } },
+			{ "min", { opcode::run_kernel, 1, vm::kernel::min } },
+			{ "max", { opcode::run_kernel, 1, vm::kernel::max } },
+			{ "dot", { opcode::run_kernel, 2, vm::kernel::dot } },
+			{ "add", { opcode::run_kernel, 2, vm::kernel::add } },
+			{ "sub", { opcode::run_kernel, 2, vm::kernel::sub } },
+			{ "mul", { opcode::run_kernel, 2, vm::kernel::mul } },
+			{ "div", { opcode::run_kernel, 2, vm::kernel::div } },
+			{ "filter", { opcode::run_kernel, 3, vm::kernel::filter } },
+			{ "sort", { opcode::run_kernel, 1, vm::kernel::sort } },
+		};
+	}
+
+	builder::builder(function& function, module& module)
+		: function_(function), module_(module), functions_(module.functions), globals_(module.globals) {}
+
+	block_id builder::new_block()
+	{
+		sealed_.push_back(false);
+		return function_.add_block();
+	}
+
+	void builder::seal(const block_id block)
+	{
+		if (const auto pending = incomplete_phis_.find(block); pending != incomplete_phis_.end())
+		{
+			auto phis = std::move(pending->second);
+			incomplete_phis_.erase(pending);
+			for (const auto& [variable, phi] : phis)
+			{
+				add_phi_operands(variable, phi);
+			}
+		}
+		sealed_[block] = true;
+	}
+
+	value_id builder::emit(const ast::node* source, const opcode op, std::vector<value_id> operands, const std::int64_t immediate)
+	{
+		instruction instruction;
+		instruction.op = op;
+		instruction.operands = std::move(operands);
+		instruction.immediate = immediate;
+		instruction.position = { source->line, source->column };
+		return function_.append(current_, std::move(instruction));
+	}
+
+	void builder::terminate(const ast::node* source, const opcode op, std::vector<block_id> successors, std::vector<value_id> operands)
+	{
+		emit(source, op, std::move(operands));
+		for (const auto successor : successors)
+		{
+			function_.add_edge(current_, successor);
+		}
+	}
+
+	size_t builder::find(const types::string& name) const
+	{
+		for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope)
+		{
+			if (const auto variable = scope->find(name); variable != scope->end())
+			{
+				return variable->second;
+			}
+		}
+		return no_variable;
+	}
+
+	size_t builder::resolve(const ast::node* source, const types::string& name) const
+	{
+		const auto variable = find(name);
+		if (variable == no_variable)
+		{
+			codegen_error("undeclared variable '%s' on line %d", name.c_str(), static_cast<int>(source->line));
+		}
+		return variable;
+	}
+
+	void builder::write_variable(const size_t variable, const block_id block, const value_id value)
+	{
+		variables_[variable].definitions[block] = value;
+	}
+
+	value_id builder::read_variable(const size_t variable, const block_id block)
+	{
+		const auto& definitions = variables_[variable].definitions;
+		if (const auto definition = definitions.find(block); definition != definitions.end())
+		{
+			return definition->second;
+		}
+		return read_variable_recursive(variable, block);
+	}
+
+	value_id builder::read_variable_recursive(const size_t variable, const block_id block)
+	{
+		const auto& predecessors = function_.blocks[block].predecessors;
+
+		value_id value;
+		if (!sealed_[block])
+		{
+			value = function_.insert_phi(block);
+			incomplete_phis_[block].emplace_back(variable, value);
+		}
+		else if (predecessors.size() == 1)
+		{
+			value = read_variable(variable, predecessors.front());
+		}
+		else
+		{
+			value = function_.insert_phi(block);
+			write_variable(variable, block, value); // breaks cycles through loops
+			value = add_phi_operands(variable, value);
+		}
+		write_variable(variable, block, value);
+		return value;
+	}
+
+	value_id builder::add_phi_operands(const size_t variable, const value_id phi)
+	{
+		const auto block = function_.values[phi].block;
+		for (const auto predecessor : function_.blocks[block].predecessors)
+		{
+			const auto operand = read_variable(variable, predecessor);
+			function_.values[phi].operands.push_back(operand);
+		}
+		return try_remove_trivial_phi(phi);
+	}
+
+	value_id builder::try_remove_trivial_phi(const value_id phi)
+	{
+		auto same = no_value;
+		for (const auto operand : function_.values[phi].operands)
+		{
+			if (operand == same || operand == phi)
+			{
+				continue;
+			}
+
+			if (same != no_value)
+			{
+				return phi; // merges at least two values
+			}
+			same = operand;
+		}
+
+		if (same == no_value)
+		{
+			return phi; // unreachable or only self-referencing; left for dce
+		}
+
+		// collect phi users before rewiring them, they may become trivial too
+		std::vector<value_id> users;
+		for (value_id id = 0; id < function_.values.size(); id++)
+		{
+			const auto& user = function_.values[id];
+			if (id != phi && user.op == opcode::phi && std::find(user.operands.begin(), user.operands.end(), phi) != user.operands.end())
+			{
+				users.push_back(id);
+			}
+		}
+
+		function_.replace_uses(phi, same);
+		for (auto& variable : variables_)
+		{
+			for (auto& [block, definition] : variable.definitions)
+			{
+				if (definition == phi)
+				{
+					definition = same;
+				}
+			}
+			std::replace(variable.captures.begin(), variable.captures.end(), phi, same);
+		}
+
+		auto& removed = function_.values[phi];
+		auto& instructions = function_.blocks[removed.block].instructions;
+		instructions.erase(std::find(instructions.begin(), instructions.end(), phi));
+		removed.op = opcode::nop;
+		removed.operands.clear();
+
+		for (const auto user : users)
+		{
+			if (function_.values[user].op == opcode::phi)
+			{
+				try_remove_trivial_phi(user);
+			}
+		}
+		return same;
+	}
+
+	value_id builder::lower(ast::node* node)
+	{
+		result_ = no_value;
+		node->accept(this);
+		return result_;
+	}
+
+	void builder::lower_block(ast::statement_block* block)
+	{
+		scopes_.emplace_back();
+		for (size_t index = 0; index < block->statements.size(); index++)
+		{
+			if (function_.terminated(current_))
+			{
+				break; // everything after a return is dead
+			}
+
+			auto* stmt = block->statements[index].get();
+			if (const auto* nested = dynamic_cast<ast::function_statement*>(stmt))
+			{
+				// it can only be used after its definition, and in its own body
+				ast::escape_visitor escape(nested->definition->function_name);
+				for (auto following = index + 1; following < block->statements.size(); following++)
+				{
+					block->statements[following]->accept(&escape);
+				}
+				nested->definition->accept(&escape);
+				escapes_ = escape.escapes();
+			}
+			lower(stmt);
+		}
+		scopes_.pop_back();
+	}
+
+	void builder::build(ast::function_definition* definition, const nested_function* nested)
+	{
+		in_function_ = true;
+		current_ = new_block();
+		seal(current_);
+
+		// a function sees the program's globals, then what it captured, shadowed by its own parameters and locals
+		declare_globals();
+		scopes_.emplace_back();
+		function_.parameters = definition->parameters.size();
+		if (nested)
+		{
+			declare_captures(definition, *nested);
+		}
+
+		scopes_.emplace_back();
+		for (size_t index = 0; index < definition->parameters.size(); index++)
+		{
+			assign(definition, definition->parameters[index], true, false, emit(definition, opcode::parameter, {}, static_cast<std::int64_t>(index)));
+		}
+		lower_block(definition->body.get());
+		scopes_.pop_back();
+		scopes_.pop_back();
+		scopes_.pop_back();
+
+		if (!function_.terminated(current_))
+		{
+			terminate(definition, opcode::ret, {});
+		}
+	}
+
+	void builder::declare_captures(ast::function_definition* definition, const nested_function& nested)
+	{
+		// closures read their captures from the upvalue array, direct calls pass them after the arguments
+		std::vector<value_id> captures;
+		for (size_t index = 0; index < nested.captures.size(); index++)
+		{
+			const auto value = nested.escapes
+				? emit(definition, opcode::load_upvalue, {}, static_cast<std::int64_t>(index))
+				: emit(definition, opcode::parameter, {}, static_cast<std::int64_t>(function_.parameters + index));
+			variables_.push_back({ nested.captures[index], true, {} });
+			variables_.back().captured = true;
+			scopes_.back()[nested.captures[index]] = variables_.size() - 1;
+			write_variable(variables_.size() - 1, current_, value);
+			captures.push_back(value);
+		}
+
+		// its own name, for recursion
+		if (nested.escapes)
+		{
+			function_.upvalues = nested.captures.size();
+			assign(definition, definition->function_name, true, true, emit(definition, opcode::current_closure));
+		}
+		else
+		{
+			function_.parameters += nested.captures.size();
+			variables_.push_back({ definition->function_name, true, {} });
+			variables_.back().callee = nested.index;
+			variables_.back().captures = std::move(captures);
+			scopes_.back()[definition->function_name] = variables_.size() - 1;
+		}
+	}
+
+	void builder::declare_globals()
+	{
+		scopes_.emplace_back();
+		for (const auto& [name, global] : globals_)
+		{
+			variables_.push_back({ name, global.immutable, {}, global.index });
+			scopes_.back()[name] = variables_.size() - 1;
+		}
+	}
+
+	value_id builder::load(const ast::node* source, const size_t variable)
+	{
+		if (variables_[variable].global != no_global)
+		{
+			return emit(source, opcode::load_global, {}, variables_[variable].global);
+		}
+		return read_variable(variable, current_);
+	}
+
+	void builder::assign(const ast::node* source, const types::string& name, const bool declaration, const bool immutable, const value_id value)
+	{
+		size_t variable;
+		if (declaration)
+		{
+			// only top-level declarations of the main chunk can be globals
+			const auto global = in_function_ || scopes_.size() != 1 ? globals_.end() : globals_.find(name);
+			variables_.push_back({ name, immutable, {}, global != globals_.end() ? global->second.index : no_global });
+			variable = scopes_.back()[name] = variables_.size() - 1;
+		}
+		else
+		{
+			variable = resolve(source, name);
+			if (variables_[variable].captured)
+			{
+				codegen_error("cannot assign to captured variable '%s' on line %d", name.c_str(), static_cast<int>(source->line));
+			}
+			if (variables_[variable].immutable)
+			{
+				codegen_error("cannot assign to const '%s' on line %d", name.c_str(), static_cast<int>(source->line));
+			}
+		}
+
+		if (variables_[variable].global != no_global)
+		{
+			emit(source, opcode::store_global, { value }, variables_[variable].global);
+			return;
+		}
+		write_variable(variable, current_, value);
+	}
+
+	const callable& builder::resolve_call(const ast::call_expression* call) const
+	{
+		const auto callee = functions_.find(call->function_name);
+		if (callee == functions_.end())
+		{
+			codegen_error("undefined function '%s' on line %d", call->function_name.c_str(), static_cast<int>(call->line));
+		}
+		if (callee->second.parameters != call->arguments.size())
+		{
+			codegen_error("'%s' takes %d arguments but %d were given on line %d", call->function_name.c_str(), static_cast<int>(callee->second.parameters), static_cast<int>(call->arguments.size()), static_cast<int>(call->line));
+		}
+		return callee->second;
+	}
+
+	std::vector<value_id> builder::lower_arguments(ast::call_expression* call)
+	{
+		std::vector<value_id> arguments;
+		for (const auto& argument : call->arguments)
+		{
+			arguments.push_back(lower(argument.get()));
+		}
+		return arguments;
+	}
+
+	void builder::visit(ast::program* node)
+	{
+		current_ = new_block();
+		seal(current_);
+
+		scopes_.emplace_back();
+		for (const auto& element : node->body)
+		{
+			if (std::holds_alternative<std::unique_ptr<ast::statement>>(element))
+			{
+				lower(std::get<std::unique_ptr<ast::statement>>(element).get());
+			}
+			else
+			{
+				lower(std::get<std::unique_ptr<ast::function_definition>>(element).get());
+			}
+		}
+		scopes_.pop_back();
+
+		terminate(node, opcode::halt, {});
+	}
+
+	void builder::visit(ast::boolean_literal* node)
+	{
+		result_ = emit(node, opcode::constant, {}, node->value ? 1 : 0);
+		function_.values[result_].type = value_type::boolean;
+	}
+
+	void builder::visit(ast::number_literal* node)
+	{
+		if (std::holds_alternative<types::floating_point>(node->value))
+		{
+			result_ = emit(node, opcode::constant, {}, from_double(static_cast<double>(std::get<types::floating_point>(node->value))));
+			function_.values[result_].type = value_type::floating;
+			return;
+		}
+		result_ = emit(node, opcode::constant, {}, std::get<types::integer>(node->value));
+		function_.values[result_].type = value_type::integer;
+	}
+
+	void builder::visit(ast::string_literal* node)
+	{
+		codegen_error("string values are not supported by the VM yet (line %d)", static_cast<int>(node->line));
+	}
+
+	void builder::visit(ast::binary_expression* node)
+	{
+		const auto lhs = lower(node->lhs.get());
+		const auto rhs = lower(node->rhs.get());
+		switch (node->operation)
+		{
+			case token_type::ADD: result_ = emit(node, opcode::add, { lhs, rhs }); break;
+			case token_type::SUBTRACT: result_ = emit(node, opcode::sub, { lhs, rhs }); break;
+			case token_type::MULTIPLY: result_ = emit(node, opcode::mul, { lhs, rhs }); break;
+			case token_type::DIVIDE: result_ = emit(node, opcode::div, { lhs, rhs }); break;
+			default: codegen_error("unsupported binary operator on line %d", static_cast<int>(node->line));
+		}
+	}
+
+	void builder::visit(ast::unary_expression* node)
+	{
+		const auto rhs = lower(node->rhs.get());
+		result_ = emit(node, node->operation == token_type::SUBTRACT ? opcode::neg : opcode::logical_not, { rhs });
+	}
+
+	void builder::visit(ast::variable* node)
+	{
+		if (const auto variable = find(node->value); variable != no_variable)
+		{
+			if (variables_[variable].callee != no_function)
+			{
+				codegen_error("'%s' cannot be used as a value on line %d", node->value.c_str(), static_cast<int>(node->line));
+			}
+			result_ = load(node, variable);
+			return;
+		}
+
+		// a top-level function used as a value captures nothing
+		if (const auto callee = functions_.find(node->value); callee != functions_.end())
+		{
+			result_ = emit(node, opcode::make_closure, {}, callee->second.index);
+			return;
+		}
+		resolve(node, node->value);
+	}
+
+	void builder::visit(ast::assignment_statement* node)
+	{
+		assign(node, node->variable_name, node->declaration, node->immutable, lower(node->value.get()));
+	}
+
+	void builder::visit(ast::multiple_assignment_statement* node)
+	{
+		const auto call = lower(node->value.get());
+		for (size_t index = 0; index < node->variable_names.size(); index++)
+		{
+			const auto value = index == 0 ? call : emit(node, opcode::result, { call }, static_cast<std::int64_t>(index));
+			assign(node, node->variable_names[index], node->declaration, node->immutable, value);
+		}
+	}
+
+	void builder::visit(ast::if_statement* node)
+	{
+		const auto condition = lower(node->condition.get());
+
+		const auto then_block = new_block();
+		const auto else_block = node->else_block ? new_block() : no_block;
+		const auto merge_block = new_block();
+		terminate(node, opcode::branch, { then_block, node->else_block ? else_block : merge_block }, { condition });
+
+		seal(then_block);
+		current_ = then_block;
+		lower_block(node->main_block.get());
+		if (!function_.terminated(current_))
+		{
+			terminate(node, opcode::jump, { merge_block });
+		}
+
+		if (node->else_block)
+		{
+			seal(else_block);
+			current_ = else_block;
+			lower_block(node->else_block.get());
+			if (!function_.terminated(current_))
+			{
+				terminate(node, opcode::jump, { merge_block });
+			}
+		}
+
+		seal(merge_block);
+		current_ = merge_block;
+		if (function_.blocks[merge_block].predecessors.empty())
+		{
+			terminate(node, opcode::ret, {}); // both branches returned, nothing after this runs
+		}
+	}
+
+	void builder::visit(ast::while_statement* node)
+	{
+		const auto header = new_block();
+		const auto body = new_block();
+		const auto exit = new_block();
+		terminate(node, opcode::jump, { header });
+
+		current_ = header; // sealed once the back edge exists
+		const auto condition = lower(node->condition.get());
+		terminate(node, opcode::branch, { body, exit }, { condition });
+
+		seal(body);
+		current_ = body;
+		lower_block(node->block.get());
+		if (!function_.terminated(current_))
+		{
+			terminate(node, opcode::jump, { header });
+		}
+
+		seal(header);
+		seal(exit);
+		current_ = exit;
+	}
+
+	value_id builder::lower_call(ast::call_expression* call, const bool tail)
+	{
+		const auto variable = find(call->function_name);
+		if (const auto builtin = builtins.find(call->function_name); variable == no_variable && builtin != builtins.end() && !functions_.count(call->function_name))
+		{
+			if (builtin->second.parameters != call->arguments.size())
+			{
+				codegen_error("'%s' takes %d arguments but %d were given on line %d", call->function_name.c_str(), static_cast<int>(builtin->second.parameters), static_cast<int>(call->arguments.size()), static_cast<int>(call->line));
+			}
+			const auto result = emit(call, builtin->second.op, lower_arguments(call), static_cast<std::int64_t>(builtin->second.kernel));
+			if (tail)
+			{
+				terminate(call, opcode::ret, {}, { result });
+			}
+			return result;
+		}
+		if (variable == no_variable)
+		{
+			const auto& callee = resolve_call(call);
+			return emit(call, tail ? opcode::tail_call : opcode::call, lower_arguments(call), callee.index);
+		}
+
+		auto arguments = lower_arguments(call);
+		const auto& info = variables_[variable];
+		if (info.callee != no_function)
+		{
+			// nested functions are numbered in the order they are found, after the top-level ones
+			const auto& nested = module_.nested[info.callee - (module_.function_count - module_.nested.size())];
+			if (nested.definition->parameters.size() != call->arguments.size())
+			{
+				codegen_error("'%s' takes %d arguments but %d were given on line %d", call->function_name.c_str(), static_cast<int>(nested.definition->parameters.size()), static_cast<int>(call->arguments.size()), static_cast<int>(call->line));
+			}
+			arguments.insert(arguments.end(), info.captures.begin(), info.captures.end());
+			return emit(call, tail ? opcode::tail_call : opcode::call, std::move(arguments), info.callee);
+		}
+
+		// anything else is called through its value, which checks the argument count when it runs
+		arguments.push_back(load(call, variable));
+		return emit(call, tail ? opcode::tail_call_value : opcode::call_value, std::move(arguments));
+	}
+
+	void builder::visit(ast::call_expression* node)
+	{
+		result_ = lower_call(node, false);
+	}
+
+	std::uint32_t builder::field_id(const types::string& name)
+	{
+		const auto [found, added] = module_.field_ids.try_emplace(name, static_cast<std::uint32_t>(module_.layout.fields.size()));
+		if (added)
+		{
+			module_.layout.fields.push_back(name);
+		}
+		return found->second;
+	}
+
+	std::uint32_t builder::shape_id(std::vector<std::uint32_t> fields)
+	{
+		const auto [found, added] = module_.shape_ids.try_emplace(fields, static_cast<std::uint32_t>(module_.layout.shapes.size()));
+		if (added)
+		{
+			module_.layout.shapes.push_back(std::move(fields));
+		}
+		return found->second;
+	}
+
+	void builder::visit(ast::object_literal* node)
+	{
+		std::vector<value_id> values;
+		std::vector<std::uint32_t> fields;
+		for (const auto& [name, value] : node->fields)
+		{
+			values.push_back(lower(value.get()));
+			fields.push_back(field_id(name));
+		}
+		result_ = emit(node, opcode::make_object, std::move(values), shape_id(std::move(fields)));
+	}
+
+	void builder::visit(ast::array_literal* node)
+	{
+		std::vector<value_id> elements;
+		for (const auto& element : node->elements)
+		{
+			elements.push_back(lower(element.get()));
+		}
+		result_ = emit(node, opcode::make_array, std::move(elements));
+	}
+
+	void builder::visit(ast::field_expression* node)
+	{
+		const auto object = lower(node->object.get());
+		result_ = emit(node, opcode::load_field, { object }, field_id(node->field));
+	}
+
+	void builder::visit(ast::field_assignment_statement* node)
+	{
+		const auto object = lower(node->target->object.get());
+		const auto value = lower(node->value.get());
+		emit(node, opcode::store_field, { object, value }, field_id(node->target->field));
+		result_ = no_value;
+	}
+
+	void builder::visit(ast::index_expression* node)
+	{
+		const auto container = lower(node->container.get());
+		const auto key = lower(node->key.get());
+		result_ = emit(node, opcode::load_entry, { container, key });
+	}
+
+	void builder::visit(ast::index_assignment_statement* node)
+	{
+		const auto container = lower(node->target->container.get());
+		const auto key = lower(node->target->key.get());
+		const auto value = lower(node->value.get());
+		emit(node, opcode::store_entry, { container, key, value });
+		result_ = no_value;
+	}
+
+	void builder::visit(ast::function_statement* node)
+	{
+		auto* definition = node->definition.get();
+		ast::capture_visitor free;
+		definition->accept(&free);
+
+		// globals are shared rather than captured
+		nested_function nested{ definition, module_.function_count++, {}, escapes_ };
+		std::vector<value_id> captures;
+		for (const auto& name : free.captures())
+		{
+			const auto variable = find(name);
+			if (variable == no_variable || variables_[variable].global != no_global)
+			{
+				continue;
+			}
+			if (variables_[variable].callee != no_function)
+			{
+				codegen_error("'%s' cannot be used as a value on line %d", name.c_str(), static_cast<int>(node->line));
+			}
+			nested.captures.push_back(name);
+			captures.push_back(load(node, variable));
+		}
+
+		if (nested.escapes)
+		{
+			assign(node, definition->function_name, true, true, emit(node, opcode::make_closure, std::move(captures), nested.index));
+		}
+		else
+		{
+			variables_.push_back({ definition->function_name, true, {} });
+			variables_.back().callee = nested.index;
+			variables_.back().captures = std::move(captures);
+			scopes_.back()[definition->function_name] = variables_.size() - 1;
+		}
+		module_.nested.push_back(std::move(nested));
+	}
+
+	void builder::visit(ast::function_definition*)
+	{
+		// lowered into their own ir::function through build()
+	}
+
+	void builder::visit(ast::return_statement* node)
+	{
+		if (!in_function_)
+		{
+			codegen_error("return outside of a function on line %d", static_cast<int>(node->line));
+		}
+
+		// returning a call is always a tail call, and passes on everything the callee returns
+		if (node->values.size() == 1)
+		{
+			if (auto* call = dynamic_cast<ast::call_expression*>(node->values.front().get()))
+			{
+				lower_call(call, true);
+				return;
+			}
+		}
+
+		std::vector<value_id> values;
+		for (const auto& value : node->values)
+		{
+			values.push_back(lower(value.get()));
+		}
+		terminate(node, opcode::ret, {}, std::move(values));
+	}
+
+	void builder::visit(ast::statement_block* node)
+	{
+		lower_block(node);
+	}
+
+	void builder::visit(ast::primary_expression*) {}
+	void builder::visit(ast::multiplicative_expression*) {}
+	void builder::visit(ast::additive_expression*) {}
+	void builder::visit(ast::expression*) {}
+	void builder::visit(ast::statement*) {}
+}
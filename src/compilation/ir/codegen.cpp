@@ -0,0 +1,696 @@
+/*
+ * File Name: codegen.cpp
+ * Author(s): P. Kamara
+ *
+ * Generates register bytecode from the IR.
+ */
+
+#include <algorithm>
+#include <limits>
+#include <map>
+
+#include "exceptions.h"
+#include "compilation/ir/analysis.h"
+#include "compilation/ir/codegen.h"
+#include "compilation/ir/passes.h"
+
+namespace cherie::compiler::ir
+{
+	namespace
+	{
+		struct interval
+		{
+			value_id value;
+			size_t start;
+			size_t end;
+		};
+
+		class generator
+		{
+			function& function_;
+			bytecode output_;
+
+			std::vector<block_id> order_;
+			std::vector<size_t> position_;
+			std::vector<size_t> block_start_;
+			std::vector<size_t> block_end_;
+			std::vector<std::vector<bool>> live_in_;
+			std::vector<std::vector<bool>> live_out_;
+			std::vector<size_t> register_;
+			std::vector<size_t> results_; // how many results each call hands back
+			size_t scratch_ = 0;
+			size_t window_ = 0; // first register of a callee's window
+			size_t frame_size_ = 0;
+
+			std::vector<size_t> block_pc_;
+			std::vector<std::pair<size_t, block_id>> patches_;
+			std::map<std::int64_t, size_t> constant_index_;
+
+			[[nodiscard]] bool defines_value(const instruction& instruction) const
+			{
+				return instruction.op != opcode::nop && instruction.op != opcode::store_global && instruction.op != opcode::store_field && instruction.op != opcode::store_entry && !instruction.is_terminator();
+			}
+
+			[[nodiscard]] size_t index_in_predecessors(const block_id block, const block_id predecessor) const
+			{
+				const auto& predecessors = function_.blocks[block].predecessors;
+				return std::find(predecessors.begin(), predecessors.end(), predecessor) - predecessors.begin();
+			}
+
+			void number_instructions()
+			{
+				order_ = reverse_postorder(function_);
+				position_.assign(function_.values.size(), 0);
+				block_start_.assign(function_.blocks.size(), 0);
+				block_end_.assign(function_.blocks.size(), 0);
+
+				// even positions for instructions, odd ones are free for phi copies
+				size_t position = 0;
+				for (const auto block : order_)
+				{
+					block_start_[block] = position;
+					position += 2;
+					for (const auto id : function_.blocks[block].instructions)
+					{
+						if (function_.values[id].op == opcode::phi)
+						{
+							position_[id] = block_start_[block];
+							continue;
+						}
+						position_[id] = position;
+						position += 2;
+					}
+					block_end_[block] = position - 2;
+				}
+			}
+
+			void compute_liveness()
+			{
+				const auto value_count = function_.values.size();
+				live_in_.assign(function_.blocks.size(), std::vector<bool>(value_count, false));
+				live_out_.assign(function_.blocks.size(), std::vector<bool>(value_count, false));
+
+				for (auto changed = true; changed;)
+				{
+					changed = false;
+					for (auto block = order_.rbegin(); block != order_.rend(); ++block)
+					{
+						std::vector<bool> live(value_count, false);
+						for (const auto successor : function_.blocks[*block].successors)
+						{
+							const auto incoming = index_in_predecessors(successor, *block);
+							for (value_id id = 0; id < value_count; id++)
+							{
+								if (live_in_[successor][id])
+								{
+									live[id] = true;
+								}
+							}
+
+							// phi copies happen at the end of this block
+							for (const auto id : function_.blocks[successor].instructions)
+							{
+								if (const auto& phi = function_.values[id]; phi.op == opcode::phi)
+								{
+									live[id] = true;
+									live[phi.operands[incoming]] = true;
+								}
+							}
+						}
+						live_out_[*block] = live;
+
+						const auto& instructions = function_.blocks[*block].instructions;
+						for (auto id = instructions.rbegin(); id != instructions.rend(); ++id)
+						{
+							const auto& instruction = function_.values[*id];
+							live[*id] = false;
+							if (instruction.op == opcode::phi)
+							{
+								continue;
+							}
+							for (const auto operand : instruction.operands)
+							{
+								live[operand] = true;
+							}
+						}
+
+						if (live != live_in_[*block])
+						{
+							live_in_[*block] = std::move(live);
+							changed = true;
+						}
+					}
+				}
+			}
+
+			void allocate_registers()
+			{
+				std::vector<interval> intervals;
+				std::vector<size_t> interval_of(function_.values.size(), SIZE_MAX);
+				for (const auto block : order_)
+				{
+					for (const auto id : function_.blocks[block].instructions)
+					{
+						if (defines_value(function_.values[id]))
+						{
+							interval_of[id] = intervals.size();
+							intervals.push_back({ id, position_[id], position_[id] });
+						}
+					}
+				}
+
+				const auto extend = [&](const value_id id, const size_t position)
+				{
+					auto& range = intervals[interval_of[id]];
+					range.start = std::min(range.start, position);
+					range.end = std::max(range.end, position);
+				};
+
+				// arguments are already in place when the function starts
+				for (value_id id = 0; id < function_.values.size(); id++)
+				{
+					if (function_.values[id].op == opcode::parameter && interval_of[id] != SIZE_MAX)
+					{
+						extend(id, 0);
+					}
+				}
+
+				for (const auto block : order_)
+				{
+					for (const auto id : function_.blocks[block].instructions)
+					{
+						const auto& instruction = function_.values[id];
+						if (instruction.op == opcode::phi)
+						{
+							const auto& predecessors = function_.blocks[block].predecessors;
+							for (size_t incoming = 0; incoming < instruction.operands.size(); incoming++)
+							{
+								extend(instruction.operands[incoming], block_end_[predecessors[incoming]] - 1);
+							}
+							continue;
+						}
+						for (const auto operand : instruction.operands)
+						{
+							extend(operand, position_[id]);
+						}
+					}
+
+					for (value_id id = 0; id < function_.values.size(); id++)
+					{
+						if (interval_of[id] == SIZE_MAX)
+						{
+							continue;
+						}
+						if (live_in_[block][id])
+						{
+							extend(id, block_start_[block]);
+						}
+						if (live_out_[block][id])
+						{
+							extend(id, block_end_[block]);
+						}
+					}
+				}
+
+				std::sort(intervals.begin(), intervals.end(), [](const interval& a, const interval& b)
+				{
+					return a.start != b.start ? a.start < b.start : a.value < b.value;
+				});
+
+				register_.assign(function_.values.size(), 0);
+				std::vector<bool> in_use(scratch_register, false);
+				scratch_ = 0;
+				std::vector<const interval*> active;
+				for (const auto& current : intervals)
+				{
+					active.erase(std::remove_if(active.begin(), active.end(), [&](const interval* range)
+					{
+						if (range->end < current.start)
+						{
+							in_use[register_[range->value]] = false;
+							return true;
+						}
+						return false;
+					}), active.end());
+
+					auto free = std::find(in_use.begin(), in_use.end(), false);
+					if (const auto& value = function_.values[current.value]; value.op == opcode::parameter)
+					{
+						free = in_use.begin() + value.immediate; // parameters come first, so this is never taken
+					}
+					if (free == in_use.end())
+					{
+						codegen_error("too many live values in '%s' (line %d)", function_.name.c_str(), static_cast<int>(function_.values[current.value].position.line));
+					}
+					*free = true;
+					register_[current.value] = free - in_use.begin();
+					scratch_ = std::max(scratch_, register_[current.value] + 1);
+					active.push_back(&current);
+				}
+
+				// the scratch register goes right above the allocated ones and callee windows above that
+				window_ = scratch_ + 1;
+				frame_size_ = window_;
+				results_.assign(function_.values.size(), 1);
+				for (const auto& instruction : function_.values)
+				{
+					if (instruction.op == opcode::result)
+					{
+						auto& count = results_[instruction.operands[0]];
+						count = std::max(count, static_cast<size_t>(instruction.immediate) + 1);
+					}
+				}
+				for (value_id id = 0; id < function_.values.size(); id++)
+				{
+					const auto& instruction = function_.values[id];
+					switch (instruction.op)
+					{
+						case opcode::call:
+						case opcode::call_value:
+							frame_size_ = std::max(frame_size_, window_ + std::max(instruction.operands.size(), results_[id]));
+							break;
+						case opcode::ret:
+						case opcode::tail_call:
+						case opcode::tail_call_value:
+						case opcode::make_closure:
+						case opcode::make_object:
+						case opcode::make_array:
+						case opcode::run_kernel:
+							frame_size_ = std::max(frame_size_, window_ + instruction.operands.size());
+							break;
+						default:
+							break;
+					}
+				}
+				if (frame_size_ > register_count)
+				{
+					codegen_error("too many live values around calls in '%s'", function_.name.c_str());
+				}
+			}
+
+			void emit(const vm::i64 instruction, const vm::source_position position)
+			{
+				output_.lines.add(output_.program.size(), position);
+				output_.program.push_back(instruction);
+			}
+
+			void emit_jump(const vm::opcode op, const block_id target, const size_t condition, const vm::source_position position)
+			{
+				patches_.emplace_back(output_.program.size(), target);
+				emit(make(op, 0, condition), position);
+			}
+
+			/* registers are unsigned, the instruction fields they go into are not */
+			[[nodiscard]] static vm::i64 make(const vm::opcode op, const size_t destination, const size_t source, const std::int32_t operand = 0)
+			{
+				return vm::i64(op, operand, static_cast<std::int16_t>(source), static_cast<std::int8_t>(destination));
+			}
+
+			void emit_move(const size_t destination, const size_t source, const bool generic, const vm::source_position position)
+			{
+				emit(make(generic ? vm::opcode::movev : vm::opcode::move, destination, source), position);
+			}
+
+			/* generic opcodes read the tag of every operand, statically typed values never set one */
+			void emit_tag(const size_t destination, const value_type type, const vm::source_position position)
+			{
+				const auto tag = type == value_type::floating ? vm::value_type::floating : type == value_type::boolean ? vm::value_type::boolean : vm::value_type::integer;
+				emit(make(vm::opcode::tag, destination, 0, static_cast<std::int32_t>(tag)), position);
+			}
+
+			void emit_operand_tag(const value_id operand, const vm::source_position position)
+			{
+				if (const auto type = function_.values[operand].type; type != value_type::dynamic)
+				{
+					emit_tag(register_[operand], type, position);
+				}
+			}
+
+			void emit_phi_copies(const block_id block, const block_id successor, const vm::source_position position)
+			{
+				struct copy
+				{
+					size_t destination;
+					size_t source;
+					bool generic; // the value carries a runtime tag that has to move with it
+				};
+
+				const auto incoming = index_in_predecessors(successor, block);
+
+				std::vector<copy> pending;
+				for (const auto id : function_.blocks[successor].instructions)
+				{
+					if (const auto& phi = function_.values[id]; phi.op == opcode::phi && register_[id] != register_[phi.operands[incoming]])
+					{
+						pending.push_back({ register_[id], register_[phi.operands[incoming]], function_.values[phi.operands[incoming]].type == value_type::dynamic });
+					}
+				}
+
+				while (!pending.empty())
+				{
+					const auto ready = std::find_if(pending.begin(), pending.end(), [&](const copy& candidate)
+					{
+						return std::none_of(pending.begin(), pending.end(), [&](const copy& other)
+						{
+							return other.source == candidate.destination;
+						});
+					});
+
+					if (ready != pending.end())
+					{
+						emit_move(ready->destination, ready->source, ready->generic, position);
+						pending.erase(ready);
+						continue;
+					}
+
+					// every destination is still read by another copy: save one aside
+					const auto saved = pending.front().destination;
+					emit_move(scratch_, saved, true, position);
+					for (auto& candidate : pending)
+					{
+						if (candidate.source == saved)
+						{
+							candidate.source = scratch_;
+						}
+					}
+				}
+
+				// statically typed values flowing into dynamically typed phis
+				for (const auto id : function_.blocks[successor].instructions)
+				{
+					if (const auto& phi = function_.values[id]; phi.op == opcode::phi && phi.type == value_type::dynamic)
+					{
+						if (const auto type = function_.values[phi.operands[incoming]].type; type != value_type::dynamic)
+						{
+							emit_tag(register_[id], type, position);
+						}
+					}
+				}
+			}
+
+			/* register holding the operand as a double, converting integers through the scratch register */
+			size_t floating_operand(const value_id operand, const vm::source_position position)
+			{
+				if (function_.values[operand].type == value_type::floating)
+				{
+					return register_[operand];
+				}
+				emit(make(vm::opcode::itof, scratch_, register_[operand]), position);
+				return scratch_;
+			}
+
+			void emit_arithmetic(const value_id id, const instruction& instruction)
+			{
+				constexpr vm::opcode integer[] = { vm::opcode::addr, vm::opcode::subr, vm::opcode::mulr, vm::opcode::divr };
+				constexpr vm::opcode floating[] = { vm::opcode::addf, vm::opcode::subf, vm::opcode::mulf, vm::opcode::divf };
+				constexpr vm::opcode generic[] = { vm::opcode::addv, vm::opcode::subv, vm::opcode::mulv, vm::opcode::divv };
+
+				const auto index = static_cast<size_t>(instruction.op) - static_cast<size_t>(opcode::add);
+				const auto lhs = instruction.operands[0];
+				const auto rhs = instruction.operands[1];
+				switch (instruction.type)
+				{
+					case value_type::floating:
+					{
+						// at most one side is an integer, so the scratch register is enough
+						const auto left = floating_operand(lhs, instruction.position);
+						const auto right = floating_operand(rhs, instruction.position);
+						emit(make(floating[index], register_[id], left, static_cast<std::int32_t>(right)), instruction.position);
+						break;
+					}
+					case value_type::dynamic:
+					{
+						emit_operand_tag(lhs, instruction.position);
+						emit_operand_tag(rhs, instruction.position);
+						emit(make(generic[index], register_[id], register_[lhs], static_cast<std::int32_t>(register_[rhs])), instruction.position);
+						break;
+					}
+					default:
+					{
+						emit(make(integer[index], register_[id], register_[lhs], static_cast<std::int32_t>(register_[rhs])), instruction.position);
+						break;
+					}
+				}
+			}
+
+			void emit_unary(const value_id id, const instruction& instruction)
+			{
+				const auto operand = instruction.operands[0];
+				const auto type = function_.values[operand].type;
+				const auto negate = instruction.op == opcode::neg;
+
+				auto op = negate ? vm::opcode::neg : vm::opcode::lnot;
+				if (type == value_type::floating)
+				{
+					op = negate ? vm::opcode::negf : vm::opcode::lnotf;
+				}
+				else if (type == value_type::dynamic)
+				{
+					op = negate ? vm::opcode::negv : vm::opcode::lnotv;
+				}
+				emit(make(op, register_[id], register_[operand]), instruction.position);
+			}
+
+			void emit_constant(const value_id id, const instruction& instruction)
+			{
+				if (instruction.immediate >= std::numeric_limits<std::int32_t>::min() && instruction.immediate <= std::numeric_limits<std::int32_t>::max())
+				{
+					return emit(make(vm::opcode::load, register_[id], 0, static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+				}
+
+				auto [index, inserted] = constant_index_.emplace(instruction.immediate, output_.constants.size());
+				if (inserted)
+				{
+					output_.constants.push_back(instruction.immediate);
+				}
+				emit(make(vm::opcode::loadk, register_[id], 0, static_cast<std::int32_t>(index->second)), instruction.position);
+			}
+
+			/* callees see every value as dynamic, so statically typed ones get their tag on the way */
+			void emit_window(const std::vector<value_id>& values, const vm::source_position position)
+			{
+				for (size_t index = 0; index < values.size(); index++)
+				{
+					const auto& value = function_.values[values[index]];
+					emit_move(window_ + index, register_[values[index]], value.type == value_type::dynamic, position);
+					if (value.type != value_type::dynamic)
+					{
+						emit_tag(window_ + index, value.type, position);
+					}
+				}
+			}
+
+			/* each getf and setf gets a cache of its own in the VM */
+			[[nodiscard]] std::int32_t field_site(const instruction& instruction)
+			{
+				output_.layout.sites.push_back(static_cast<std::uint32_t>(instruction.immediate));
+				return static_cast<std::int32_t>(output_.layout.sites.size() - 1);
+			}
+
+			void emit_return(const instruction& instruction)
+			{
+				if (instruction.operands.size() == 1)
+				{
+					// a single value is returned from wherever it is
+					const auto value = instruction.operands[0];
+					emit_operand_tag(value, instruction.position);
+					emit(make(vm::opcode::ret, register_[value], 1), instruction.position);
+					return;
+				}
+				emit_window(instruction.operands, instruction.position);
+				emit(make(vm::opcode::ret, window_, instruction.operands.size()), instruction.position);
+			}
+
+			void emit_block(const block_id block, const block_id next)
+			{
+				block_pc_[block] = output_.program.size();
+				for (const auto id : function_.blocks[block].instructions)
+				{
+					const auto& instruction = function_.values[id];
+					const auto& successors = function_.blocks[block].successors;
+					switch (instruction.op)
+					{
+						case opcode::nop:
+						case opcode::phi:
+							break;
+						case opcode::constant:
+							emit_constant(id, instruction);
+							break;
+						case opcode::copy:
+							if (register_[id] != register_[instruction.operands[0]])
+							{
+								emit_move(register_[id], register_[instruction.operands[0]], instruction.type == value_type::dynamic, instruction.position);
+							}
+							break;
+						case opcode::add:
+						case opcode::sub:
+						case opcode::mul:
+						case opcode::div:
+							emit_arithmetic(id, instruction);
+							break;
+						case opcode::neg:
+						case opcode::logical_not:
+							emit_unary(id, instruction);
+							break;
+						case opcode::jump:
+							emit_phi_copies(block, successors[0], instruction.position);
+							if (successors[0] != next)
+							{
+								emit_jump(vm::opcode::jmp, successors[0], 0, instruction.position);
+							}
+							break;
+						case opcode::branch:
+						{
+							// jz/jnz test the raw bits, other types are turned into a negated boolean first
+							auto condition = register_[instruction.operands[0]];
+							auto if_true = vm::opcode::jnz;
+							auto if_false = vm::opcode::jz;
+							if (const auto type = function_.values[instruction.operands[0]].type; !is_integral(type))
+							{
+								const auto op = type == value_type::floating ? vm::opcode::lnotf : vm::opcode::lnotv;
+								emit(make(op, scratch_, condition), instruction.position);
+								condition = scratch_;
+								std::swap(if_true, if_false);
+							}
+
+							if (successors[1] == next)
+							{
+								emit_jump(if_true, successors[0], condition, instruction.position);
+								break;
+							}
+							emit_jump(if_false, successors[1], condition, instruction.position);
+							if (successors[0] != next)
+							{
+								emit_jump(vm::opcode::jmp, successors[0], 0, instruction.position);
+							}
+							break;
+						}
+						case opcode::parameter:
+							break; // precoloured
+						case opcode::call:
+							emit_window(instruction.operands, instruction.position);
+							emit(make(vm::opcode::call, window_, results_[id], static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+							emit_move(register_[id], window_, true, instruction.position);
+							break;
+						case opcode::result:
+							emit_move(register_[id], window_ + instruction.immediate, true, instruction.position);
+							break;
+						case opcode::call_value:
+							// the closure goes right behind the arguments
+							emit_window(instruction.operands, instruction.position);
+							emit(make(vm::opcode::callv, window_, results_[id], static_cast<std::int32_t>(instruction.operands.size() - 1)), instruction.position);
+							emit_move(register_[id], window_, true, instruction.position);
+							break;
+						case opcode::make_closure:
+							emit_window(instruction.operands, instruction.position);
+							emit(make(vm::opcode::closure, register_[id], window_, static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+							break;
+						case opcode::make_object:
+							emit_window(instruction.operands, instruction.position);
+							emit(make(vm::opcode::object, register_[id], window_, static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+							break;
+						case opcode::load_field:
+							emit_operand_tag(instruction.operands[0], instruction.position);
+							emit(make(vm::opcode::getf, register_[id], register_[instruction.operands[0]], field_site(instruction)), instruction.position);
+							break;
+						case opcode::store_field:
+							// the value is stored with its tag, and a receiver that is not an object has to be refused
+							emit_operand_tag(instruction.operands[0], instruction.position);
+							emit_operand_tag(instruction.operands[1], instruction.position);
+							emit(make(vm::opcode::setf, register_[instruction.operands[0]], register_[instruction.operands[1]], field_site(instruction)), instruction.position);
+							break;
+						case opcode::make_map:
+							emit(make(vm::opcode::map, register_[id], 0), instruction.position);
+							break;
+						case opcode::load_entry:
+						case opcode::has_entry:
+						case opcode::next_entry:
+						case opcode::entry_key:
+						{
+							// keys and positions are checked by their tag
+							emit_operand_tag(instruction.operands[0], instruction.position);
+							emit_operand_tag(instruction.operands[1], instruction.position);
+							const auto op = instruction.op == opcode::load_entry ? vm::opcode::getk : instruction.op == opcode::has_entry ? vm::opcode::hask : instruction.op == opcode::next_entry ? vm::opcode::nextk : vm::opcode::keyk;
+							emit(make(op, register_[id], register_[instruction.operands[0]], static_cast<std::int32_t>(register_[instruction.operands[1]])), instruction.position);
+							break;
+						}
+						case opcode::store_entry:
+							for (const auto operand : instruction.operands)
+							{
+								emit_operand_tag(operand, instruction.position);
+							}
+							emit(make(vm::opcode::setk, register_[instruction.operands[0]], register_[instruction.operands[1]], static_cast<std::int32_t>(register_[instruction.operands[2]])), instruction.position);
+							break;
+						case opcode::make_array:
+							emit_window(instruction.operands, instruction.position);
+							emit(make(vm::opcode::array, register_[id], window_, static_cast<std::int32_t>(instruction.operands.size())), instruction.position);
+							break;
+						case opcode::run_kernel:
+							emit_window(instruction.operands, instruction.position);
+							emit(make(vm::opcode::vec, register_[id], window_, static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+							break;
+						case opcode::load_upvalue:
+							emit(make(vm::opcode::getu, register_[id], 0, static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+							break;
+						case opcode::current_closure:
+							emit(make(vm::opcode::self, register_[id], 0), instruction.position);
+							break;
+						case opcode::load_global:
+							emit(make(vm::opcode::getg, register_[id], 0, static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+							break;
+						case opcode::store_global:
+							emit_operand_tag(instruction.operands[0], instruction.position);
+							emit(make(vm::opcode::setg, 0, register_[instruction.operands[0]], static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+							break;
+						case opcode::halt:
+							emit(vm::i64(vm::opcode::halt), instruction.position);
+							break;
+						case opcode::ret:
+							emit_return(instruction);
+							break;
+						case opcode::tail_call:
+							emit_window(instruction.operands, instruction.position);
+							emit(make(vm::opcode::tailcall, window_, 0, static_cast<std::int32_t>(instruction.immediate)), instruction.position);
+							break;
+						case opcode::tail_call_value:
+							emit_window(instruction.operands, instruction.position);
+							emit(make(vm::opcode::tailcallv, window_, 0, static_cast<std::int32_t>(instruction.operands.size() - 1)), instruction.position);
+							break;
+					}
+				}
+			}
+		public:
+			explicit generator(function& function)
+				: function_(function) {}
+
+			bytecode generate()
+			{
+				remove_unreachable_blocks(function_);
+				split_critical_edges(function_);
+				infer_types(function_);
+				number_instructions();
+				compute_liveness();
+				allocate_registers();
+
+				block_pc_.assign(function_.blocks.size(), 0);
+				for (size_t index = 0; index < order_.size(); index++)
+				{
+					emit_block(order_[index], index + 1 < order_.size() ? order_[index + 1] : no_block);
+				}
+
+				for (const auto& [pc, target] : patches_)
+				{
+					output_.program[pc].a = static_cast<std::uint32_t>(block_pc_[target]);
+				}
+
+				output_.functions.push_back({ function_.name, 0, static_cast<std::uint32_t>(function_.parameters), static_cast<std::uint32_t>(frame_size_), static_cast<std::uint32_t>(function_.upvalues) });
+				return std::move(output_);
+			}
+		};
+	}
+
+	bytecode generate(function& function)
+	{
+		return generator(function).generate();
+	}
+}
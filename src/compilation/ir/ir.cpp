@@ -0,0 +1,282 @@
+/*
+ * File Name: ir.cpp
+ * Author(s): P. Kamara
+ *
+ * SSA intermediate representation.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "compilation/ir/ir.h"
+#include "vm/array.h"
+
+namespace cherie::compiler::ir
+{
+	void function::replace_uses(const value_id from, const value_id to)
+	{
+		for (auto& instruction : values)
+		{
+			std::replace(instruction.operands.begin(), instruction.operands.end(), from, to);
+		}
+	}
+
+	void function::remove_edge(const block_id from, const block_id to)
+	{
+		auto& successors = blocks[from].successors;
+		successors.erase(std::find(successors.begin(), successors.end(), to));
+
+		auto& predecessors = blocks[to].predecessors;
+		const auto index = std::find(predecessors.begin(), predecessors.end(), from) - predecessors.begin();
+		predecessors.erase(predecessors.begin() + index);
+		for (const auto id : blocks[to].instructions)
+		{
+			if (auto& phi = values[id]; phi.op == opcode::phi && static_cast<size_t>(index) < phi.operands.size())
+			{
+				phi.operands.erase(phi.operands.begin() + index);
+			}
+		}
+	}
+
+	void function::compact()
+	{
+		for (auto& block : blocks)
+		{
+			block.instructions.erase(std::remove_if(block.instructions.begin(), block.instructions.end(), [this](const value_id id)
+			{
+				return values[id].op == opcode::nop;
+			}), block.instructions.end());
+		}
+	}
+
+	size_t function::instruction_count() const
+	{
+		size_t count = 0;
+		for (const auto& block : blocks)
+		{
+			count += block.instructions.size();
+		}
+		return count;
+	}
+
+	namespace
+	{
+		/* whether every operand is a number or a boolean, the generic opcodes trap on functions, objects, maps and arrays */
+		bool numeric_operands(const function& function, const instruction& instruction)
+		{
+			return std::all_of(instruction.operands.begin(), instruction.operands.end(), [&function](const value_id operand)
+			{
+				const auto type = function.values[operand].type;
+				return type == value_type::integer || type == value_type::floating || type == value_type::boolean;
+			});
+		}
+	}
+
+	bool has_side_effects(const function& function, const instruction& instruction)
+	{
+		switch (instruction.op)
+		{
+			case opcode::add:
+			case opcode::sub:
+			case opcode::mul:
+			case opcode::neg:
+			case opcode::logical_not:
+			{
+				return !numeric_operands(function, instruction);
+			}
+			case opcode::div:
+			{
+				if (!numeric_operands(function, instruction))
+				{
+					return true;
+				}
+
+				// integer division can trap, unless the divisor is a known non-zero constant
+				if (instruction.type == value_type::floating)
+				{
+					return false;
+				}
+				const auto& divisor = function.values[instruction.operands[1]];
+				return divisor.op != opcode::constant || divisor.type == value_type::floating || divisor.immediate == 0;
+			}
+			case opcode::call:
+			case opcode::call_value:
+			case opcode::result: // pinned next to its call, which clobbers the registers it reads
+			case opcode::make_object: // every object is a new one, and its fields can change
+			case opcode::load_field:  // traps on a missing field, and stores and calls can change it
+			case opcode::store_field:
+			case opcode::make_map: // like objects, and the others trap on bad keys and positions
+			case opcode::load_entry:
+			case opcode::has_entry:
+			case opcode::next_entry:
+			case opcode::entry_key:
+			case opcode::store_entry:
+			case opcode::make_array: // traps on elements that are not numbers, and kernels read arrays that stores change
+			case opcode::run_kernel:
+			case opcode::load_global: // calls and stores can change it
+			case opcode::store_global:
+			case opcode::jump:
+			case opcode::branch:
+			case opcode::halt:
+			case opcode::ret:
+			case opcode::tail_call:
+			case opcode::tail_call_value:
+			{
+				return true;
+			}
+			default:
+			{
+				return false;
+			}
+		}
+	}
+
+	std::optional<std::int64_t> evaluate(const opcode op, const std::int64_t lhs, const std::int64_t rhs)
+	{
+		const auto a = static_cast<std::uint64_t>(lhs);
+		const auto b = static_cast<std::uint64_t>(rhs);
+		switch (op)
+		{
+			case opcode::add: return static_cast<std::int64_t>(a + b);
+			case opcode::sub: return static_cast<std::int64_t>(a - b);
+			case opcode::mul: return static_cast<std::int64_t>(a * b);
+			case opcode::div:
+			{
+				if (rhs == 0)
+				{
+					return std::nullopt;
+				}
+				return rhs == -1 ? static_cast<std::int64_t>(0 - a) : lhs / rhs;
+			}
+			case opcode::neg: return static_cast<std::int64_t>(0 - a);
+			case opcode::logical_not: return lhs == 0;
+			default: return std::nullopt;
+		}
+	}
+
+	double as_double(const std::int64_t bits)
+	{
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	std::int64_t from_double(const double value)
+	{
+		std::int64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	const char* type_name(const value_type type)
+	{
+		switch (type)
+		{
+			case value_type::unknown: return "?";
+			case value_type::integer: return "int";
+			case value_type::floating: return "float";
+			case value_type::boolean: return "bool";
+			case value_type::dynamic: return "any";
+		}
+		return "?";
+	}
+
+	const char* opcode_name(const opcode op)
+	{
+		switch (op)
+		{
+			case opcode::nop: return "nop";
+			case opcode::constant: return "const";
+			case opcode::copy: return "copy";
+			case opcode::phi: return "phi";
+			case opcode::add: return "add";
+			case opcode::sub: return "sub";
+			case opcode::mul: return "mul";
+			case opcode::div: return "div";
+			case opcode::neg: return "neg";
+			case opcode::logical_not: return "not";
+			case opcode::jump: return "jump";
+			case opcode::branch: return "branch";
+			case opcode::halt: return "halt";
+			case opcode::parameter: return "param";
+			case opcode::call: return "call";
+			case opcode::result: return "result";
+			case opcode::load_global: return "getg";
+			case opcode::store_global: return "setg";
+			case opcode::make_closure: return "closure";
+			case opcode::load_upvalue: return "getu";
+			case opcode::current_closure: return "self";
+			case opcode::call_value: return "callv";
+			case opcode::make_object: return "object";
+			case opcode::load_field: return "getf";
+			case opcode::store_field: return "setf";
+			case opcode::make_map: return "map";
+			case opcode::load_entry: return "getk";
+			case opcode::has_entry: return "hask";
+			case opcode::next_entry: return "nextk";
+			case opcode::entry_key: return "keyk";
+			case opcode::store_entry: return "setk";
+			case opcode::make_array: return "array";
+			case opcode::run_kernel: return "vec";
+			case opcode::ret: return "ret";
+			case opcode::tail_call: return "tailcall";
+			case opcode::tail_call_value: return "tailcallv";
+		}
+		return "?";
+	}
+
+	void print(const function& function, std::FILE* out)
+	{
+		std::fprintf(out, "function %s\n", function.name.c_str());
+		for (block_id block = 0; block < function.blocks.size(); block++)
+		{
+			std::fprintf(out, "b%u:", block);
+			for (const auto predecessor : function.blocks[block].predecessors)
+			{
+				std::fprintf(out, " <- b%u", predecessor);
+			}
+			std::fprintf(out, "\n");
+
+			for (const auto id : function.blocks[block].instructions)
+			{
+				const auto& instruction = function.values[id];
+				std::fprintf(out, "    %%%u:%s = %s", id, type_name(instruction.type), opcode_name(instruction.op));
+				if (instruction.op == opcode::constant && instruction.type == value_type::floating)
+				{
+					std::fprintf(out, " %g", as_double(instruction.immediate));
+				}
+				else if (instruction.op == opcode::constant || instruction.op == opcode::parameter || instruction.op == opcode::result || instruction.op == opcode::load_global || instruction.op == opcode::store_global || instruction.op == opcode::load_upvalue)
+				{
+					std::fprintf(out, " %lld", static_cast<long long>(instruction.immediate));
+				}
+				else if (instruction.op == opcode::call || instruction.op == opcode::tail_call || instruction.op == opcode::make_closure)
+				{
+					std::fprintf(out, " f%lld", static_cast<long long>(instruction.immediate));
+				}
+				else if (instruction.op == opcode::make_object)
+				{
+					std::fprintf(out, " s%lld", static_cast<long long>(instruction.immediate));
+				}
+				else if (instruction.op == opcode::load_field || instruction.op == opcode::store_field)
+				{
+					std::fprintf(out, " .%lld", static_cast<long long>(instruction.immediate));
+				}
+				else if (instruction.op == opcode::run_kernel)
+				{
+					std::fprintf(out, " %s", vm::kernel_name(static_cast<vm::kernel>(instruction.immediate)));
+				}
+				for (const auto operand : instruction.operands)
+				{
+					std::fprintf(out, " %%%u", operand);
+				}
+				for (const auto successor : function.blocks[block].successors)
+				{
+					if (instruction.is_terminator())
+					{
+						std::fprintf(out, " b%u", successor);
+					}
+				}
+				std::fprintf(out, "\n");
+			}
+		}
+	}
+}
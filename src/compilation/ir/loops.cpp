@@ -0,0 +1,469 @@
+/*
+ * File Name: loops.cpp
+ * Author(s): P. Kamara
+ *
+ * Loop optimisations over the IR.
+ */
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#include "compilation/ir/analysis.h"
+#include "compilation/ir/loops.h"
+
+namespace cherie::compiler::ir
+{
+	namespace
+	{
+		size_t index_of(const std::vector<block_id>& blocks, const block_id block)
+		{
+			return std::find(blocks.begin(), blocks.end(), block) - blocks.begin();
+		}
+
+		/* puts an existing instruction right before the block's terminator */
+		void place(function& function, const block_id block, const value_id id)
+		{
+			auto& instructions = function.blocks[block].instructions;
+			instructions.insert(instructions.end() - 1, id);
+			function.values[id].block = block;
+		}
+
+		value_id insert(function& function, const block_id block, instruction instruction)
+		{
+			function.values.push_back(std::move(instruction));
+			const auto id = static_cast<value_id>(function.values.size() - 1);
+			place(function, block, id);
+			return id;
+		}
+
+		value_id make_constant(function& function, const block_id block, const std::int64_t immediate, const vm::source_position position)
+		{
+			instruction constant;
+			constant.op = opcode::constant;
+			constant.type = value_type::integer;
+			constant.immediate = immediate;
+			constant.position = position;
+			return insert(function, block, std::move(constant));
+		}
+
+		std::optional<std::int64_t> constant_value(const function& function, const value_id id)
+		{
+			// the simulation and the rewrites below are integer only
+			if (const auto& value = function.values[id]; value.op == opcode::constant && is_integral(value.type))
+			{
+				return value.immediate;
+			}
+			return std::nullopt;
+		}
+
+		void retire(function& function, const value_id id)
+		{
+			auto& instruction = function.values[id];
+			instruction.op = opcode::nop;
+			instruction.operands.clear();
+		}
+
+		/* a loop entered only from its preheader and closed by a single back edge */
+		bool is_simple(const function& function, const loop& loop)
+		{
+			return loop.preheader != no_block && loop.latches.size() == 1 && function.blocks[loop.header].predecessors.size() == 2;
+		}
+
+		/* runs the loop on constants until the header branch falls out of it */
+		std::optional<size_t> trip_count(const function& function, const loop& loop, const std::vector<value_id>& phis, const std::vector<value_id>& body, const size_t max_trip_count)
+		{
+			const auto& header = function.blocks[loop.header];
+			const auto entry = index_of(header.predecessors, loop.preheader);
+			const auto back = index_of(header.predecessors, loop.latches.front());
+
+			std::vector<std::optional<std::int64_t>> known(function.values.size());
+			const auto value_of = [&](const value_id id)
+			{
+				const auto constant = constant_value(function, id);
+				return constant ? constant : known[id];
+			};
+
+			const auto step = [&](const value_id id)
+			{
+				const auto& instruction = function.values[id];
+				std::optional<std::int64_t> result;
+				switch (instruction.op)
+				{
+					case opcode::copy:
+						result = value_of(instruction.operands[0]);
+						break;
+					case opcode::add:
+					case opcode::sub:
+					case opcode::mul:
+					case opcode::div:
+					{
+						const auto lhs = value_of(instruction.operands[0]);
+						const auto rhs = value_of(instruction.operands[1]);
+						if (lhs && rhs)
+						{
+							result = evaluate(instruction.op, *lhs, *rhs);
+						}
+						break;
+					}
+					case opcode::neg:
+					case opcode::logical_not:
+						if (const auto operand = value_of(instruction.operands[0]))
+						{
+							result = evaluate(instruction.op, *operand);
+						}
+						break;
+					default:
+						break;
+				}
+				known[id] = result;
+			};
+
+			std::vector<std::optional<std::int64_t>> incoming;
+			for (const auto phi : phis)
+			{
+				incoming.push_back(value_of(function.values[phi].operands[entry]));
+			}
+
+			for (size_t trip = 0; trip <= max_trip_count; trip++)
+			{
+				for (size_t index = 0; index < phis.size(); index++)
+				{
+					known[phis[index]] = incoming[index];
+				}
+
+				for (const auto id : header.instructions)
+				{
+					const auto& instruction = function.values[id];
+					if (instruction.op == opcode::branch)
+					{
+						const auto condition = value_of(instruction.operands[0]);
+						if (!condition)
+						{
+							return std::nullopt;
+						}
+						if (*condition == 0)
+						{
+							return trip;
+						}
+					}
+					else if (instruction.op != opcode::phi)
+					{
+						step(id);
+					}
+				}
+
+				for (const auto id : body)
+				{
+					step(id);
+				}
+
+				for (size_t index = 0; index < phis.size(); index++)
+				{
+					incoming[index] = value_of(function.values[phis[index]].operands[back]);
+				}
+			}
+			return std::nullopt;
+		}
+
+		bool unroll(function& function, const loop& loop, const size_t max_trip_count, const size_t max_instructions)
+		{
+			if (loop.blocks.size() != 2 || !is_simple(function, loop))
+			{
+				return false;
+			}
+
+			const auto header = loop.header;
+			const auto latch = loop.blocks[1];
+			const auto preheader = loop.preheader;
+			if (function.values[function.blocks[header].instructions.back()].op != opcode::branch || function.blocks[header].successors[0] != latch)
+			{
+				return false;
+			}
+
+			const auto exit = function.blocks[header].successors[1];
+			if (exit == header || function.blocks[exit].predecessors.size() != 1)
+			{
+				return false;
+			}
+
+			std::vector<value_id> phis;
+			std::vector<value_id> header_code;
+			for (const auto id : function.blocks[header].instructions)
+			{
+				const auto& instruction = function.values[id];
+				if (instruction.op == opcode::phi)
+				{
+					phis.push_back(id);
+				}
+				else if (!instruction.is_terminator())
+				{
+					header_code.push_back(id);
+				}
+			}
+			const std::vector<value_id> body(function.blocks[latch].instructions.begin(), function.blocks[latch].instructions.end() - 1);
+
+			const auto trips = trip_count(function, loop, phis, body, max_trip_count);
+			if (!trips || header_code.size() * (*trips + 1) + body.size() * *trips > max_instructions)
+			{
+				return false;
+			}
+
+			const auto entry = index_of(function.blocks[header].predecessors, preheader);
+			const auto back = index_of(function.blocks[header].predecessors, latch);
+
+			std::unordered_map<value_id, value_id> mapping;
+			const auto resolve = [&](const value_id id)
+			{
+				const auto mapped = mapping.find(id);
+				return mapped != mapping.end() ? mapped->second : id;
+			};
+			const auto clone = [&](const value_id id)
+			{
+				auto copy = function.values[id];
+				for (auto& operand : copy.operands)
+				{
+					operand = resolve(operand);
+				}
+				mapping[id] = insert(function, preheader, std::move(copy));
+			};
+
+			for (const auto phi : phis)
+			{
+				mapping[phi] = function.values[phi].operands[entry];
+			}
+
+			for (size_t iteration = 0;; iteration++)
+			{
+				std::for_each(header_code.begin(), header_code.end(), clone);
+				if (iteration == *trips)
+				{
+					break;
+				}
+				std::for_each(body.begin(), body.end(), clone);
+
+				std::vector<value_id> next;
+				for (const auto phi : phis)
+				{
+					next.push_back(resolve(function.values[phi].operands[back]));
+				}
+				for (size_t index = 0; index < phis.size(); index++)
+				{
+					mapping[phis[index]] = next[index];
+				}
+			}
+
+			for (const auto block : { header, latch })
+			{
+				for (const auto id : function.blocks[block].instructions)
+				{
+					retire(function, id);
+				}
+				function.blocks[block].instructions.clear();
+			}
+
+			function.remove_edge(header, latch);
+			function.remove_edge(latch, header);
+			function.remove_edge(header, exit);
+			function.remove_edge(preheader, header);
+			function.add_edge(preheader, exit);
+
+			// only header values can be used past the loop
+			for (const auto id : phis)
+			{
+				function.replace_uses(id, mapping[id]);
+			}
+			for (const auto id : header_code)
+			{
+				function.replace_uses(id, mapping[id]);
+			}
+			return true;
+		}
+	}
+
+	size_t hoist_loop_invariants(function& function)
+	{
+		const auto dominators = compute_dominators(function);
+		size_t hoisted = 0;
+
+		for (const auto& loop : find_loops(function, dominators))
+		{
+			if (loop.preheader == no_block)
+			{
+				continue;
+			}
+
+			for (auto changed = true; changed;)
+			{
+				changed = false;
+				for (const auto block : loop.blocks)
+				{
+					const auto instructions = function.blocks[block].instructions;
+					for (const auto id : instructions)
+					{
+						const auto& instruction = function.values[id];
+						if (instruction.op == opcode::phi || instruction.is_terminator() || has_side_effects(function, instruction))
+						{
+							continue;
+						}
+
+						const auto invariant = std::none_of(instruction.operands.begin(), instruction.operands.end(), [&](const value_id operand)
+						{
+							return loop.has(function.values[operand].block);
+						});
+						if (!invariant)
+						{
+							continue;
+						}
+
+						auto& from = function.blocks[block].instructions;
+						from.erase(std::find(from.begin(), from.end(), id));
+						place(function, loop.preheader, id);
+						hoisted++;
+						changed = true;
+					}
+				}
+			}
+		}
+		return hoisted;
+	}
+
+	size_t reduce_induction_variables(function& function)
+	{
+		const auto dominators = compute_dominators(function);
+		size_t reduced = 0;
+
+		for (const auto& loop : find_loops(function, dominators))
+		{
+			if (!is_simple(function, loop))
+			{
+				continue;
+			}
+
+			const auto header = loop.header;
+			const auto latch = loop.latches.front();
+			const auto entry = index_of(function.blocks[header].predecessors, loop.preheader);
+			const auto back = index_of(function.blocks[header].predecessors, latch);
+
+			// basic induction variables: phi = phi(init, phi +/- constant)
+			std::unordered_map<value_id, std::int64_t> steps;
+			for (const auto id : function.blocks[header].instructions)
+			{
+				const auto& phi = function.values[id];
+				if (phi.op != opcode::phi || phi.type != value_type::integer)
+				{
+					continue;
+				}
+
+				const auto& next = function.values[phi.operands[back]];
+				if (next.op == opcode::add && (next.operands[0] == id || next.operands[1] == id))
+				{
+					if (const auto step = constant_value(function, next.operands[next.operands[0] == id ? 1 : 0]))
+					{
+						steps[id] = *step;
+					}
+				}
+				else if (next.op == opcode::sub && next.operands[0] == id)
+				{
+					if (const auto step = constant_value(function, next.operands[1]))
+					{
+						steps[id] = *evaluate(opcode::neg, *step);
+					}
+				}
+			}
+
+			std::map<std::pair<value_id, std::int64_t>, value_id> derived;
+			for (const auto block : loop.blocks)
+			{
+				const auto instructions = function.blocks[block].instructions;
+				for (const auto id : instructions)
+				{
+					const auto& product = function.values[id];
+					if (product.op != opcode::mul || product.type != value_type::integer)
+					{
+						continue;
+					}
+
+					const auto induction = steps.count(product.operands[0]) ? 0 : steps.count(product.operands[1]) ? 1 : 2;
+					if (induction == 2)
+					{
+						continue;
+					}
+					const auto variable = product.operands[induction];
+					const auto factor = constant_value(function, product.operands[1 - induction]);
+					if (!factor)
+					{
+						continue;
+					}
+
+					auto [replacement, created] = derived.try_emplace({ variable, *factor }, no_value);
+					if (created)
+					{
+						const auto position = product.position;
+						const auto init = function.values[variable].operands[entry];
+
+						instruction start;
+						start.type = value_type::integer;
+						if (const auto constant = constant_value(function, init))
+						{
+							start.op = opcode::constant;
+							start.immediate = *evaluate(opcode::mul, *constant, *factor);
+						}
+						else
+						{
+							start.op = opcode::mul;
+							start.operands = { init, make_constant(function, loop.preheader, *factor, position) };
+						}
+						start.position = position;
+						const auto start_id = insert(function, loop.preheader, std::move(start));
+						const auto stride = make_constant(function, loop.preheader, *evaluate(opcode::mul, steps[variable], *factor), position);
+
+						const auto phi = function.insert_phi(header);
+						function.values[phi].position = position;
+						function.values[phi].type = value_type::integer;
+
+						instruction increment;
+						increment.op = opcode::add;
+						increment.type = value_type::integer;
+						increment.operands = { phi, stride };
+						increment.position = position;
+						const auto next = insert(function, latch, std::move(increment));
+
+						function.values[phi].operands.resize(2);
+						function.values[phi].operands[entry] = start_id;
+						function.values[phi].operands[back] = next;
+						replacement->second = phi;
+					}
+
+					function.replace_uses(id, replacement->second);
+					retire(function, id);
+					reduced++;
+				}
+			}
+		}
+
+		function.compact();
+		return reduced;
+	}
+
+	size_t unroll_loops(function& function, const size_t max_trip_count, const size_t max_instructions)
+	{
+		size_t unrolled = 0;
+
+		// one loop at a time, unrolling invalidates the loop forest
+		for (auto changed = true; changed;)
+		{
+			changed = false;
+			for (const auto& loop : find_loops(function, compute_dominators(function)))
+			{
+				if (unroll(function, loop, max_trip_count, max_instructions))
+				{
+					unrolled++;
+					changed = true;
+					break;
+				}
+			}
+		}
+		return unrolled;
+	}
+}
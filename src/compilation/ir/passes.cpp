@@ -0,0 +1,416 @@
+/*
+ * File Name: passes.cpp
+ * Author(s): P. Kamara
+ *
+ * Scalar optimisations over the IR.
+ */
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include "compilation/ir/analysis.h"
+#include "compilation/ir/passes.h"
+
+namespace cherie::compiler::ir
+{
+	namespace
+	{
+		using value_key = std::tuple<opcode, value_type, std::int64_t, block_id, std::vector<value_id>>;
+		
+		/* forwarding table: value -> value that replaces it */
+		struct forwarding
+		{
+			std::vector<value_id> target;
+
+			explicit forwarding(const function& function)
+				: target(function.values.size())
+			{
+				for (value_id id = 0; id < target.size(); id++)
+				{
+					target[id] = id;
+				}
+			}
+
+			value_id resolve(value_id id)
+			{
+				while (target[id] != id)
+				{
+					id = target[id] = target[target[id]];
+				}
+				return id;
+			}
+
+			void apply(function& function)
+			{
+				for (auto& instruction : function.values)
+				{
+					for (auto& operand : instruction.operands)
+					{
+						operand = resolve(operand);
+					}
+				}
+			}
+		};
+
+		bool is_numberable(const function& function, const instruction& instruction)
+		{
+			switch (instruction.op)
+			{
+				case opcode::nop:
+				case opcode::copy:
+				case opcode::phi:
+					return false;
+				case opcode::add:
+				case opcode::sub:
+				case opcode::mul:
+				case opcode::neg:
+				case opcode::logical_not:
+					return true; // may trap on what they are given, but the same way as the copy that is kept, which runs first
+				default:
+					return !instruction.is_terminator() && !has_side_effects(function, instruction);
+			}
+		}
+
+		value_key key_of(const instruction& instruction, forwarding& forward)
+		{
+			std::vector<value_id> operands;
+			operands.reserve(instruction.operands.size());
+			for (const auto operand : instruction.operands)
+			{
+				operands.push_back(forward.resolve(operand));
+			}
+
+			if ((instruction.op == opcode::add || instruction.op == opcode::mul) && operands[0] > operands[1])
+			{
+				std::swap(operands[0], operands[1]);
+			}
+
+			// phis are only equal to phis in the same block
+			const auto block = instruction.op == opcode::phi ? instruction.block : no_block;
+			return { instruction.op, instruction.type, instruction.immediate, block, std::move(operands) };
+		}
+
+		void remove(function& function, const value_id id)
+		{
+			auto& instruction = function.values[id];
+			instruction.op = opcode::nop;
+			instruction.operands.clear();
+		}
+	}
+	
+	size_t fold_constants(function& function)
+	{
+		size_t folded = 0;
+		for (value_id id = 0; id < function.values.size(); id++)
+		{
+			auto& instruction = function.values[id];
+			const auto constant = [&](const size_t operand) -> const ir::instruction*
+			{
+				const auto& value = function.values[instruction.operands[operand]];
+				return value.op == opcode::constant ? &value : nullptr;
+			};
+			const auto real = [](const ir::instruction* value)
+			{
+				return value->type == value_type::floating ? as_double(value->immediate) : static_cast<double>(value->immediate);
+			};
+
+			std::optional<std::int64_t> result;
+			auto type = value_type::integer;
+			switch (instruction.op)
+			{
+				case opcode::add:
+				case opcode::sub:
+				case opcode::mul:
+				case opcode::div:
+				{
+					const auto lhs = constant(0);
+					const auto rhs = constant(1);
+					if (!lhs || !rhs)
+					{
+						break;
+					}
+					if (is_integral(lhs->type) && is_integral(rhs->type))
+					{
+						result = evaluate(instruction.op, lhs->immediate, rhs->immediate);
+						break;
+					}
+
+					const auto a = real(lhs);
+					const auto b = real(rhs);
+					type = value_type::floating;
+					switch (instruction.op)
+					{
+						case opcode::add: result = from_double(a + b); break;
+						case opcode::sub: result = from_double(a - b); break;
+						case opcode::mul: result = from_double(a * b); break;
+						default: result = from_double(a / b); break;
+					}
+					break;
+				}
+				case opcode::neg:
+				{
+					if (const auto operand = constant(0); operand && operand->type == value_type::floating)
+					{
+						result = from_double(-real(operand));
+						type = value_type::floating;
+					}
+					else if (operand)
+					{
+						result = evaluate(opcode::neg, operand->immediate);
+					}
+					break;
+				}
+				case opcode::logical_not:
+				{
+					if (const auto operand = constant(0))
+					{
+						result = real(operand) == 0.0;
+						type = value_type::boolean;
+					}
+					break;
+				}
+				case opcode::branch:
+				{
+					if (const auto condition = constant(0))
+					{
+						const auto& successors = function.blocks[instruction.block].successors;
+						const auto untaken = successors[real(condition) != 0.0 ? 1 : 0];
+						instruction.op = opcode::jump;
+						instruction.operands.clear();
+						function.remove_edge(instruction.block, untaken);
+						folded++;
+					}
+					break;
+				}
+				default:
+					break;
+			}
+
+			if (result)
+			{
+				instruction.op = opcode::constant;
+				instruction.type = type;
+				instruction.immediate = *result;
+				instruction.operands.clear();
+				folded++;
+			}
+		}
+		return folded;
+	}
+
+	size_t propagate_copies(function& function)
+	{
+		forwarding forward(function);
+		size_t removed = 0;
+		
+		for (auto changed = true; changed;)
+		{
+			changed = false;
+			for (value_id id = 0; id < function.values.size(); id++)
+			{
+				auto& instruction = function.values[id];
+				auto same = no_value;
+				if (instruction.op == opcode::copy)
+				{
+					same = forward.resolve(instruction.operands[0]);
+				}
+				else if (instruction.op == opcode::phi)
+				{
+					for (const auto operand : instruction.operands)
+					{
+						const auto resolved = forward.resolve(operand);
+						if (resolved == id || resolved == same)
+						{
+							continue;
+						}
+						same = same == no_value ? resolved : no_value - 1;
+					}
+				}
+
+				if (same == no_value || same == no_value - 1)
+				{
+					continue;
+				}
+
+				forward.target[id] = same;
+				remove(function, id);
+				removed++;
+				changed = true;
+			}
+		}
+
+		forward.apply(function);
+		function.compact();
+		return removed;
+	}
+
+	size_t eliminate_common_subexpressions(function& function)
+	{
+		forwarding forward(function);
+		size_t removed = 0;
+
+		for (const auto& block : function.blocks)
+		{
+			std::map<value_key, value_id> available;
+			for (const auto id : block.instructions)
+			{
+				if (!is_numberable(function, function.values[id]))
+				{
+					continue;
+				}
+
+				auto key = key_of(function.values[id], forward);
+				if (const auto existing = available.find(key); existing != available.end())
+				{
+					forward.target[id] = existing->second;
+					remove(function, id);
+					removed++;
+					continue;
+				}
+				available.emplace(std::move(key), id);
+			}
+		}
+
+		forward.apply(function);
+		function.compact();
+		return removed;
+	}
+
+	size_t number_values(function& function)
+	{
+		const auto dominators = compute_dominators(function);
+		forwarding forward(function);
+		size_t removed = 0;
+
+		// one table for the whole walk; entries are undone when leaving a subtree
+		std::map<value_key, value_id> available;
+		std::vector<std::pair<block_id, std::vector<value_key>>> stack = { { 0, {} } };
+		std::vector<size_t> next_child(function.blocks.size(), 0);
+		
+		const auto enter = [&](const block_id block, std::vector<value_key>& inserted)
+		{
+			for (const auto id : function.blocks[block].instructions)
+			{
+				auto& instruction = function.values[id];
+				if (!is_numberable(function, instruction) && instruction.op != opcode::phi)
+				{
+					continue;
+				}
+
+				auto key = key_of(instruction, forward);
+				if (const auto existing = available.find(key); existing != available.end())
+				{
+					forward.target[id] = existing->second;
+					remove(function, id);
+					removed++;
+					continue;
+				}
+				available.emplace(key, id);
+				inserted.push_back(std::move(key));
+			}
+		};
+
+		if (function.blocks.empty())
+		{
+			return 0;
+		}
+
+		enter(0, stack.back().second);
+		while (!stack.empty())
+		{
+			auto& [block, inserted] = stack.back();
+			const auto& children = dominators.children[block];
+			if (next_child[block] < children.size())
+			{
+				const auto child = children[next_child[block]++];
+				stack.emplace_back(child, std::vector<value_key>());
+				enter(child, stack.back().second);
+				continue;
+			}
+
+			for (const auto& key : inserted)
+			{
+				available.erase(key);
+			}
+			stack.pop_back();
+		}
+
+		forward.apply(function);
+		function.compact();
+		return removed;
+	}
+
+	size_t remove_unreachable_blocks(function& function)
+	{
+		size_t removed = 0;
+		std::vector<bool> reachable(function.blocks.size(), false);
+		for (const auto block : reverse_postorder(function))
+		{
+			reachable[block] = true;
+		}
+
+		for (block_id block = 0; block < function.blocks.size(); block++)
+		{
+			if (reachable[block])
+			{
+				continue;
+			}
+
+			while (!function.blocks[block].successors.empty())
+			{
+				function.remove_edge(block, function.blocks[block].successors.back());
+			}
+			for (const auto id : function.blocks[block].instructions)
+			{
+				remove(function, id);
+				removed++;
+			}
+			function.blocks[block].instructions.clear();
+		}
+		return removed;
+	}
+
+	size_t eliminate_dead_code(function& function)
+	{
+		// unreachable blocks first, so their phi operands disappear with them
+		auto removed = remove_unreachable_blocks(function);
+
+		std::vector<bool> live(function.values.size(), false);
+		std::vector<value_id> worklist;
+		for (value_id id = 0; id < function.values.size(); id++)
+		{
+			if (const auto& instruction = function.values[id]; instruction.op != opcode::nop && has_side_effects(function, instruction))
+			{
+				live[id] = true;
+				worklist.push_back(id);
+			}
+		}
+
+		while (!worklist.empty())
+		{
+			const auto id = worklist.back();
+			worklist.pop_back();
+			for (const auto operand : function.values[id].operands)
+			{
+				if (!live[operand])
+				{
+					live[operand] = true;
+					worklist.push_back(operand);
+				}
+			}
+		}
+
+		for (value_id id = 0; id < function.values.size(); id++)
+		{
+			if (!live[id] && function.values[id].op != opcode::nop)
+			{
+				remove(function, id);
+				removed++;
+			}
+		}
+
+		function.compact();
+		return removed;
+	}
+}
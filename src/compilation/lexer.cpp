@@ -42,6 +42,10 @@ namespace cherie::compiler
 		{
 			column_++;
 		}
+		if (next_character != eof)
+		{
+			offset_++;
+		}
 
 		if (!clear_whitespace)
 		{
@@ -225,6 +229,7 @@ namespace cherie::compiler
 						case '=': return_type = token_type::EQUALS; break;
 						case '+': return_type = token_type::ADD_ASSIGN; break;
 						case '-': return_type = token_type::SUBTRACT_ASSIGN; break;
+						case '*': return_type = token_type::MULTIPLY_ASSIGN; break;
 						case '/': return_type = token_type::DIVIDE_ASSIGN; break;
 						default: break;
 					}
@@ -268,7 +273,7 @@ namespace cherie::compiler
 			case '{': return token_type::OPEN_BRACE;
 			case '}': return token_type::CLOSE_BRACE;
 			case '[': return token_type::OPEN_BRACKET;
-			case ']': return token_type::CLOSE_BRACE;
+			case ']': return token_type::CLOSE_BRACKET;
 			case ',': return token_type::COMMA;
 			case ':': return token_type::COLON;
 			case ';': return token_type::SEMICOLON;
@@ -414,4 +419,11 @@ namespace cherie::compiler
 	{
 		stream_ = std::make_unique<types::stringstream>(source);
 	}
+
+	lexer::lexer(const types::string source, const size_t line, const size_t column)
+		: lexer(source)
+	{
+		line_ = line;
+		column_ = column;
+	}
 }
@@ -0,0 +1,448 @@
+/*
+ * File Name: native.cpp
+ * Author(s): P. Kamara
+ *
+ * Ahead-of-time translation of bytecode to C++.
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <set>
+
+#include "exceptions.h"
+#include "compilation/compiler.h"
+
+namespace cherie::compiler
+{
+	namespace
+	{
+		using vm::opcode;
+
+		std::string literal(const vm::vm_register value)
+		{
+			if (value >= INT32_MIN && value <= INT32_MAX)
+			{
+				return std::to_string(value);
+			}
+			char text[48];
+			std::snprintf(text, sizeof(text), "static_cast<vm_register>(0x%llxull)", static_cast<unsigned long long>(value));
+			return text;
+		}
+
+		const char* tag_name(const std::uint32_t tag)
+		{
+			switch (static_cast<vm::value_type>(tag))
+			{
+				case vm::value_type::integer: return "integer";
+				case vm::value_type::floating: return "floating";
+				case vm::value_type::boolean: return "boolean";
+				case vm::value_type::function: return "function";
+				case vm::value_type::object: return "object";
+				case vm::value_type::map: return "map";
+				case vm::value_type::integers: return "integers";
+				case vm::value_type::floats: return "floats";
+			}
+			codegen_error("unknown value type %u", tag);
+			return "";
+		}
+
+		std::string quoted(const std::string& text)
+		{
+			std::string quoted = "\"";
+			for (const auto character : text)
+			{
+				if (character == '"' || character == '\\')
+				{
+					quoted += '\\';
+				}
+				quoted += character;
+			}
+			return quoted + "\"";
+		}
+
+		class translator
+		{
+			const ir::bytecode& code_;
+			std::ostream& out_;
+			std::uint32_t function_;
+			std::uint32_t begin_;
+			std::uint32_t end_;
+			std::set<std::uint32_t> targets_;
+			std::uint32_t pc_ = 0;
+			int depth_ = 0;
+
+			[[nodiscard]] std::string r(const size_t index) const
+			{
+				return "r[" + std::to_string(index) + "]";
+			}
+
+			[[nodiscard]] std::string t(const size_t index) const
+			{
+				return "t[" + std::to_string(index) + "]";
+			}
+
+			[[nodiscard]] static std::string callee(const std::uint32_t function)
+			{
+				return "function_" + std::to_string(function);
+			}
+
+			void line(const std::string& text) const
+			{
+				out_ << std::string(2 + depth_, '\t') << text << "\n";
+			}
+
+			/* before anything that can fail, the interpreter's helpers report the line of this pc */
+			void at() const
+			{
+				line("rt::at(vm, r, t, " + std::to_string(pc_) + ");");
+			}
+
+			void binary(const vm::i64& instruction, const char* operation) const
+			{
+				line(r(instruction.rc()) + " = " + operation + "(" + r(instruction.rbs()) + ", " + r(instruction.a) + ");");
+			}
+
+			void floating(const vm::i64& instruction, const char* operation) const
+			{
+				line(r(instruction.rc()) + " = from_double(as_double(" + r(instruction.rbs()) + ") " + operation + " as_double(" + r(instruction.a) + "));");
+			}
+
+			/* moves the arguments of a call to this function down and starts over, as the interpreter's tail call would */
+			void restart(const std::string& window, const char* environment) const
+			{
+				const auto parameters = std::to_string(code_.functions[function_].parameters);
+				line("std::memmove(r, r + " + window + ", " + parameters + " * sizeof(vm_register));");
+				line("std::memmove(t, t + " + window + ", " + parameters + " * sizeof(value_type));");
+				line(std::string("rt::restart(vm, ") + environment + ");");
+				line("goto entry;");
+			}
+
+			void call(const vm::i64& instruction, const bool tail) const
+			{
+				const auto window = std::to_string(instruction.rc());
+				at();
+				if (tail && instruction.a == function_)
+				{
+					return restart(window, "nullptr");
+				}
+				line("rt::enter(vm, " + std::to_string(instruction.a) + ", r + " + window + ", nullptr);");
+				line("n = " + callee(instruction.a) + "(vm, r + " + window + ", t + " + window + ");");
+				line("rt::leave(vm);");
+				line(tail ? "return rt::ret(r, t, " + window + ", n);" : "rt::results(r + " + window + ", t + " + window + ", n, " + std::to_string(instruction.rbs()) + ");");
+			}
+
+			void call_value(const vm::i64& instruction, const bool tail)
+			{
+				const auto window = std::to_string(instruction.rc());
+				line("{");
+				depth_++;
+				at();
+				line("auto* const target = rt::callee(vm, " + std::to_string(instruction.raw) + "ull);");
+				if (tail)
+				{
+					line("if (target->function == " + std::to_string(function_) + ")");
+					line("{");
+					depth_++;
+					restart(window, "target");
+					depth_--;
+					line("}");
+				}
+				line("const auto function = target->function;");
+				line("rt::enter(vm, function, r + " + window + ", target);");
+				line("n = rt::code(vm, function)(vm, r + " + window + ", t + " + window + ");");
+				line("rt::leave(vm);");
+				line(tail ? "return rt::ret(r, t, " + window + ", n);" : "rt::results(r + " + window + ", t + " + window + ", n, " + std::to_string(instruction.rbs()) + ");");
+				depth_--;
+				line("}");
+			}
+
+			void jump(const vm::i64& instruction, const std::string& condition) const
+			{
+				const auto target = "goto pc_" + std::to_string(instruction.a) + ";";
+				line(condition.empty() ? target : "if (" + condition + ") " + target);
+			}
+
+			void translate(const vm::i64& instruction)
+			{
+				const auto c = instruction.rc();
+				const auto b = instruction.rbs();
+				if (vm::writes_number(instruction.op))
+				{
+					line(t(c) + " = untagged(" + t(c) + ");");
+				}
+				switch (instruction.op)
+				{
+					case opcode::nop: break;
+					case opcode::load: line(r(c) + " = " + literal(instruction.sa()) + ";"); break;
+					case opcode::loadk: line(r(c) + " = " + literal(code_.constants[instruction.a]) + ";"); break;
+					case opcode::move: line(r(c) + " = " + r(b) + ";"); break;
+					case opcode::addrs: line(r(c) + " = wrapping_add(" + r(b) + ", " + literal(instruction.sa()) + ");"); break;
+					case opcode::mulrs: line(r(c) + " = wrapping_multiply(" + r(b) + ", " + literal(instruction.sa()) + ");"); break;
+					case opcode::divrs:
+						at();
+						line(r(c) + " = rt::divide(vm, " + r(b) + ", " + literal(instruction.sa()) + ");");
+						break;
+					case opcode::addr: binary(instruction, "wrapping_add"); break;
+					case opcode::subr: binary(instruction, "wrapping_subtract"); break;
+					case opcode::mulr: binary(instruction, "wrapping_multiply"); break;
+					case opcode::divr:
+						at();
+						line(r(c) + " = rt::divide(vm, " + r(b) + ", " + r(instruction.a) + ");");
+						break;
+					case opcode::neg: line(r(c) + " = wrapping_subtract(0, " + r(b) + ");"); break;
+					case opcode::lnot: line(r(c) + " = " + r(b) + " == 0;"); break;
+					case opcode::addf: floating(instruction, "+"); break;
+					case opcode::subf: floating(instruction, "-"); break;
+					case opcode::mulf: floating(instruction, "*"); break;
+					case opcode::divf: floating(instruction, "/"); break;
+					case opcode::negf: line(r(c) + " = from_double(-as_double(" + r(b) + "));"); break;
+					case opcode::lnotf: line(r(c) + " = as_double(" + r(b) + ") == 0.0;"); break;
+					case opcode::itof: line(r(c) + " = from_double(static_cast<double>(" + r(b) + "));"); break;
+					case opcode::tag: line(t(c) + " = value_type::" + tag_name(instruction.a) + ";"); break;
+					case opcode::movev:
+						line(r(c) + " = " + r(b) + ";");
+						line(t(c) + " = " + t(b) + ";");
+						break;
+					case opcode::addv:
+					case opcode::subv:
+					case opcode::mulv:
+					case opcode::divv:
+						at();
+						line("rt::generic_arithmetic(vm, " + std::to_string(instruction.raw) + "ull);");
+						break;
+					case opcode::negv:
+					case opcode::lnotv:
+						at();
+						line("rt::generic_unary(vm, " + std::to_string(instruction.raw) + "ull);");
+						break;
+					case opcode::getg:
+						line(r(c) + " = g[" + std::to_string(instruction.a) + "];");
+						line(t(c) + " = gt[" + std::to_string(instruction.a) + "];");
+						break;
+					case opcode::setg:
+						line("g[" + std::to_string(instruction.a) + "] = " + r(b) + ";");
+						line("gt[" + std::to_string(instruction.a) + "] = " + t(b) + ";");
+						break;
+					case opcode::closure:
+						line(r(c) + " = reinterpret_cast<vm_register>(rt::make_closure(vm, " + std::to_string(instruction.a) + ", r + " + std::to_string(b) + ", t + " + std::to_string(b) + "));");
+						line(t(c) + " = value_type::function;");
+						break;
+					case opcode::getu:
+						line(r(c) + " = rt::environment(vm)->values()[" + std::to_string(instruction.a) + "];");
+						line(t(c) + " = rt::environment(vm)->tags()[" + std::to_string(instruction.a) + "];");
+						break;
+					case opcode::self:
+						line(r(c) + " = reinterpret_cast<vm_register>(rt::environment(vm));");
+						line(t(c) + " = value_type::function;");
+						break;
+					case opcode::object:
+						line(r(c) + " = reinterpret_cast<vm_register>(rt::make_object(vm, " + std::to_string(instruction.a) + ", r + " + std::to_string(b) + ", t + " + std::to_string(b) + "));");
+						line(t(c) + " = value_type::object;");
+						break;
+					case opcode::getf:
+						at();
+						line("rt::get_field(vm, " + std::to_string(instruction.raw) + "ull);");
+						break;
+					case opcode::setf:
+						at();
+						line("rt::set_field(vm, " + std::to_string(instruction.raw) + "ull);");
+						break;
+					case opcode::map:
+						line(r(c) + " = reinterpret_cast<vm_register>(rt::make_map(vm));");
+						line(t(c) + " = value_type::map;");
+						break;
+					case opcode::getk:
+					case opcode::hask:
+					case opcode::nextk:
+					case opcode::keyk:
+					case opcode::setk:
+						at();
+						line("rt::map_access(vm, " + std::to_string(instruction.raw) + "ull);");
+						break;
+					case opcode::array:
+						at();
+						line("rt::array_literal(vm, " + std::to_string(instruction.raw) + "ull);");
+						break;
+					case opcode::vec:
+						at();
+						line("rt::run_kernel(vm, " + std::to_string(instruction.raw) + "ull);");
+						break;
+					case opcode::jmp: jump(instruction, ""); break;
+					case opcode::jz: jump(instruction, r(b) + " == 0"); break;
+					case opcode::jnz: jump(instruction, r(b) + " != 0"); break;
+					case opcode::call: call(instruction, false); break;
+					case opcode::tailcall: call(instruction, true); break;
+					case opcode::callv: call_value(instruction, false); break;
+					case opcode::tailcallv: call_value(instruction, true); break;
+					case opcode::ret: line("return rt::ret(r, t, " + std::to_string(c) + ", " + std::to_string(b) + ");"); break;
+					case opcode::halt: line("return 0;"); break;
+					default:
+						codegen_error("'%s' uses the operand stack, which the native backend does not translate", code_.functions[function_].name.c_str());
+				}
+			}
+		public:
+			translator(const ir::bytecode& code, std::ostream& out, const std::uint32_t function, const std::uint32_t begin, const std::uint32_t end)
+				: code_(code), out_(out), function_(function), begin_(begin), end_(end) {}
+
+			void write()
+			{
+				auto restarts = false;
+				auto globals = false;
+				for (auto pc = begin_; pc < end_; pc++)
+				{
+					const auto& instruction = code_.program[pc];
+					switch (instruction.op)
+					{
+						case opcode::jmp:
+						case opcode::jz:
+						case opcode::jnz:
+							if (instruction.a < begin_ || instruction.a >= end_)
+							{
+								codegen_error("'%s' jumps out of its own code", code_.functions[function_].name.c_str());
+							}
+							targets_.insert(static_cast<std::uint32_t>(instruction.a)); // a copy, i64 is packed
+							break;
+						case opcode::tailcall:
+							restarts |= instruction.a == function_;
+							break;
+						case opcode::tailcallv:
+							restarts = true;
+							break;
+						case opcode::getg:
+						case opcode::setg:
+							globals = true;
+							break;
+						default:
+							break;
+					}
+				}
+
+				out_ << "\t// " << code_.functions[function_].name << "\n";
+				out_ << "\tstd::uint32_t " << callee(function_) << "([[maybe_unused]] virtual_machine& vm, [[maybe_unused]] vm_register* r, [[maybe_unused]] value_type* t)\n\t{\n";
+				line("[[maybe_unused]] std::uint32_t n = 0;");
+				if (globals)
+				{
+					line("auto* const g = rt::globals(vm);");
+					line("auto* const gt = rt::global_tags(vm);");
+				}
+				if (restarts)
+				{
+					out_ << "\tentry:\n";
+				}
+				for (pc_ = begin_; pc_ < end_; pc_++)
+				{
+					if (targets_.count(pc_))
+					{
+						out_ << "\tpc_" << pc_ << ":\n";
+					}
+					translate(code_.program[pc_]);
+				}
+				if (const auto last = code_.program[end_ - 1].op; last != opcode::ret && last != opcode::halt && last != opcode::tailcall && last != opcode::tailcallv)
+				{
+					line("return 0;");
+				}
+				out_ << "\t}\n\n";
+			}
+		};
+	}
+
+	void write_native(std::ostream& out, const ir::bytecode& code, const std::string& symbol)
+	{
+		for (const auto& function : code.functions)
+		{
+			if (function.entry == vm::function_info::deferred)
+			{
+				codegen_error("function '%s' is not compiled yet and cannot be translated", function.name.c_str());
+			}
+		}
+
+		// each function's code runs from its entry up to the next one
+		std::vector<std::uint32_t> order(code.functions.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](const std::uint32_t a, const std::uint32_t b)
+		{
+			return code.functions[a].entry < code.functions[b].entry;
+		});
+
+		out << "/* generated by write_native, do not edit */\n\n";
+		out << "#include <cstring>\n#include \"vm/native.h\"\n\n";
+		out << "namespace\n{\n";
+		out << "\tusing namespace cherie::vm;\n";
+		out << "\tusing rt = native_runtime;\n\n";
+		for (size_t index = 0; index < code.functions.size(); index++)
+		{
+			out << "\tstd::uint32_t function_" << index << "(virtual_machine& vm, vm_register* r, value_type* t);\n";
+		}
+		out << "\n";
+
+		for (size_t position = 0; position < order.size(); position++)
+		{
+			const auto function = order[position];
+			const auto end = position + 1 < order.size() ? code.functions[order[position + 1]].entry : static_cast<std::uint32_t>(code.program.size());
+			translator(code, out, function, code.functions[function].entry, end).write();
+		}
+
+		out << "\tconst native_function_entry functions[] = {\n";
+		for (size_t index = 0; index < code.functions.size(); index++)
+		{
+			const auto& function = code.functions[index];
+			out << "\t\t{ " << quoted(function.name) << ", " << function.parameters << ", " << function.frame_size << ", " << function.upvalues << ", &function_" << index << " },\n";
+		}
+		out << "\t};\n";
+
+		if (!code.globals.empty())
+		{
+			out << "\tconst char* const globals[] = {";
+			for (const auto& global : code.globals)
+			{
+				out << " " << quoted(global) << ",";
+			}
+			out << " };\n";
+		}
+
+		const auto& lines = code.lines.data();
+		out << "\tconst std::uint8_t lines[] = {";
+		for (size_t index = 0; index < lines.size(); index++)
+		{
+			out << (index % 16 == 0 ? "\n\t\t" : " ") << static_cast<int>(lines[index]) << ",";
+		}
+		out << (lines.empty() ? " 0 };\n" : "\n\t};\n");
+
+		const auto& layout = code.layout;
+		const auto shapes = layout.flat_shapes();
+		const auto table = [&out](const char* name, const std::vector<std::uint32_t>& values)
+		{
+			if (values.empty())
+			{
+				return;
+			}
+			out << "\tconst std::uint32_t " << name << "[] = {";
+			for (size_t index = 0; index < values.size(); index++)
+			{
+				out << (index % 16 == 0 ? "\n\t\t" : " ") << values[index] << ",";
+			}
+			out << "\n\t};\n";
+		};
+		if (!layout.fields.empty())
+		{
+			out << "\tconst char* const fields[] = {";
+			for (const auto& field : layout.fields)
+			{
+				out << " " << quoted(field) << ",";
+			}
+			out << " };\n";
+		}
+		table("shapes", shapes);
+		table("sites", layout.sites);
+		out << "}\n\n";
+
+		out << "extern const cherie::vm::native_program " << symbol << " = {\n";
+		out << "\tfunctions, " << code.functions.size() << ",\n";
+		out << "\t" << (code.globals.empty() ? "nullptr" : "globals") << ", " << code.globals.size() << ",\n";
+		out << "\tlines, " << lines.size() << ", " << code.lines.entries() << ",\n";
+		out << "\t" << (layout.fields.empty() ? "nullptr" : "fields") << ", " << layout.fields.size() << ",\n";
+		out << "\t" << (shapes.empty() ? "nullptr" : "shapes") << ", " << shapes.size() << ",\n";
+		out << "\t" << (layout.sites.empty() ? "nullptr" : "sites") << ", " << layout.sites.size() << ",\n";
+		out << "};\n";
+	}
+}
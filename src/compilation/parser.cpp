@@ -10,8 +10,62 @@
 
 namespace cherie::compiler
 {
-	parser::parser(lexer* lexer)
-		: lexer_(lexer) {}
+	namespace
+	{
+		/* a copy of a variable or of a chain of fields and entries off one, null for anything else */
+		ast::primary_expression* copy_path(const ast::expression* path)
+		{
+			if (const auto* number = dynamic_cast<const ast::number_literal*>(path))
+			{
+				return new ast::number_literal(*number);
+			}
+			if (const auto* boolean = dynamic_cast<const ast::boolean_literal*>(path))
+			{
+				return new ast::boolean_literal(*boolean);
+			}
+			if (const auto* name = dynamic_cast<const ast::variable*>(path))
+			{
+				auto* copy = new ast::variable(name->value);
+				copy->line = name->line;
+				copy->column = name->column;
+				return copy;
+			}
+			if (const auto* access = dynamic_cast<const ast::field_expression*>(path))
+			{
+				auto* object = copy_path(access->object.get());
+				if (!object)
+				{
+					return nullptr;
+				}
+				auto* copy = new ast::field_expression();
+				copy->object = std::unique_ptr<ast::expression>(object);
+				copy->field = access->field;
+				copy->line = access->line;
+				copy->column = access->column;
+				return copy;
+			}
+			if (const auto* index = dynamic_cast<const ast::index_expression*>(path))
+			{
+				auto* container = copy_path(index->container.get());
+				auto* key = container ? copy_path(index->key.get()) : nullptr;
+				if (!key)
+				{
+					delete container;
+					return nullptr;
+				}
+				auto* copy = new ast::index_expression();
+				copy->container = std::unique_ptr<ast::expression>(container);
+				copy->key = std::unique_ptr<ast::expression>(key);
+				copy->line = index->line;
+				copy->column = index->column;
+				return copy;
+			}
+			return nullptr;
+		}
+	}
+
+	parser::parser(lexer* lexer, const size_t defer_above)
+		: lexer_(lexer), defer_above_(defer_above) {}
 
 	void parser::expect(const token_type type) const
 	{
@@ -23,7 +77,7 @@ namespace cherie::compiler
 
 	ast::call_expression* parser::parse_call_expression()
 	{
-		auto* expression = new ast::call_expression();
+		auto* expression = make_node<ast::call_expression>();
 
 		expression->function_name = get_token_value<types::string>();
 		
@@ -46,9 +100,81 @@ namespace cherie::compiler
 		return expression;
 	}
 
+	ast::object_literal* parser::parse_object_literal()
+	{
+		auto* literal = make_node<ast::object_literal>();
+		while (lexer_->peek_token() != token_type::CLOSE_BRACE)
+		{
+			auto name = expect_and_get<types::string>(token_type::IDENTIFIER);
+			for (const auto& [existing, value] : literal->fields)
+			{
+				if (existing == name)
+				{
+					parser_error("field '%s' is given twice on line %d", name.c_str(), lexer_->line());
+				}
+			}
+			expect(token_type::COLON);
+			literal->fields.emplace_back(std::move(name), std::unique_ptr<ast::expression>(parse_expression()));
+			if (lexer_->peek_token() != token_type::COMMA)
+			{
+				break;
+			}
+			lexer_->next_token();
+		}
+		expect(token_type::CLOSE_BRACE);
+		return literal;
+	}
+
+	ast::array_literal* parser::parse_array_literal()
+	{
+		auto* literal = make_node<ast::array_literal>();
+		while (lexer_->peek_token() != token_type::CLOSE_BRACKET)
+		{
+			literal->elements.emplace_back(parse_expression());
+			if (lexer_->peek_token() != token_type::COMMA)
+			{
+				break;
+			}
+			lexer_->next_token();
+		}
+		expect(token_type::CLOSE_BRACKET);
+		return literal;
+	}
+
 	ast::primary_expression* parser::parse_primary_expression()
 	{
-		switch (lexer_->next_token())
+		auto* expression = parse_operand();
+		while (expression)
+		{
+			if (lexer_->peek_token() == token_type::DOT)
+			{
+				lexer_->next_token();
+				auto* access = make_node<ast::field_expression>();
+				access->object = std::unique_ptr<ast::expression>(expression);
+				access->field = expect_and_get<types::string>(token_type::IDENTIFIER);
+				expression = access;
+			}
+			else if (lexer_->peek_token() == token_type::OPEN_BRACKET)
+			{
+				lexer_->next_token();
+				auto* index = make_node<ast::index_expression>();
+				index->container = std::unique_ptr<ast::expression>(expression);
+				index->key = std::unique_ptr<ast::expression>(parse_expression());
+				expect(token_type::CLOSE_BRACKET);
+				expression = index;
+			}
+			else
+			{
+				break;
+			}
+		}
+		return expression;
+	}
+
+	ast::primary_expression* parser::parse_operand()
+	{
+		const auto next_token = lexer_->next_token();
+		switch (next_token)
 		{
 			case token_type::IDENTIFIER:
 			{
@@ -56,26 +182,44 @@ namespace cherie::compiler
 				{
 					return parse_call_expression();
 				}
-				return new ast::variable(std::get<types::string>(lexer_->token_value()));
+				return make_node<ast::variable>(std::get<types::string>(lexer_->token_value()));
+			}
+			case token_type::OPEN_PARENTHESIS:
+			{
+				// every concrete expression node is a primary_expression
+				auto* expression = static_cast<ast::primary_expression*>(parse_additive_expression());
+				expect(token_type::CLOSE_PARENTHESIS);
+				return expression;
 			}
-			case token_type::TRUE: return new ast::boolean_literal(true);
-			case token_type::FALSE:  return new ast::boolean_literal(false);
+			case token_type::SUBTRACT:
+			case token_type::NOT:
+			case token_type::EXCLAMATION_MARK:
+			{
+				auto* expression = make_node<ast::unary_expression>();
+				expression->operation = next_token == token_type::SUBTRACT ? token_type::SUBTRACT : token_type::NOT;
+				expression->rhs = std::unique_ptr<ast::expression>(parse_primary_expression());
+				return expression;
+			}
+			case token_type::OPEN_BRACE: return parse_object_literal();
+			case token_type::OPEN_BRACKET: return parse_array_literal();
+			case token_type::TRUE: return make_node<ast::boolean_literal>(true);
+			case token_type::FALSE:  return make_node<ast::boolean_literal>(false);
 			case token_type::LITERAL:
 			{
 				const auto literal = lexer_->token_value();
 				if (std::holds_alternative<types::string>(literal)) // string literal
 				{
-					return new ast::string_literal(std::get<types::string>(literal));
+					return make_node<ast::string_literal>(rope(std::get<types::string>(literal)));
 				}
 
 				if (std::holds_alternative<types::integer>(literal)) // integer literal
 				{
-					return new ast::number_literal(std::get<types::integer>(literal));
+					return make_node<ast::number_literal>(std::get<types::integer>(literal));
 				}
 
 				if (std::holds_alternative<types::floating_point>(literal)) // floating point literal (same as integer)
 				{
-					return new ast::number_literal(std::get<types::floating_point>(literal));
+					return make_node<ast::number_literal>(std::get<types::floating_point>(literal));
 				}
 				break;
 			}
@@ -100,7 +244,7 @@ namespace cherie::compiler
 				while (next_peeked_token == token_type::MULTIPLY || next_peeked_token == token_type::DIVIDE)
 				{
 					const auto next_token = lexer_->next_token(); // wouldn't evaluate, so this is a hack
-					current_expression = new ast::binary_expression(next_token, current_expression, parse_primary_expression());
+					current_expression = make_node<ast::binary_expression>(next_token, current_expression, parse_primary_expression());
 					next_peeked_token = lexer_->peek_token();
 				}
 			}
@@ -125,7 +269,7 @@ namespace cherie::compiler
 				while (next_peeked_token == token_type::ADD || next_peeked_token == token_type::SUBTRACT)
 				{
 					const auto next_token = lexer_->next_token(); // wouldn't evaluate, so this is a hack
-					current_expression = new ast::binary_expression(next_token, current_expression, parse_multiplicative_expression());
+					current_expression = make_node<ast::binary_expression>(next_token, current_expression, parse_multiplicative_expression());
 					next_peeked_token = lexer_->peek_token();
 				}
 				break;
@@ -140,48 +284,103 @@ namespace cherie::compiler
 
 	ast::expression* parser::parse_expression()
 	{
-		if (lexer_->peek_token() == token_type::OPEN_PARENTHESIS)
-		{
-			expect(token_type::OPEN_PARENTHESIS);
-			auto* expression = parse_expression();
-			expect(token_type::CLOSE_PARENTHESIS);
-			return expression;
-		}
 		return parse_additive_expression();
 	}
 
-	ast::function_definition* parser::parse_function_definition()
+	ast::function_definition* parser::parse_function_definition(const bool top_level)
 	{
-		auto* func_def = new ast::function_definition();
+		auto* func_def = make_node<ast::function_definition>();
 
 		func_def->function_name = expect_and_get<types::string>(token_type::IDENTIFIER);
 		
 		expect(token_type::OPEN_PARENTHESIS);
+		if (lexer_->peek_token() != token_type::CLOSE_PARENTHESIS)
+		{
+			func_def->parameters.push_back(expect_and_get<types::string>(token_type::IDENTIFIER));
+			while (lexer_->peek_token() == token_type::COMMA)
+			{
+				lexer_->next_token();
+				func_def->parameters.push_back(expect_and_get<types::string>(token_type::IDENTIFIER));
+			}
+		}
 		expect(token_type::CLOSE_PARENTHESIS);
 
-		expect(token_type::OPEN_BRACE);
-
-		if (lexer_->peek_token() == token_type::CLOSE_BRACE)
+		if (!top_level || defer_above_ == never_defer)
 		{
+			func_def->body = std::unique_ptr<ast::statement_block>(parse_statement_block());
 			return func_def;
 		}
 
-		func_def->body->statements.push_back(std::unique_ptr<ast::statement>(parse_statement()));
-		while (lexer_->next_token() != token_type::CLOSE_BRACE)
+		// small bodies are parsed right away so they can still be inlined
+		auto deferred = scan_function_body(func_def->function_name);
+		if (deferred->tokens <= defer_above_)
+		{
+			parser body(new lexer(deferred->source, deferred->line, deferred->column));
+			func_def->body = std::unique_ptr<ast::statement_block>(body.parse_body());
+		}
+		else
 		{
-			func_def->body->statements.push_back(std::unique_ptr<ast::statement>(parse_statement()));
+			func_def->deferred = std::move(deferred);
 		}
+		return func_def;
+	}
 
-		expect(token_type::CLOSE_BRACKET);
+	std::unique_ptr<ast::deferred_body> parser::scan_function_body(const types::string& name)
+	{
+		auto body = std::make_unique<ast::deferred_body>();
+		body->line = lexer_->line();
+		body->column = lexer_->column();
+		const auto begin = lexer_->offset();
+
+		expect(token_type::OPEN_BRACE);
+		for (size_t depth = 1; depth != 0; body->tokens++)
+		{
+			switch (lexer_->next_token())
+			{
+				case token_type::OPEN_BRACE:
+					depth++;
+					break;
+				case token_type::CLOSE_BRACE:
+					depth--;
+					break;
+				case token_type::IDENTIFIER:
+					body->names.push_back(get_token_value<types::string>());
+					break;
+				case token_type::EOF:
+					parser_error("body of function '%s' is not closed, starting on line %d", name.c_str(), static_cast<int>(body->line));
+					break;
+				default:
+					break;
+			}
+		}
+
+		body->source = lexer_->text(begin, lexer_->offset());
+		return body;
+	}
+
+	ast::return_statement* parser::parse_return_statement()
+	{
+		expect(token_type::RETURN);
+
+		auto* new_statement = make_node<ast::return_statement>();
+		if (lexer_->peek_token() != token_type::SEMICOLON)
+		{
+			new_statement->values.push_back(std::unique_ptr<ast::expression>(parse_expression()));
+			while (lexer_->peek_token() == token_type::COMMA)
+			{
+				lexer_->next_token();
+				new_statement->values.push_back(std::unique_ptr<ast::expression>(parse_expression()));
+			}
+		}
 		
-		return func_def;
+		return new_statement;
 	}
 	
 	ast::statement_block* parser::parse_statement_block()
 	{
 		expect(token_type::OPEN_BRACE);
 		
-		auto* statement_block = new ast::statement_block();
+		auto* statement_block = make_node<ast::statement_block>();
 
 		while (lexer_->peek_token() != token_type::CLOSE_BRACE)
 		{
@@ -193,27 +392,145 @@ namespace cherie::compiler
 		return statement_block;
 	}
 
-	ast::assignment_statement* parser::parse_assignment_statement()
+	ast::statement* parser::parse_assignment_statement()
 	{
-		auto* statement = new ast::assignment_statement();
-
-		if (lexer_->next_token() == token_type::CONST)
+		const auto immutable = lexer_->next_token() == token_type::CONST;
+		const auto name = expect_and_get<types::string>(token_type::IDENTIFIER);
+		if (lexer_->peek_token() == token_type::COMMA)
 		{
-			statement->immutable = true;
+			auto* statement = parse_multiple_assignment({ name });
+			statement->immutable = immutable;
+			return statement;
 		}
-		
-		statement->variable_name = expect_and_get<types::string>(token_type::IDENTIFIER);
+
+		auto* statement = make_node<ast::assignment_statement>();
+		statement->immutable = immutable;
+		statement->variable_name = name;
 		expect(token_type::EQUALS);
 		statement->value = std::unique_ptr<ast::expression>(parse_expression());
 		
 		return statement;
 	}
+
+	ast::multiple_assignment_statement* parser::parse_multiple_assignment(std::vector<types::string> names)
+	{
+		auto* statement = make_node<ast::multiple_assignment_statement>();
+
+		statement->variable_names = std::move(names);
+		while (lexer_->peek_token() == token_type::COMMA)
+		{
+			lexer_->next_token();
+			statement->variable_names.push_back(expect_and_get<types::string>(token_type::IDENTIFIER));
+		}
+		expect(token_type::EQUALS);
+
+		auto* value = parse_expression();
+		statement->value = std::unique_ptr<ast::call_expression>(dynamic_cast<ast::call_expression*>(value));
+		if (!statement->value)
+		{
+			delete value;
+			parser_error("only a call can be assigned to several variables on line %d", static_cast<int>(statement->line));
+		}
+		
+		return statement;
+	}
 	
+	ast::statement* parser::parse_reassignment(ast::variable* target)
+	{
+		auto operation = token_type::NONE;
+		switch (lexer_->peek_token())
+		{
+			case token_type::COMMA:
+			{
+				auto* statement = parse_multiple_assignment({ target->value });
+				statement->declaration = false;
+				delete target;
+				return statement;
+			}
+			case token_type::EQUALS: break;
+			case token_type::ADD_ASSIGN: operation = token_type::ADD; break;
+			case token_type::SUBTRACT_ASSIGN: operation = token_type::SUBTRACT; break;
+			case token_type::MULTIPLY_ASSIGN: operation = token_type::MULTIPLY; break;
+			case token_type::DIVIDE_ASSIGN: operation = token_type::DIVIDE; break;
+			default: return target; // plain expression statement
+		}
+		lexer_->next_token();
+
+		auto* statement = make_node<ast::assignment_statement>();
+		statement->declaration = false;
+		statement->variable_name = target->value;
+
+		// every concrete expression node is a primary_expression
+		auto* value = static_cast<ast::primary_expression*>(parse_expression());
+		if (operation != token_type::NONE) // x op= y is x = x op y
+		{
+			statement->value = std::unique_ptr<ast::expression>(make_node<ast::binary_expression>(operation, target, value));
+		}
+		else
+		{
+			statement->value = std::unique_ptr<ast::expression>(value);
+			delete target;
+		}
+		return statement;
+	}
+	
+	ast::statement* parser::parse_store(ast::primary_expression* target)
+	{
+		auto operation = token_type::NONE;
+		switch (lexer_->peek_token())
+		{
+			case token_type::EQUALS: break;
+			case token_type::ADD_ASSIGN: operation = token_type::ADD; break;
+			case token_type::SUBTRACT_ASSIGN: operation = token_type::SUBTRACT; break;
+			case token_type::MULTIPLY_ASSIGN: operation = token_type::MULTIPLY; break;
+			case token_type::DIVIDE_ASSIGN: operation = token_type::DIVIDE; break;
+			default: return target; // plain expression statement
+		}
+		lexer_->next_token();
+
+		ast::statement* statement;
+		std::unique_ptr<ast::expression>* stored;
+		if (auto* field = dynamic_cast<ast::field_expression*>(target))
+		{
+			auto* store = make_node<ast::field_assignment_statement>();
+			store->target = std::unique_ptr<ast::field_expression>(field);
+			statement = store;
+			stored = &store->value;
+		}
+		else
+		{
+			auto* store = make_node<ast::index_assignment_statement>();
+			store->target = std::unique_ptr<ast::index_expression>(static_cast<ast::index_expression*>(target));
+			statement = store;
+			stored = &store->value;
+		}
+
+		// every concrete expression node is a primary_expression
+		auto* value = static_cast<ast::primary_expression*>(parse_expression());
+		if (operation != token_type::NONE) // o.f op= y is o.f = o.f op y, o is read twice
+		{
+			auto* current = copy_path(target);
+			if (!current)
+			{
+				const auto line = static_cast<int>(statement->line);
+				delete statement;
+				delete value;
+				parser_error("only the fields and entries of a variable can be updated in place on line %d", line);
+			}
+			*stored = std::unique_ptr<ast::expression>(make_node<ast::binary_expression>(operation, current, value));
+		}
+		else
+		{
+			*stored = std::unique_ptr<ast::expression>(value);
+		}
+		return statement;
+	}
+
 	ast::while_statement* parser::parse_while_statement()
 	{
 		expect(token_type::WHILE);
 
-		auto* new_statement = new ast::while_statement();
+		auto* new_statement = make_node<ast::while_statement>();
 
 		expect(token_type::OPEN_PARENTHESIS);
 		new_statement->condition = std::unique_ptr<ast::expression>(parse_expression());
@@ -228,7 +545,7 @@ namespace cherie::compiler
 	{
 		expect(token_type::IF);
 		
-		auto* new_statement = new ast::if_statement();
+		auto* new_statement = make_node<ast::if_statement>();
 
 		expect(token_type::OPEN_PARENTHESIS);
 		new_statement->condition = std::unique_ptr<ast::expression>(parse_expression());
@@ -277,9 +594,31 @@ namespace cherie::compiler
 				new_statement = parse_while_statement();
 				break;
 			}
+			case token_type::RETURN:
+			{
+				new_statement = parse_return_statement();
+				expect(token_type::SEMICOLON);
+				break;
+			}
+			case token_type::FUNCTION: // nested function definition
+			{
+				lexer_->next_token();
+				auto* nested = make_node<ast::function_statement>();
+				nested->definition = std::unique_ptr<ast::function_definition>(parse_function_definition());
+				new_statement = nested;
+				break;
+			}
 			default:
 			{
 				new_statement = parse_expression();
+				if (auto* target = dynamic_cast<ast::variable*>(new_statement))
+				{
+					new_statement = parse_reassignment(target);
+				}
+				else if (dynamic_cast<ast::field_expression*>(new_statement) || dynamic_cast<ast::index_expression*>(new_statement))
+				{
+					new_statement = parse_store(static_cast<ast::primary_expression*>(new_statement));
+				}
 				expect(token_type::SEMICOLON);
 				break;
 			}
@@ -290,7 +629,7 @@ namespace cherie::compiler
 
 	ast::program* parser::parse()
 	{
-		auto* program_node = new ast::program();
+		auto* program_node = make_node<ast::program>();
 
 		auto next_token = lexer_->peek_token();
 		while (next_token != token_type::EOF)
@@ -298,7 +637,7 @@ namespace cherie::compiler
 			if (next_token == token_type::FUNCTION) // Function Definition
 			{
 				lexer_->next_token();
-				auto new_function = std::unique_ptr<ast::function_definition>(parse_function_definition());
+				auto new_function = std::unique_ptr<ast::function_definition>(parse_function_definition(true));
 				program_node->body.emplace_back(std::move(new_function));
 			}
 			else // Any other generic statement
@@ -312,4 +651,9 @@ namespace cherie::compiler
 		
 		return program_node;
 	}
+
+	ast::statement_block* parser::parse_body()
+	{
+		return parse_statement_block();
+	}
 }
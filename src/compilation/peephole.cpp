@@ -0,0 +1,616 @@
+/*
+ * File Name: peephole.cpp
+ * Author(s): P. Kamara
+ *
+ * Peephole optimiser over emitted bytecode.
+ */
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+#include "compilation/peephole.h"
+
+namespace cherie::compiler::peephole
+{
+	namespace
+	{
+		using vm::i64;
+		using vm::opcode;
+		using register_set = std::bitset<ir::register_count>;
+
+		constexpr auto max_passes = 8;
+
+		bool is_jump(const opcode op)
+		{
+			return op == opcode::jmp || op == opcode::jz || op == opcode::jnz;
+		}
+
+		/* register written by the instruction, if any */
+		std::optional<size_t> written_register(const i64& instruction)
+		{
+			switch (instruction.op)
+			{
+				case opcode::pop:
+				case opcode::load:
+				case opcode::loadk:
+				case opcode::move:
+				case opcode::addrs:
+				case opcode::mulrs:
+				case opcode::divrs:
+				case opcode::addr:
+				case opcode::subr:
+				case opcode::mulr:
+				case opcode::divr:
+				case opcode::neg:
+				case opcode::lnot:
+				case opcode::addf:
+				case opcode::subf:
+				case opcode::mulf:
+				case opcode::divf:
+				case opcode::negf:
+				case opcode::lnotf:
+				case opcode::itof:
+				case opcode::movev:
+				case opcode::addv:
+				case opcode::subv:
+				case opcode::mulv:
+				case opcode::divv:
+				case opcode::negv:
+				case opcode::lnotv:
+				case opcode::getg:
+				case opcode::closure:
+				case opcode::getu:
+				case opcode::self:
+				case opcode::object:
+				case opcode::getf:
+				case opcode::map:
+				case opcode::getk:
+				case opcode::hask:
+				case opcode::nextk:
+				case opcode::keyk:
+				case opcode::array:
+				case opcode::vec:
+					return instruction.rc();
+				default:
+					return std::nullopt;
+			}
+		}
+
+		/* a call's window: everything from its first register up, which the callee may overwrite */
+		register_set window(const size_t first)
+		{
+			register_set registers;
+			for (auto index = first; index < ir::register_count; index++)
+			{
+				registers.set(index);
+			}
+			return registers;
+		}
+
+		bool writes_tag(const i64& instruction)
+		{
+			return (instruction.op >= opcode::movev && instruction.op <= opcode::lnotv) || instruction.op == opcode::getg || (instruction.op >= opcode::closure && instruction.op <= opcode::getf) || (instruction.op >= opcode::map && instruction.op <= opcode::keyk) || instruction.op == opcode::array || instruction.op == opcode::vec;
+		}
+
+		register_set read_registers(const i64& instruction)
+		{
+			register_set read;
+			switch (instruction.op)
+			{
+				case opcode::pushr:
+					read.set(instruction.rc());
+					break;
+				case opcode::move:
+				case opcode::addrs:
+				case opcode::mulrs:
+				case opcode::divrs:
+				case opcode::neg:
+				case opcode::lnot:
+				case opcode::negf:
+				case opcode::lnotf:
+				case opcode::itof:
+				case opcode::movev:
+				case opcode::negv:
+				case opcode::lnotv:
+				case opcode::setg:
+				case opcode::getf:
+				case opcode::jz:
+				case opcode::jnz:
+					read.set(instruction.rbs());
+					break;
+				case opcode::setf:
+					read.set(instruction.rc());
+					read.set(instruction.rbs());
+					break;
+				case opcode::getk:
+				case opcode::hask:
+				case opcode::nextk:
+				case opcode::keyk:
+					read.set(instruction.rbs());
+					read.set(instruction.a);
+					break;
+				case opcode::setk:
+					read.set(instruction.rc());
+					read.set(instruction.rbs());
+					read.set(instruction.a);
+					break;
+				case opcode::addr:
+				case opcode::subr:
+				case opcode::mulr:
+				case opcode::divr:
+				case opcode::addf:
+				case opcode::subf:
+				case opcode::mulf:
+				case opcode::divf:
+				case opcode::addv:
+				case opcode::subv:
+				case opcode::mulv:
+				case opcode::divv:
+					read.set(instruction.rbs());
+					read.set(instruction.a);
+					break;
+				case opcode::ret:
+					for (size_t index = 0; index < instruction.rbs() && instruction.rc() + index < ir::register_count; index++)
+					{
+						read.set(instruction.rc() + index);
+					}
+					break;
+				case opcode::call:
+				case opcode::tailcall:
+				case opcode::callv:
+				case opcode::tailcallv:
+					read = window(instruction.rc()); // the arguments, without knowing how many
+					break;
+				case opcode::closure:
+				case opcode::object:
+				case opcode::array:
+				case opcode::vec:
+					read = window(instruction.rbs()); // the captured values, fields, elements or arguments, likewise
+					break;
+				default:
+					break;
+			}
+			return read;
+		}
+
+		/* writes a register and does nothing else: no stack, no trap */
+		bool is_pure(const i64& instruction)
+		{
+			return written_register(instruction) && instruction.op != opcode::pop && instruction.op != opcode::divr && !(instruction.op >= opcode::addv && instruction.op <= opcode::lnotv) && instruction.op != opcode::getf && !(instruction.op >= opcode::getk && instruction.op <= opcode::keyk) && instruction.op != opcode::array && instruction.op != opcode::vec;
+		}
+
+		struct context
+		{
+			std::vector<i64>& program;
+			std::vector<bool> targets;
+			std::vector<bool> reachable;
+			std::vector<register_set> live_out;
+			std::array<std::optional<std::int32_t>, ir::register_count> known; // load results in the current block
+
+			explicit context(std::vector<i64>& program)
+				: program(program) {}
+
+			[[nodiscard]] std::vector<size_t> successors(const size_t pc) const
+			{
+				const auto& instruction = program[pc];
+				switch (instruction.op)
+				{
+					case opcode::halt:
+					case opcode::ret:
+					case opcode::tailcall:
+					case opcode::tailcallv:
+						return {};
+					case opcode::jmp:
+						return { instruction.a };
+					case opcode::jz:
+					case opcode::jnz:
+						return { instruction.a, pc + 1 };
+					default:
+						return { pc + 1 };
+				}
+			}
+
+			/* pc + 1 exists and can only be entered from pc */
+			[[nodiscard]] bool follows(const size_t pc) const
+			{
+				return pc + 1 < program.size() && !targets[pc + 1];
+			}
+
+			/* where control really ends up when entering pc: skips nops and jmps */
+			[[nodiscard]] size_t resolve(size_t pc) const
+			{
+				for (size_t steps = 0; pc < program.size() && steps < program.size(); steps++)
+				{
+					if (program[pc].op == opcode::nop)
+					{
+						pc++;
+					}
+					else if (program[pc].op == opcode::jmp)
+					{
+						pc = program[pc].a;
+					}
+					else
+					{
+						break;
+					}
+				}
+				return pc;
+			}
+
+			void analyse()
+			{
+				const auto size = program.size();
+				targets.assign(size, false);
+				reachable.assign(size, false);
+				live_out.assign(size, {});
+				known.fill(std::nullopt);
+
+				if (size == 0)
+				{
+					return;
+				}
+
+				targets[0] = true;
+				for (const auto& instruction : program)
+				{
+					if (is_jump(instruction.op) && instruction.a < size)
+					{
+						targets[instruction.a] = true;
+					}
+				}
+
+				std::vector<size_t> pending = { 0 };
+				reachable[0] = true;
+				while (!pending.empty())
+				{
+					const auto pc = pending.back();
+					pending.pop_back();
+					for (const auto successor : successors(pc))
+					{
+						if (successor < size && !reachable[successor])
+						{
+							reachable[successor] = true;
+							pending.push_back(successor);
+						}
+					}
+				}
+
+				std::vector<register_set> live_in(size);
+				for (auto changed = true; changed;)
+				{
+					changed = false;
+					for (auto pc = size; pc-- > 0;)
+					{
+						register_set out;
+						for (const auto successor : successors(pc))
+						{
+							if (successor < size)
+							{
+								out |= live_in[successor];
+							}
+						}
+
+						auto in = out;
+						if (const auto written = written_register(program[pc]))
+						{
+							in.reset(*written);
+						}
+						in |= read_registers(program[pc]);
+
+						live_out[pc] = out;
+						if (in != live_in[pc])
+						{
+							live_in[pc] = in;
+							changed = true;
+						}
+					}
+				}
+			}
+
+			void observe(const size_t pc)
+			{
+				if (const auto written = written_register(program[pc]))
+				{
+					known[*written] = program[pc].op == opcode::load ? std::optional(program[pc].sa()) : std::nullopt;
+				}
+				else if (program[pc].op == opcode::call || program[pc].op == opcode::callv)
+				{
+					std::fill(known.begin() + program[pc].rc(), known.end(), std::nullopt);
+				}
+			}
+		};
+
+		void remove(i64& instruction)
+		{
+			instruction = i64(opcode::nop);
+		}
+
+		bool thread_jumps(context& context, const size_t pc)
+		{
+			auto& instruction = context.program[pc];
+			if (!context.reachable[pc])
+			{
+				if (instruction.op == opcode::nop)
+				{
+					return false;
+				}
+				remove(instruction);
+				return true;
+			}
+
+			if (!is_jump(instruction.op))
+			{
+				return false;
+			}
+
+			const auto target = context.resolve(instruction.a);
+			if (target == context.resolve(pc + 1))
+			{
+				remove(instruction); // lands where falling through would
+				return true;
+			}
+
+			if (instruction.op == opcode::jmp)
+			{
+				if (target < context.program.size() && context.program[target].op == opcode::halt)
+				{
+					instruction = context.program[target];
+					return true;
+				}
+			}
+			else if (context.follows(pc) && context.program[pc + 1].op == opcode::jmp && target == context.resolve(pc + 2))
+			{
+				// jz r, L; jmp M; L: -> jnz r, M
+				instruction.op = instruction.op == opcode::jz ? opcode::jnz : opcode::jz;
+				instruction.a = context.program[pc + 1].a;
+				remove(context.program[pc + 1]);
+				return true;
+			}
+
+			if (target != instruction.a)
+			{
+				instruction.a = static_cast<std::uint32_t>(target);
+				return true;
+			}
+			return false;
+		}
+
+		bool fold_push_pop(context& context, const size_t pc)
+		{
+			auto& push = context.program[pc];
+			if ((push.op != opcode::pushr && push.op != opcode::pushi) || !context.follows(pc) || context.program[pc + 1].op != opcode::pop)
+			{
+				return false;
+			}
+
+			const auto destination = context.program[pc + 1].c;
+			if (push.op == opcode::pushi)
+			{
+				push = i64(opcode::load, push.sa(), 0, destination);
+			}
+			else if (push.rc() == static_cast<std::uint8_t>(destination))
+			{
+				remove(push);
+			}
+			else
+			{
+				push = i64(opcode::move, 0, static_cast<std::int16_t>(push.rc()), destination);
+			}
+			remove(context.program[pc + 1]);
+			return true;
+		}
+
+		bool fold_immediate(context& context, const size_t pc)
+		{
+			auto& instruction = context.program[pc];
+			const auto constant = [&](const size_t reg) { return context.known[reg]; };
+			const auto rewrite = [&](const opcode op, const std::int32_t immediate, const size_t source)
+			{
+				instruction = i64(op, immediate, static_cast<std::int16_t>(source), instruction.c);
+				return true;
+			};
+
+			switch (instruction.op)
+			{
+				case opcode::move:
+					if (const auto k = constant(instruction.rbs()))
+					{
+						return rewrite(opcode::load, *k, 0);
+					}
+					return false;
+				case opcode::addr:
+				case opcode::mulr:
+				{
+					const auto op = instruction.op == opcode::addr ? opcode::addrs : opcode::mulrs;
+					if (const auto k = constant(instruction.a))
+					{
+						return rewrite(op, *k, instruction.rbs());
+					}
+					if (const auto k = constant(instruction.rbs()))
+					{
+						return rewrite(op, *k, instruction.a);
+					}
+					return false;
+				}
+				case opcode::subr:
+					if (const auto k = constant(instruction.a); k && *k != std::numeric_limits<std::int32_t>::min())
+					{
+						return rewrite(opcode::addrs, -*k, instruction.rbs());
+					}
+					return false;
+				case opcode::divr:
+					if (const auto k = constant(instruction.a); k && *k != 0)
+					{
+						return rewrite(opcode::divrs, *k, instruction.rbs());
+					}
+					return false;
+				case opcode::addrs:
+					return instruction.sa() == 0 && rewrite(opcode::move, 0, instruction.rbs());
+				case opcode::mulrs:
+					if (instruction.sa() == 0)
+					{
+						return rewrite(opcode::load, 0, 0);
+					}
+					return instruction.sa() == 1 && rewrite(opcode::move, 0, instruction.rbs());
+				case opcode::divrs:
+					return instruction.sa() == 1 && rewrite(opcode::move, 0, instruction.rbs());
+				default:
+					return false;
+			}
+		}
+
+		bool remove_redundant_move(context& context, const size_t pc)
+		{
+			auto& instruction = context.program[pc];
+			if (instruction.op != opcode::move && instruction.op != opcode::movev)
+			{
+				return false;
+			}
+
+			const auto swaps_back = [&]
+			{
+				// move b, a; move a, b: the second one copies back what is already there
+				const auto& previous = context.program[pc - 1];
+				return previous.op == opcode::move && instruction.op == opcode::move && previous.rc() == instruction.rbs() && previous.rbs() == instruction.rc();
+			};
+
+			if (instruction.rbs() == instruction.rc() || (pc > 0 && !context.targets[pc] && swaps_back()))
+			{
+				remove(instruction);
+				return true;
+			}
+
+			// t = ...; move d, t with t dead afterwards: compute into d directly
+			if (pc > 0 && !context.targets[pc] && !context.live_out[pc][instruction.rbs()])
+			{
+				// movev also copies the tag, so the previous instruction has to write one
+				auto& previous = context.program[pc - 1];
+				if (written_register(previous) == instruction.rbs() && (instruction.op == opcode::move || writes_tag(previous)))
+				{
+					previous.c = instruction.c;
+					remove(instruction);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool remove_dead_write(context& context, const size_t pc)
+		{
+			auto& instruction = context.program[pc];
+			if (!is_pure(instruction) || context.live_out[pc][instruction.rc()])
+			{
+				return false;
+			}
+			remove(instruction);
+			return true;
+		}
+
+		using rewrite = bool (*)(context& context, size_t pc);
+
+		struct rule_entry
+		{
+			rule id;
+			const char* name;
+			rewrite apply;
+		};
+
+		const rule_entry rule_table[] =
+		{
+			{ rule::jump_threading, "jump threading", &thread_jumps },
+			{ rule::push_pop, "push/pop pairs", &fold_push_pop },
+			{ rule::fold_immediate, "immediate folding", &fold_immediate },
+			{ rule::redundant_move, "redundant moves", &remove_redundant_move },
+			{ rule::dead_write, "dead writes", &remove_dead_write },
+		};
+
+		/* drops nops, remapping jump targets and the line table */
+		void compact(ir::bytecode& bytecode)
+		{
+			auto& program = bytecode.program;
+			std::vector<size_t> remap(program.size() + 1);
+			size_t next = 0;
+			for (size_t pc = 0; pc < program.size(); pc++)
+			{
+				remap[pc] = next;
+				if (program[pc].op != opcode::nop)
+				{
+					next++;
+				}
+			}
+			remap[program.size()] = next;
+
+			if (next == program.size())
+			{
+				return;
+			}
+
+			const auto positions = bytecode.lines.expand(program.size());
+			std::vector<i64> compacted;
+			compacted.reserve(next);
+			bytecode.lines.clear();
+			for (size_t pc = 0; pc < program.size(); pc++)
+			{
+				auto instruction = program[pc];
+				if (instruction.op == opcode::nop)
+				{
+					continue;
+				}
+				if (is_jump(instruction.op))
+				{
+					instruction.a = static_cast<std::uint32_t>(remap[std::min<size_t>(instruction.a, program.size())]);
+				}
+				bytecode.lines.add(compacted.size(), positions[pc]);
+				compacted.push_back(instruction);
+			}
+			program = std::move(compacted);
+		}
+	}
+
+	statistics optimise(ir::bytecode& bytecode, const rule_set& rules)
+	{
+		statistics statistics;
+		statistics.instructions_before = bytecode.program.size();
+
+		for (auto changed = true; changed && statistics.passes < max_passes; statistics.passes++)
+		{
+			changed = false;
+			context context(bytecode.program);
+			context.analyse();
+
+			for (size_t pc = 0; pc < bytecode.program.size(); pc++)
+			{
+				if (context.targets[pc])
+				{
+					context.known.fill(std::nullopt);
+				}
+
+				// liveness describes the instruction as it was, so one rewrite per pc and pass
+				for (const auto& entry : rule_table)
+				{
+					if (rules[static_cast<size_t>(entry.id)] && entry.apply(context, pc))
+					{
+						statistics.applied[static_cast<size_t>(entry.id)]++;
+						changed = true;
+						break;
+					}
+				}
+				context.observe(pc);
+			}
+			compact(bytecode);
+		}
+
+		statistics.instructions_after = bytecode.program.size();
+		return statistics;
+	}
+
+	const char* rule_name(const rule rule)
+	{
+		const auto entry = std::find_if(std::begin(rule_table), std::end(rule_table), [&](const rule_entry& candidate)
+		{
+			return candidate.id == rule;
+		});
+		return entry != std::end(rule_table) ? entry->name : "unknown";
+	}
+}
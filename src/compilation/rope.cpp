@@ -0,0 +1,166 @@
+/*
+ * File Name: rope.cpp
+ * Author(s): P. Kamara
+ *
+ * Interned strings that concatenate lazily.
+ */
+
+#include "compilation/rope.h"
+
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cherie::compiler
+{
+	namespace
+	{
+		struct intern_table
+		{
+			std::mutex mutex;
+			std::unordered_map<std::basic_string_view<types::che_char>, std::weak_ptr<const types::string>> strings; // keys point into the strings
+		};
+
+		intern_table& table()
+		{
+			static auto* instance = new intern_table(); // never destroyed, ropes in static storage may outlive it otherwise
+			return *instance;
+		}
+	}
+
+	rope::rope(types::string text)
+	{
+		if (!text.empty())
+		{
+			auto leaf = std::make_shared<piece>();
+			leaf->size = text.size();
+			leaf->text = intern(std::move(text));
+			root_ = std::move(leaf);
+		}
+	}
+
+	std::shared_ptr<const types::string> rope::intern(types::string text)
+	{
+		auto& strings = table();
+		std::lock_guard lock(strings.mutex);
+		if (const auto found = strings.strings.find(text); found != strings.strings.end())
+		{
+			if (auto existing = found->second.lock())
+			{
+				return existing;
+			}
+			strings.strings.erase(found); // the last user is on its way out, its key must not outlive it
+		}
+
+		std::shared_ptr<const types::string> interned(new types::string(std::move(text)), [](const types::string* dead)
+		{
+			{
+				auto& strings = table();
+				std::lock_guard lock(strings.mutex);
+				if (const auto found = strings.strings.find(*dead); found != strings.strings.end() && found->first.data() == dead->data())
+				{
+					strings.strings.erase(found);
+				}
+			}
+			delete dead;
+		});
+		strings.strings.emplace(*interned, interned);
+		return interned;
+	}
+
+	rope::piece::~piece()
+	{
+		// a long chain would otherwise be released one nested destructor per link
+		std::vector<std::shared_ptr<const piece>> pending;
+		pending.push_back(std::move(left));
+		pending.push_back(std::move(right));
+		while (!pending.empty())
+		{
+			const auto next = std::move(pending.back());
+			pending.pop_back();
+			if (next && next.use_count() == 1)
+			{
+				pending.push_back(std::move(next->left));
+				pending.push_back(std::move(next->right));
+			}
+		}
+	}
+
+	const types::string& rope::flatten(const piece& node)
+	{
+		if (node.text)
+		{
+			return *node.text;
+		}
+
+		std::call_once(node.flattened, [&node]
+		{
+			// other threads may be flattening a rope this node is part of, and may see it drop its children
+			types::string text;
+			text.reserve(node.size);
+			std::vector<std::shared_ptr<const piece>> pending{ std::atomic_load(&node.right), std::atomic_load(&node.left) };
+			while (!pending.empty())
+			{
+				const auto next = std::move(pending.back());
+				pending.pop_back();
+				if (next->text)
+				{
+					text += *next->text;
+					continue;
+				}
+
+				// the left child is dropped last, so a node missing either has its text in flat
+				auto left = std::atomic_load(&next->left);
+				auto right = std::atomic_load(&next->right);
+				if (!left || !right)
+				{
+					text += *next->flat;
+					continue;
+				}
+				pending.push_back(std::move(right));
+				pending.push_back(std::move(left));
+			}
+			node.flat = intern(std::move(text));
+			std::atomic_store(&node.right, std::shared_ptr<const piece>());
+			std::atomic_store(&node.left, std::shared_ptr<const piece>());
+		});
+		return *node.flat;
+	}
+
+	const types::string& rope::str() const
+	{
+		static const types::string empty;
+		return root_ ? flatten(*root_) : empty;
+	}
+
+	rope operator+(const rope& lhs, const rope& rhs)
+	{
+		if (lhs.empty())
+		{
+			return rhs;
+		}
+		if (rhs.empty())
+		{
+			return lhs;
+		}
+
+		auto node = std::make_shared<rope::piece>();
+		node->left = lhs.root_;
+		node->right = rhs.root_;
+		node->size = lhs.size() + rhs.size();
+
+		rope joined;
+		joined.root_ = std::move(node);
+		return joined;
+	}
+
+	bool operator==(const rope& lhs, const rope& rhs)
+	{
+		if (lhs.root_ == rhs.root_)
+		{
+			return true;
+		}
+		// equal text is interned into the same string
+		return lhs.size() == rhs.size() && &lhs.str() == &rhs.str();
+	}
+}
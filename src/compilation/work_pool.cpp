@@ -0,0 +1,166 @@
+/*
+ * File Name: work_pool.cpp
+ * Author(s): P. Kamara
+ *
+ * Work-stealing thread pool for the compiler.
+ */
+
+#include <algorithm>
+#include <optional>
+#include "compilation/work_pool.h"
+
+namespace cherie::compiler
+{
+	work_pool::work_pool(const size_t workers)
+	{
+		for (size_t index = 0; index <= workers; index++)
+		{
+			queues_.push_back(std::make_unique<queue>());
+		}
+		for (size_t index = 0; index < workers; index++)
+		{
+			workers_.emplace_back(&work_pool::work, this, index);
+		}
+	}
+
+	work_pool::~work_pool()
+	{
+		{
+			std::lock_guard lock(sleep_mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_all();
+		for (auto& worker : workers_)
+		{
+			worker.join();
+		}
+	}
+
+	bool work_pool::run_one(const size_t home)
+	{
+		std::optional<job> next;
+		{
+			auto& own = *queues_[home];
+			std::lock_guard lock(own.mutex);
+			if (!own.jobs.empty())
+			{
+				next = own.jobs.back();
+				own.jobs.pop_back();
+			}
+		}
+
+		for (size_t offset = 1; !next && offset < queues_.size(); offset++)
+		{
+			auto& victim = *queues_[(home + offset) % queues_.size()];
+			std::lock_guard lock(victim.mutex);
+			if (!victim.jobs.empty())
+			{
+				next = victim.jobs.front();
+				victim.jobs.pop_front();
+			}
+		}
+
+		if (!next)
+		{
+			return false;
+		}
+		queued_--;
+		execute(*next);
+		return true;
+	}
+
+	void work_pool::execute(const job& job)
+	{
+		auto& batch = *job.owner;
+		try
+		{
+			(*batch.task)(job.index);
+		}
+		catch (...)
+		{
+			std::lock_guard lock(batch.mutex);
+			if (job.index < batch.error_index)
+			{
+				batch.error = std::current_exception();
+				batch.error_index = job.index;
+			}
+		}
+
+		// under the lock, the caller frees the batch as soon as it sees zero
+		std::lock_guard lock(batch.mutex);
+		if (--batch.remaining == 0)
+		{
+			batch.done.notify_all();
+		}
+	}
+
+	void work_pool::work(const size_t home)
+	{
+		while (true)
+		{
+			if (run_one(home))
+			{
+				continue;
+			}
+
+			std::unique_lock lock(sleep_mutex_);
+			wake_.wait(lock, [this]
+			{
+				return stopping_ || queued_ != 0;
+			});
+			if (stopping_ && queued_ == 0)
+			{
+				return;
+			}
+		}
+	}
+
+	void work_pool::run(const size_t count, const std::function<void(size_t)>& task)
+	{
+		if (workers_.empty() || count < 2)
+		{
+			for (size_t index = 0; index < count; index++)
+			{
+				task(index);
+			}
+			return;
+		}
+
+		batch batch;
+		batch.task = &task;
+		batch.remaining = count;
+		{
+			std::lock_guard lock(sleep_mutex_);
+			queued_ += count;
+		}
+		for (size_t index = 0; index < count; index++)
+		{
+			auto& target = *queues_[index % queues_.size()];
+			std::lock_guard lock(target.mutex);
+			target.jobs.push_back({ &batch, index });
+		}
+		wake_.notify_all();
+
+		const auto home = queues_.size() - 1;
+		while (batch.remaining != 0 && run_one(home)) {}
+
+		{
+			std::unique_lock lock(batch.mutex);
+			batch.done.wait(lock, [&]
+			{
+				return batch.remaining == 0;
+			});
+		}
+
+		if (batch.error)
+		{
+			std::rethrow_exception(batch.error);
+		}
+	}
+
+	work_pool& work_pool::shared()
+	{
+		static work_pool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+		return pool;
+	}
+}
@@ -13,5 +13,143 @@
 
 namespace cherie
 {
-	
+	void state_raw::load(const types::string& source, const compiler::options& options)
+	{
+		load(std::make_shared<compiler::unit>(source, options));
+	}
+
+	void state_raw::load(std::shared_ptr<compiler::unit> unit)
+	{
+		const auto& output = unit->program();
+		program = output.program;
+		constants.assign(output.constants.begin(), output.constants.end());
+		lines = output.lines;
+		functions = output.functions;
+		globals = output.globals;
+		layout = output.layout;
+		unit_ = std::move(unit);
+		image_.reset();
+		mapped_program_ = nullptr;
+		mapped_constants_ = nullptr;
+		native_ = nullptr;
+	}
+
+	void state_raw::load(std::shared_ptr<const vm::image> image)
+	{
+		program.clear();
+		constants.clear();
+		lines = image->lines();
+		functions = image->functions();
+		globals = image->globals();
+		layout = image->layout();
+		mapped_program_ = image->program();
+		mapped_constants_ = image->constants();
+		native_ = nullptr;
+		unit_.reset();
+		image_ = std::move(image);
+	}
+
+	void state_raw::load(const compiler::embedded::program_view& program)
+	{
+		this->program.assign(program.code, program.code + program.size);
+		constants.clear();
+		lines.clear();
+		for (size_t pc = 0; pc < program.size; pc++)
+		{
+			lines.add(pc, { program.lines[pc], 0 });
+		}
+		functions.clear();
+		for (size_t index = 0; index < program.function_count; index++)
+		{
+			const auto& function = program.functions[index];
+			functions.push_back({ std::string(function.name.begin(), function.name.end()), function.entry, function.parameters, function.frame_size, 0 });
+		}
+		globals.clear();
+		for (size_t index = 0; index < program.global_count; index++)
+		{
+			globals.emplace_back(program.globals[index].begin(), program.globals[index].end());
+		}
+		layout = {};
+		unit_.reset();
+		image_.reset();
+		mapped_program_ = nullptr;
+		mapped_constants_ = nullptr;
+		native_ = nullptr;
+	}
+
+	void state_raw::load(const vm::native_program& program)
+	{
+		this->program.clear();
+		constants.clear();
+		lines.assign(program.lines, program.lines_size, program.line_entries);
+		functions.clear();
+		for (size_t index = 0; index < program.function_count; index++)
+		{
+			const auto& function = program.functions[index];
+			functions.push_back({ function.name, 0, function.parameters, function.frame_size, function.upvalues });
+		}
+		globals.assign(program.globals, program.globals + program.global_count);
+		layout.fields.assign(program.fields, program.fields + program.field_count);
+		layout.assign_shapes(program.shapes, program.shapes_size);
+		layout.sites.assign(program.sites, program.sites + program.site_count);
+		unit_.reset();
+		image_.reset();
+		mapped_program_ = nullptr;
+		mapped_constants_ = nullptr;
+		native_ = &program;
+	}
+
+	void state_raw::load_function(const std::uint32_t function)
+	{
+		if (!unit_)
+		{
+			return virtual_machine::load_function(function);
+		}
+
+		const auto& compiled = unit_->compile(function);
+		const auto entry = static_cast<std::uint32_t>(program.size());
+		const auto pool = static_cast<std::uint32_t>(constants.size());
+		const auto sites = static_cast<std::uint32_t>(layout.sites.size());
+		const auto positions = compiled.code.lines.expand(compiled.code.program.size());
+		for (size_t pc = 0; pc < compiled.code.program.size(); pc++)
+		{
+			auto instruction = compiled.code.program[pc];
+			compiler::relocate(instruction, entry, pool, sites);
+			lines.add(program.size(), positions[pc]);
+			program.push_back(instruction);
+		}
+		constants.insert(constants.end(), compiled.code.constants.begin(), compiled.code.constants.end());
+
+		// fields and shapes are numbered across the unit, the function brings the tables as they were when it was compiled
+		const auto& objects = compiled.code.layout;
+		layout.sites.insert(layout.sites.end(), objects.sites.begin(), objects.sites.end());
+		if (objects.fields.size() > layout.fields.size())
+		{
+			layout.fields = objects.fields;
+		}
+		if (objects.shapes.size() > layout.shapes.size())
+		{
+			layout.shapes = objects.shapes;
+		}
+
+		for (size_t index = 0; index < compiled.indices.size(); index++)
+		{
+			const auto slot = compiled.indices[index];
+			if (slot >= functions.size())
+			{
+				functions.resize(slot + 1);
+			}
+			functions[slot] = compiled.code.functions[index];
+			functions[slot].entry += entry;
+		}
+	}
+
+	vm::telemetry_snapshot state_raw::telemetry() const
+	{
+#ifdef CHERIE_TELEMETRY
+		return telemetry_.snapshot();
+#else
+		return {};
+#endif
+	}
 }
@@ -0,0 +1,749 @@
+/*
+ * File Name: array.cpp
+ * Author(s): P. Kamara
+ *
+ * Packed numeric arrays.
+ */
+
+#include "vm/array.h"
+
+#include <algorithm>
+
+#include "vm/arithmetic.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHERIE_ARRAY_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define CHERIE_ARRAY_AVX2 __attribute__((target("avx2"))) // built for any x86-64, used where the processor has it
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#define CHERIE_ARRAY_AVX2
+#include <immintrin.h>
+#endif
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace cherie::vm
+{
+	namespace
+	{
+		constexpr size_t lanes = 8; // partial sums of sums and dot products
+
+		double combine(const double partial[lanes])
+		{
+			return ((partial[0] + partial[1]) + (partial[2] + partial[3])) + ((partial[4] + partial[5]) + (partial[6] + partial[7]));
+		}
+
+		std::uint32_t ones(const std::uint32_t mask)
+		{
+#ifdef _MSC_VER
+			return __popcnt(mask);
+#else
+			return static_cast<std::uint32_t>(__builtin_popcount(mask));
+#endif
+		}
+
+		template <kernel op>
+		vm_register apply(const vm_register a, const vm_register b)
+		{
+			if constexpr (op == kernel::add)
+			{
+				return wrapping_add(a, b);
+			}
+			else if constexpr (op == kernel::sub)
+			{
+				return wrapping_subtract(a, b);
+			}
+			else if constexpr (op == kernel::mul)
+			{
+				return wrapping_multiply(a, b);
+			}
+			else
+			{
+				return b == -1 ? wrapping_subtract(0, a) : a / b; // the caller has ruled out zero
+			}
+		}
+
+		template <kernel op>
+		double apply(const double a, const double b)
+		{
+			if constexpr (op == kernel::add)
+			{
+				return a + b;
+			}
+			else if constexpr (op == kernel::sub)
+			{
+				return a - b;
+			}
+			else if constexpr (op == kernel::mul)
+			{
+				return a * b;
+			}
+			else
+			{
+				return a / b;
+			}
+		}
+
+		bool between(const vm_register value, const vm_register low, const vm_register high)
+		{
+			return low <= value && value <= high;
+		}
+
+		bool between(const double value, const double low, const double high)
+		{
+			return low <= value && value <= high;
+		}
+
+#ifdef CHERIE_ARRAY_SSE2
+		/* each of these does a prefix of the elements and returns how many, plain loops do the rest */
+		namespace sse2
+		{
+			size_t sum(const vm_register* values, const size_t count, vm_register& total)
+			{
+				auto low = _mm_setzero_si128();
+				auto high = _mm_setzero_si128();
+				size_t index = 0;
+				for (; index + 4 <= count; index += 4)
+				{
+					low = _mm_add_epi64(low, _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + index)));
+					high = _mm_add_epi64(high, _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + index + 2)));
+				}
+				vm_register partial[2];
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(partial), _mm_add_epi64(low, high));
+				total = wrapping_add(partial[0], partial[1]);
+				return index;
+			}
+
+			size_t sum(const double* values, const size_t count, double partial[lanes])
+			{
+				__m128d sums[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+				size_t index = 0;
+				for (; index + lanes <= count; index += lanes)
+				{
+					for (size_t part = 0; part < 4; part++)
+					{
+						sums[part] = _mm_add_pd(sums[part], _mm_loadu_pd(values + index + part * 2));
+					}
+				}
+				for (size_t part = 0; part < 4; part++)
+				{
+					_mm_storeu_pd(partial + part * 2, sums[part]);
+				}
+				return index;
+			}
+
+			size_t dot(const double* lhs, const double* rhs, const size_t count, double partial[lanes])
+			{
+				__m128d sums[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+				size_t index = 0;
+				for (; index + lanes <= count; index += lanes)
+				{
+					for (size_t part = 0; part < 4; part++)
+					{
+						sums[part] = _mm_add_pd(sums[part], _mm_mul_pd(_mm_loadu_pd(lhs + index + part * 2), _mm_loadu_pd(rhs + index + part * 2)));
+					}
+				}
+				for (size_t part = 0; part < 4; part++)
+				{
+					_mm_storeu_pd(partial + part * 2, sums[part]);
+				}
+				return index;
+			}
+
+			template <bool smallest>
+			size_t extreme(const double* values, const size_t count, double& best)
+			{
+				auto result = _mm_set1_pd(best);
+				size_t index = 0;
+				for (; index + 2 <= count; index += 2)
+				{
+					const auto value = _mm_loadu_pd(values + index);
+					result = smallest ? _mm_min_pd(value, result) : _mm_max_pd(value, result);
+				}
+				double partial[2];
+				_mm_storeu_pd(partial, result);
+				for (const auto value : partial)
+				{
+					best = smallest ? (value < best ? value : best) : (value > best ? value : best);
+				}
+				return index;
+			}
+
+			template <kernel op>
+			__m128i apply(const __m128i a, const __m128i b)
+			{
+				return op == kernel::add ? _mm_add_epi64(a, b) : _mm_sub_epi64(a, b);
+			}
+
+			template <kernel op>
+			__m128d apply(const __m128d a, const __m128d b)
+			{
+				if constexpr (op == kernel::add)
+				{
+					return _mm_add_pd(a, b);
+				}
+				else if constexpr (op == kernel::sub)
+				{
+					return _mm_sub_pd(a, b);
+				}
+				else if constexpr (op == kernel::mul)
+				{
+					return _mm_mul_pd(a, b);
+				}
+				else
+				{
+					return _mm_div_pd(a, b);
+				}
+			}
+
+			template <kernel op, bool lhs_scalar, bool rhs_scalar>
+			size_t elementwise(const vm_register* lhs, const vm_register* rhs, vm_register* out, const size_t count)
+			{
+				if constexpr (op != kernel::add && op != kernel::sub)
+				{
+					return 0; // no 64-bit multiplies or divides
+				}
+				else
+				{
+					const auto left = lhs_scalar ? _mm_set1_epi64x(*lhs) : _mm_setzero_si128();
+					const auto right = rhs_scalar ? _mm_set1_epi64x(*rhs) : _mm_setzero_si128();
+					size_t index = 0;
+					for (; index + 2 <= count; index += 2)
+					{
+						const auto a = lhs_scalar ? left : _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + index));
+						const auto b = rhs_scalar ? right : _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + index));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), apply<op>(a, b));
+					}
+					return index;
+				}
+			}
+
+			template <kernel op, bool lhs_scalar, bool rhs_scalar>
+			size_t elementwise(const double* lhs, const double* rhs, double* out, const size_t count)
+			{
+				const auto left = lhs_scalar ? _mm_set1_pd(*lhs) : _mm_setzero_pd();
+				const auto right = rhs_scalar ? _mm_set1_pd(*rhs) : _mm_setzero_pd();
+				size_t index = 0;
+				for (; index + 2 <= count; index += 2)
+				{
+					const auto a = lhs_scalar ? left : _mm_loadu_pd(lhs + index);
+					const auto b = rhs_scalar ? right : _mm_loadu_pd(rhs + index);
+					_mm_storeu_pd(out + index, apply<op>(a, b));
+				}
+				return index;
+			}
+
+			size_t count_between(const double* values, const size_t count, const double low, const double high, size_t& kept)
+			{
+				const auto lower = _mm_set1_pd(low);
+				const auto upper = _mm_set1_pd(high);
+				size_t index = 0;
+				for (; index + 2 <= count; index += 2)
+				{
+					const auto value = _mm_loadu_pd(values + index);
+					kept += ones(static_cast<std::uint32_t>(_mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(value, lower), _mm_cmple_pd(value, upper)))));
+				}
+				return index;
+			}
+		}
+#endif
+
+#ifdef CHERIE_ARRAY_AVX2
+		namespace avx2
+		{
+			bool supported()
+			{
+#ifdef __GNUC__
+				static const bool available = __builtin_cpu_supports("avx2");
+				return available;
+#else
+				return true; // only built with AVX2 enabled
+#endif
+			}
+
+			/* for each mask of four lanes, the 32-bit halves of the lanes it keeps moved to the front */
+			struct compress_table
+			{
+				std::uint32_t indices[16][8] = {};
+
+				constexpr compress_table()
+				{
+					for (std::uint32_t mask = 0; mask < 16; mask++)
+					{
+						std::uint32_t next = 0;
+						for (std::uint32_t lane = 0; lane < 4; lane++)
+						{
+							if (mask >> lane & 1)
+							{
+								indices[mask][next++] = lane * 2;
+								indices[mask][next++] = lane * 2 + 1;
+							}
+						}
+					}
+				}
+			};
+			constexpr compress_table compress;
+
+			CHERIE_ARRAY_AVX2 size_t sum(const vm_register* values, const size_t count, vm_register& total)
+			{
+				auto low = _mm256_setzero_si256();
+				auto high = _mm256_setzero_si256();
+				size_t index = 0;
+				for (; index + 8 <= count; index += 8)
+				{
+					low = _mm256_add_epi64(low, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + index)));
+					high = _mm256_add_epi64(high, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + index + 4)));
+				}
+				vm_register partial[4];
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(partial), _mm256_add_epi64(low, high));
+				total = wrapping_add(wrapping_add(partial[0], partial[1]), wrapping_add(partial[2], partial[3]));
+				return index;
+			}
+
+			CHERIE_ARRAY_AVX2 size_t sum(const double* values, const size_t count, double partial[lanes])
+			{
+				auto low = _mm256_setzero_pd();
+				auto high = _mm256_setzero_pd();
+				size_t index = 0;
+				for (; index + lanes <= count; index += lanes)
+				{
+					low = _mm256_add_pd(low, _mm256_loadu_pd(values + index));
+					high = _mm256_add_pd(high, _mm256_loadu_pd(values + index + 4));
+				}
+				_mm256_storeu_pd(partial, low);
+				_mm256_storeu_pd(partial + 4, high);
+				return index;
+			}
+
+			CHERIE_ARRAY_AVX2 size_t dot(const double* lhs, const double* rhs, const size_t count, double partial[lanes])
+			{
+				auto low = _mm256_setzero_pd();
+				auto high = _mm256_setzero_pd();
+				size_t index = 0;
+				for (; index + lanes <= count; index += lanes)
+				{
+					// separate multiplies and adds, a fused one would round differently from the other paths
+					low = _mm256_add_pd(low, _mm256_mul_pd(_mm256_loadu_pd(lhs + index), _mm256_loadu_pd(rhs + index)));
+					high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_loadu_pd(lhs + index + 4), _mm256_loadu_pd(rhs + index + 4)));
+				}
+				_mm256_storeu_pd(partial, low);
+				_mm256_storeu_pd(partial + 4, high);
+				return index;
+			}
+
+			template <bool smallest>
+			CHERIE_ARRAY_AVX2 size_t extreme(const vm_register* values, const size_t count, vm_register& best)
+			{
+				auto result = _mm256_set1_epi64x(best);
+				size_t index = 0;
+				for (; index + 4 <= count; index += 4)
+				{
+					const auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + index));
+					const auto better = smallest ? _mm256_cmpgt_epi64(result, value) : _mm256_cmpgt_epi64(value, result);
+					result = _mm256_blendv_epi8(result, value, better);
+				}
+				vm_register partial[4];
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(partial), result);
+				for (const auto value : partial)
+				{
+					best = smallest ? std::min(best, value) : std::max(best, value);
+				}
+				return index;
+			}
+
+			template <bool smallest>
+			CHERIE_ARRAY_AVX2 size_t extreme(const double* values, const size_t count, double& best)
+			{
+				auto result = _mm256_set1_pd(best);
+				size_t index = 0;
+				for (; index + 4 <= count; index += 4)
+				{
+					const auto value = _mm256_loadu_pd(values + index);
+					result = smallest ? _mm256_min_pd(value, result) : _mm256_max_pd(value, result);
+				}
+				double partial[4];
+				_mm256_storeu_pd(partial, result);
+				for (const auto value : partial)
+				{
+					best = smallest ? (value < best ? value : best) : (value > best ? value : best);
+				}
+				return index;
+			}
+
+			template <kernel op>
+			CHERIE_ARRAY_AVX2 __m256i apply(const __m256i a, const __m256i b)
+			{
+				return op == kernel::add ? _mm256_add_epi64(a, b) : _mm256_sub_epi64(a, b);
+			}
+
+			template <kernel op>
+			CHERIE_ARRAY_AVX2 __m256d apply(const __m256d a, const __m256d b)
+			{
+				if constexpr (op == kernel::add)
+				{
+					return _mm256_add_pd(a, b);
+				}
+				else if constexpr (op == kernel::sub)
+				{
+					return _mm256_sub_pd(a, b);
+				}
+				else if constexpr (op == kernel::mul)
+				{
+					return _mm256_mul_pd(a, b);
+				}
+				else
+				{
+					return _mm256_div_pd(a, b);
+				}
+			}
+
+			template <kernel op, bool lhs_scalar, bool rhs_scalar>
+			CHERIE_ARRAY_AVX2 size_t elementwise(const vm_register* lhs, const vm_register* rhs, vm_register* out, const size_t count)
+			{
+				if constexpr (op != kernel::add && op != kernel::sub)
+				{
+					return 0;
+				}
+				else
+				{
+					const auto left = lhs_scalar ? _mm256_set1_epi64x(*lhs) : _mm256_setzero_si256();
+					const auto right = rhs_scalar ? _mm256_set1_epi64x(*rhs) : _mm256_setzero_si256();
+					size_t index = 0;
+					for (; index + 4 <= count; index += 4)
+					{
+						const auto a = lhs_scalar ? left : _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + index));
+						const auto b = rhs_scalar ? right : _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + index));
+						_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + index), apply<op>(a, b));
+					}
+					return index;
+				}
+			}
+
+			template <kernel op, bool lhs_scalar, bool rhs_scalar>
+			CHERIE_ARRAY_AVX2 size_t elementwise(const double* lhs, const double* rhs, double* out, const size_t count)
+			{
+				const auto left = lhs_scalar ? _mm256_set1_pd(*lhs) : _mm256_setzero_pd();
+				const auto right = rhs_scalar ? _mm256_set1_pd(*rhs) : _mm256_setzero_pd();
+				size_t index = 0;
+				for (; index + 4 <= count; index += 4)
+				{
+					const auto a = lhs_scalar ? left : _mm256_loadu_pd(lhs + index);
+					const auto b = rhs_scalar ? right : _mm256_loadu_pd(rhs + index);
+					_mm256_storeu_pd(out + index, apply<op>(a, b));
+				}
+				return index;
+			}
+
+			CHERIE_ARRAY_AVX2 __m256i inside(const __m256i value, const __m256i low, const __m256i high)
+			{
+				return _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi64(low, value), _mm256_cmpgt_epi64(value, high)), _mm256_set1_epi64x(-1));
+			}
+
+			CHERIE_ARRAY_AVX2 __m256i inside(const __m256d value, const __m256d low, const __m256d high)
+			{
+				return _mm256_castpd_si256(_mm256_and_pd(_mm256_cmp_pd(value, low, _CMP_GE_OQ), _mm256_cmp_pd(value, high, _CMP_LE_OQ)));
+			}
+
+			CHERIE_ARRAY_AVX2 __m256i load(const vm_register* values) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values)); }
+			CHERIE_ARRAY_AVX2 __m256d load(const double* values) { return _mm256_loadu_pd(values); }
+			CHERIE_ARRAY_AVX2 __m256i broadcast(const vm_register value) { return _mm256_set1_epi64x(value); }
+			CHERIE_ARRAY_AVX2 __m256d broadcast(const double value) { return _mm256_set1_pd(value); }
+			CHERIE_ARRAY_AVX2 __m256i bits(const __m256i value) { return value; }
+			CHERIE_ARRAY_AVX2 __m256i bits(const __m256d value) { return _mm256_castpd_si256(value); }
+
+			template <typename T>
+			CHERIE_ARRAY_AVX2 size_t count_between(const T* values, const size_t count, const T low, const T high, size_t& kept)
+			{
+				const auto lower = broadcast(low);
+				const auto upper = broadcast(high);
+				size_t index = 0;
+				for (; index + 4 <= count; index += 4)
+				{
+					kept += ones(static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(inside(load(values + index), lower, upper)))));
+				}
+				return index;
+			}
+
+			/* packs the lanes that are in range to the front and stores all four, as long as out has room for them */
+			template <typename T>
+			CHERIE_ARRAY_AVX2 size_t copy_between(const T* values, const size_t count, const T low, const T high, T* out, const size_t kept, size_t& written)
+			{
+				const auto lower = broadcast(low);
+				const auto upper = broadcast(high);
+				size_t index = 0;
+				for (; index + 4 <= count && written + 4 <= kept; index += 4)
+				{
+					const auto value = load(values + index);
+					const auto mask = static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(inside(value, lower, upper))));
+					const auto order = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(compress.indices[mask]));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written), _mm256_permutevar8x32_epi32(bits(value), order));
+					written += ones(mask);
+				}
+				return index;
+			}
+		}
+#endif
+
+		template <typename T>
+		void copy_range(const T* values, const size_t count, const T low, const T high, T* out, const size_t kept)
+		{
+			size_t written = 0;
+			size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+			index = avx2::supported() ? avx2::copy_between(values, count, low, high, out, kept, written) : 0;
+#endif
+			// every write lands below kept, and once that many are written the rest are all out of range
+			for (; index < count && written < kept; index++)
+			{
+				out[written] = values[index];
+				written += between(values[index], low, high);
+			}
+		}
+
+		template <typename T, kernel op, bool lhs_scalar, bool rhs_scalar>
+		void elementwise(const T* lhs, const T* rhs, T* out, const size_t count)
+		{
+			size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+			index = avx2::supported() ? avx2::elementwise<op, lhs_scalar, rhs_scalar>(lhs, rhs, out, count) : sse2::elementwise<op, lhs_scalar, rhs_scalar>(lhs, rhs, out, count);
+#elif defined(CHERIE_ARRAY_SSE2)
+			index = sse2::elementwise<op, lhs_scalar, rhs_scalar>(lhs, rhs, out, count);
+#endif
+			for (; index < count; index++)
+			{
+				out[index] = apply<op>(lhs[lhs_scalar ? 0 : index], rhs[rhs_scalar ? 0 : index]);
+			}
+		}
+
+		template <typename T, kernel op>
+		void elementwise(const T* lhs, const bool lhs_scalar, const T* rhs, const bool rhs_scalar, T* out, const size_t count)
+		{
+			if (lhs_scalar)
+			{
+				elementwise<T, op, true, false>(lhs, rhs, out, count);
+			}
+			else if (rhs_scalar)
+			{
+				elementwise<T, op, false, true>(lhs, rhs, out, count);
+			}
+			else
+			{
+				elementwise<T, op, false, false>(lhs, rhs, out, count);
+			}
+		}
+
+		template <typename T>
+		void elementwise(const kernel op, const T* lhs, const bool lhs_scalar, const T* rhs, const bool rhs_scalar, T* out, const size_t count)
+		{
+			switch (op)
+			{
+				case kernel::add: elementwise<T, kernel::add>(lhs, lhs_scalar, rhs, rhs_scalar, out, count); break;
+				case kernel::sub: elementwise<T, kernel::sub>(lhs, lhs_scalar, rhs, rhs_scalar, out, count); break;
+				case kernel::mul: elementwise<T, kernel::mul>(lhs, lhs_scalar, rhs, rhs_scalar, out, count); break;
+				default: elementwise<T, kernel::div>(lhs, lhs_scalar, rhs, rhs_scalar, out, count); break;
+			}
+		}
+	}
+
+	const char* kernel_name(const kernel op)
+	{
+		constexpr const char* names[] = { "fill", "len", "sum", "min", "max", "dot", "add", "sub", "mul", "div", "filter", "sort" };
+		return names[static_cast<size_t>(op)];
+	}
+
+	std::uint32_t kernel_arity(const kernel op)
+	{
+		constexpr std::uint32_t arities[] = { 2, 1, 1, 1, 1, 2, 2, 2, 2, 2, 3, 1 };
+		return arities[static_cast<size_t>(op)];
+	}
+
+	vm_register sum(const vm_register* values, const size_t count)
+	{
+		vm_register total = 0;
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::sum(values, count, total) : sse2::sum(values, count, total);
+#elif defined(CHERIE_ARRAY_SSE2)
+		index = sse2::sum(values, count, total);
+#endif
+		for (; index < count; index++)
+		{
+			total = wrapping_add(total, values[index]);
+		}
+		return total;
+	}
+
+	double sum(const double* values, const size_t count)
+	{
+		double partial[lanes] = {};
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::sum(values, count, partial) : sse2::sum(values, count, partial);
+#elif defined(CHERIE_ARRAY_SSE2)
+		index = sse2::sum(values, count, partial);
+#endif
+		for (; index < count; index++)
+		{
+			partial[index % lanes] += values[index];
+		}
+		return combine(partial);
+	}
+
+	vm_register minimum(const vm_register* values, const size_t count)
+	{
+		auto best = values[0];
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::extreme<true>(values, count, best) : 0; // SSE2 has no 64-bit compares
+#endif
+		for (; index < count; index++)
+		{
+			best = std::min(best, values[index]);
+		}
+		return best;
+	}
+
+	double minimum(const double* values, const size_t count)
+	{
+		auto best = values[0];
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::extreme<true>(values, count, best) : sse2::extreme<true>(values, count, best);
+#elif defined(CHERIE_ARRAY_SSE2)
+		index = sse2::extreme<true>(values, count, best);
+#endif
+		for (; index < count; index++)
+		{
+			best = values[index] < best ? values[index] : best; // what minpd does, NaNs are skipped unless the first one is
+		}
+		return best;
+	}
+
+	vm_register maximum(const vm_register* values, const size_t count)
+	{
+		auto best = values[0];
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::extreme<false>(values, count, best) : 0;
+#endif
+		for (; index < count; index++)
+		{
+			best = std::max(best, values[index]);
+		}
+		return best;
+	}
+
+	double maximum(const double* values, const size_t count)
+	{
+		auto best = values[0];
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::extreme<false>(values, count, best) : sse2::extreme<false>(values, count, best);
+#elif defined(CHERIE_ARRAY_SSE2)
+		index = sse2::extreme<false>(values, count, best);
+#endif
+		for (; index < count; index++)
+		{
+			best = values[index] > best ? values[index] : best;
+		}
+		return best;
+	}
+
+	vm_register dot(const vm_register* lhs, const vm_register* rhs, const size_t count)
+	{
+		// there are no 64-bit vector multiplies before AVX-512, the compiler can still unroll this
+		vm_register total = 0;
+		for (size_t index = 0; index < count; index++)
+		{
+			total = wrapping_add(total, wrapping_multiply(lhs[index], rhs[index]));
+		}
+		return total;
+	}
+
+	double dot(const double* lhs, const double* rhs, const size_t count)
+	{
+		double partial[lanes] = {};
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::dot(lhs, rhs, count, partial) : sse2::dot(lhs, rhs, count, partial);
+#elif defined(CHERIE_ARRAY_SSE2)
+		index = sse2::dot(lhs, rhs, count, partial);
+#endif
+		for (; index < count; index++)
+		{
+			partial[index % lanes] += lhs[index] * rhs[index];
+		}
+		return combine(partial);
+	}
+
+	bool elementwise(const kernel op, const vm_register* lhs, const bool lhs_scalar, const vm_register* rhs, const bool rhs_scalar, vm_register* out, const size_t count)
+	{
+		if (op == kernel::div && std::find(rhs, rhs + (rhs_scalar ? 1 : count), 0) != rhs + (rhs_scalar ? 1 : count))
+		{
+			return false;
+		}
+		elementwise<vm_register>(op, lhs, lhs_scalar, rhs, rhs_scalar, out, count);
+		return true;
+	}
+
+	void elementwise(const kernel op, const double* lhs, const bool lhs_scalar, const double* rhs, const bool rhs_scalar, double* out, const size_t count)
+	{
+		elementwise<double>(op, lhs, lhs_scalar, rhs, rhs_scalar, out, count);
+	}
+
+	size_t count_between(const vm_register* values, const size_t count, const vm_register low, const vm_register high)
+	{
+		size_t kept = 0;
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::count_between(values, count, low, high, kept) : 0;
+#endif
+		for (; index < count; index++)
+		{
+			kept += between(values[index], low, high);
+		}
+		return kept;
+	}
+
+	size_t count_between(const double* values, const size_t count, const double low, const double high)
+	{
+		size_t kept = 0;
+		size_t index = 0;
+#if defined(CHERIE_ARRAY_AVX2)
+		index = avx2::supported() ? avx2::count_between(values, count, low, high, kept) : sse2::count_between(values, count, low, high, kept);
+#elif defined(CHERIE_ARRAY_SSE2)
+		index = sse2::count_between(values, count, low, high, kept);
+#endif
+		for (; index < count; index++)
+		{
+			kept += between(values[index], low, high);
+		}
+		return kept;
+	}
+
+	void copy_between(const vm_register* values, const size_t count, const vm_register low, const vm_register high, vm_register* out, const size_t kept)
+	{
+		copy_range(values, count, low, high, out, kept);
+	}
+
+	void copy_between(const double* values, const size_t count, const double low, const double high, double* out, const size_t kept)
+	{
+		copy_range(values, count, low, high, out, kept);
+	}
+
+	void sort(vm_register* values, const size_t count)
+	{
+		std::sort(values, values + count);
+	}
+
+	void sort(double* values, const size_t count)
+	{
+		// NaNs are not ordered against anything, std::sort needs them out of the way
+		const auto numbers = std::partition(values, values + count, [](const double value) { return value == value; });
+		std::sort(values, numbers);
+	}
+}
@@ -0,0 +1,403 @@
+/*
+ * File Name: heap.cpp
+ * Author(s): P. Kamara
+ *
+ * Garbage collected heap.
+ */
+
+#include "vm/heap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace cherie::vm
+{
+	namespace
+	{
+		constexpr size_t word = sizeof(std::uint64_t);
+		constexpr size_t large_fraction = 8; // objects over this share of the nursery are allocated old
+	}
+
+	heap::heap(const size_t nursery_size)
+		: nursery_(new std::uint64_t[nursery_size / word]), nursery_size_(nursery_size / word * word),
+		starts_((nursery_size / word + 63) / 64), major_threshold_(minimum_major_threshold)
+	{
+	}
+
+	heap::~heap()
+	{
+		clear();
+	}
+
+	size_t heap::allocation_size(const std::uint32_t size)
+	{
+		const auto bytes = sizeof(header) + sizeof(closure) + size * (sizeof(vm_register) + sizeof(value_type));
+		return (bytes + word - 1) / word * word;
+	}
+
+	bool heap::in_nursery(const closure* object) const
+	{
+		const auto* address = reinterpret_cast<const std::uint8_t*>(object);
+		const auto* begin = reinterpret_cast<const std::uint8_t*>(nursery_.get());
+		return address >= begin && address < begin + top_;
+	}
+
+	bool heap::starts_object(const closure* object) const
+	{
+		const auto offset = static_cast<size_t>(reinterpret_cast<const std::uint8_t*>(object) - reinterpret_cast<const std::uint8_t*>(nursery_.get()));
+		return offset % word == 0 && starts_[offset / word / 64] >> (offset / word % 64) & 1;
+	}
+
+	bool heap::in_region(const closure* object) const
+	{
+		const auto* address = reinterpret_cast<const std::uint8_t*>(object);
+		for (size_t chunk = 0; chunk <= chunk_ && chunk < chunks_.size(); chunk++)
+		{
+			const auto* begin = reinterpret_cast<const std::uint8_t*>(chunks_[chunk].get());
+			if (address >= begin && address < begin + (chunk == chunk_ ? chunk_top_ : chunk_sizes_[chunk]))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	closure* heap::allocate_region(const size_t bytes)
+	{
+		while (chunk_ < chunks_.size() && chunk_top_ + bytes > chunk_sizes_[chunk_])
+		{
+			chunk_++;
+			chunk_top_ = 0;
+		}
+		if (chunk_ == chunks_.size())
+		{
+			const auto size = std::max(nursery_size_, bytes);
+			chunks_.emplace_back(new std::uint64_t[size / word]);
+			chunk_sizes_.push_back(size);
+		}
+
+		auto* memory = reinterpret_cast<std::uint8_t*>(chunks_[chunk_].get()) + chunk_top_;
+		new (memory) header{ static_cast<std::uint32_t>(bytes), 0 };
+		chunk_top_ += bytes;
+		region_bytes_ += bytes;
+		return reinterpret_cast<closure*>(memory + sizeof(header));
+	}
+
+	closure* heap::allocate(const std::uint32_t function, const std::uint32_t size)
+	{
+		return place(function, size, allocation_size(size));
+	}
+
+	closure* heap::allocate_data(const std::uint32_t function, const size_t bytes)
+	{
+		return place(function, 0, (allocation_size(0) + bytes + word - 1) / word * word);
+	}
+
+	closure* heap::place(const std::uint32_t function, const std::uint32_t size, const size_t bytes)
+	{
+		if (region_)
+		{
+			return new (allocate_region(bytes)) closure{ function, size };
+		}
+		if (bytes > nursery_size_ / large_fraction)
+		{
+			// these skip the nursery, a nursery's worth of them still has to start or advance the major cycle
+			if (large_bytes_ >= nursery_size_ && (phase_ != phase::idle || needs_major()))
+			{
+				return nullptr;
+			}
+			large_bytes_ += bytes;
+			auto* object = new (allocate_old(bytes)) closure{ function, size };
+			if (phase_ == phase::marking)
+			{
+				mark_object(object); // traced after the caller has filled it in
+			}
+			return object;
+		}
+		if (top_ + bytes > nursery_size_)
+		{
+			return nullptr;
+		}
+
+		auto* memory = reinterpret_cast<std::uint8_t*>(nursery_.get()) + top_;
+		new (memory) header{ static_cast<std::uint32_t>(bytes), 0 };
+		const auto start = (top_ + sizeof(header)) / word;
+		starts_[start / 64] |= 1ull << start % 64;
+		top_ += bytes;
+		return new (memory + sizeof(header)) closure{ function, size };
+	}
+
+	closure* heap::allocate_old(const size_t bytes)
+	{
+		auto* memory = static_cast<header*>(::operator new(bytes));
+		*memory = { static_cast<std::uint32_t>(bytes), 0 };
+		auto* object = reinterpret_cast<closure*>(memory + 1);
+		old_.insert(object);
+		old_bytes_ += bytes;
+		return object;
+	}
+
+	void heap::free_old(closure* object)
+	{
+		old_bytes_ -= header_of(object)->bytes;
+		::operator delete(header_of(object));
+	}
+
+	void heap::write_barrier(closure* object)
+	{
+		if (region_)
+		{
+			return; // nothing is old while a region is in use
+		}
+		if (auto* info = header_of(object); !in_nursery(object) && !(info->flags & remembered))
+		{
+			info->flags |= remembered;
+			remembered_.push_back(object);
+		}
+	}
+
+	void heap::write_barrier(closure* object, vm_register value, const value_type tag)
+	{
+		write_barrier(object);
+		if (phase_ == phase::marking)
+		{
+			trace(value, tag); // nothing moves outside a minor collection
+		}
+	}
+
+	closure* heap::promote(closure* object)
+	{
+		auto* from = header_of(object);
+		closure* to;
+		if (from->flags & forwarded)
+		{
+			std::memcpy(&to, object, sizeof(to));
+			return to;
+		}
+
+		to = allocate_old(from->bytes);
+		std::memcpy(to, object, from->bytes - sizeof(header));
+		promoted_bytes_ += from->bytes;
+		from->flags |= forwarded;
+		std::memcpy(object, &to, sizeof(to)); // every closure has room for a pointer
+		promoted_.push_back(to);
+		if (phase_ == phase::marking)
+		{
+			mark_object(to);
+		}
+		return to;
+	}
+
+	void heap::mark_object(closure* object)
+	{
+		if (auto* info = header_of(object); !(info->flags & marked))
+		{
+			info->flags |= marked;
+			grey_.push_back(object);
+		}
+	}
+
+	void heap::begin_minor()
+	{
+		minor_ = true;
+		minor_collections_++;
+		large_bytes_ = 0;
+		promoted_before_ = promoted_bytes_;
+
+		// nursery objects waiting to be marked either get promoted and marked again or are garbage
+		grey_.erase(std::remove_if(grey_.begin(), grey_.end(), [this](const closure* object)
+		{
+			return in_nursery(object);
+		}), grey_.end());
+	}
+
+	size_t heap::finish_minor()
+	{
+		// old objects written since the last collection are roots too
+		for (auto* object : remembered_)
+		{
+			header_of(object)->flags &= ~remembered;
+			promoted_.push_back(object);
+		}
+		remembered_.clear();
+
+		while (!promoted_.empty())
+		{
+			auto* object = promoted_.back();
+			promoted_.pop_back();
+			for (std::uint32_t index = 0; index < object->size; index++)
+			{
+				trace(object->values()[index], object->tags()[index]);
+			}
+		}
+
+		// whatever was not promoted is garbage
+		const auto freed = top_ - (promoted_bytes_ - promoted_before_);
+		std::fill(starts_.begin(), starts_.end(), 0);
+		top_ = 0;
+		minor_ = false;
+		return freed;
+	}
+
+	void heap::begin_marking()
+	{
+		phase_ = phase::marking;
+		major_collections_++;
+	}
+
+	bool heap::mark(const std::chrono::steady_clock::time_point deadline)
+	{
+		for (size_t count = 1; !grey_.empty(); count++)
+		{
+			auto* object = grey_.back();
+			grey_.pop_back();
+			for (std::uint32_t index = 0; index < object->size; index++)
+			{
+				trace(object->values()[index], object->tags()[index]);
+			}
+			if (count % 256 == 0 && std::chrono::steady_clock::now() >= deadline)
+			{
+				break;
+			}
+		}
+		return grey_.empty();
+	}
+
+	void heap::finish_marking()
+	{
+		// remembered objects are kept until the next minor collection has read them
+		for (auto* object : remembered_)
+		{
+			mark_object(object);
+		}
+		[[maybe_unused]] const auto done = mark(std::chrono::steady_clock::time_point::max());
+
+		sweep_.assign(old_.begin(), old_.end());
+		swept_ = 0;
+		phase_ = phase::sweeping;
+	}
+
+	size_t heap::sweep(const std::chrono::steady_clock::time_point deadline)
+	{
+		size_t freed = 0;
+		while (swept_ < sweep_.size())
+		{
+			auto* object = sweep_[swept_++];
+			if (auto* info = header_of(object); info->flags & marked)
+			{
+				info->flags &= ~marked;
+			}
+			else
+			{
+				freed += info->bytes;
+				old_.erase(object);
+				free_old(object);
+			}
+			if (swept_ % 1024 == 0 && std::chrono::steady_clock::now() >= deadline)
+			{
+				return freed;
+			}
+		}
+
+		sweep_.clear();
+		phase_ = phase::idle;
+		major_threshold_ = std::max(minimum_major_threshold, old_bytes_ * 2);
+		return freed;
+	}
+
+	void heap::trace(vm_register& value, const value_type tag)
+	{
+		if (tag != value_type::function && tag != value_type::object && tag != value_type::map && tag != value_type::integers && tag != value_type::floats)
+		{
+			return;
+		}
+		auto* object = reinterpret_cast<closure*>(value);
+		trace(object);
+		value = reinterpret_cast<vm_register>(object);
+	}
+
+	void heap::trace(closure*& object)
+	{
+		if (releasing_)
+		{
+			// only what the owner traces here survives the region, and its tags can be trusted
+			if (in_region(object))
+			{
+				object = promote(object);
+			}
+			return;
+		}
+		if (in_nursery(object))
+		{
+			if (!starts_object(object))
+			{
+				return;
+			}
+			if (minor_)
+			{
+				object = promote(object);
+			}
+			else if (phase_ == phase::marking)
+			{
+				mark_object(object); // stays where it is until the next minor collection
+			}
+			return;
+		}
+		if (phase_ == phase::marking && old_.count(object))
+		{
+			mark_object(object);
+		}
+	}
+
+	void heap::begin_release()
+	{
+		releasing_ = true;
+		promoted_before_ = promoted_bytes_;
+	}
+
+	size_t heap::release_region()
+	{
+		while (!promoted_.empty())
+		{
+			auto* object = promoted_.back();
+			promoted_.pop_back();
+			for (std::uint32_t index = 0; index < object->size; index++)
+			{
+				trace(object->values()[index], object->tags()[index]);
+			}
+		}
+
+		const auto freed = region_bytes_ - (promoted_bytes_ - promoted_before_);
+		chunk_ = 0;
+		chunk_top_ = 0;
+		region_bytes_ = 0;
+		region_ = false;
+		releasing_ = false;
+		return freed;
+	}
+
+	void heap::clear()
+	{
+		for (auto* object : old_)
+		{
+			free_old(object);
+		}
+		old_.clear();
+		remembered_.clear();
+		promoted_.clear();
+		grey_.clear();
+		sweep_.clear();
+		phase_ = phase::idle;
+		minor_ = false;
+		chunk_ = 0;
+		chunk_top_ = 0;
+		region_bytes_ = 0;
+		region_ = false;
+		releasing_ = false;
+		std::fill(starts_.begin(), starts_.end(), 0);
+		top_ = 0;
+		large_bytes_ = 0;
+		major_threshold_ = minimum_major_threshold;
+	}
+}
@@ -0,0 +1,548 @@
+/*
+ * File Name: image.cpp
+ * Author(s): P. Kamara
+ *
+ * Bytecode image files.
+ */
+
+#include "vm/image.h"
+
+#include <algorithm>
+#include <cstring>
+#include "exceptions.h"
+#include "vm/array.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cherie::vm
+{
+	namespace
+	{
+		constexpr std::uint64_t align(const std::uint64_t offset)
+		{
+			return (offset + 7) & ~std::uint64_t{ 7 };
+		}
+
+		template <typename T>
+		void put(std::vector<std::uint8_t>& out, const std::uint64_t offset, const T* values, const size_t count)
+		{
+			if (count != 0)
+			{
+				std::memcpy(out.data() + offset, values, count * sizeof(T));
+			}
+		}
+	}
+
+	image::~image()
+	{
+#ifdef _WIN32
+		if (mapping_)
+		{
+			UnmapViewOfFile(data_);
+			CloseHandle(mapping_);
+		}
+		if (file_)
+		{
+			CloseHandle(file_);
+		}
+#else
+		if (mapping_)
+		{
+			munmap(mapping_, size_);
+		}
+#endif
+	}
+
+	std::shared_ptr<const image> image::map(const std::string& path)
+	{
+		std::shared_ptr<image> mapped(new image());
+#ifdef _WIN32
+		const auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			runtime_error("cannot open image '%s'", path.c_str());
+		}
+		mapped->file_ = file;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+		{
+			runtime_error("cannot map image '%s'", path.c_str());
+		}
+		const auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		const auto* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!view)
+		{
+			if (mapping)
+			{
+				CloseHandle(mapping);
+			}
+			runtime_error("cannot map image '%s'", path.c_str());
+		}
+		mapped->mapping_ = mapping;
+		mapped->data_ = static_cast<const std::uint8_t*>(view);
+		mapped->size_ = static_cast<size_t>(size.QuadPart);
+#else
+		const auto file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			runtime_error("cannot open image '%s'", path.c_str());
+		}
+
+		struct stat status = {};
+		auto* view = fstat(file, &status) == 0 && status.st_size != 0 ? mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+		close(file); // the mapping keeps the file
+		if (view == MAP_FAILED)
+		{
+			runtime_error("cannot map image '%s'", path.c_str());
+		}
+		mapped->mapping_ = view;
+		mapped->data_ = static_cast<const std::uint8_t*>(view);
+		mapped->size_ = static_cast<size_t>(status.st_size);
+#endif
+		mapped->validate();
+		return mapped;
+	}
+
+	std::shared_ptr<const image> image::from_bytes(std::vector<std::uint8_t> bytes)
+	{
+		std::shared_ptr<image> loaded(new image());
+		loaded->owned_ = std::move(bytes);
+		loaded->data_ = loaded->owned_.data();
+		loaded->size_ = loaded->owned_.size();
+		loaded->validate();
+		return loaded;
+	}
+
+	void image::validate() const
+	{
+		if (size_ < sizeof(image_header) || std::memcmp(header().magic, image_header::signature, sizeof(image_header::signature)) != 0)
+		{
+			runtime_error("not a bytecode image");
+		}
+
+		const auto& header = this->header();
+		if (header.version != image_header::current_version)
+		{
+			runtime_error("bytecode image version %d is not supported, expected %d", static_cast<int>(header.version), static_cast<int>(image_header::current_version));
+		}
+		if (header.byte_order != image_header::byte_order_mark || header.opcode_count != static_cast<std::uint32_t>(opcode::count))
+		{
+			runtime_error("bytecode image was written for another machine or instruction set");
+		}
+
+		const auto fits = [&](const std::uint64_t offset, const std::uint64_t count, const std::uint64_t size)
+		{
+			return offset % 8 == 0 && offset <= size_ && count <= (size_ - offset) / size;
+		};
+		if (header.file_size != size_
+			|| !fits(header.program_offset, header.program_size, sizeof(i64))
+			|| !fits(header.constants_offset, header.constants_size, sizeof(vm_register))
+			|| !fits(header.functions_offset, header.function_count, sizeof(image_function))
+			|| !fits(header.globals_offset, header.global_count, sizeof(std::uint32_t))
+			|| !fits(header.strings_offset, header.strings_size, 1)
+			|| !fits(header.lines_offset, header.lines_size, 1)
+			|| !fits(header.fields_offset, header.field_count, sizeof(std::uint32_t))
+			|| !fits(header.shapes_offset, header.shapes_size, sizeof(std::uint32_t))
+			|| !fits(header.sites_offset, header.site_count, sizeof(std::uint32_t))
+			|| header.function_count == 0
+			|| header.strings_size == 0 || data_[header.strings_offset + header.strings_size - 1] != 0)
+		{
+			runtime_error("bytecode image is truncated or corrupt");
+		}
+
+		const auto* functions = reinterpret_cast<const image_function*>(data_ + header.functions_offset);
+		for (std::uint32_t index = 0; index < header.function_count; index++)
+		{
+			if (functions[index].name >= header.strings_size || functions[index].entry >= header.program_size)
+			{
+				runtime_error("bytecode image is truncated or corrupt");
+			}
+		}
+		const auto* globals = reinterpret_cast<const std::uint32_t*>(data_ + header.globals_offset);
+		for (std::uint32_t index = 0; index < header.global_count; index++)
+		{
+			if (globals[index] >= header.strings_size)
+			{
+				runtime_error("bytecode image is truncated or corrupt");
+			}
+		}
+		const auto* fields = reinterpret_cast<const std::uint32_t*>(data_ + header.fields_offset);
+		for (std::uint32_t index = 0; index < header.field_count; index++)
+		{
+			if (fields[index] >= header.strings_size)
+			{
+				runtime_error("bytecode image is truncated or corrupt");
+			}
+		}
+
+		// every shape has to end inside the section and name fields that exist
+		const auto* shapes = reinterpret_cast<const std::uint32_t*>(data_ + header.shapes_offset);
+		std::vector<std::uint32_t> shape_sizes;
+		std::uint64_t position = 0;
+		for (std::uint32_t shape = 0; shape < header.shape_count; shape++)
+		{
+			if (position >= header.shapes_size || shapes[position] >= header.shapes_size - position)
+			{
+				runtime_error("bytecode image is truncated or corrupt");
+			}
+			shape_sizes.push_back(shapes[position]);
+			const auto end = position + 1 + shapes[position];
+			for (position++; position < end; position++)
+			{
+				if (shapes[position] >= header.field_count)
+				{
+					runtime_error("bytecode image is truncated or corrupt");
+				}
+			}
+		}
+		if (position != header.shapes_size)
+		{
+			runtime_error("bytecode image is truncated or corrupt");
+		}
+		const auto* sites = reinterpret_cast<const std::uint32_t*>(data_ + header.sites_offset);
+		for (std::uint32_t index = 0; index < header.site_count; index++)
+		{
+			if (sites[index] >= header.field_count)
+			{
+				runtime_error("bytecode image is truncated or corrupt");
+			}
+		}
+		validate_program(shape_sizes);
+	}
+
+	void image::validate_program(const std::vector<std::uint32_t>& shape_sizes) const
+	{
+		const auto& header = this->header();
+		const auto* functions = reinterpret_cast<const image_function*>(data_ + header.functions_offset);
+		const auto* program = this->program();
+
+		// the code of a function runs from its entry to the next one, functions sharing code get the smallest frame of them
+		struct span
+		{
+			std::uint32_t begin;
+			std::uint32_t end;
+			std::uint32_t frame_size;
+			std::uint32_t upvalues;
+			bool environment = false; // reads the running closure, so only ever entered through one
+		};
+		std::vector<span> entries;
+		for (std::uint32_t index = 0; index < header.function_count; index++)
+		{
+			const auto& function = functions[index];
+			if (function.frame_size > max_frame_size || function.parameters > function.frame_size)
+			{
+				runtime_error("bytecode image is truncated or corrupt");
+			}
+			entries.push_back({ function.entry, 0, function.frame_size, function.upvalues });
+		}
+		std::sort(entries.begin(), entries.end(), [](const span& lhs, const span& rhs) { return lhs.begin < rhs.begin; });
+		std::vector<span> spans;
+		for (const auto& entry : entries)
+		{
+			if (!spans.empty() && spans.back().begin == entry.begin)
+			{
+				spans.back().frame_size = std::min(spans.back().frame_size, entry.frame_size);
+				spans.back().upvalues = std::min(spans.back().upvalues, entry.upvalues);
+				continue;
+			}
+			spans.push_back(entry);
+		}
+		for (size_t index = 0; index < spans.size(); index++)
+		{
+			spans[index].end = index + 1 < spans.size() ? spans[index + 1].begin : static_cast<std::uint32_t>(header.program_size);
+		}
+		const auto span_of = [&spans](const std::uint32_t entry) -> const span&
+		{
+			return *std::lower_bound(spans.begin(), spans.end(), entry, [](const span& code, const std::uint32_t pc) { return code.begin < pc; });
+		};
+
+		for (auto& code : spans)
+		{
+			const auto in_frame = [&code](const std::uint64_t first, const std::uint64_t count = 1)
+			{
+				return first + count <= code.frame_size;
+			};
+			const auto callee = [&](const std::uint32_t function) -> const image_function*
+			{
+				return function < header.function_count ? &functions[function] : nullptr;
+			};
+
+			for (auto pc = code.begin; pc < code.end; pc++)
+			{
+				const auto& instruction = program[pc];
+				const auto a = instruction.a;
+				const auto b = instruction.rbs();
+				const auto c = instruction.rc();
+				bool valid;
+				switch (instruction.op)
+				{
+					case opcode::nop:
+					case opcode::halt:
+						valid = true;
+						break;
+					case opcode::load:
+					case opcode::map:
+						valid = in_frame(c);
+						break;
+					case opcode::loadk:
+						valid = in_frame(c) && a < header.constants_size;
+						break;
+					case opcode::tag:
+						// a heap tag on a number would have the collector follow it
+						valid = in_frame(c) && a <= static_cast<std::uint32_t>(value_type::boolean);
+						break;
+					case opcode::move:
+					case opcode::addrs:
+					case opcode::mulrs:
+					case opcode::divrs:
+					case opcode::neg:
+					case opcode::lnot:
+					case opcode::negf:
+					case opcode::lnotf:
+					case opcode::itof:
+					case opcode::movev:
+					case opcode::negv:
+					case opcode::lnotv:
+						valid = in_frame(c) && in_frame(b);
+						break;
+					case opcode::addr:
+					case opcode::subr:
+					case opcode::mulr:
+					case opcode::divr:
+					case opcode::addf:
+					case opcode::subf:
+					case opcode::mulf:
+					case opcode::divf:
+					case opcode::addv:
+					case opcode::subv:
+					case opcode::mulv:
+					case opcode::divv:
+					case opcode::getk:
+					case opcode::hask:
+					case opcode::nextk:
+					case opcode::keyk:
+					case opcode::setk:
+						valid = in_frame(c) && in_frame(b) && in_frame(a);
+						break;
+					case opcode::getg:
+						valid = in_frame(c) && a < header.global_count;
+						break;
+					case opcode::setg:
+						valid = in_frame(b) && a < header.global_count;
+						break;
+					case opcode::closure:
+						valid = in_frame(c) && callee(a) && in_frame(b, callee(a)->upvalues);
+						break;
+					case opcode::getu:
+						code.environment = true;
+						valid = in_frame(c) && a < code.upvalues;
+						break;
+					case opcode::self:
+						code.environment = true;
+						valid = in_frame(c);
+						break;
+					case opcode::object:
+						valid = in_frame(c) && a < shape_sizes.size() && in_frame(b, shape_sizes[a]);
+						break;
+					case opcode::getf:
+					case opcode::setf:
+						valid = in_frame(c) && in_frame(b) && a < header.site_count;
+						break;
+					case opcode::array:
+						valid = in_frame(c) && in_frame(b, a);
+						break;
+					case opcode::vec:
+						valid = in_frame(c) && a < kernel_count && in_frame(b, kernel_arity(static_cast<kernel>(a)));
+						break;
+					case opcode::jmp:
+						valid = a >= code.begin && a < code.end;
+						break;
+					case opcode::jz:
+					case opcode::jnz:
+						valid = in_frame(b) && a >= code.begin && a < code.end;
+						break;
+					case opcode::call:
+						// the callee's own window is checked against the value stack when it is entered
+						valid = callee(a) && in_frame(c, std::max<std::uint64_t>(callee(a)->parameters, b));
+						break;
+					case opcode::tailcall:
+						valid = callee(a) && in_frame(c, callee(a)->parameters);
+						break;
+					case opcode::callv:
+						// the callee is checked against the argument count when it is called
+						valid = in_frame(c, std::max<std::uint64_t>(a + std::uint64_t{ 1 }, b));
+						break;
+					case opcode::tailcallv:
+						valid = in_frame(c, a + std::uint64_t{ 1 });
+						break;
+					case opcode::ret:
+						valid = in_frame(c, b);
+						break;
+					default:
+						// compiled code never uses the operand stack, whose depth is not tracked here
+						valid = false;
+						break;
+				}
+				if (!valid)
+				{
+					runtime_error("bytecode image is truncated or corrupt");
+				}
+			}
+
+			// running off the end of a function would run the next one in this frame
+			const auto last = code.end == code.begin ? opcode::nop : program[code.end - 1].op;
+			if (last != opcode::jmp && last != opcode::ret && last != opcode::tailcall && last != opcode::tailcallv && last != opcode::halt)
+			{
+				runtime_error("bytecode image is truncated or corrupt");
+			}
+		}
+
+		// direct calls and the main chunk run without a closure
+		if (span_of(functions[0].entry).environment)
+		{
+			runtime_error("bytecode image is truncated or corrupt");
+		}
+		for (const auto& code : spans)
+		{
+			for (auto pc = code.begin; pc < code.end; pc++)
+			{
+				if (const auto& instruction = program[pc]; (instruction.op == opcode::call || instruction.op == opcode::tailcall) && span_of(functions[instruction.a].entry).environment)
+				{
+					runtime_error("bytecode image is truncated or corrupt");
+				}
+			}
+		}
+	}
+
+	const char* image::string(const std::uint32_t offset) const
+	{
+		return reinterpret_cast<const char*>(data_ + header().strings_offset + offset);
+	}
+
+	void image::write(std::ostream& out, const std::vector<i64>& program, const std::vector<vm_register>& constants, const std::vector<function_info>& functions, const std::vector<std::string>& globals, const line_table& lines, const object_layout& layout)
+	{
+		std::vector<char> strings;
+		const auto intern = [&](const std::string& name)
+		{
+			const auto offset = static_cast<std::uint32_t>(strings.size());
+			strings.insert(strings.end(), name.begin(), name.end());
+			strings.push_back('\0');
+			return offset;
+		};
+
+		std::vector<image_function> table;
+		for (const auto& function : functions)
+		{
+			table.push_back({ intern(function.name), function.entry, function.parameters, function.frame_size, function.upvalues });
+		}
+		std::vector<std::uint32_t> names;
+		for (const auto& global : globals)
+		{
+			names.push_back(intern(global));
+		}
+		std::vector<std::uint32_t> fields;
+		for (const auto& field : layout.fields)
+		{
+			fields.push_back(intern(field));
+		}
+		const auto shapes = layout.flat_shapes();
+
+		image_header header = {};
+		std::memcpy(header.magic, image_header::signature, sizeof(header.magic));
+		header.version = image_header::current_version;
+		header.byte_order = image_header::byte_order_mark;
+		header.opcode_count = static_cast<std::uint32_t>(opcode::count);
+		header.function_count = static_cast<std::uint32_t>(table.size());
+		header.global_count = static_cast<std::uint32_t>(names.size());
+		header.line_entries = static_cast<std::uint32_t>(lines.entries());
+		header.field_count = static_cast<std::uint32_t>(fields.size());
+		header.shape_count = static_cast<std::uint32_t>(layout.shapes.size());
+		header.shapes_size = static_cast<std::uint32_t>(shapes.size());
+		header.site_count = static_cast<std::uint32_t>(layout.sites.size());
+
+		header.program_offset = sizeof(image_header);
+		header.program_size = program.size();
+		header.constants_offset = align(header.program_offset + program.size() * sizeof(i64));
+		header.constants_size = constants.size();
+		header.functions_offset = align(header.constants_offset + constants.size() * sizeof(vm_register));
+		header.globals_offset = align(header.functions_offset + table.size() * sizeof(image_function));
+		header.strings_offset = align(header.globals_offset + names.size() * sizeof(std::uint32_t));
+		header.strings_size = strings.size();
+		header.lines_offset = align(header.strings_offset + strings.size());
+		header.lines_size = lines.data().size();
+		header.fields_offset = align(header.lines_offset + lines.data().size());
+		header.shapes_offset = align(header.fields_offset + fields.size() * sizeof(std::uint32_t));
+		header.sites_offset = align(header.shapes_offset + shapes.size() * sizeof(std::uint32_t));
+		header.file_size = align(header.sites_offset + layout.sites.size() * sizeof(std::uint32_t));
+
+		std::vector<std::uint8_t> bytes(header.file_size);
+		put(bytes, 0, &header, 1);
+		put(bytes, header.program_offset, program.data(), program.size());
+		put(bytes, header.constants_offset, constants.data(), constants.size());
+		put(bytes, header.functions_offset, table.data(), table.size());
+		put(bytes, header.globals_offset, names.data(), names.size());
+		put(bytes, header.strings_offset, strings.data(), strings.size());
+		put(bytes, header.lines_offset, lines.data().data(), lines.data().size());
+		put(bytes, header.fields_offset, fields.data(), fields.size());
+		put(bytes, header.shapes_offset, shapes.data(), shapes.size());
+		put(bytes, header.sites_offset, layout.sites.data(), layout.sites.size());
+		out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	}
+
+	std::vector<function_info> image::functions() const
+	{
+		const auto* table = reinterpret_cast<const image_function*>(data_ + header().functions_offset);
+		std::vector<function_info> functions(header().function_count);
+		for (size_t index = 0; index < functions.size(); index++)
+		{
+			functions[index].name = string(table[index].name);
+			functions[index].entry = table[index].entry;
+			functions[index].parameters = table[index].parameters;
+			functions[index].frame_size = table[index].frame_size;
+			functions[index].upvalues = table[index].upvalues;
+		}
+		return functions;
+	}
+
+	std::vector<std::string> image::globals() const
+	{
+		const auto* names = reinterpret_cast<const std::uint32_t*>(data_ + header().globals_offset);
+		std::vector<std::string> globals;
+		for (std::uint32_t index = 0; index < header().global_count; index++)
+		{
+			globals.emplace_back(string(names[index]));
+		}
+		return globals;
+	}
+
+	line_table image::lines() const
+	{
+		line_table lines;
+		lines.assign(data_ + header().lines_offset, header().lines_size, header().line_entries);
+		return lines;
+	}
+
+	object_layout image::layout() const
+	{
+		object_layout layout;
+		const auto* fields = reinterpret_cast<const std::uint32_t*>(data_ + header().fields_offset);
+		for (std::uint32_t index = 0; index < header().field_count; index++)
+		{
+			layout.fields.emplace_back(string(fields[index]));
+		}
+		layout.assign_shapes(reinterpret_cast<const std::uint32_t*>(data_ + header().shapes_offset), header().shapes_size);
+		const auto* sites = reinterpret_cast<const std::uint32_t*>(data_ + header().sites_offset);
+		layout.sites.assign(sites, sites + header().site_count);
+		return layout;
+	}
+}
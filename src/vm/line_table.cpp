@@ -0,0 +1,120 @@
+/*
+ * File Name: line_table.cpp
+ * Author(s): P. Kamara
+ *
+ * Compact pc -> source position table.
+ */
+
+#include "vm/line_table.h"
+
+namespace cherie::vm
+{
+	namespace
+	{
+		void write_varint(std::vector<std::uint8_t>& out, std::uint64_t value)
+		{
+			while (value >= 0x80)
+			{
+				out.push_back(static_cast<std::uint8_t>(value | 0x80));
+				value >>= 7;
+			}
+			out.push_back(static_cast<std::uint8_t>(value));
+		}
+
+		std::uint64_t read_varint(const std::vector<std::uint8_t>& in, size_t& offset)
+		{
+			std::uint64_t value = 0;
+			for (auto shift = 0; offset < in.size(); shift += 7)
+			{
+				const auto byte = in[offset++];
+				value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+				if (!(byte & 0x80))
+				{
+					break;
+				}
+			}
+			return value;
+		}
+	}
+	
+	void line_table::add(const size_t pc, const source_position position)
+	{
+		if (entries_ > 0 && position.line == last_position_.line && position.column == last_position_.column)
+		{
+			return;
+		}
+
+		const auto line_delta = static_cast<std::int64_t>(position.line - last_position_.line);
+		write_varint(data_, pc - last_pc_);
+		write_varint(data_, (static_cast<std::uint64_t>(line_delta) << 1) ^ static_cast<std::uint64_t>(line_delta >> 63));
+		write_varint(data_, position.column);
+
+		last_pc_ = pc;
+		last_position_ = position;
+		entries_++;
+	}
+
+	void line_table::clear()
+	{
+		data_.clear();
+		last_pc_ = 0;
+		last_position_ = {};
+		entries_ = 0;
+	}
+
+	void line_table::assign(const std::uint8_t* data, const size_t size, const size_t entries)
+	{
+		data_.assign(data, data + size);
+		entries_ = entries;
+	}
+
+	source_position line_table::find(const size_t pc) const
+	{
+		source_position found = {};
+		source_position current = {};
+		size_t current_pc = 0;
+		
+		for (size_t offset = 0; offset < data_.size();)
+		{
+			current_pc += read_varint(data_, offset);
+			if (current_pc > pc)
+			{
+				break;
+			}
+
+			const auto zigzag = read_varint(data_, offset);
+			current.line += static_cast<size_t>(static_cast<std::int64_t>(zigzag >> 1) ^ -static_cast<std::int64_t>(zigzag & 1));
+			current.column = read_varint(data_, offset);
+			found = current;
+		}
+		return found;
+	}
+
+	std::vector<source_position> line_table::expand(const size_t count) const
+	{
+		std::vector<source_position> positions(count);
+		source_position current = {};
+		size_t current_pc = 0;
+		size_t filled = 0;
+
+		for (size_t offset = 0; offset < data_.size() && filled < count;)
+		{
+			const auto next_pc = current_pc + read_varint(data_, offset);
+			for (; filled < next_pc && filled < count; filled++)
+			{
+				positions[filled] = current;
+			}
+
+			const auto zigzag = read_varint(data_, offset);
+			current.line += static_cast<size_t>(static_cast<std::int64_t>(zigzag >> 1) ^ -static_cast<std::int64_t>(zigzag & 1));
+			current.column = read_varint(data_, offset);
+			current_pc = next_pc;
+		}
+
+		for (; filled < count; filled++)
+		{
+			positions[filled] = current;
+		}
+		return positions;
+	}
+}
@@ -0,0 +1,191 @@
+/*
+ * File Name: map.cpp
+ * Author(s): P. Kamara
+ *
+ * Hash maps.
+ */
+
+#include "vm/map.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "vm/arithmetic.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHERIE_MAP_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace cherie::vm
+{
+	namespace
+	{
+		constexpr std::uint8_t empty = 0x80; // hash fragments only use the low seven bits
+
+		std::uint32_t lowest_bit(const std::uint32_t mask)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return index;
+#else
+			return static_cast<std::uint32_t>(__builtin_ctz(mask));
+#endif
+		}
+
+		/* the control bytes of sixteen entries, bit i of a mask stands for the entry at i */
+		class group
+		{
+#ifdef CHERIE_MAP_SSE2
+			__m128i bytes_;
+		public:
+			explicit group(const std::uint8_t* control)
+				: bytes_(_mm_loadu_si128(reinterpret_cast<const __m128i*>(control))) {}
+
+			[[nodiscard]] std::uint32_t match(const std::uint8_t fragment) const
+			{
+				return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes_, _mm_set1_epi8(static_cast<char>(fragment)))));
+			}
+
+			[[nodiscard]] std::uint32_t match_empty() const
+			{
+				return static_cast<std::uint32_t>(_mm_movemask_epi8(bytes_));
+			}
+#else
+			const std::uint8_t* bytes_;
+		public:
+			explicit group(const std::uint8_t* control)
+				: bytes_(control) {}
+
+			[[nodiscard]] std::uint32_t match(const std::uint8_t fragment) const
+			{
+				std::uint32_t mask = 0;
+				for (std::uint32_t index = 0; index < map_table::group_size; index++)
+				{
+					mask |= static_cast<std::uint32_t>(bytes_[index] == fragment) << index;
+				}
+				return mask;
+			}
+
+			[[nodiscard]] std::uint32_t match_empty() const
+			{
+				return match(empty);
+			}
+#endif
+
+			[[nodiscard]] std::uint32_t match_full() const
+			{
+				return ~match_empty() & 0xffff;
+			}
+		};
+
+		/* splitmix64's finaliser, keys that only differ in a few low bits still end up in different groups */
+		std::uint64_t hash_key(const vm_register key, const value_type tag)
+		{
+			auto hash = static_cast<std::uint64_t>(key) ^ static_cast<std::uint64_t>(tag) << 56;
+			hash ^= hash >> 30;
+			hash *= 0xbf58476d1ce4e5b9ull;
+			hash ^= hash >> 27;
+			hash *= 0x94d049bb133111ebull;
+			return hash ^ hash >> 31;
+		}
+	}
+
+	void map_table::clear()
+	{
+		std::memset(control(), empty, capacity());
+		std::memset(table_->values() + capacity() / 8, 0, (capacity() / 2 + capacity() * 2) * sizeof(vm_register));
+		std::memset(table_->tags(), static_cast<int>(value_type::integer), table_->size * sizeof(value_type));
+	}
+
+	std::uint32_t map_table::find(const vm_register key, const value_type tag) const
+	{
+		const auto hash = hash_key(key, tag);
+		const auto fragment = static_cast<std::uint8_t>(hash & 0x7f);
+		const auto groups = capacity() / group_size;
+		auto index = static_cast<std::uint32_t>(hash >> 7) & (groups - 1);
+		for (std::uint32_t step = 1;; step++)
+		{
+			const group probe(control() + index * group_size);
+			for (auto matches = probe.match(fragment); matches; matches &= matches - 1)
+			{
+				const auto entry = index * group_size + lowest_bit(matches);
+				if (this->key(entry) == key && key_tag(entry) == tag)
+				{
+					return entry;
+				}
+			}
+
+			// nothing is ever removed, a key would have gone into the first group with room for it
+			if (probe.match_empty())
+			{
+				return not_found;
+			}
+			index = (index + step) & (groups - 1); // triangular steps visit every group
+		}
+	}
+
+	std::uint32_t map_table::insert(const vm_register key, const value_type tag, const std::uint32_t position)
+	{
+		const auto hash = hash_key(key, tag);
+		const auto groups = capacity() / group_size;
+		auto index = static_cast<std::uint32_t>(hash >> 7) & (groups - 1);
+		for (std::uint32_t step = 1;; step++)
+		{
+			if (const auto room = group(control() + index * group_size).match_empty())
+			{
+				const auto entry = index * group_size + lowest_bit(room);
+				control()[entry] = static_cast<std::uint8_t>(hash & 0x7f);
+				this->key(entry) = key;
+				key_tag(entry) = tag;
+				order()[position] = entry;
+				return entry;
+			}
+			index = (index + step) & (groups - 1);
+		}
+	}
+
+	bool normalise_key(vm_register& key, value_type& tag)
+	{
+		switch (tag)
+		{
+			case value_type::integer:
+			case value_type::boolean:
+				return true;
+			case value_type::floating:
+			{
+				// the range check leaves out 2^63, which would not fit
+				if (const auto value = as_double(key); std::trunc(value) == value && value >= -9223372036854775808.0 && value < 9223372036854775808.0)
+				{
+					key = static_cast<vm_register>(value);
+					tag = value_type::integer;
+				}
+				return true;
+			}
+			default:
+				return false;
+		}
+	}
+
+	std::string describe_key(const vm_register key, const value_type tag)
+	{
+		switch (tag)
+		{
+			case value_type::floating:
+			{
+				char text[32];
+				std::snprintf(text, sizeof(text), "%g", as_double(key));
+				return text;
+			}
+			case value_type::boolean:
+				return key ? "true" : "false";
+			default:
+				return std::to_string(key);
+		}
+	}
+}
@@ -0,0 +1,149 @@
+/*
+ * File Name: perf_map.cpp
+ * Author(s): P. Kamara
+ *
+ * Linux perf symbol map (/tmp/perf-<pid>.map) and interpreter trampolines.
+ */
+
+#include "vm/perf_map.h"
+
+#include <cinttypes>
+#include <cstring>
+
+#if defined(__linux__) && defined(__x86_64__)
+#define CHERIE_PERF_MAP_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace cherie::vm
+{
+	namespace
+	{
+		/**
+		 * push rbp
+		 * mov  rbp, rsp
+		 * mov  rax, <target>
+		 * call rax
+		 * pop  rbp
+		 * ret
+		 *
+		 * the frame is kept so frame-pointer unwinding sees the trampoline.
+		 */
+		constexpr std::uint8_t trampoline_code[] = {
+			0x55,
+			0x48, 0x89, 0xe5,
+			0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0,
+			0xff, 0xd0,
+			0x5d,
+			0xc3,
+		};
+		constexpr size_t trampoline_target_offset = 6;
+		constexpr size_t trampoline_size = 32; // keep every trampoline cache-aligned
+		constexpr size_t arena_size = 64 * 1024;
+
+		static_assert(sizeof(trampoline_code) <= trampoline_size);
+	}
+	
+	perf_map::~perf_map()
+	{
+		if (file_)
+		{
+			std::fclose(file_);
+		}
+	}
+
+	perf_map& perf_map::get()
+	{
+		static perf_map instance;
+		return instance;
+	}
+
+	bool perf_map::allocate_arena()
+	{
+#ifdef CHERIE_PERF_MAP_SUPPORTED
+		// arenas are filled completely before being made executable, so no page is
+		// ever writable while another thread may be running one of its trampolines.
+		auto* memory = mmap(nullptr, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+		{
+			return false;
+		}
+
+		auto* arena = static_cast<std::byte*>(memory);
+		for (size_t offset = 0; offset + trampoline_size <= arena_size; offset += trampoline_size)
+		{
+			std::memset(arena + offset, 0xcc, trampoline_size); // int3 padding
+			std::memcpy(arena + offset, trampoline_code, sizeof(trampoline_code));
+			std::memcpy(arena + offset + trampoline_target_offset, &target_, sizeof(target_));
+		}
+
+		if (mprotect(memory, arena_size, PROT_READ | PROT_EXEC) != 0)
+		{
+			munmap(memory, arena_size);
+			return false;
+		}
+
+		arena_ = arena;
+		arena_used_ = 0;
+		arena_size_ = arena_size;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool perf_map::enable(const trampoline target)
+	{
+#ifdef CHERIE_PERF_MAP_SUPPORTED
+		std::lock_guard lock(mutex_);
+		if (target_)
+		{
+			return true;
+		}
+		
+		char path[64];
+		std::snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+		file_ = std::fopen(path, "a");
+		if (!file_)
+		{
+			return false;
+		}
+
+		target_ = target;
+		return true;
+#else
+		(void)target;
+		return false;
+#endif
+	}
+
+	trampoline perf_map::trampoline_for(const std::string& symbol)
+	{
+		std::lock_guard lock(mutex_);
+		if (!target_)
+		{
+			return nullptr;
+		}
+		
+		if (const auto existing = trampolines_.find(symbol); existing != trampolines_.end())
+		{
+			return existing->second;
+		}
+
+		if (arena_used_ + trampoline_size > arena_size_ && !allocate_arena())
+		{
+			return nullptr;
+		}
+
+		auto* code = arena_ + arena_used_;
+		arena_used_ += trampoline_size;
+
+		std::fprintf(file_, "%" PRIxPTR " %zx cherie:%s\n", reinterpret_cast<std::uintptr_t>(code), trampoline_size, symbol.c_str());
+		std::fflush(file_);
+
+		auto* entry = reinterpret_cast<trampoline>(code);
+		trampolines_.emplace(symbol, entry);
+		return entry;
+	}
+}
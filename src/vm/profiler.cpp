@@ -0,0 +1,83 @@
+/*
+ * File Name: profiler.cpp
+ * Author(s): P. Kamara
+ *
+ * Sampling profiler.
+ */
+
+#include "vm/profiler.h"
+
+#include <algorithm>
+
+namespace cherie::vm
+{
+	void profiler::start(const size_t interval)
+	{
+		interval_ = interval ? interval : default_interval;
+	}
+
+	void profiler::stop()
+	{
+		interval_ = 0;
+	}
+
+	void profiler::clear()
+	{
+		samples_.clear();
+	}
+
+	size_t profiler::sample_count() const
+	{
+		size_t total = 0;
+		for (const auto& [stack, count] : samples_)
+		{
+			total += count;
+		}
+		return total;
+	}
+
+	void profiler::sample(const std::vector<size_t>& stack)
+	{
+		samples_[stack]++;
+	}
+
+	void profiler::write_folded(std::ostream& out, const std::vector<function_info>& functions, const line_table& lines) const
+	{
+		// every function's code is one block from its entry on, the owner of a pc is the last entry at or below it
+		std::vector<std::pair<size_t, const std::string*>> entries;
+		for (const auto& function : functions)
+		{
+			if (function.entry != function_info::deferred)
+			{
+				entries.emplace_back(function.entry, &function.name);
+			}
+		}
+		std::sort(entries.begin(), entries.end());
+
+		// several pcs usually share a line, so merge them before writing
+		std::map<std::string, size_t> folded;
+		for (const auto& [stack, count] : samples_)
+		{
+			std::string frames;
+			for (const auto pc : stack)
+			{
+				if (!frames.empty())
+				{
+					frames += ';';
+				}
+				const auto owner = std::upper_bound(entries.begin(), entries.end(), pc, [](const size_t value, const auto& entry)
+				{
+					return value < entry.first;
+				});
+				frames += owner == entries.begin() ? std::string("?") : *std::prev(owner)->second;
+				frames += ":" + std::to_string(lines.find(pc).line);
+			}
+			folded[frames] += count;
+		}
+
+		for (const auto& [frames, count] : folded)
+		{
+			out << frames << ' ' << count << '\n';
+		}
+	}
+}
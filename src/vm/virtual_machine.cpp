@@ -5,15 +5,994 @@
  * Virtual Machine.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "exceptions.h"
+#include "vm/arithmetic.h"
+#include "vm/native.h"
 #include "vm/virtual_machine.h"
 
-namespace cherie::vm
-{
+namespace cherie::vm
+{
+	vm_register virtual_machine::divide(const vm_register a, const vm_register b) const
+	{
+		if (b == 0)
+		{
+			runtime_error("division by zero on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		return b == -1 ? wrapping_subtract(0, a) : a / b;
+	}
+
+	void virtual_machine::enter(const size_t base, const function_info& function)
+	{
+		if (base + function.frame_size > values_.size())
+		{
+			runtime_error("stack overflow calling '%s' on line %d", function.name.c_str(), static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		base_ = base;
+		top_ = std::max<size_t>(top_, base + function.frame_size);
+		registers.gpr = values_.data() + base;
+		registers.tags = tags_.data() + base;
+	}
+
+	const function_info& virtual_machine::resolve(const std::uint32_t function)
+	{
+		if (functions[function].entry == function_info::deferred)
+		{
+			load_function(function);
+			statics_.resize(functions.size()); // its nested functions are new
+			caches_.resize(layout.sites.size()); // and so are its field accesses
+			bind();
+		}
+		return functions[function];
+	}
+
+	void virtual_machine::bind()
+	{
+		code_ = mapped_program_ ? mapped_program_ : program.data();
+		pool_ = mapped_program_ ? mapped_constants_ : constants.data();
+	}
+
+	void virtual_machine::load_function(const std::uint32_t function)
+	{
+		runtime_error("'%s' was never compiled on line %d", functions[function].name.c_str(), static_cast<int>(lines.find(registers.pc - 1).line));
+	}
+
+	closure* virtual_machine::make_closure(const std::uint32_t function, const vm_register* values, const value_type* tags)
+	{
+		const auto size = functions[function].upvalues;
+		if (size == 0)
+		{
+			auto& shared = statics_[function];
+			if (!shared)
+			{
+				shared = closure::create(function, 0);
+			}
+			return shared.get();
+		}
+
+		auto* created = heap_.allocate(function, size);
+		if (!created)
+		{
+			collect();
+			created = heap_.allocate(function, size);
+		}
+		CHERIE_TELEMETRY_ONLY(telemetry_.allocation(heap::allocation_size(size));)
+		std::memcpy(created->values(), values, size * sizeof(vm_register));
+		std::memcpy(created->tags(), tags, size * sizeof(value_type));
+		heap_.write_barrier(created);
+		return created;
+	}
+
+	object* virtual_machine::make_object(const std::uint32_t shape, const vm_register* values, const value_type* tags)
+	{
+		const auto size = static_cast<std::uint32_t>(layout.shapes[shape].size());
+		auto* created = heap_.allocate(shape, size);
+		if (!created)
+		{
+			collect();
+			created = heap_.allocate(shape, size);
+		}
+		CHERIE_TELEMETRY_ONLY(telemetry_.allocation(heap::allocation_size(size));)
+		std::memcpy(created->values(), values, size * sizeof(vm_register));
+		std::memcpy(created->tags(), tags, size * sizeof(value_type));
+		heap_.write_barrier(created);
+		return created;
+	}
+
+	object* virtual_machine::receiver(const std::uint16_t slot) const
+	{
+		if (registers.tags[slot] != value_type::object)
+		{
+			runtime_error("field access on a value that is not an object on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		return reinterpret_cast<object*>(registers.gpr[slot]);
+	}
+
+	std::uint32_t virtual_machine::find_field(const std::uint32_t site, const object* target)
+	{
+		auto& cache = caches_[site];
+		for (std::uint32_t way = 1; way < field_cache::ways; way++)
+		{
+			if (cache.shapes[way] == target->function)
+			{
+				return cache.slots[way];
+			}
+		}
+
+		const auto field = layout.sites[site];
+		const auto& shape = layout.shapes[target->function];
+		const auto found = std::find(shape.begin(), shape.end(), field);
+		if (found == shape.end())
+		{
+			runtime_error("object has no field '%s' on line %d", layout.fields[field].c_str(), static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+
+		// a site that has seen every way full is megamorphic, it searches whatever it has not cached
+		const auto slot = static_cast<std::uint32_t>(found - shape.begin());
+		for (std::uint32_t way = 0; way < field_cache::ways; way++)
+		{
+			if (cache.shapes[way] == field_cache::empty)
+			{
+				cache.shapes[way] = target->function;
+				cache.slots[way] = slot;
+				break;
+			}
+		}
+		return slot;
+	}
+
+	void virtual_machine::get_field(const i64& instruction)
+	{
+		auto* target = receiver(instruction.rbs());
+		const auto slot = field_slot(instruction.a, target);
+		registers.gpr[instruction.rc()] = target->values()[slot];
+		registers.tags[instruction.rc()] = target->tags()[slot];
+	}
+
+	void virtual_machine::set_field(const i64& instruction)
+	{
+		auto* target = receiver(instruction.rc());
+		const auto slot = field_slot(instruction.a, target);
+		const auto value = registers.gpr[instruction.rbs()];
+		const auto tag = registers.tags[instruction.rbs()];
+		target->values()[slot] = value;
+		target->tags()[slot] = tag;
+		heap_.write_barrier(target, value, tag);
+	}
+
+	map* virtual_machine::make_map()
+	{
+		auto* created = heap_.allocate(0, 1);
+		if (!created)
+		{
+			collect();
+			created = heap_.allocate(0, 1);
+		}
+		CHERIE_TELEMETRY_ONLY(telemetry_.allocation(heap::allocation_size(1));)
+		created->values()[0] = 0;
+		created->tags()[0] = value_type::integer; // no table until something is stored
+		return created;
+	}
+
+	map* virtual_machine::container(const std::uint16_t slot) const
+	{
+		if (registers.tags[slot] != value_type::map)
+		{
+			runtime_error("indexing a value that is not a map on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		return reinterpret_cast<map*>(registers.gpr[slot]);
+	}
+
+	std::uint32_t virtual_machine::find_key(const i64& instruction, map_table& table) const
+	{
+		const auto* target = container(instruction.rbs());
+		auto key = registers.gpr[instruction.a];
+		auto tag = registers.tags[instruction.a];
+		if (!normalise_key(key, tag))
+		{
+			runtime_error("map keys have to be numbers or booleans on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		if (target->function == 0)
+		{
+			return map_table::not_found;
+		}
+		table = map_table(reinterpret_cast<closure*>(target->values()[0]));
+		return table.find(key, tag);
+	}
+
+	closure* virtual_machine::grow(const std::uint16_t slot)
+	{
+		const auto* current = reinterpret_cast<map*>(registers.gpr[slot]);
+		const auto capacity = current->function == 0 ? map_table::minimum_capacity : reinterpret_cast<closure*>(current->values()[0])->function * 2;
+		const auto size = map_table::size_for(capacity);
+		auto* created = heap_.allocate(capacity, size);
+		if (!created)
+		{
+			collect();
+			created = heap_.allocate(capacity, size);
+		}
+		CHERIE_TELEMETRY_ONLY(telemetry_.allocation(heap::allocation_size(size));)
+
+		// the collection may have moved the map and its table
+		auto* target = reinterpret_cast<map*>(registers.gpr[slot]);
+		map_table table(created);
+		table.clear();
+		if (target->function != 0)
+		{
+			const map_table old(reinterpret_cast<closure*>(target->values()[0]));
+			for (std::uint32_t position = 0; position < target->function; position++)
+			{
+				const auto entry = old.at(position);
+				const auto moved = table.insert(old.key(entry), old.key_tag(entry), position);
+				table.value(moved) = old.value(entry);
+				table.value_tag(moved) = old.value_tag(entry);
+			}
+		}
+		heap_.write_barrier(created);
+
+		target->values()[0] = reinterpret_cast<vm_register>(created);
+		target->tags()[0] = value_type::map;
+		heap_.write_barrier(target, target->values()[0], value_type::map);
+		return created;
+	}
+
+	void virtual_machine::get_key(const i64& instruction)
+	{
+		if (is_array(registers.tags[instruction.rbs()]))
+		{
+			get_element(instruction);
+			return;
+		}
+
+		map_table table(nullptr);
+		const auto entry = find_key(instruction, table);
+		if (entry == map_table::not_found)
+		{
+			runtime_error("map has no key %s on line %d", describe_key(registers.gpr[instruction.a], registers.tags[instruction.a]).c_str(), static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		registers.gpr[instruction.rc()] = table.value(entry);
+		registers.tags[instruction.rc()] = table.value_tag(entry);
+	}
+
+	void virtual_machine::has_key(const i64& instruction)
+	{
+		map_table table(nullptr);
+		registers.gpr[instruction.rc()] = find_key(instruction, table) != map_table::not_found;
+		registers.tags[instruction.rc()] = value_type::boolean;
+	}
+
+	void virtual_machine::next_key(const i64& instruction)
+	{
+		const auto* target = container(instruction.rbs());
+		if (registers.tags[instruction.a] != value_type::integer)
+		{
+			runtime_error("map positions are integers on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+
+		// positions count the keys in insertion order, so keys stored during a walk come after it
+		const auto after = registers.gpr[instruction.a];
+		registers.gpr[instruction.rc()] = after >= -1 && after + 1 < static_cast<vm_register>(target->function) ? after + 1 : -1;
+		registers.tags[instruction.rc()] = value_type::integer;
+	}
+
+	void virtual_machine::key_at(const i64& instruction)
+	{
+		const auto* target = container(instruction.rbs());
+		const auto position = registers.gpr[instruction.a];
+		if (registers.tags[instruction.a] != value_type::integer || position < 0 || position >= static_cast<vm_register>(target->function))
+		{
+			runtime_error("no entry at that position of the map on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+
+		const map_table table(reinterpret_cast<closure*>(target->values()[0]));
+		const auto entry = table.at(static_cast<std::uint32_t>(position));
+		registers.gpr[instruction.rc()] = table.key(entry);
+		registers.tags[instruction.rc()] = table.key_tag(entry);
+	}
+
+	void virtual_machine::set_key(const i64& instruction)
+	{
+		if (is_array(registers.tags[instruction.rc()]))
+		{
+			set_element(instruction);
+			return;
+		}
+
+		auto* target = container(instruction.rc());
+		auto key = registers.gpr[instruction.rbs()];
+		auto tag = registers.tags[instruction.rbs()];
+		if (!normalise_key(key, tag))
+		{
+			runtime_error("map keys have to be numbers or booleans on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+
+		auto entry = map_table::not_found;
+		map_table table(nullptr);
+		if (target->function != 0)
+		{
+			table = map_table(reinterpret_cast<closure*>(target->values()[0]));
+			entry = table.find(key, tag);
+		}
+		if (entry == map_table::not_found)
+		{
+			if (target->function == 0 || target->function == map_table::limit(table.capacity()))
+			{
+				table = map_table(grow(instruction.rc()));
+				target = reinterpret_cast<map*>(registers.gpr[instruction.rc()]);
+			}
+			entry = table.insert(key, tag, target->function);
+			target->function++;
+		}
+
+		const auto value = registers.gpr[instruction.a];
+		const auto value_tag = registers.tags[instruction.a];
+		table.value(entry) = value;
+		table.value_tag(entry) = value_tag;
+		heap_.write_barrier(table.get(), value, value_tag);
+	}
+
+	array* virtual_machine::make_array(const vm_register length)
+	{
+		if (length < 0 || length > max_array_length)
+		{
+			runtime_error("arrays have from 0 to %u elements, not %lld on line %d", max_array_length, length, static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		const auto bytes = static_cast<size_t>(length) * sizeof(vm_register);
+		auto* created = heap_.allocate_data(static_cast<std::uint32_t>(length), bytes);
+		if (!created)
+		{
+			collect();
+			created = heap_.allocate_data(static_cast<std::uint32_t>(length), bytes);
+		}
+		CHERIE_TELEMETRY_ONLY(telemetry_.allocation(heap::allocation_size(0) + bytes);)
+		return created;
+	}
+
+	void virtual_machine::array_literal(const i64& instruction)
+	{
+		const auto* tags = registers.tags + instruction.rbs();
+		auto tag = value_type::integers;
+		for (std::uint32_t index = 0; index < instruction.a; index++)
+		{
+			if (tags[index] == value_type::floating)
+			{
+				tag = value_type::floats;
+			}
+			else if (tags[index] != value_type::integer)
+			{
+				runtime_error("array elements have to be numbers on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+			}
+		}
+
+		auto* created = make_array(instruction.a);
+		const auto* values = registers.gpr + instruction.rbs();
+		for (std::uint32_t index = 0; index < instruction.a; index++)
+		{
+			if (tag == value_type::integers)
+			{
+				integers(created)[index] = values[index];
+			}
+			else
+			{
+				floats(created)[index] = tags[index] == value_type::floating ? as_double(values[index]) : static_cast<double>(values[index]);
+			}
+		}
+		registers.gpr[instruction.rc()] = reinterpret_cast<vm_register>(created);
+		registers.tags[instruction.rc()] = tag;
+	}
+
+	std::uint32_t virtual_machine::element_index(const array* target, const std::uint16_t slot) const
+	{
+		if (registers.tags[slot] != value_type::integer)
+		{
+			runtime_error("array indices have to be integers on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		const auto index = registers.gpr[slot];
+		if (index < 0 || index >= length(target))
+		{
+			runtime_error("index %lld is out of bounds for an array of %u elements on line %d", index, length(target), static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		return static_cast<std::uint32_t>(index);
+	}
+
+	void virtual_machine::get_element(const i64& instruction)
+	{
+		auto* target = reinterpret_cast<array*>(registers.gpr[instruction.rbs()]);
+		const auto index = element_index(target, static_cast<std::uint16_t>(instruction.a));
+		if (registers.tags[instruction.rbs()] == value_type::integers)
+		{
+			registers.gpr[instruction.rc()] = integers(target)[index];
+			registers.tags[instruction.rc()] = value_type::integer;
+		}
+		else
+		{
+			registers.gpr[instruction.rc()] = from_double(floats(target)[index]);
+			registers.tags[instruction.rc()] = value_type::floating;
+		}
+	}
+
+	void virtual_machine::set_element(const i64& instruction)
+	{
+		auto* target = reinterpret_cast<array*>(registers.gpr[instruction.rc()]);
+		const auto index = element_index(target, instruction.rbs());
+		const auto value = registers.gpr[instruction.a];
+		const auto tag = registers.tags[instruction.a];
+		if (registers.tags[instruction.rc()] == value_type::integers)
+		{
+			if (tag != value_type::integer)
+			{
+				runtime_error("integer arrays only hold integers on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+			}
+			integers(target)[index] = value;
+		}
+		else
+		{
+			if (tag != value_type::integer && tag != value_type::floating)
+			{
+				runtime_error("array elements have to be numbers on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+			}
+			floats(target)[index] = tag == value_type::floating ? as_double(value) : static_cast<double>(value);
+		}
+	}
+
+	array* virtual_machine::argument(const kernel op, const std::uint16_t slot) const
+	{
+		if (!is_array(registers.tags[slot]))
+		{
+			runtime_error("%s takes an array on line %d", kernel_name(op), static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		return reinterpret_cast<array*>(registers.gpr[slot]);
+	}
+
+	void virtual_machine::elementwise(const kernel op, const std::uint16_t first, const std::uint16_t result)
+	{
+		const auto lhs_tag = registers.tags[first];
+		const auto rhs_tag = registers.tags[first + 1];
+		const auto number = [](const value_type tag) { return tag == value_type::integer || tag == value_type::floating; };
+		if (!(is_array(lhs_tag) || number(lhs_tag)) || !(is_array(rhs_tag) || number(rhs_tag)) || !(is_array(lhs_tag) || is_array(rhs_tag)))
+		{
+			runtime_error("%s takes two arrays or an array and a number on line %d", kernel_name(op), static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		const auto count = length(reinterpret_cast<array*>(registers.gpr[is_array(lhs_tag) ? first : first + 1]));
+		if (is_array(lhs_tag) && is_array(rhs_tag) && length(reinterpret_cast<array*>(registers.gpr[first + 1])) != count)
+		{
+			runtime_error("%s takes arrays of the same length, not %u and %u on line %d", kernel_name(op), count, length(reinterpret_cast<array*>(registers.gpr[first + 1])), static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+
+		// the operands are read from their registers once the result is allocated, the collection may move them
+		const auto floating = lhs_tag == value_type::floats || lhs_tag == value_type::floating || rhs_tag == value_type::floats || rhs_tag == value_type::floating;
+		auto* created = make_array(count);
+		if (!floating)
+		{
+			const auto* lhs = is_array(lhs_tag) ? integers(reinterpret_cast<array*>(registers.gpr[first])) : registers.gpr + first;
+			const auto* rhs = is_array(rhs_tag) ? integers(reinterpret_cast<array*>(registers.gpr[first + 1])) : registers.gpr + first + 1;
+			if (!vm::elementwise(op, lhs, !is_array(lhs_tag), rhs, !is_array(rhs_tag), integers(created), count))
+			{
+				runtime_error("division by zero on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+			}
+			registers.gpr[result] = reinterpret_cast<vm_register>(created);
+			registers.tags[result] = value_type::integers;
+			return;
+		}
+
+		// integers are widened to doubles first, as scalar arithmetic would
+		std::vector<double> widened[2];
+		double scalars[2];
+		const double* operands[2];
+		for (std::uint16_t side = 0; side < 2; side++)
+		{
+			const auto slot = static_cast<std::uint16_t>(first + side);
+			const auto tag = registers.tags[slot];
+			if (tag == value_type::floats)
+			{
+				operands[side] = floats(reinterpret_cast<array*>(registers.gpr[slot]));
+			}
+			else if (tag == value_type::integers)
+			{
+				const auto* values = integers(reinterpret_cast<array*>(registers.gpr[slot]));
+				widened[side].assign(values, values + count);
+				operands[side] = widened[side].data();
+			}
+			else
+			{
+				scalars[side] = tag == value_type::floating ? as_double(registers.gpr[slot]) : static_cast<double>(registers.gpr[slot]);
+				operands[side] = &scalars[side];
+			}
+		}
+		vm::elementwise(op, operands[0], !is_array(lhs_tag), operands[1], !is_array(rhs_tag), floats(created), count);
+		registers.gpr[result] = reinterpret_cast<vm_register>(created);
+		registers.tags[result] = value_type::floats;
+	}
+
+	void virtual_machine::filter(const std::uint16_t first, const std::uint16_t result)
+	{
+		auto* source = argument(kernel::filter, first);
+		const auto tag = registers.tags[first];
+		for (std::uint16_t index = 1; index < 3; index++)
+		{
+			if (registers.tags[first + index] != value_type::integer && registers.tags[first + index] != value_type::floating)
+			{
+				runtime_error("filter takes an array and two numbers on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+			}
+		}
+		const auto bound = [this, first](const std::uint16_t index)
+		{
+			const auto slot = first + index;
+			return registers.tags[slot] == value_type::floating ? as_double(registers.gpr[slot]) : static_cast<double>(registers.gpr[slot]);
+		};
+
+		size_t kept;
+		vm_register low = 0;
+		vm_register high = -1;
+		if (tag == value_type::integers)
+		{
+			if (registers.tags[first + 1] == value_type::integer && registers.tags[first + 2] == value_type::integer)
+			{
+				low = registers.gpr[first + 1];
+				high = registers.gpr[first + 2];
+			}
+			else if (const auto lower = std::ceil(bound(1)), upper = std::floor(bound(2)); lower <= upper && lower < 9223372036854775808.0 && upper >= -9223372036854775808.0)
+			{
+				// the integers a range of doubles holds, NaNs hold none
+				low = lower < -9223372036854775808.0 ? INT64_MIN : static_cast<vm_register>(lower);
+				high = upper >= 9223372036854775808.0 ? INT64_MAX : static_cast<vm_register>(upper);
+			}
+			kept = count_between(integers(source), length(source), low, high);
+		}
+		else
+		{
+			kept = count_between(floats(source), length(source), bound(1), bound(2));
+		}
+
+		auto* created = make_array(static_cast<vm_register>(kept));
+		source = reinterpret_cast<array*>(registers.gpr[first]);
+		if (tag == value_type::integers)
+		{
+			copy_between(integers(source), length(source), low, high, integers(created), kept);
+		}
+		else
+		{
+			copy_between(floats(source), length(source), bound(1), bound(2), floats(created), kept);
+		}
+		registers.gpr[result] = reinterpret_cast<vm_register>(created);
+		registers.tags[result] = tag;
+	}
+
+	void virtual_machine::run_kernel(const i64& instruction)
+	{
+		const auto op = static_cast<kernel>(instruction.a);
+		const auto first = instruction.rbs();
+		const auto result = instruction.rc();
+		switch (op)
+		{
+			case kernel::fill:
+			{
+				const auto tag = registers.tags[first + 1];
+				if (registers.tags[first] != value_type::integer || (tag != value_type::integer && tag != value_type::floating))
+				{
+					runtime_error("fill takes a length and a number on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+				}
+				auto* created = make_array(registers.gpr[first]);
+				std::fill_n(created->values(), length(created), registers.gpr[first + 1]); // the same bits either way
+				registers.gpr[result] = reinterpret_cast<vm_register>(created);
+				registers.tags[result] = tag == value_type::integer ? value_type::integers : value_type::floats;
+				break;
+			}
+			case kernel::len:
+			{
+				const auto tag = registers.tags[first];
+				if (!is_array(tag) && tag != value_type::map)
+				{
+					runtime_error("len takes an array or a map on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+				}
+				registers.gpr[result] = reinterpret_cast<closure*>(registers.gpr[first])->function; // the length or the number of entries
+				registers.tags[result] = value_type::integer;
+				break;
+			}
+			case kernel::sum:
+			case kernel::min:
+			case kernel::max:
+			{
+				auto* target = argument(op, first);
+				if (op != kernel::sum && length(target) == 0)
+				{
+					runtime_error("%s of an empty array on line %d", kernel_name(op), static_cast<int>(lines.find(registers.pc - 1).line));
+				}
+				if (registers.tags[first] == value_type::integers)
+				{
+					const auto* values = integers(target);
+					registers.gpr[result] = op == kernel::sum ? sum(values, length(target)) : op == kernel::min ? minimum(values, length(target)) : maximum(values, length(target));
+					registers.tags[result] = value_type::integer;
+				}
+				else
+				{
+					const auto* values = floats(target);
+					registers.gpr[result] = from_double(op == kernel::sum ? sum(values, length(target)) : op == kernel::min ? minimum(values, length(target)) : maximum(values, length(target)));
+					registers.tags[result] = value_type::floating;
+				}
+				break;
+			}
+			case kernel::dot:
+			{
+				auto* lhs = argument(op, first);
+				auto* rhs = argument(op, first + 1);
+				if (length(lhs) != length(rhs))
+				{
+					runtime_error("dot takes arrays of the same length, not %u and %u on line %d", length(lhs), length(rhs), static_cast<int>(lines.find(registers.pc - 1).line));
+				}
+				const auto lhs_tag = registers.tags[first];
+				const auto rhs_tag = registers.tags[first + 1];
+				if (lhs_tag == value_type::integers && rhs_tag == value_type::integers)
+				{
+					registers.gpr[result] = dot(integers(lhs), integers(rhs), length(lhs));
+					registers.tags[result] = value_type::integer;
+					break;
+				}
+				std::vector<double> widened;
+				if (lhs_tag != rhs_tag)
+				{
+					const auto* values = integers(lhs_tag == value_type::integers ? lhs : rhs);
+					widened.assign(values, values + length(lhs));
+				}
+				const auto* left = lhs_tag == value_type::floats ? floats(lhs) : widened.data();
+				const auto* right = rhs_tag == value_type::floats ? floats(rhs) : widened.data();
+				registers.gpr[result] = from_double(dot(left, right, length(lhs)));
+				registers.tags[result] = value_type::floating;
+				break;
+			}
+			case kernel::add:
+			case kernel::sub:
+			case kernel::mul:
+			case kernel::div:
+				elementwise(op, first, result);
+				break;
+			case kernel::filter:
+				filter(first, result);
+				break;
+			case kernel::sort:
+			{
+				auto* target = argument(op, first);
+				if (registers.tags[first] == value_type::integers)
+				{
+					sort(integers(target), length(target));
+				}
+				else
+				{
+					sort(floats(target), length(target));
+				}
+				registers.gpr[result] = registers.gpr[first];
+				registers.tags[result] = registers.tags[first];
+				break;
+			}
+		}
+	}
+
+	void virtual_machine::collect()
+	{
+		const auto started = std::chrono::steady_clock::now();
+		heap_.begin_minor();
+		trace_roots();
+		[[maybe_unused]] auto freed = heap_.finish_minor();
+		CHERIE_TELEMETRY_ONLY(telemetry_.collection(false);)
+
+		// the major cycle gets a slice of every pause, all of it if the script allocates faster than it is collected
+		const auto deadline = heap_.behind() ? std::chrono::steady_clock::time_point::max() : started + gc_pause;
+		if (heap_.cycle() == heap::phase::idle && heap_.needs_major())
+		{
+			heap_.begin_marking();
+			trace_roots();
+			CHERIE_TELEMETRY_ONLY(telemetry_.collection(true);)
+		}
+		if (heap_.cycle() == heap::phase::marking && heap_.mark(deadline))
+		{
+			trace_roots(); // what the script did to its registers and globals since marking started
+			heap_.finish_marking();
+		}
+		if (heap_.cycle() == heap::phase::sweeping)
+		{
+			freed += heap_.sweep(deadline);
+		}
+		CHERIE_TELEMETRY_ONLY(telemetry_.free(freed); telemetry_.pause(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());)
+	}
+
+	void virtual_machine::release_region()
+	{
+		if (!heap_.in_region_mode())
+		{
+			return;
+		}
+
+		// the globals outlive the run, the registers it leaves behind are only read as numbers
+		heap_.begin_release();
+		for (size_t index = 0; index < globals_.size(); index++)
+		{
+			heap_.trace(globals_[index], global_tags_[index]);
+		}
+		[[maybe_unused]] const auto freed = heap_.release_region();
+		CHERIE_TELEMETRY_ONLY(telemetry_.free(freed);)
+	}
+
+	void virtual_machine::trace_roots()
+	{
+		// registers above the running frame may be stale, but anything they point at is checked by the heap
+		for (size_t index = 0; index < top_; index++)
+		{
+			heap_.trace(values_[index], tags_[index]);
+		}
+		for (size_t index = 0; index < globals_.size(); index++)
+		{
+			heap_.trace(globals_[index], global_tags_[index]);
+		}
+		for (size_t depth = 0; depth < depth_; depth++)
+		{
+			heap_.trace(frames_[depth].environment);
+		}
+		heap_.trace(environment_);
+	}
+
+	closure* virtual_machine::callee(const i64& instruction) const
+	{
+		const auto slot = instruction.rc() + instruction.a;
+		if (registers.tags[slot] != value_type::function)
+		{
+			runtime_error("called value is not a function on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+
+		auto* target = reinterpret_cast<closure*>(registers.gpr[slot]);
+		if (const auto& function = functions[target->function]; function.parameters != instruction.a)
+		{
+			runtime_error("'%s' takes %d arguments but %d were given on line %d", function.name.c_str(), static_cast<int>(function.parameters), static_cast<int>(instruction.a), static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		return target;
+	}
+
+	void virtual_machine::check_arithmetic(const value_type lhs_type, const value_type rhs_type) const
+	{
+		if (lhs_type == value_type::function || rhs_type == value_type::function)
+		{
+			runtime_error("arithmetic on a function on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		if (lhs_type == value_type::object || rhs_type == value_type::object)
+		{
+			runtime_error("arithmetic on an object on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		if (lhs_type == value_type::map || rhs_type == value_type::map)
+		{
+			runtime_error("arithmetic on a map on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+		if (is_array(lhs_type) || is_array(rhs_type))
+		{
+			runtime_error("arithmetic on an array on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+		}
+	}
+
+	void virtual_machine::generic_arithmetic(const i64& instruction)
+	{
+		const auto lhs = registers.gpr[instruction.rbs()];
+		const auto rhs = registers.gpr[instruction.a];
+		const auto lhs_type = registers.tags[instruction.rbs()];
+		const auto rhs_type = registers.tags[instruction.a];
+		auto& result = registers.gpr[instruction.rc()];
+		auto& result_type = registers.tags[instruction.rc()];
+		check_arithmetic(lhs_type, rhs_type);
+
+		if (lhs_type != value_type::floating && rhs_type != value_type::floating)
+		{
+			switch (instruction.op)
+			{
+				case opcode::addv: result = wrapping_add(lhs, rhs); break;
+				case opcode::subv: result = wrapping_subtract(lhs, rhs); break;
+				case opcode::mulv: result = wrapping_multiply(lhs, rhs); break;
+				default: result = divide(lhs, rhs); break;
+			}
+			result_type = value_type::integer;
+			return;
+		}
+
+		const auto a = lhs_type == value_type::floating ? as_double(lhs) : static_cast<double>(lhs);
+		const auto b = rhs_type == value_type::floating ? as_double(rhs) : static_cast<double>(rhs);
+		switch (instruction.op)
+		{
+			case opcode::addv: result = from_double(a + b); break;
+			case opcode::subv: result = from_double(a - b); break;
+			case opcode::mulv: result = from_double(a * b); break;
+			default: result = from_double(a / b); break;
+		}
+		result_type = value_type::floating;
+	}
+
+	void virtual_machine::generic_unary(const i64& instruction)
+	{
+		const auto operand = registers.gpr[instruction.rbs()];
+		const auto type = registers.tags[instruction.rbs()];
+		check_arithmetic(type, type);
+
+		auto& result = registers.gpr[instruction.rc()];
+		auto& result_type = registers.tags[instruction.rc()];
+		if (instruction.op == opcode::lnotv)
+		{
+			result = type == value_type::floating ? as_double(operand) == 0.0 : operand == 0;
+			result_type = value_type::boolean;
+		}
+		else if (type == value_type::floating)
+		{
+			result = from_double(-as_double(operand));
+			result_type = value_type::floating;
+		}
+		else
+		{
+			result = wrapping_subtract(0, operand);
+			result_type = value_type::integer;
+		}
+	}
+
+	tagged_value virtual_machine::global(const std::string& name) const
+	{
+		const auto index = static_cast<size_t>(std::find(globals.begin(), globals.end(), name) - globals.begin());
+		if (index >= globals_.size())
+		{
+			runtime_error("there is no global called '%s'", name.c_str());
+		}
+		return { globals_[index], global_tags_[index] };
+	}
+
+	void virtual_machine::execute_trampoline(virtual_machine* vm)
+	{
+		try
+		{
+			vm->execute();
+		}
+		catch (...)
+		{
+			vm->failure_ = std::current_exception(); // rethrown once the trampoline has returned
+		}
+	}
+
+	trampoline virtual_machine::trampoline_of(const std::uint32_t function)
+	{
+		if (function >= trampolines_.size())
+		{
+			trampolines_.resize(functions.size());
+		}
+		if (!trampolines_[function])
+		{
+			const auto& info = functions[function];
+			const auto line = info.entry == function_info::deferred ? 0 : lines.find(info.entry).line;
+			trampolines_[function] = perf_map::get().trampoline_for(name + ":" + info.name + ":" + std::to_string(line));
+		}
+		return trampolines_[function];
+	}
+
+	bool virtual_machine::execute_through(const std::uint32_t function)
+	{
+		// the frame just entered runs in an execute of its own under the trampoline, which returns with it
+		const auto entry = trampoline_of(function);
+		if (!entry)
+		{
+			return true;
+		}
+		const auto entered = depth_;
+		const auto floor = std::exchange(floor_, entered);
+		entry(this);
+		floor_ = floor;
+		if (failure_)
+		{
+			std::rethrow_exception(std::exchange(failure_, nullptr));
+		}
+		return depth_ < entered; // false when it halted instead
+	}
+
+	bool virtual_machine::enable_perf_map()
+	{
+		return perf_map::get().enable(&execute_trampoline);
+	}
+
+#ifdef CHERIE_PROFILER
+	void virtual_machine::take_sample()
+	{
+		if (!sampler.running())
+		{
+			profile_countdown_ = SIZE_MAX;
+			return;
+		}
+		
+		profile_countdown_ = sampler.interval();
+		std::vector<size_t> stack;
+		stack.reserve(depth_ + 1);
+		for (size_t depth = 0; depth < depth_; depth++)
+		{
+			stack.push_back(static_cast<size_t>(frames_[depth].return_pc) - 1); // the call the caller is in
+		}
+		stack.push_back(static_cast<size_t>(registers.pc));
+		sampler.sample(stack);
+	}
+#endif
+
 	void virtual_machine::run()
+	{
+		if (values_.empty())
+		{
+			values_.resize(value_stack_size);
+			tags_.resize(value_stack_size);
+			frames_.resize(max_call_depth);
+		}
+		std::fill_n(values_.begin(), 256, 0);
+		std::fill_n(tags_.begin(), 256, value_type::integer);
+		globals_.assign(globals.size(), 0);
+		global_tags_.assign(globals.size(), value_type::integer);
+		CHERIE_TELEMETRY_ONLY(telemetry_.free(heap_.stats().nursery_bytes + heap_.stats().old_bytes);)
+		heap_.clear();
+		if (region)
+		{
+			heap_.begin_region();
+		}
+		statics_.clear();
+		statics_.resize(functions.size());
+		caches_.assign(layout.sites.size(), {});
+		environment_ = nullptr;
+		perf_ = perf_map::get().enabled();
+		trampolines_.assign(perf_ ? functions.size() : 0, nullptr);
+		floor_ = 0;
+		bind();
+
+		registers = {};
+		registers.gpr = values_.data();
+		registers.tags = tags_.data();
+		base_ = 0;
+		top_ = std::min<size_t>(functions.empty() ? 0 : functions[0].frame_size, value_stack_size);
+		depth_ = 0;
+		stack.clear();
+#ifdef CHERIE_PROFILER
+		profile_countdown_ = sampler.running() ? sampler.interval() : SIZE_MAX;
+#endif
+		CHERIE_TELEMETRY_ONLY(const auto started = std::chrono::steady_clock::now();)
+
+		try
+		{
+			if (native_)
+			{
+				native_->functions[0].code(*this, registers.gpr, registers.tags);
+			}
+			else
+			{
+				if (perf_)
+				{
+					execute_through(0);
+				}
+				else
+				{
+					execute();
+				}
+			}
+		}
+		catch (...)
+		{
+			release_region();
+			throw;
+		}
+		release_region();
+
+		CHERIE_TELEMETRY_ONLY(telemetry_.run(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());)
+	}
+	
+	void virtual_machine::execute()
 	{
 		while (true)
 		{
-			const auto& next_instruction = program[registers.pc++];
+#ifdef CHERIE_PROFILER
+			if (--profile_countdown_ == 0)
+			{
+				take_sample();
+			}
+#endif
+			const auto& next_instruction = code_[registers.pc++];
+			CHERIE_TELEMETRY_ONLY(telemetry_.retire(next_instruction.op);)
 			switch (next_instruction.op)
 			{
 				case opcode::nop: /* no operation */
@@ -22,28 +1001,57 @@ namespace cherie::vm
 				}
 				case opcode::pushr: /* push value from register onto stack */
 				{
-					stack.push_back(registers.gpr[next_instruction.c]);
+					stack.push_back(registers.gpr[next_instruction.rc()]);
+					CHERIE_TELEMETRY_ONLY(telemetry_.stack_depth(stack.size());)
 					break;
 				}
 				case opcode::pushi: /* push immediate value */
 				{
-					stack.push_back(next_instruction.a);
+					stack.push_back(next_instruction.sa());
+					CHERIE_TELEMETRY_ONLY(telemetry_.stack_depth(stack.size());)
 					break;
 				}
 				case opcode::pop: /* push value from stack into a register*/
 				{
-					registers.gpr[next_instruction.c] = stack.back();
+					registers.gpr[next_instruction.rc()] = stack.back();
 					stack.pop_back();
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
 					break;
 				}
 				case opcode::load: /* loads value into register */
 				{
-					registers.gpr[next_instruction.c] = next_instruction.a;
+					registers.gpr[next_instruction.rc()] = next_instruction.sa();
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::loadk: /* loads value from the constant pool into register */
+				{
+					registers.gpr[next_instruction.rc()] = pool_[next_instruction.a];
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::move:
+				{
+					registers.gpr[next_instruction.rc()] = registers.gpr[next_instruction.rbs()];
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::addrs: /* R(n) = R(m) + imm */
+				{
+					registers.gpr[next_instruction.rc()] = wrapping_add(registers.gpr[next_instruction.rbs()], next_instruction.sa());
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::mulrs: /* R(n) = R(m) * imm */
+				{
+					registers.gpr[next_instruction.rc()] = wrapping_multiply(registers.gpr[next_instruction.rbs()], next_instruction.sa());
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
 					break;
 				}
-				case opcode::addrs: /* R(n) = R(n) + R(z) */
+				case opcode::divrs: /* R(n) = R(m) / imm, imm is never zero */
 				{
-					//registers.gpr[next_instruction.c] = registers.gpr[next_instruction.bs] + next_instruction.as;
+					registers.gpr[next_instruction.rc()] = divide(registers.gpr[next_instruction.rbs()], next_instruction.sa());
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
 					break;
 				}
 				case opcode::adds:
@@ -53,11 +1061,331 @@ namespace cherie::vm
 
 					const auto a = stack.back();
 					stack.pop_back();
-					stack[stack.size() - 1] = stack.back() + a;
+					stack[stack.size() - 1] = wrapping_add(stack.back(), a);
+					break;
+				}
+				case opcode::subs:
+				case opcode::muls:
+				case opcode::divs:
+				{
+					const auto b = stack.back();
+					stack.pop_back();
+					auto& a = stack.back();
+					switch (next_instruction.op)
+					{
+						case opcode::subs: a = wrapping_subtract(a, b); break;
+						case opcode::muls: a = wrapping_multiply(a, b); break;
+						default: a = divide(a, b); break;
+					}
 					break;
 				}
 				case opcode::addr:
 				{
+					registers.gpr[next_instruction.rc()] = wrapping_add(registers.gpr[next_instruction.rbs()], registers.gpr[next_instruction.a]);
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::subr:
+				{
+					registers.gpr[next_instruction.rc()] = wrapping_subtract(registers.gpr[next_instruction.rbs()], registers.gpr[next_instruction.a]);
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::mulr:
+				{
+					registers.gpr[next_instruction.rc()] = wrapping_multiply(registers.gpr[next_instruction.rbs()], registers.gpr[next_instruction.a]);
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::divr:
+				{
+					registers.gpr[next_instruction.rc()] = divide(registers.gpr[next_instruction.rbs()], registers.gpr[next_instruction.a]);
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::neg:
+				{
+					registers.gpr[next_instruction.rc()] = wrapping_subtract(0, registers.gpr[next_instruction.rbs()]);
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::lnot:
+				{
+					registers.gpr[next_instruction.rc()] = registers.gpr[next_instruction.rbs()] == 0;
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::addf:
+				{
+					registers.gpr[next_instruction.rc()] = from_double(as_double(registers.gpr[next_instruction.rbs()]) + as_double(registers.gpr[next_instruction.a]));
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::subf:
+				{
+					registers.gpr[next_instruction.rc()] = from_double(as_double(registers.gpr[next_instruction.rbs()]) - as_double(registers.gpr[next_instruction.a]));
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::mulf:
+				{
+					registers.gpr[next_instruction.rc()] = from_double(as_double(registers.gpr[next_instruction.rbs()]) * as_double(registers.gpr[next_instruction.a]));
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::divf:
+				{
+					registers.gpr[next_instruction.rc()] = from_double(as_double(registers.gpr[next_instruction.rbs()]) / as_double(registers.gpr[next_instruction.a]));
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::negf:
+				{
+					registers.gpr[next_instruction.rc()] = from_double(-as_double(registers.gpr[next_instruction.rbs()]));
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::lnotf:
+				{
+					registers.gpr[next_instruction.rc()] = as_double(registers.gpr[next_instruction.rbs()]) == 0.0;
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::itof:
+				{
+					registers.gpr[next_instruction.rc()] = from_double(static_cast<double>(registers.gpr[next_instruction.rbs()]));
+					registers.tags[next_instruction.rc()] = untagged(registers.tags[next_instruction.rc()]);
+					break;
+				}
+				case opcode::tag:
+				{
+					registers.tags[next_instruction.rc()] = static_cast<value_type>(next_instruction.a);
+					break;
+				}
+				case opcode::movev:
+				{
+					registers.gpr[next_instruction.rc()] = registers.gpr[next_instruction.rbs()];
+					registers.tags[next_instruction.rc()] = registers.tags[next_instruction.rbs()];
+					break;
+				}
+				case opcode::addv:
+				case opcode::subv:
+				case opcode::mulv:
+				case opcode::divv:
+				{
+					generic_arithmetic(next_instruction);
+					break;
+				}
+				case opcode::negv:
+				case opcode::lnotv:
+				{
+					generic_unary(next_instruction);
+					break;
+				}
+				case opcode::getg:
+				{
+					registers.gpr[next_instruction.rc()] = globals_[next_instruction.a];
+					registers.tags[next_instruction.rc()] = global_tags_[next_instruction.a];
+					break;
+				}
+				case opcode::setg:
+				{
+					globals_[next_instruction.a] = registers.gpr[next_instruction.rbs()];
+					global_tags_[next_instruction.a] = registers.tags[next_instruction.rbs()];
+					break;
+				}
+				case opcode::closure:
+				{
+					auto* created = make_closure(next_instruction.a, registers.gpr + next_instruction.rbs(), registers.tags + next_instruction.rbs());
+					registers.gpr[next_instruction.rc()] = reinterpret_cast<vm_register>(created);
+					registers.tags[next_instruction.rc()] = value_type::function;
+					break;
+				}
+				case opcode::getu:
+				{
+					registers.gpr[next_instruction.rc()] = environment_->values()[next_instruction.a];
+					registers.tags[next_instruction.rc()] = environment_->tags()[next_instruction.a];
+					break;
+				}
+				case opcode::self:
+				{
+					registers.gpr[next_instruction.rc()] = reinterpret_cast<vm_register>(environment_);
+					registers.tags[next_instruction.rc()] = value_type::function;
+					break;
+				}
+				case opcode::object:
+				{
+					auto* created = make_object(next_instruction.a, registers.gpr + next_instruction.rbs(), registers.tags + next_instruction.rbs());
+					registers.gpr[next_instruction.rc()] = reinterpret_cast<vm_register>(created);
+					registers.tags[next_instruction.rc()] = value_type::object;
+					break;
+				}
+				case opcode::getf:
+				{
+					get_field(next_instruction);
+					break;
+				}
+				case opcode::setf:
+				{
+					set_field(next_instruction);
+					break;
+				}
+				case opcode::map:
+				{
+					auto* created = make_map();
+					registers.gpr[next_instruction.rc()] = reinterpret_cast<vm_register>(created);
+					registers.tags[next_instruction.rc()] = value_type::map;
+					break;
+				}
+				case opcode::getk:
+				{
+					get_key(next_instruction);
+					break;
+				}
+				case opcode::hask:
+				{
+					has_key(next_instruction);
+					break;
+				}
+				case opcode::nextk:
+				{
+					next_key(next_instruction);
+					break;
+				}
+				case opcode::keyk:
+				{
+					key_at(next_instruction);
+					break;
+				}
+				case opcode::setk:
+				{
+					set_key(next_instruction);
+					break;
+				}
+				case opcode::array:
+				{
+					array_literal(next_instruction);
+					break;
+				}
+				case opcode::vec:
+				{
+					run_kernel(next_instruction);
+					break;
+				}
+				case opcode::jmp:
+				{
+					registers.pc = next_instruction.a;
+					break;
+				}
+				case opcode::jz:
+				{
+					if (registers.gpr[next_instruction.rbs()] == 0)
+					{
+						registers.pc = next_instruction.a;
+					}
+					break;
+				}
+				case opcode::jnz:
+				{
+					if (registers.gpr[next_instruction.rbs()] != 0)
+					{
+						registers.pc = next_instruction.a;
+					}
+					break;
+				}
+				case opcode::call:
+				{
+					if (depth_ == frames_.size())
+					{
+						runtime_error("call stack overflow on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+					}
+					const auto instruction = next_instruction; // loading the callee can move the program
+					const auto& callee = resolve(instruction.a);
+					frames_[depth_++] = { registers.pc, base_, instruction.rbs(), environment_ };
+					CHERIE_TELEMETRY_ONLY(telemetry_.call(depth_);)
+
+					enter(base_ + instruction.rc(), callee);
+					environment_ = nullptr;
+					registers.pc = callee.entry;
+					if (perf_ && depth_ < max_trampoline_depth && !execute_through(instruction.a))
+					{
+						return;
+					}
+					break;
+				}
+				case opcode::callv:
+				{
+					auto* target = callee(next_instruction);
+					if (depth_ == frames_.size())
+					{
+						runtime_error("call stack overflow on line %d", static_cast<int>(lines.find(registers.pc - 1).line));
+					}
+					const auto instruction = next_instruction;
+					const auto& function = resolve(target->function);
+					frames_[depth_++] = { registers.pc, base_, instruction.rbs(), environment_ };
+					CHERIE_TELEMETRY_ONLY(telemetry_.call(depth_);)
+
+					const auto called = target->function;
+					enter(base_ + instruction.rc(), function);
+					environment_ = target;
+					registers.pc = function.entry;
+					if (perf_ && depth_ < max_trampoline_depth && !execute_through(called))
+					{
+						return;
+					}
+					break;
+				}
+				case opcode::ret:
+				{
+					if (depth_ == 0)
+					{
+						return; // returning from the main chunk ends the run
+					}
+
+					const auto& frame = frames_[--depth_];
+					const auto returned = std::min<size_t>(next_instruction.rbs(), frame.results);
+					const auto first = next_instruction.rc();
+					for (size_t index = 0; index < frame.results; index++)
+					{
+						// the source is never below the destination, so copying upwards is safe
+						registers.gpr[index] = index < returned ? registers.gpr[first + index] : 0;
+						registers.tags[index] = index < returned ? registers.tags[first + index] : value_type::integer;
+					}
+
+					base_ = frame.base;
+					environment_ = frame.environment;
+					registers.gpr = values_.data() + base_;
+					registers.tags = tags_.data() + base_;
+					registers.pc = frame.return_pc;
+					if (depth_ < floor_)
+					{
+						return; // back in the caller, which runs under another trampoline
+					}
+					break;
+				}
+				case opcode::tailcall:
+				{
+					const auto first = next_instruction.rc();
+					const auto& callee = resolve(next_instruction.a);
+					enter(base_, callee);
+					std::memmove(registers.gpr, registers.gpr + first, callee.parameters * sizeof(vm_register));
+					std::memmove(registers.tags, registers.tags + first, callee.parameters * sizeof(value_type));
+					CHERIE_TELEMETRY_ONLY(telemetry_.call();)
+					environment_ = nullptr;
+					registers.pc = callee.entry;
+					break;
+				}
+				case opcode::tailcallv:
+				{
+					auto* target = callee(next_instruction);
+					const auto first = next_instruction.rc();
+					const auto& function = resolve(target->function);
+					enter(base_, function);
+					std::memmove(registers.gpr, registers.gpr + first, function.parameters * sizeof(vm_register));
+					std::memmove(registers.tags, registers.tags + first, function.parameters * sizeof(value_type));
+					CHERIE_TELEMETRY_ONLY(telemetry_.call();)
+					environment_ = target;
+					registers.pc = function.entry;
 					break;
 				}
 				case opcode::halt: /* terminates execution*/
@@ -0,0 +1,82 @@
+/*
+ * File Name: arrays.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for packed numeric arrays and their vector kernels.
+ */
+
+#include "test.h"
+
+CHERIE_TEST(arrays_index_and_update)
+{
+	const char* const source = R"(
+		let ints = [1, 2, 3];
+		ints[1] = 7;
+		ints[2] += 5;
+		ints[0] *= 4;
+		let floats = [1, 2.5];
+		floats[0] = 3;
+		let big = fill(100000, 1);
+		let i = 0;
+		while (100000 - i) { big[i] = i; i += 1; }
+		let r = ints[0] + ints[1] * 10 + ints[2] * 100 + len(ints) * 1000;
+		let f = floats[0] + floats[1];
+		let b = sum(big) + min(big) + max(big);
+	)";
+	const auto result = cherie::test::run(source, { "r", "f", "b", "ints", "floats" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 3874);
+	CHERIE_CHECK_EQUAL(result.floating("f"), 5.5);
+	CHERIE_CHECK_EQUAL(result.integer("b"), 4999950000LL + 99999);
+	CHERIE_CHECK_EQUAL(static_cast<int>(result.value("ints").tag), static_cast<int>(cherie::vm::value_type::integers));
+	CHERIE_CHECK_EQUAL(static_cast<int>(result.value("floats").tag), static_cast<int>(cherie::vm::value_type::floats));
+	CHERIE_CHECK_SAME(source, { "r", "f", "b" });
+}
+
+CHERIE_TEST(arrays_kernels_match_scalar_loops)
+{
+	// lengths around every vector width, so the scalar tails run too
+	const char* const source = R"(
+		fn check(n) {
+			let a = fill(n, 0);
+			let x = fill(n, 0.0);
+			let i = 0;
+			let s = 0;
+			let d = 0;
+			while (n - i) {
+				let v = (i * 37 + 11) - (i * 37 + 11) / 101 * 101 - 50;
+				a[i] = v;
+				x[i] = v * 0.5;
+				s += v;
+				d += v * v;
+				i += 1;
+			}
+			let vector = sum(a) * 7 + dot(a, a) * 3 + sum(mul(a, 2)) + sum(add(x, 1.0));
+			let scalar = s * 7 + d * 3 + s * 2 + (s * 0.5 + n);
+			return vector - scalar, len(filter(a, -10, 10)), sum(sort(a)) - s;
+		}
+		let r = 0;
+		let k = 0;
+		let n = 0;
+		while (40 - n) {
+			let diff, kept, sorted = check(n);
+			r += diff;
+			k += kept;
+			r += sorted;
+			n += 1;
+		}
+	)";
+	const auto result = cherie::test::run(source, { "r", "k" });
+	CHERIE_CHECK_EQUAL(result.error, "");
+	CHERIE_CHECK_EQUAL(result.floating("r"), 0.0);
+	CHERIE_CHECK(result.integer("k") > 0);
+	CHERIE_CHECK_SAME(source, { "r", "k" });
+}
+
+CHERIE_TEST(arrays_report_bad_uses)
+{
+	CHERIE_CHECK_EQUAL(cherie::test::run("let a = [1, 2];\nlet r = a[2];", {}).error, "index 2 is out of bounds for an array of 2 elements on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("let a = [1, 2];\na[0] = 1.5;", {}).error, "integer arrays only hold integers on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("let r = dot([1], [1, 2]);", {}).error.rfind("dot takes arrays of the same length, not 1 and 2", 0), 0u);
+	CHERIE_CHECK_SAME("let r = div([1, 2], [1, 0]);", { "r" });
+	CHERIE_CHECK_SAME("let a = sort([2.5, 0.0 / 0.0, -1, 1]); let r = a[0] + a[2];", { "r" });
+}
@@ -0,0 +1,120 @@
+/*
+ * File Name: cache.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the on-disk compilation cache.
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "compilation/cache.h"
+#include "test.h"
+
+namespace
+{
+	const char* const script = R"(
+		fn f(n) { let s = 0; let i = 0; while (n - i) { s += i * 0.5; i += 1; } return s; }
+		let r = f(10);
+		fn keep_globals() { return r; }
+	)";
+
+	std::filesystem::path fresh_directory(const char* const name)
+	{
+		const auto directory = std::filesystem::temp_directory_path() / name;
+		std::filesystem::remove_all(directory);
+		return directory;
+	}
+
+	double run_cached(cherie::compiler::cache& cache, const std::string& source, const cherie::compiler::options& options = {})
+	{
+		auto state = std::make_unique<cherie::state_raw>();
+		state->load(cache.load(source, options));
+		return cherie::test::run(std::move(state)).floating("r");
+	}
+}
+
+CHERIE_TEST(cache_hits_after_the_first_compile)
+{
+	const auto directory = fresh_directory("cherie_test_cache");
+	cherie::compiler::cache cache(directory);
+	CHERIE_CHECK_EQUAL(run_cached(cache, script), 22.5);
+	CHERIE_CHECK_EQUAL(run_cached(cache, script), 22.5);
+	CHERIE_CHECK_EQUAL(cache.stats().misses, 1u);
+	CHERIE_CHECK_EQUAL(cache.stats().hits, 1u);
+	CHERIE_CHECK(std::filesystem::exists(directory / (cherie::compiler::cache::key(script, {}) + ".chbc")));
+
+	// other options are another entry, with the same results
+	CHERIE_CHECK(cherie::compiler::cache::key(script, cherie::test::unoptimised()) != cherie::compiler::cache::key(script, {}));
+	CHERIE_CHECK_EQUAL(run_cached(cache, script, cherie::test::unoptimised()), 22.5);
+	CHERIE_CHECK_EQUAL(cache.stats().misses, 2u);
+	CHERIE_CHECK_SAME(script, { "r" });
+
+	// a new cache over the same directory finds what the first one stored
+	cherie::compiler::cache reopened(directory);
+	CHERIE_CHECK_EQUAL(run_cached(reopened, script), 22.5);
+	CHERIE_CHECK_EQUAL(reopened.stats().hits, 1u);
+	std::filesystem::remove_all(directory);
+}
+
+CHERIE_TEST(cache_recompiles_damaged_entries)
+{
+	const auto directory = fresh_directory("cherie_test_cache_damaged");
+	cherie::compiler::cache cache(directory);
+	(void)cache.load(script);
+	std::ofstream(directory / (cherie::compiler::cache::key(script, {}) + ".chbc"), std::ios::binary | std::ios::trunc) << "garbage";
+
+	CHERIE_CHECK_EQUAL(run_cached(cache, script), 22.5);
+	CHERIE_CHECK_EQUAL(cache.stats().misses, 2u);
+	CHERIE_CHECK_EQUAL(run_cached(cache, script), 22.5);
+	CHERIE_CHECK_EQUAL(cache.stats().hits, 1u);
+	std::filesystem::remove_all(directory);
+}
+
+CHERIE_TEST(cache_evicts_down_to_its_capacity)
+{
+	const auto directory = fresh_directory("cherie_test_cache_small");
+	cherie::compiler::cache cache(directory, 1); // any entry is over it, only the newest one is kept
+	for (auto index = 0; index < 5; index++)
+	{
+		const auto source = std::string(script) + "let unused" + std::to_string(index) + " = 1;";
+		CHERIE_CHECK_EQUAL(run_cached(cache, source), 22.5);
+	}
+	CHERIE_CHECK_EQUAL(cache.stats().evictions, 4u);
+
+	size_t entries = 0;
+	for (const auto& file : std::filesystem::directory_iterator(directory))
+	{
+		entries += file.path().extension() == ".chbc";
+	}
+	CHERIE_CHECK_EQUAL(entries, 1u);
+	std::filesystem::remove_all(directory);
+}
+
+CHERIE_TEST(cache_removes_entries_whose_bytes_changed)
+{
+	const auto directory = fresh_directory("cherie_test_cache_digest");
+	cherie::compiler::cache cache(directory);
+	(void)cache.load(script);
+	const auto entry = directory / (cherie::compiler::cache::key(script, {}) + ".chbc");
+
+	// another valid image under the same name, only its digest tells them apart
+	const auto other = std::string(script) + "r = 7.5;";
+	(void)cache.load(other);
+	std::filesystem::copy_file(directory / (cherie::compiler::cache::key(other, {}) + ".chbc"), entry, std::filesystem::copy_options::overwrite_existing);
+	CHERIE_CHECK(cherie::compiler::cache::key(other, {}) != cherie::compiler::cache::key(script, {}));
+
+	CHERIE_CHECK_EQUAL(run_cached(cache, script), 22.5);
+	CHERIE_CHECK_EQUAL(cache.stats().misses, 3u);
+	CHERIE_CHECK_EQUAL(cache.stats().hits, 0u);
+	CHERIE_CHECK_EQUAL(run_cached(cache, script), 22.5);
+	CHERIE_CHECK_EQUAL(cache.stats().hits, 1u);
+
+	// an entry without its digest is not trusted either
+	std::filesystem::remove(directory / (cherie::compiler::cache::key(script, {}) + ".sum"));
+	CHERIE_CHECK_EQUAL(run_cached(cache, script), 22.5);
+	CHERIE_CHECK_EQUAL(cache.stats().misses, 4u);
+	CHERIE_CHECK(std::filesystem::exists(directory / (cherie::compiler::cache::key(script, {}) + ".sum")));
+	std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,64 @@
+/*
+ * File Name: calls.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for register-window calls, multiple returns and tail calls.
+ */
+
+#include <string>
+
+#include "test.h"
+
+CHERIE_TEST(calls_return_several_values)
+{
+	const char* const source = R"(
+		fn divmod(a, b) { let q = a / b; return q, a - q * b; }
+		fn three(x) { return x, x * 2, x * 3; }
+		let q, m = divmod(17, 5);
+		let a, b, c = three(1.5);
+		let s = 0;
+		let t = 0;
+		s, t = divmod(100, 7);
+		s, t = divmod(s, t);
+	)";
+	const auto result = cherie::test::run(source, { "q", "m", "a", "b", "c", "s", "t" });
+	CHERIE_CHECK_EQUAL(result.integer("q"), 3);
+	CHERIE_CHECK_EQUAL(result.integer("m"), 2);
+	CHERIE_CHECK_EQUAL(result.floating("c"), 4.5);
+	CHERIE_CHECK_EQUAL(result.integer("s"), 7);
+	CHERIE_CHECK_EQUAL(result.integer("t"), 0);
+	CHERIE_CHECK_SAME(source, { "q", "m", "a", "b", "c", "s", "t" });
+}
+
+CHERIE_TEST(calls_in_tail_position_run_in_constant_space)
+{
+	// far deeper than the call stack, so only works if the frame is reused
+	const char* const source = R"(
+		fn count(n, acc) { if (n) { return count(n - 1, acc + n); } return acc; }
+		fn even(n) { if (n) { return odd(n - 1); } return true; }
+		fn odd(n) { if (n) { return even(n - 1); } return false; }
+		let r = count(1000000, 0);
+		let e = even(300001);
+	)";
+	const auto result = cherie::test::run(source, { "r", "e" }, cherie::test::unoptimised());
+	CHERIE_CHECK_EQUAL(result.error, "");
+	CHERIE_CHECK_EQUAL(result.integer("r"), 500000500000);
+	CHERIE_CHECK_EQUAL(result.boolean("e"), false);
+	CHERIE_CHECK_SAME(source, { "r", "e" });
+}
+
+CHERIE_TEST(calls_overflowing_the_stack_fail_cleanly)
+{
+	const char* const source = R"(
+		fn deep(n) { if (n) { return 1 + deep(n - 1); } return 0; }
+		let r = deep(10000000);
+	)";
+	const auto result = cherie::test::run(source, { "r" });
+	CHERIE_CHECK_EQUAL(result.error.rfind("stack overflow calling 'deep'", 0), 0u);
+	CHERIE_CHECK_SAME(source, { "r" });
+
+	// the state is usable again afterwards
+	result.state->load("fn deep(n) { if (n) { return 1 + deep(n - 1); } return 0; } let r = deep(1000); fn keep_globals() { return r; }");
+	result.state->run();
+	CHERIE_CHECK_EQUAL(result.state->global("r").value, 1000);
+}
@@ -0,0 +1,82 @@
+/*
+ * File Name: closures.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for flat upvalue closures and escape analysis.
+ */
+
+#include <algorithm>
+
+#include "test.h"
+
+namespace
+{
+	size_t closures_made(const char* const source)
+	{
+		const auto code = cherie::compiler::compile(source, cherie::test::unoptimised());
+		return std::count_if(code.program.begin(), code.program.end(), [](const cherie::vm::i64& instruction)
+		{
+			return instruction.op == cherie::vm::opcode::closure;
+		});
+	}
+}
+
+CHERIE_TEST(closures_capture_by_value)
+{
+	const char* const source = R"(
+		fn make(a, b) { fn both(x) { return x * a + b; } return both; }
+		fn compose(f, g) { fn h(x) { return f(g(x)); } return h; }
+		fn inc(x) { return x + 1; }
+		fn late(a) { fn f() { return a; } a = 5; return f(); }
+		let f = make(2, 3);
+		let g = make(0.5, 1);
+		let h = compose(inc, f);
+		let r = f(1) * 100 + h(10);
+		let s = g(3);
+		let l = late(1);
+	)";
+	const auto result = cherie::test::run(source, { "r", "s", "l" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 524);
+	CHERIE_CHECK_EQUAL(result.floating("s"), 2.5);
+	CHERIE_CHECK_EQUAL(result.integer("l"), 1); // a was copied when f was made
+	CHERIE_CHECK_SAME(source, { "r", "s", "l" });
+}
+
+CHERIE_TEST(closures_that_do_not_escape_stay_calls)
+{
+	const char* const local = R"(
+		fn outer(n) {
+			fn count(i, acc) { if (i) { return count(i - 1, acc + n); } return acc; }
+			fn add(x) { return x + n; }
+			return count(10, 0) + add(1);
+		}
+		let r = outer(3);
+	)";
+	CHERIE_CHECK_EQUAL(closures_made(local), 0u);
+	CHERIE_CHECK_EQUAL(cherie::test::run(local, { "r" }).integer("r"), 34);
+	CHERIE_CHECK_SAME(local, { "r" });
+
+	const char* const escaping = R"(
+		fn outer(n) { fn add(x) { return x + n; } let f = add; return f(1); }
+		let r = outer(3);
+	)";
+	CHERIE_CHECK_EQUAL(closures_made(escaping), 1u);
+	CHERIE_CHECK_EQUAL(cherie::test::run(escaping, { "r" }).integer("r"), 4);
+	CHERIE_CHECK_SAME(escaping, { "r" });
+}
+
+CHERIE_TEST(closures_cannot_assign_captures)
+{
+	const auto result = cherie::test::run("fn outer(a) { fn f() { a = 2; } f(); return a; }\nlet r = outer(1);", { "r" }, cherie::test::unoptimised());
+	CHERIE_CHECK_EQUAL(result.error, "cannot assign to captured variable 'a' on line 1");
+}
+
+CHERIE_TEST(closures_in_unused_arithmetic_still_trap)
+{
+	// the sum is dead, but dropping it would hide the error the unoptimised run reports
+	const char* const source = "fn h(f) { let unused = f + 1; return 2; }\nfn g() { return 1; }\nlet r = h(g);";
+	CHERIE_CHECK_EQUAL(cherie::test::run(source, { "r" }).error, "arithmetic on a function on line 1");
+	CHERIE_CHECK_SAME(source, { "r" });
+	CHERIE_CHECK_SAME("fn h(m) { let i = 0; while (3 - i) { let unused = m * 2; i += 1; } return i; }\nlet r = h(map());", { "r" });
+	CHERIE_CHECK_SAME("fn h(x) { let unused = x / 2; return 2; }\nlet r = h(4) + h(2.5);", { "r" });
+}
@@ -0,0 +1,60 @@
+/*
+ * File Name: constant_folding.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for constant folding, const propagation and branch pruning.
+ */
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+#include "exceptions.h"
+#include "compilation/ast/visitors/constant_folding_visitor.h"
+#include "compilation/lexer.h"
+#include "compilation/parser.h"
+#include "test.h"
+
+CHERIE_TEST(folding_rounds_like_the_vm)
+{
+	const auto result = cherie::test::run("let a = 0.1 + 0.2; let b = 1.0 / 3.0; let c = 0.1 * 3.0; let d = -(0.1 + 0.7) * 10; let e = 1 / 3.0 + 2;", { "a", "b", "c", "d", "e" });
+	const volatile double tenth = 0.1, one = 1.0; // computed in double at run time here too
+	CHERIE_CHECK_EQUAL(result.floating("a"), tenth + 0.2);
+	CHERIE_CHECK_EQUAL(result.floating("b"), one / 3.0);
+	CHERIE_CHECK_EQUAL(result.floating("c"), tenth * 3.0);
+	CHERIE_CHECK_EQUAL(result.floating("d"), -(tenth + 0.7) * 10);
+
+	CHERIE_CHECK_SAME("let a = 0.1 + 0.2; let b = 1.0 / 3.0; let c = 0.1 * 3.0; let d = -(0.1 + 0.7) * 10; let e = 1 / 3.0 + 2;", { "a", "b", "c", "d", "e" });
+	CHERIE_CHECK_SAME("let x = 0.1; let r = x + 0.2 - 0.3;", { "r" });
+}
+
+CHERIE_TEST(folding_wraps_integers_and_leaves_errors_to_the_vm)
+{
+	const auto wrapped = cherie::test::run("let r = 4611686018427387904 * 2; let s = 0 - 4611686018427387904 - 4611686018427387904 - 1;", { "r", "s" });
+	CHERIE_CHECK_EQUAL(wrapped.integer("r"), std::numeric_limits<std::int64_t>::min());
+	CHERIE_CHECK_EQUAL(wrapped.integer("s"), std::numeric_limits<std::int64_t>::max());
+	CHERIE_CHECK_SAME("let r = 4611686018427387904 * 2; let s = 0 - 4611686018427387904 - 4611686018427387904 - 1; let t = 7 / -2;", { "r", "s", "t" });
+
+	CHERIE_CHECK_EQUAL(cherie::test::run("let r = 1 / 0;", { "r" }).error, "division by zero on line 1");
+	CHERIE_CHECK_SAME("let r = 1 / 0;", { "r" });
+}
+
+CHERIE_TEST(folding_propagates_consts_and_prunes_branches)
+{
+	const char* const source = R"(
+		const k = 2;
+		let r = 0;
+		if (k - 2) { r = 100; }
+		if (k) { r += k * 3; }
+		while (k - k) { r = 1000; }
+	)";
+	cherie::compiler::parser parser(new cherie::compiler::lexer(source));
+	const std::unique_ptr<cherie::compiler::ast::program> program(parser.parse());
+	cherie::compiler::ast::constant_folding_visitor folder;
+	program->accept(&folder);
+	CHERIE_CHECK_EQUAL(folder.pruned(), 3u);
+	CHERIE_CHECK(folder.folded() >= 3);
+
+	CHERIE_CHECK_EQUAL(cherie::test::run(source, { "r" }).integer("r"), 6);
+	CHERIE_CHECK_SAME(source, { "r" });
+}
@@ -0,0 +1,68 @@
+/*
+ * File Name: embedded.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for scripts compiled at C++ compile time.
+ */
+
+#include <string>
+#include <vector>
+
+#include "compilation/embedded.h"
+#include "test.h"
+
+namespace
+{
+	constexpr const char* fibonacci = "fn fib(n) { if (n) { if (n - 1) { return fib(n - 1) + fib(n - 2); } return 1; } return 0; }\nlet r = fib(20);\nlet s = 0;\nlet i = 0;\nwhile (i - 10) { s += i * i; i += 1; }";
+	constexpr auto compiled = CHERIE_EMBED(fibonacci);
+
+	// the whole program is a constant, nothing is left to do when the host starts
+	static_assert(compiled.code.size() > 0);
+	static_assert(compiled.functions[0].entry == 0);
+	static_assert(compiled.functions[1].name == "fib");
+	static_assert(compiled.functions[1].parameters == 1);
+
+	/* runs the embedded program and the same source through the compiler, a failed check unless every global agrees */
+	template <typename Program>
+	void same_as_source(const char* const file, const int line, const Program& program, const char* const source, const std::vector<std::string>& globals)
+	{
+		auto state = std::make_unique<cherie::state_raw>();
+		state->load(program);
+		const auto embedded = cherie::test::run(std::move(state));
+		const auto from_source = cherie::test::run(source, globals);
+		cherie::test::equal(file, line, "error", embedded.error, from_source.error);
+		for (const auto& name : globals)
+		{
+			if (embedded.error.empty())
+			{
+				cherie::test::equal(file, line, name.c_str(), embedded.value(name).value, from_source.value(name).value);
+			}
+		}
+	}
+}
+
+CHERIE_TEST(embedded_scripts_run_like_compiled_ones)
+{
+	auto state = std::make_unique<cherie::state_raw>();
+	state->load(compiled);
+	const auto result = cherie::test::run(std::move(state));
+	CHERIE_CHECK_EQUAL(result.integer("r"), 6765);
+	CHERIE_CHECK_EQUAL(result.integer("s"), 285);
+	same_as_source(__FILE__, __LINE__, compiled, fibonacci, { "r", "s" });
+	CHERIE_CHECK_SAME(fibonacci, { "r", "s" });
+
+	constexpr const char* arithmetic = "let x = 5000000000; let y = -9223372036854775807 - 1; let z = x * 3 + 0x7fffffffffffffff; const k = 3; let q = k / 2 - -k;";
+	same_as_source(__FILE__, __LINE__, CHERIE_EMBED(arithmetic), arithmetic, { "x", "y", "z", "q" });
+
+	constexpr const char* globals = "let g = 1; fn bump(n) { g = g + n; return g; } let r = bump(5) + bump(10);";
+	same_as_source(__FILE__, __LINE__, CHERIE_EMBED(globals), globals, { "g", "r" });
+}
+
+CHERIE_TEST(embedded_scripts_fail_at_run_time_like_compiled_ones)
+{
+	constexpr const char* division = "let a = 10;\nlet b = a / 0;";
+	auto state = std::make_unique<cherie::state_raw>();
+	state->load(CHERIE_EMBED(division));
+	CHERIE_CHECK_EQUAL(cherie::test::run(std::move(state)).error, "division by zero on line 2");
+	same_as_source(__FILE__, __LINE__, CHERIE_EMBED(division), division, { "a", "b" });
+}
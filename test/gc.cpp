@@ -0,0 +1,117 @@
+/*
+ * File Name: gc.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the generational collector.
+ */
+
+#include "test.h"
+
+namespace
+{
+	// far more than the nursery holds, with old objects pointing at young ones
+	const char* const churn = R"(
+		fn wrap(f, k) { fn g(x) { return f(x) + k; } return g; }
+		fn id(x) { return x; }
+		fn node(v, next) { return { v: v, next: next, pad: 0 }; }
+
+		let chain = id;
+		let i = 0;
+		while (1000 - i) { chain = wrap(chain, i); i += 1; }
+
+		let list = node(0, 0);
+		let tail = list;
+		i = 1;
+		while (20000 - i) {
+			let temporary = wrap(id, i);
+			let next = node(temporary(i), 0);
+			tail.next = next;
+			tail = next;
+			i += 1;
+		}
+
+		let total = 0;
+		let walk = list;
+		i = 0;
+		while (20000 - i) { total += walk.v; walk = walk.next; i += 1; }
+		let r = chain(5);
+	)";
+}
+
+CHERIE_TEST(gc_leaves_numbers_in_reused_registers_alone)
+{
+	using cherie::vm::i64;
+	using cherie::vm::opcode;
+
+	// R[0] held a closure, then a typed move writes a number into it that happens to be an address in the nursery
+	auto state = std::make_unique<cherie::state_raw>();
+	state->program = {
+		i64::encode(opcode::load, 1, 0, 5),
+		i64::encode(opcode::closure, 1, 5, 0),
+		i64::encode(opcode::closure, 1, 5, 1),
+		i64::encode(opcode::move, 0, 1, 0),
+		i64::encode(opcode::move, 0, 1, 2),
+		i64::encode(opcode::load, 20000, 0, 3),
+		i64::encode(opcode::closure, 1, 5, 4), // enough of them for a few minor collections
+		i64::encode(opcode::addrs, -1, 3, 3),
+		i64::encode(opcode::jnz, 6, 3),
+		i64::encode(opcode::subr, 2, 0, 6),
+		i64::encode(opcode::setg, 0, 6),
+		i64::encode(opcode::halt),
+	};
+	state->functions = { { "main", 0, 0, 8, 0 }, { "f", 11, 0, 1, 1 } };
+	state->globals = { "r" };
+	const auto result = cherie::test::run(std::move(state));
+	CHERIE_CHECK_EQUAL(result.error, "");
+	CHERIE_CHECK_EQUAL(result.integer("r"), 0);
+}
+
+CHERIE_TEST(gc_keeps_everything_reachable)
+{
+	const auto result = cherie::test::run(churn, { "r", "total", "list", "tail" });
+	CHERIE_CHECK_EQUAL(result.error, "");
+	CHERIE_CHECK_EQUAL(result.integer("r"), 5 + 999 * 500);
+	CHERIE_CHECK_EQUAL(result.integer("total"), 19999LL * 20000);
+	CHERIE_CHECK_SAME(churn, { "r", "total" });
+
+#ifdef CHERIE_TELEMETRY
+	const auto counters = result.state->telemetry();
+	CHERIE_CHECK(counters.minor_collections > 5);
+	CHERIE_CHECK(counters.heap_allocations > 40000);
+	CHERIE_CHECK(counters.heap_bytes_live < counters.heap_bytes_allocated); // the temporaries are gone
+#endif
+}
+
+CHERIE_TEST(gc_survives_runs_of_the_same_state)
+{
+	auto state = std::make_unique<cherie::state_raw>();
+	state->load(std::string(churn) + "\nfn keep_globals() { return r, total; }");
+	for (auto run = 0; run < 3; run++)
+	{
+		state->run();
+		CHERIE_CHECK_EQUAL(state->global("total").value, 19999LL * 20000);
+		CHERIE_CHECK_EQUAL(state->global("r").value, 5 + 999 * 500);
+	}
+}
+
+CHERIE_TEST(gc_collects_large_objects)
+{
+	// each array is too large for the nursery and goes straight to the old space
+	const char* const source = R"(
+		let keep = fill(10, 2);
+		let total = 0;
+		let i = 0;
+		while (300 - i) { let big = fill(100000, 1); total += sum(big) + keep[i - i / 10 * 10]; i += 1; }
+	)";
+	const auto result = cherie::test::run(source, { "total", "keep" });
+	CHERIE_CHECK_EQUAL(result.error, "");
+	CHERIE_CHECK_EQUAL(result.integer("total"), 300 * 100002LL);
+	CHERIE_CHECK_SAME(source, { "total" });
+
+#ifdef CHERIE_TELEMETRY
+	const auto counters = result.state->telemetry();
+	CHERIE_CHECK(counters.major_collections > 0);
+	CHERIE_CHECK(counters.heap_bytes_allocated > 200u << 20);
+	CHERIE_CHECK(counters.heap_bytes_live < 32u << 20);
+#endif
+}
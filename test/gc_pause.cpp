@@ -0,0 +1,56 @@
+/*
+ * File Name: gc_pause.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for incremental marking and the pause budget.
+ */
+
+#include <chrono>
+
+#include "test.h"
+
+namespace
+{
+	// several old generations' worth of lists, each dropped for the next one while marking runs
+	const char* const generations = R"(
+		fn node(v, next) { return { v: v, next: next }; }
+		fn build(n) { let head = 0; let i = 0; while (n - i) { head = node(i, head); i += 1; } return head; }
+		fn sum(list, n) { let s = 0; let i = 0; while (n - i) { s += list.v; list = list.next; i += 1; } return s; }
+
+		let kept = build(1000);
+		let holder = { young: 0 };
+		let total = 0;
+		let round = 0;
+		while (8 - round) {
+			let list = build(50000);
+			holder.young = node(round, 0);
+			total += sum(list, 50000) + holder.young.v;
+			round += 1;
+		}
+		let check = sum(kept, 1000);
+	)";
+
+	cherie::test::outcome run_with_pause(void (*configure)(cherie::state_raw&))
+	{
+		return cherie::test::run(generations, { "total", "check", "kept", "holder" }, {}, configure);
+	}
+}
+
+CHERIE_TEST(gc_pause_budget_does_not_change_results)
+{
+	const auto fine = run_with_pause([](cherie::state_raw& state) { state.gc_pause = std::chrono::microseconds(1); });
+	const auto coarse = run_with_pause([](cherie::state_raw& state) { state.gc_pause = std::chrono::microseconds(100000); });
+	CHERIE_CHECK_EQUAL(fine.error, "");
+	CHERIE_CHECK_EQUAL(fine.integer("total"), 8 * (49999LL * 25000) + 28);
+	CHERIE_CHECK_EQUAL(fine.integer("check"), 999 * 500);
+	CHERIE_CHECK_EQUAL(coarse.integer("total"), fine.integer("total"));
+	CHERIE_CHECK_EQUAL(coarse.integer("check"), fine.integer("check"));
+	CHERIE_CHECK_SAME(generations, { "total", "check" });
+
+#ifdef CHERIE_TELEMETRY
+	const auto counters = fine.state->telemetry();
+	CHERIE_CHECK(counters.major_collections > 0);
+	CHERIE_CHECK(counters.gc_pauses > counters.major_collections); // each cycle took several slices
+	CHERIE_CHECK(counters.gc_max_pause_ns <= counters.gc_pause_ns);
+#endif
+}
@@ -0,0 +1,68 @@
+/*
+ * File Name: globals.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for variables resolved to slots and globals at compile time.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <string>
+
+#include "test.h"
+
+CHERIE_TEST(globals_are_shared_with_functions)
+{
+	const char* const source = R"(
+		let counter = 0;
+		let unused = 42;
+		fn bump(by) { counter += by; return counter; }
+		fn shadow(counter) { let x = counter * 2; return x; }
+		bump(5);
+		bump(10);
+		let s = shadow(100) + counter;
+	)";
+	const auto result = cherie::test::run(source, { "counter", "s" });
+	CHERIE_CHECK_EQUAL(result.integer("counter"), 15);
+	CHERIE_CHECK_EQUAL(result.integer("s"), 215);
+	CHERIE_CHECK_SAME(source, { "counter", "s" });
+
+	// only what functions reference gets a slot in the global array
+	const auto& globals = result.state->globals;
+	CHERIE_CHECK(std::find(globals.begin(), globals.end(), "counter") != globals.end());
+	CHERIE_CHECK(std::find(globals.begin(), globals.end(), "unused") == globals.end());
+}
+
+CHERIE_TEST(globals_and_locals_follow_block_scopes)
+{
+	const char* const source = R"(
+		let a = 1;
+		let r = 0;
+		if (a) { let a = 10; r += a; if (a) { let a = 100; r += a; } r += a; }
+		r += a;
+		let i = 0;
+		while (3 - i) { let t = i * i; r += t; i += 1; }
+	)";
+	const auto result = cherie::test::run(source, { "a", "r" });
+	CHERIE_CHECK_EQUAL(result.integer("a"), 1);
+	CHERIE_CHECK_EQUAL(result.integer("r"), 121 + 5);
+	CHERIE_CHECK_SAME(source, { "a", "r" });
+}
+
+CHERIE_TEST(globals_report_bad_names_at_compile_time)
+{
+	CHERIE_CHECK_EQUAL(cherie::test::run("let r = missing + 1;", {}).error, "undeclared variable 'missing' on line 1");
+	CHERIE_CHECK_EQUAL(cherie::test::run("const k = 1;\nk = 2;", {}).error, "cannot assign to const 'k' on line 2");
+
+	const auto result = cherie::test::run("let r = 1;", { "r" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 1);
+	try
+	{
+		(void)result.state->global("nothing");
+		CHERIE_CHECK(!"a missing global is an error");
+	}
+	catch (std::exception& exception)
+	{
+		CHERIE_CHECK_EQUAL(std::string(exception.what()), "there is no global called 'nothing'");
+	}
+}
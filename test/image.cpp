@@ -0,0 +1,164 @@
+/*
+ * File Name: image.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the bytecode image format.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "vm/image.h"
+#include "test.h"
+
+namespace
+{
+	const char* const script = R"(
+		fn point(x, y) { return { x: x, y: y }; }
+		fn len(p) { return p.x * p.x + p.y * p.y; }
+		fn scale(k) { fn by(x) { return x * k; } return by; }
+		let f = scale(2.5);
+		let r = len(point(3, 4));
+		let s = f(4) + 10000000000.0;
+		fn keep_globals() { return r, s; }
+	)";
+
+	std::vector<std::uint8_t> image_bytes(const cherie::compiler::options& options = {})
+	{
+		std::ostringstream out;
+		cherie::compiler::write_image(out, cherie::compiler::compile(script, options));
+		const auto bytes = out.str();
+		return { bytes.begin(), bytes.end() };
+	}
+
+	cherie::test::outcome run_image(std::vector<std::uint8_t> bytes)
+	{
+		auto state = std::make_unique<cherie::state_raw>();
+		try
+		{
+			state->load(cherie::vm::image::from_bytes(std::move(bytes)));
+		}
+		catch (std::exception& exception)
+		{
+			return { std::move(state), exception.what() };
+		}
+		return cherie::test::run(std::move(state));
+	}
+
+	/* an unoptimised image with the first instruction of op changed, empty when it has none */
+	std::vector<std::uint8_t> damaged(const cherie::vm::opcode op, const std::function<void(cherie::vm::i64&)>& change)
+	{
+		auto bytes = image_bytes(cherie::test::unoptimised());
+		const auto& header = *reinterpret_cast<const cherie::vm::image_header*>(bytes.data());
+		for (std::uint64_t pc = 0; pc < header.program_size; pc++)
+		{
+			auto* at = bytes.data() + header.program_offset + pc * sizeof(cherie::vm::i64);
+			cherie::vm::i64 instruction;
+			std::memcpy(&instruction, at, sizeof(instruction));
+			if (instruction.op == op)
+			{
+				change(instruction);
+				std::memcpy(at, &instruction, sizeof(instruction));
+				return bytes;
+			}
+		}
+		return {};
+	}
+}
+
+CHERIE_TEST(image_round_trips_programs)
+{
+	const auto bytes = image_bytes();
+	const auto& header = *reinterpret_cast<const cherie::vm::image_header*>(bytes.data());
+	CHERIE_CHECK_EQUAL(header.file_size, bytes.size());
+	for (const auto offset : { header.program_offset, header.constants_offset, header.functions_offset, header.globals_offset, header.strings_offset, header.lines_offset, header.fields_offset, header.shapes_offset, header.sites_offset })
+	{
+		CHERIE_CHECK_EQUAL(offset % 8, 0u);
+	}
+
+	const auto loaded = run_image(bytes);
+	const auto source = cherie::test::run(script, {});
+	CHERIE_CHECK_EQUAL(loaded.error, "");
+	CHERIE_CHECK_EQUAL(loaded.integer("r"), 25);
+	CHERIE_CHECK_EQUAL(loaded.floating("s"), 10000000010.0);
+	CHERIE_CHECK_EQUAL(loaded.floating("s"), source.floating("s"));
+
+	// unoptimised images agree too
+	const auto plain = run_image(image_bytes(cherie::test::unoptimised()));
+	CHERIE_CHECK_EQUAL(plain.integer("r"), 25);
+	CHERIE_CHECK_EQUAL(plain.floating("s"), loaded.floating("s"));
+	CHERIE_CHECK_SAME(script, { "r", "s" });
+}
+
+CHERIE_TEST(image_maps_files)
+{
+	const auto path = (std::filesystem::temp_directory_path() / "cherie_test_image.bin").string();
+	{
+		const auto bytes = image_bytes();
+		std::ofstream file(path, std::ios::binary);
+		file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	}
+
+	auto state = std::make_unique<cherie::state_raw>();
+	state->load(cherie::vm::image::map(path));
+	const auto result = cherie::test::run(std::move(state));
+	CHERIE_CHECK_EQUAL(result.integer("r"), 25);
+	std::remove(path.c_str());
+}
+
+CHERIE_TEST(image_refuses_damaged_bytes)
+{
+	auto bytes = image_bytes();
+	bytes.resize(bytes.size() - 8);
+	CHERIE_CHECK_EQUAL(run_image(bytes).error, "bytecode image is truncated or corrupt");
+
+	bytes = image_bytes();
+	reinterpret_cast<cherie::vm::image_header*>(bytes.data())->version++;
+	CHERIE_CHECK(run_image(bytes).error.rfind("bytecode image version", 0) == 0);
+
+	bytes = image_bytes();
+	bytes[0] = 'X';
+	CHERIE_CHECK_EQUAL(run_image(bytes).error, "not a bytecode image");
+}
+
+CHERIE_TEST(image_refuses_damaged_instructions)
+{
+	using cherie::vm::i64;
+	using cherie::vm::opcode;
+	const auto refused = [](const std::vector<std::uint8_t>& bytes)
+	{
+		return !bytes.empty() && run_image(bytes).error == "bytecode image is truncated or corrupt";
+	};
+
+	// every index an instruction holds, into the table it indexes
+	CHERIE_CHECK(refused(damaged(opcode::loadk, [](i64& instruction) { instruction.a = 1000; })));
+	CHERIE_CHECK(refused(damaged(opcode::closure, [](i64& instruction) { instruction.a = 1000; })));
+	CHERIE_CHECK(refused(damaged(opcode::call, [](i64& instruction) { instruction.a = 1000; })));
+	CHERIE_CHECK(refused(damaged(opcode::object, [](i64& instruction) { instruction.a = 1000; })));
+	CHERIE_CHECK(refused(damaged(opcode::getf, [](i64& instruction) { instruction.a = 1000; })));
+	CHERIE_CHECK(refused(damaged(opcode::setg, [](i64& instruction) { instruction.a = 1000; })));
+	CHERIE_CHECK(refused(damaged(opcode::getu, [](i64& instruction) { instruction.a = 1000; })));
+
+	// registers outside the frame, control leaving the function and tags the collector would follow
+	CHERIE_CHECK(refused(damaged(opcode::getf, [](i64& instruction) { instruction.c = -1; })));
+	CHERIE_CHECK(refused(damaged(opcode::ret, [](i64& instruction) { instruction.bs = 200; })));
+	CHERIE_CHECK(refused(damaged(opcode::ret, [](i64& instruction) { instruction = i64::encode(opcode::load, 0); })));
+	CHERIE_CHECK(refused(damaged(opcode::getf, [](i64& instruction) { instruction = i64::encode(opcode::jmp, 100000); })));
+	CHERIE_CHECK(refused(damaged(opcode::getf, [](i64& instruction) { instruction = i64::encode(opcode::tag, static_cast<std::int32_t>(cherie::vm::value_type::object)); })));
+	CHERIE_CHECK(refused(damaged(opcode::getf, [](i64& instruction) { instruction = i64::encode(opcode::pop); })));
+	CHERIE_CHECK(refused(damaged(opcode::getu, [](i64& instruction) { instruction.op = static_cast<opcode>(250); })));
+
+	// and a closure's code is never entered without its closure
+	const auto functions = cherie::vm::image::from_bytes(image_bytes(cherie::test::unoptimised()))->functions();
+	const auto by = static_cast<std::uint32_t>(std::find_if(functions.begin(), functions.end(), [](const cherie::vm::function_info& function) { return function.name == "by"; }) - functions.begin());
+	CHERIE_CHECK(by < functions.size());
+	CHERIE_CHECK(refused(damaged(opcode::call, [by](i64& instruction) { instruction.a = by; })));
+	CHERIE_CHECK_EQUAL(run_image(image_bytes(cherie::test::unoptimised())).error, "");
+}
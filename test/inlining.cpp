@@ -0,0 +1,68 @@
+/*
+ * File Name: inlining.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the AST inliner.
+ */
+
+#include "test.h"
+
+namespace
+{
+	const char* const helpers = R"(
+		fn square(x) { return x * x; }
+		fn add(a, b) { return a + b; }
+		fn fact(n) { if (n) { return n * fact(n - 1); } return 1; }
+		fn big(x) {
+			let a = x + 1; let b = a * 2; let c = b - x; let d = c * c;
+			let e = d + a; let f = e * b; let g = f - c; let h = g + d;
+			return h * 2 + a - b;
+		}
+		let r = 0;
+		let i = 0;
+		while (20 - i) { r += add(square(i), 3); i += 1; }
+		let s = fact(10) + square(2.5);
+		let t = big(3);
+	)";
+
+	size_t inlined(const cherie::compiler::options& options)
+	{
+		cherie::compiler::report report;
+		(void)cherie::compiler::compile(helpers, options, &report);
+		return report.calls_inlined;
+	}
+}
+
+CHERIE_TEST(inlining_substitutes_small_callees)
+{
+	auto options = cherie::test::unoptimised();
+	CHERIE_CHECK_EQUAL(inlined(options), 0u);
+
+	options.inlining = true;
+	CHERIE_CHECK_EQUAL(inlined(options), 3u); // add, square twice; not the recursive or the big one
+
+	options.inline_budget = 0;
+	CHERIE_CHECK_EQUAL(inlined(options), 0u);
+}
+
+CHERIE_TEST(inlining_keeps_results)
+{
+	auto options = cherie::test::unoptimised();
+	options.inlining = true;
+	options.constant_folding = true;
+	const auto result = cherie::test::run(helpers, { "r", "s", "t" }, options);
+	CHERIE_CHECK_EQUAL(result.integer("r"), 2470 + 60);
+	CHERIE_CHECK_EQUAL(result.floating("s"), 3628800 + 6.25);
+	CHERIE_CHECK_EQUAL(result.integer("t"), 500);
+	CHERIE_CHECK_SAME(helpers, { "r", "s", "t" });
+
+	// arguments are evaluated once, in order, even when the parameter is used twice or not at all
+	CHERIE_CHECK_SAME(R"(
+		let n = 0;
+		fn next() { n += 1; return n; }
+		fn twice(x) { return x + x; }
+		fn ignore(x) { return 7; }
+		let a = twice(next()) * 10 + ignore(next());
+		let b = n;
+	)", { "a", "b", "n" });
+}
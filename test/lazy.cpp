@@ -0,0 +1,81 @@
+/*
+ * File Name: lazy.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for functions compiled on their first call.
+ */
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace
+{
+	// each body is longer than the inline budget, so each one is deferred
+	const char* const library = R"(
+		fn used(n) { let s = 0; let i = 0; while (n - i) { s += i * i + 1; i += 1; } return s + 0 * 1 * 2 * 3 * 4 * 5 * 6 * 7; }
+		fn never(n) { let s = 0; let i = 0; while (n - i) { s += i * 3 - 1; i += 1; } return s + 0 * 1 * 2 * 3 * 4 * 5 * 6 * 7; }
+		fn nested(n) { fn inner(x) { return x * n; } let t = 0; let i = 0; while (n - i) { t += inner(i); i += 1; } return t + 0 * 1 * 2; }
+		fn unused(n) { let a = n * 2; let b = a + 3; let c = b * b; let d = c - a; return d + b + c + a + n + 1 + 2 + 3 + 4; }
+		let r = used(10) + nested(4);
+		fn keep_globals() { return r; }
+	)";
+}
+
+CHERIE_TEST(lazy_functions_compile_on_first_call)
+{
+	const auto unit = std::make_shared<cherie::compiler::unit>(library);
+	CHERIE_CHECK_EQUAL(unit->deferred(), 4u); // not keep_globals, it is short enough to inline
+
+	auto state = std::make_unique<cherie::state_raw>();
+	state->load(unit);
+	const auto result = cherie::test::run(std::move(state));
+	CHERIE_CHECK_EQUAL(result.integer("r"), 295 + 24);
+	CHERIE_CHECK_EQUAL(unit->deferred(), 2u); // never and unused
+	CHERIE_CHECK_SAME(library, { "r" });
+}
+
+CHERIE_TEST(lazy_functions_compile_once_for_racing_states)
+{
+	const auto unit = std::make_shared<cherie::compiler::unit>(library);
+	std::vector<std::unique_ptr<cherie::state_raw>> states;
+	for (auto index = 0; index < 8; index++)
+	{
+		states.push_back(std::make_unique<cherie::state_raw>());
+		states.back()->load(unit);
+	}
+
+	std::vector<std::thread> threads;
+	for (auto& state : states)
+	{
+		threads.emplace_back([&state] { state->run(); });
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	for (const auto& state : states)
+	{
+		CHERIE_CHECK_EQUAL(state->global("r").value, 295 + 24);
+	}
+	CHERIE_CHECK_EQUAL(unit->deferred(), 2u);
+}
+
+CHERIE_TEST(lazy_functions_report_errors_when_called)
+{
+	const char* const source = R"(
+		fn broken(n) { let s = 0; let i = 0; while (n - i) { s += missing * i; i += 1; } return s + 0 * 1 * 2 * 3 * 4 * 5 * 6; }
+		let r = 1;
+	)";
+	auto options = cherie::test::unoptimised();
+	CHERIE_CHECK(!cherie::test::run(source, { "r" }, options).error.empty());
+
+	// never called, so never compiled
+	options.lazy_functions = true;
+	const auto result = cherie::test::run(source, { "r" }, options);
+	CHERIE_CHECK_EQUAL(result.error, "");
+	CHERIE_CHECK_EQUAL(result.integer("r"), 1);
+}
@@ -0,0 +1,74 @@
+/*
+ * File Name: loops.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the loop optimisations.
+ */
+
+#include "test.h"
+
+namespace
+{
+	cherie::compiler::report statistics(const char* const source, const cherie::compiler::options& options = {})
+	{
+		cherie::compiler::report report;
+		(void)cherie::compiler::compile(source, options, &report);
+		return report;
+	}
+}
+
+CHERIE_TEST(loops_with_known_trip_counts_unroll)
+{
+	const char* const source = R"(
+		fn sum() { let s = 0; let i = 0; while (5 - i) { s += i * i; i += 1; } return s; }
+		fn long() { let s = 0; let i = 0; while (500 - i) { s += i; i += 1; } return s; }
+		let r = sum();
+		let t = long();
+	)";
+	auto options = cherie::test::unoptimised();
+	options.loop_unrolling = true;
+	CHERIE_CHECK_EQUAL(statistics(source, options).loops_unrolled, 1u); // long is over the trip count
+
+	const auto result = cherie::test::run(source, { "r", "t" }, options);
+	CHERIE_CHECK_EQUAL(result.integer("r"), 30);
+	CHERIE_CHECK_EQUAL(result.integer("t"), 499 * 250);
+	CHERIE_CHECK_SAME(source, { "r", "t" });
+}
+
+CHERIE_TEST(loops_hoist_invariants_and_reduce_induction_variables)
+{
+	const char* const source = R"(
+		fn f(a, b, n) {
+			let s = 0;
+			let i = 0;
+			while (n - i) { s += a * b + i * 8; i += 1; }
+			return s;
+		}
+		let r = f(3, 4, 100);
+		let z = f(3, 4, 0);
+	)";
+	const auto report = statistics(source);
+	CHERIE_CHECK(report.invariants_hoisted > 0);
+	CHERIE_CHECK(report.induction_variables_reduced > 0);
+
+	const auto result = cherie::test::run(source, { "r", "z" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 1200 + 8 * 4950);
+	CHERIE_CHECK_EQUAL(result.integer("z"), 0);
+	CHERIE_CHECK_SAME(source, { "r", "z" });
+}
+
+CHERIE_TEST(loops_keep_results_when_nested)
+{
+	CHERIE_CHECK_SAME(R"(
+		fn grid(w, h) {
+			let s = 0;
+			let y = 0;
+			while (h - y) { let x = 0; while (w - x) { s += y * 3 + x * w; x += 1; } y += 1; }
+			return s;
+		}
+		let r = grid(4, 3) + grid(7, 11) * 1000;
+		let f = 0.5;
+		let k = 0;
+		while (6 - k) { f = f * 1.5 + 0.1; k += 1; }
+	)", { "r", "f" });
+}
@@ -0,0 +1,106 @@
+/*
+ * File Name: maps.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the built-in hash map.
+ */
+
+#include "test.h"
+
+CHERIE_TEST(maps_aggregate_and_grow)
+{
+	const char* const source = R"(
+		let counts = map();
+		let i = 0;
+		while (100000 - i) {
+			let k = i - i / 100 * 100;
+			if (has(counts, k)) { counts[k] += 1; } else { counts[k] = 1; }
+			i += 1;
+		}
+		let squares = map();
+		i = 0;
+		while (10000 - i) { squares[i * 7] = i * i; i += 1; }
+		let r = counts[0] + counts[99] * 1000;
+		let s = squares[7 * 9999] + squares[0];
+		let mixed = map();
+		mixed[2] = 7;
+		mixed[true] = 3;
+		mixed[1.5] = 0.25;
+		let t = mixed[4 / 2.0] * 10 + mixed[true] + mixed[3 / 2.0];
+	)";
+	const auto result = cherie::test::run(source, { "r", "s", "t", "counts" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 1001000);
+	CHERIE_CHECK_EQUAL(result.integer("s"), 9999LL * 9999);
+	CHERIE_CHECK_EQUAL(result.floating("t"), 73.25);
+	CHERIE_CHECK_EQUAL(static_cast<int>(result.value("counts").tag), static_cast<int>(cherie::vm::value_type::map));
+	CHERIE_CHECK_SAME(source, { "r", "s", "t" });
+}
+
+CHERIE_TEST(maps_iterate_every_entry_once)
+{
+	const char* const source = R"(
+		let m = map();
+		let i = 0;
+		while (1000 - i) { m[i] = i * 2; i += 1; }
+		let sum = 0;
+		let n = 0;
+		let p = next(m, -1);
+		while (p + 1) { sum += m[key(m, p)]; n += 1; p = next(m, p); }
+		let empty = next(map(), -1);
+	)";
+	const auto result = cherie::test::run(source, { "sum", "n", "empty" });
+	CHERIE_CHECK_EQUAL(result.integer("sum"), 999000);
+	CHERIE_CHECK_EQUAL(result.integer("n"), 1000);
+	CHERIE_CHECK_EQUAL(result.integer("empty"), -1);
+	CHERIE_CHECK_SAME(source, { "sum", "n", "empty" });
+}
+
+CHERIE_TEST(maps_walk_in_insertion_order_while_growing)
+{
+	const char* const source = R"(
+		let m = map();
+		m[3] = 0; m[1] = 0; m[2] = 0;
+		let order = 0;
+		let sum = 0;
+		let n = 0;
+		let p = next(m, -1);
+		while (p + 1)
+		{
+			let k = key(m, p);
+			if (n / 4) {} else { order = order * 10000 + k; }
+			if (k / 100) {} else { let j = 0; while (10 - j) { m[k * 1000 + 100 + j] = k; j += 1; } }
+			sum += k;
+			n += 1;
+			p = next(m, p);
+		}
+	)";
+	const auto result = cherie::test::run(source, { "order", "sum", "n" });
+	CHERIE_CHECK_EQUAL(result.integer("n"), 33);
+	CHERIE_CHECK_EQUAL(result.integer("sum"), 63141);
+	CHERIE_CHECK_EQUAL(result.integer("order"), 3000100023100LL);
+	CHERIE_CHECK_SAME(source, { "order", "sum", "n" });
+}
+
+CHERIE_TEST(maps_hold_heap_values_across_collections)
+{
+	const char* const source = R"(
+		fn adder(n) { fn add(x) { return x + n; } return add; }
+		let keep = map();
+		let i = 0;
+		while (60000 - i) { let m = map(); m[0] = { v: i }; keep[i - i / 64 * 64] = m; i += 1; }
+		keep[64] = adder(5);
+		let f = keep[64];
+		let r = keep[63][0].v + keep[0][0].v + f(1);
+	)";
+	const auto result = cherie::test::run(source, { "r" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 59967 + 59968 + 6);
+	CHERIE_CHECK_SAME(source, { "r" });
+}
+
+CHERIE_TEST(maps_report_missing_keys)
+{
+	CHERIE_CHECK_EQUAL(cherie::test::run("let m = map();\nlet r = m[1];", {}).error, "map has no key 1 on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("let m = map();\nm[map()] = 1;", {}).error, "map keys have to be numbers or booleans on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("let m = 3;\nlet r = m[1];", {}, cherie::test::unoptimised()).error, "indexing a value that is not a map on line 2");
+	CHERIE_CHECK_SAME("let m = map(); m[1] = 1; let r = key(m, 3);", { "r" });
+}
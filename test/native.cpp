@@ -0,0 +1,66 @@
+/*
+ * File Name: native.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for programs translated to C++ ahead of time.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "test.h"
+
+// test/scripts/native.che, written out by Cherie_Compiler -cpp when the tests are built
+extern const cherie::vm::native_program native_script;
+
+namespace
+{
+	const char* const globals[] = { "r", "q", "m", "s", "c", "o", "mixed" };
+
+	std::string script()
+	{
+		std::ifstream file(CHERIE_TEST_SCRIPTS "/native.che", std::ios::binary);
+		std::ostringstream source;
+		source << file.rdbuf();
+		return source.str();
+	}
+}
+
+CHERIE_TEST(native_programs_run_like_interpreted_ones)
+{
+	auto state = std::make_unique<cherie::state_raw>();
+	state->load(native_script);
+	const auto native = cherie::test::run(std::move(state));
+	CHERIE_CHECK_EQUAL(native.error, "");
+	CHERIE_CHECK_EQUAL(native.integer("r"), 6765);
+	CHERIE_CHECK_EQUAL(native.integer("m"), 2);
+	CHERIE_CHECK_EQUAL(native.floating("s"), 10.875);
+	CHERIE_CHECK_EQUAL(native.integer("c"), 5000050000);
+	CHERIE_CHECK_EQUAL(native.integer("o"), 25);
+	CHERIE_CHECK_EQUAL(native.floating("mixed"), 121.0);
+
+	const auto source = script();
+	CHERIE_CHECK(!source.empty());
+	const auto interpreted = cherie::test::run(source, {});
+	for (const auto* name : globals)
+	{
+		CHERIE_CHECK_EQUAL(static_cast<int>(native.value(name).tag), static_cast<int>(interpreted.value(name).tag));
+		CHERIE_CHECK_EQUAL(native.value(name).value, interpreted.value(name).value);
+	}
+	CHERIE_CHECK_SAME(source, { "r", "q", "m", "s", "c", "o", "mixed" });
+}
+
+CHERIE_TEST(native_translation_covers_every_function)
+{
+	std::ostringstream out;
+	const auto code = cherie::compiler::compile(script());
+	cherie::compiler::write_native(out, code, "translated");
+	const auto translated = out.str();
+	for (size_t index = 0; index < code.functions.size(); index++)
+	{
+		CHERIE_CHECK(translated.find("std::uint32_t function_" + std::to_string(index) + "(") != std::string::npos);
+	}
+	CHERIE_CHECK(translated.find("extern const cherie::vm::native_program translated = {") != std::string::npos);
+	CHERIE_CHECK_EQUAL(native_script.function_count, code.functions.size());
+}
@@ -0,0 +1,67 @@
+/*
+ * File Name: objects.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for shaped objects and their field caches.
+ */
+
+#include <string>
+
+#include "test.h"
+
+CHERIE_TEST(objects_read_and_write_fields)
+{
+	const char* const source = R"(
+		fn point(x, y) { return { x: x, y: y }; }
+		fn len(p) { return p.x * p.x + p.y * p.y; }
+		fn bump(o) { o.v += 5; return o.v; }
+		let o = { v: 1, nested: { inner: { deep: 3 } }, scale: 1.5 };
+		o.nested.inner.deep *= 7;
+		o.scale += 1;
+		let r = len(point(3, 4)) + bump(o) * 100 + o.nested.inner.deep;
+		let f = o.scale * 2;
+	)";
+	const auto result = cherie::test::run(source, { "r", "f", "o" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 25 + 600 + 21);
+	CHERIE_CHECK_EQUAL(result.floating("f"), 5.0);
+	CHERIE_CHECK_EQUAL(static_cast<int>(result.value("o").tag), static_cast<int>(cherie::vm::value_type::object));
+	CHERIE_CHECK_SAME(source, { "r", "f" });
+}
+
+CHERIE_TEST(objects_of_many_shapes_share_sites)
+{
+	// one site sees one shape, a few, then more than its cache holds
+	const char* const source = R"(
+		fn get(p) { return p.v; }
+		fn set(p, v) { p.v = v; return p.v; }
+		let r = 0;
+		let i = 0;
+		while (50 - i) {
+			r += get({ v: 1 });
+			r += get({ v: 1 }) + get({ a: 0, v: 2 }) + get({ v: 3, b: 0 });
+			r += get({ c: 0, v: 4 }) + get({ d: 0, v: 5 }) + get({ e: 0, f: 0, v: 6 }) + get({ g: 0, h: 0, k: 0, v: 7 });
+			r += set({ v: 0 }, i) + set({ z: 0, v: 0 }, 1);
+			i += 1;
+		}
+	)";
+	const auto result = cherie::test::run(source, { "r" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 50 * 30 + 49 * 25);
+	CHERIE_CHECK_SAME(source, { "r" });
+}
+
+CHERIE_TEST(objects_report_bad_accesses)
+{
+	CHERIE_CHECK_EQUAL(cherie::test::run("let o = { x: 1 };\nlet r = o.y;", {}).error, "object has no field 'y' on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("let n = 5;\nlet r = n.x;", {}, cherie::test::unoptimised()).error, "field access on a value that is not an object on line 2");
+	CHERIE_CHECK(!cherie::test::run("let o = { x: 1, x: 2 };", {}).error.empty());
+	CHERIE_CHECK_SAME("fn get(p) { return p.y; } let a = get({ y: 1 }); let r = get({ x: 1 });", { "a", "r" });
+
+	// negating or inverting a reference would only look at its address
+	CHERIE_CHECK_EQUAL(cherie::test::run("let o = { x: 1 };\nlet r = -o;", {}).error, "arithmetic on an object on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("let o = { x: 1 };\nlet r = !o;", {}).error, "arithmetic on an object on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("fn f() { return 1; }\nlet r = -f;", {}).error, "arithmetic on a function on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("let m = map();\nlet r = !m;", {}).error, "arithmetic on a map on line 2");
+	CHERIE_CHECK_EQUAL(cherie::test::run("let a = [1];\nlet r = -a;", {}).error, "arithmetic on an array on line 2");
+	CHERIE_CHECK_SAME("fn h(o) { let unused = -o; let other = !o; return 2; }\nlet r = h({ x: 1 });", { "r" });
+	CHERIE_CHECK_SAME("fn h(o) { return -o * 2 + !o; }\nlet r = h(3) + h(0.5) + h(0);", { "r" });
+}
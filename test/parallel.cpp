@@ -0,0 +1,96 @@
+/*
+ * File Name: parallel.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the work pool and the parallel compilation driver.
+ */
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "compilation/work_pool.h"
+#include "test.h"
+
+namespace
+{
+	std::string functions(const size_t count)
+	{
+		std::string source;
+		for (size_t index = 0; index < count; index++)
+		{
+			const auto n = std::to_string(index);
+			source += "fn f" + n + "(x) { let s = x; let i = 0; while (" + n + " - i) { s += i * " + n + " + 0.5 * x; i += 1; } if (s - " + n + ") { return s; } return 0; }\n";
+		}
+		source += "let r = 0;\n";
+		for (size_t index = 0; index < count; index++)
+		{
+			source += "r += f" + std::to_string(index) + "(" + std::to_string(index % 7) + ");\n";
+		}
+		return source;
+	}
+}
+
+CHERIE_TEST(parallel_compilation_is_deterministic)
+{
+	const auto source = functions(64);
+	auto options = cherie::test::unoptimised();
+	options.parallel = false;
+	const auto serial = cherie::compiler::compile(source, options);
+
+	options.parallel = true;
+	for (auto attempt = 0; attempt < 4; attempt++)
+	{
+		const auto parallel = cherie::compiler::compile(source, options);
+		CHERIE_CHECK_EQUAL(parallel.program.size(), serial.program.size());
+		CHERIE_CHECK(parallel.constants == serial.constants);
+		CHERIE_CHECK(parallel.lines.data() == serial.lines.data());
+		CHERIE_CHECK_EQUAL(parallel.functions.size(), serial.functions.size());
+		for (size_t pc = 0; pc < serial.program.size() && pc < parallel.program.size(); pc++)
+		{
+			CHERIE_CHECK_EQUAL(parallel.program[pc].raw, serial.program[pc].raw);
+		}
+		for (size_t index = 0; index < serial.functions.size() && index < parallel.functions.size(); index++)
+		{
+			CHERIE_CHECK_EQUAL(parallel.functions[index].entry, serial.functions[index].entry);
+		}
+	}
+
+	auto parallel = cherie::test::unoptimised();
+	parallel.parallel = true;
+	const auto result = cherie::test::run(source, { "r" }, parallel);
+	CHERIE_CHECK_EQUAL(result.error, "");
+	CHERIE_CHECK_SAME(source, { "r" });
+}
+
+CHERIE_TEST(parallel_work_pool_runs_every_task_once)
+{
+	cherie::compiler::work_pool pool(3);
+	std::vector<std::atomic<int>> runs(1000);
+	pool.run(runs.size(), [&](const size_t index)
+	{
+		runs[index]++;
+	});
+	for (const auto& count : runs)
+	{
+		CHERIE_CHECK_EQUAL(count.load(), 1);
+	}
+
+	// the error of the lowest index, whichever thread got there first
+	try
+	{
+		pool.run(100, [](const size_t index)
+		{
+			if (index % 10 == 7)
+			{
+				throw std::runtime_error("task " + std::to_string(index));
+			}
+		});
+		CHERIE_CHECK(!"the pool rethrows");
+	}
+	catch (std::runtime_error& error)
+	{
+		CHERIE_CHECK_EQUAL(std::string(error.what()), "task 7");
+	}
+}
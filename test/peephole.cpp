@@ -0,0 +1,91 @@
+/*
+ * File Name: peephole.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the bytecode peephole optimiser.
+ */
+
+#include "compilation/peephole.h"
+#include "test.h"
+
+namespace
+{
+	using cherie::vm::i64;
+	using cherie::vm::opcode;
+
+	cherie::compiler::ir::bytecode handwritten()
+	{
+		cherie::compiler::ir::bytecode code;
+		code.program = {
+			i64::encode(opcode::load, 5, 0, 1),
+			i64::encode(opcode::move, 0, 1, 1),    // redundant
+			i64::encode(opcode::pushr, 0, 0, 1),
+			i64::encode(opcode::pop, 0, 0, 2),     // a move
+			i64::encode(opcode::load, 7, 0, 3),
+			i64::encode(opcode::addr, 3, 2, 4),    // takes 7 as an immediate
+			i64::encode(opcode::jmp, 8),
+			i64::encode(opcode::load, 1000, 0, 4), // unreachable
+			i64::encode(opcode::jmp, 9),           // to the next instruction
+			i64::encode(opcode::setg, 0, 4),
+			i64::encode(opcode::halt),
+		};
+		code.functions.push_back({ "main", 0, 0, 8, 0 });
+		code.globals = { "r" };
+		return code;
+	}
+
+	std::int64_t run(const cherie::compiler::ir::bytecode& code)
+	{
+		auto state = std::make_unique<cherie::state_raw>();
+		state->program = code.program;
+		state->functions = code.functions;
+		state->globals = code.globals;
+		return cherie::test::run(std::move(state)).integer("r");
+	}
+}
+
+CHERIE_TEST(peephole_rules_rewrite_handwritten_code)
+{
+	auto code = handwritten();
+	CHERIE_CHECK_EQUAL(run(code), 12);
+
+	const auto statistics = cherie::compiler::peephole::optimise(code);
+	CHERIE_CHECK_EQUAL(run(code), 12);
+	CHERIE_CHECK_EQUAL(statistics.instructions_before, 11u);
+	CHERIE_CHECK_EQUAL(statistics.instructions_after, code.program.size());
+	CHERIE_CHECK_EQUAL(code.program.size(), 4u); // load, addrs, setg, halt
+	for (const auto rule : { cherie::compiler::peephole::rule::push_pop, cherie::compiler::peephole::rule::fold_immediate, cherie::compiler::peephole::rule::jump_threading, cherie::compiler::peephole::rule::dead_write })
+	{
+		CHERIE_CHECK(statistics.applied[static_cast<size_t>(rule)] > 0);
+	}
+}
+
+CHERIE_TEST(peephole_rules_can_be_turned_off)
+{
+	auto code = handwritten();
+	cherie::compiler::peephole::rule_set rules;
+	rules.set(static_cast<size_t>(cherie::compiler::peephole::rule::redundant_move));
+	const auto statistics = cherie::compiler::peephole::optimise(code, rules);
+	CHERIE_CHECK_EQUAL(statistics.applied[static_cast<size_t>(cherie::compiler::peephole::rule::redundant_move)], 1u);
+	CHERIE_CHECK_EQUAL(statistics.applied[static_cast<size_t>(cherie::compiler::peephole::rule::push_pop)], 0u);
+	CHERIE_CHECK_EQUAL(code.program.size(), 10u);
+	CHERIE_CHECK_EQUAL(run(code), 12);
+}
+
+CHERIE_TEST(peephole_keeps_compiled_results)
+{
+	const char* const source = R"(
+		fn step(a, b) { let c = a; let d = c * 3 + b; if (d - 7) { return d; } return 0; }
+		let r = 0;
+		let i = 0;
+		while (50 - i) { r += step(i, 1); i += 1; }
+	)";
+	cherie::compiler::report report;
+	auto options = cherie::test::unoptimised();
+	options.peephole = true;
+	(void)cherie::compiler::compile(source, options, &report);
+	CHERIE_CHECK(report.peephole.removed() > 0);
+
+	CHERIE_CHECK_EQUAL(cherie::test::run(source, { "r" }, options).integer("r"), 3 * 1225 + 50 - 7);
+	CHERIE_CHECK_SAME(source, { "r" });
+}
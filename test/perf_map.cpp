@@ -0,0 +1,81 @@
+/*
+ * File Name: perf_map.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for perf map entries and interpreter trampolines.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "test.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char* const recursion = R"(
+		fn fib(n) { if (n) { if (n - 1) { return fib(n - 1) + fib(n - 2); } } return n; }
+		fn deep(n) { if (n) { return 1 + deep(n - 1); } return 0; }
+		fn fails(n) { if (n) { return fails(n - 1); } return 1 / n; }
+		let r = fib(20);
+		let d = deep(3000);
+	)";
+
+	std::string perf_map_path()
+	{
+#ifdef __linux__
+		char path[64];
+		std::snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+		return path;
+#else
+		return {};
+#endif
+	}
+}
+
+CHERIE_TEST(perf_map_names_every_called_function)
+{
+	if (!cherie::vm::virtual_machine::enable_perf_map())
+	{
+		return; // not linux on x86-64
+	}
+
+	for (const auto lazy : { false, true })
+	{
+		auto options = cherie::test::unoptimised();
+		options.lazy_functions = lazy;
+		const auto result = cherie::test::run(recursion, { "r", "d" }, options);
+		CHERIE_CHECK_EQUAL(result.error, "");
+		CHERIE_CHECK_EQUAL(result.integer("r"), 6765);
+		CHERIE_CHECK_EQUAL(result.integer("d"), 3000); // deeper than the trampolines go
+	}
+
+	std::ifstream file(perf_map_path());
+	const std::string map{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+	CHERIE_CHECK(map.find(" cherie:main:main:") != std::string::npos);
+	CHERIE_CHECK(map.find(" cherie:main:fib:2\n") != std::string::npos);
+	CHERIE_CHECK(map.find(" cherie:main:deep:3\n") != std::string::npos);
+	file.close();
+	std::remove(perf_map_path().c_str()); // nothing is recording this process
+}
+
+CHERIE_TEST(perf_map_rethrows_errors_from_nested_calls)
+{
+	if (!cherie::vm::virtual_machine::enable_perf_map())
+	{
+		return;
+	}
+
+	const auto result = cherie::test::run(std::string(recursion) + "let e = fails(10);", { "r" }, cherie::test::unoptimised());
+	CHERIE_CHECK_EQUAL(result.error, "division by zero on line 4");
+}
+
+CHERIE_TEST(perf_map_keeps_results)
+{
+	CHERIE_CHECK_SAME(recursion, { "r", "d" });
+}
@@ -0,0 +1,64 @@
+/*
+ * File Name: profiler.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the line table and the sampling profiler.
+ */
+
+#include <sstream>
+#include <string>
+
+#include "test.h"
+
+CHERIE_TEST(line_table_finds_positions_going_back_and_forth)
+{
+	cherie::vm::line_table lines;
+	lines.add(0, { 5, 1 });
+	lines.add(2, { 5, 1 }); // same position, not recorded
+	lines.add(3, { 2, 4 });
+	lines.add(7, { 900, 1 });
+	lines.add(9, { 1, 2 });
+	CHERIE_CHECK_EQUAL(lines.entries(), 4u);
+
+	const size_t expected[] = { 5, 5, 5, 2, 2, 2, 2, 900, 900, 1, 1 };
+	const auto expanded = lines.expand(11);
+	for (size_t pc = 0; pc < 11; pc++)
+	{
+		CHERIE_CHECK_EQUAL(lines.find(pc).line, expected[pc]);
+		CHERIE_CHECK_EQUAL(expanded[pc].line, expected[pc]);
+	}
+	CHERIE_CHECK_EQUAL(lines.find(4).column, 4u);
+
+	cherie::vm::line_table copy;
+	copy.assign(lines.data().data(), lines.data().size(), lines.entries());
+	CHERIE_CHECK_EQUAL(copy.find(8).line, 900u);
+}
+
+CHERIE_TEST(runtime_errors_name_the_line)
+{
+	const auto result = cherie::test::run("let a = 1;\nlet b = 0;\n\nlet r = a / b;", {}, cherie::test::unoptimised());
+	CHERIE_CHECK_EQUAL(result.error, "division by zero on line 4");
+}
+
+#ifdef CHERIE_PROFILER
+CHERIE_TEST(profiler_folds_stacks_by_function_and_line)
+{
+	const auto result = cherie::test::run(R"(
+		fn leaf(n) { let s = 0; while (n) { s += n; n -= 1; } return s; }
+		fn middle(n) { return leaf(n) + 1; }
+		let r = 0;
+		let i = 0;
+		while (200 - i) { r += middle(100); i += 1; }
+	)", { "r" }, cherie::test::unoptimised(), [](cherie::state_raw& state)
+	{
+		state.sampler.start(50);
+	});
+	CHERIE_CHECK_EQUAL(result.error, "");
+	CHERIE_CHECK_EQUAL(result.integer("r"), 200 * 5051);
+	CHERIE_CHECK(result.state->sampler.sample_count() > 100);
+
+	std::ostringstream folded;
+	result.state->sampler.write_folded(folded, result.state->functions, result.state->lines);
+	CHERIE_CHECK(folded.str().find("main:6;middle:3;leaf:2 ") != std::string::npos);
+}
+#endif
@@ -0,0 +1,75 @@
+/*
+ * File Name: region.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for region mode, where a run allocates from an arena freed in bulk.
+ */
+
+#include "test.h"
+
+namespace
+{
+	const char* const request = R"(
+		fn wrap(f, k) { fn g(x) { return f(x) + k; } return g; }
+		fn id(x) { return x; }
+		let handler = id;
+		let i = 0;
+		let total = 0;
+		while (30000 - i) {
+			let step = wrap(id, i);
+			let pair = { a: step(1), b: i };
+			total += pair.a - pair.b;
+			if (i - 29990) { } else { handler = wrap(handler, i); }
+			i += 1;
+		}
+		let result = { total: total, last: handler(0) };
+		let r = result.total;
+		let h = handler(1);
+	)";
+
+	void regions(cherie::state_raw& state)
+	{
+		state.region = true;
+	}
+}
+
+CHERIE_TEST(region_runs_match_collected_ones)
+{
+	const auto region = cherie::test::run(request, { "r", "h", "result", "handler" }, {}, regions);
+	const auto collected = cherie::test::run(request, { "r", "h", "result", "handler" });
+	CHERIE_CHECK_EQUAL(region.error, "");
+	CHERIE_CHECK_EQUAL(region.integer("r"), 30000);
+	CHERIE_CHECK_EQUAL(region.integer("h"), 1 + 29990);
+	CHERIE_CHECK_EQUAL(region.integer("h"), collected.integer("h"));
+
+	// what the globals still reach was moved out of the region before it was rewound
+	CHERIE_CHECK_EQUAL(static_cast<int>(region.value("result").tag), static_cast<int>(cherie::vm::value_type::object));
+	CHERIE_CHECK_EQUAL(static_cast<int>(region.value("handler").tag), static_cast<int>(cherie::vm::value_type::function));
+	CHERIE_CHECK_SAME(request, { "r", "h" });
+
+#ifdef CHERIE_TELEMETRY
+	const auto counters = region.state->telemetry();
+	CHERIE_CHECK_EQUAL(counters.minor_collections, 0u);
+	CHERIE_CHECK_EQUAL(counters.major_collections, 0u);
+	CHERIE_CHECK(counters.heap_allocations > 60000);
+	CHERIE_CHECK(collected.state->telemetry().minor_collections > 0);
+#endif
+}
+
+CHERIE_TEST(region_is_reused_by_the_next_run)
+{
+	auto state = std::make_unique<cherie::state_raw>();
+	state->region = true;
+	state->load(std::string(request) + "\nfn keep_globals() { return r, h, result, handler; }");
+	for (auto run = 0; run < 4; run++)
+	{
+		state->run();
+		CHERIE_CHECK_EQUAL(state->global("r").value, 30000);
+		CHERIE_CHECK_EQUAL(state->global("h").value, 1 + 29990);
+	}
+
+	// and a state can leave region mode between runs
+	state->region = false;
+	state->run();
+	CHERIE_CHECK_EQUAL(state->global("h").value, 1 + 29990);
+}
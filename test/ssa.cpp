@@ -0,0 +1,66 @@
+/*
+ * File Name: ssa.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the SSA IR and its scalar optimisations.
+ */
+
+#include "test.h"
+
+namespace
+{
+	const char* const redundant = R"(
+		fn f(a, b) {
+			let x = a * b + 1;
+			let y = a * b + 1;
+			let z = x;
+			let n = 5;
+			let unused = n - 2;
+			if (a) { z = z + y; } else { z = z - y; }
+			return z + a * b;
+		}
+		let r = f(3, 4) + f(0, 5) * 100;
+		let s = f(-2, 7);
+	)";
+
+	size_t instructions(const cherie::compiler::options& options)
+	{
+		return cherie::compiler::compile(redundant, options).program.size();
+	}
+}
+
+CHERIE_TEST(ssa_passes_keep_results)
+{
+	const auto result = cherie::test::run(redundant, { "r", "s" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 38);
+	CHERIE_CHECK_EQUAL(result.integer("s"), 0 - 26 - 14);
+	CHERIE_CHECK_SAME(redundant, { "r", "s" });
+
+	// values that only meet at a join
+	CHERIE_CHECK_SAME(R"(
+		let a = 5;
+		let b = 0;
+		let i = 0;
+		while (10 - i) { if (i - 4) { b = b + a * i; } else { a = a + 1; } i += 1; }
+		let r = a * 1000 + b;
+	)", { "r" });
+}
+
+CHERIE_TEST(ssa_passes_remove_instructions)
+{
+	const auto plain = cherie::test::unoptimised();
+	const auto baseline = instructions(plain);
+
+	auto options = plain;
+	options.common_subexpression_elimination = true;
+	CHERIE_CHECK(instructions(options) < baseline);
+
+	options = plain;
+	options.global_value_numbering = true;
+	CHERIE_CHECK(instructions(options) < baseline);
+
+	options = plain;
+	options.copy_propagation = true;
+	options.dead_code_elimination = true;
+	CHERIE_CHECK(instructions(options) < baseline);
+}
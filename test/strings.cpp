@@ -0,0 +1,93 @@
+/*
+ * File Name: strings.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for interned ropes and the string constants folded with them.
+ */
+
+#include <memory>
+#include <string>
+
+#include "exceptions.h"
+#include "compilation/ast/visitors/constant_folding_visitor.h"
+#include "compilation/lexer.h"
+#include "compilation/parser.h"
+#include "compilation/rope.h"
+#include "test.h"
+
+namespace
+{
+	/* the string a script's first statement, `let s = ...;`, folds to */
+	std::string folded(const std::string& source, const bool fold = true)
+	{
+		cherie::compiler::parser parser(new cherie::compiler::lexer(source));
+		const std::unique_ptr<cherie::compiler::ast::program> program(parser.parse());
+		if (fold)
+		{
+			cherie::compiler::ast::constant_folding_visitor folder;
+			program->accept(&folder);
+		}
+
+		const auto* statement = std::get_if<std::unique_ptr<cherie::compiler::ast::statement>>(&program->body.front());
+		const auto* assignment = statement ? dynamic_cast<const cherie::compiler::ast::assignment_statement*>(statement->get()) : nullptr;
+		const auto* literal = assignment ? dynamic_cast<const cherie::compiler::ast::string_literal*>(assignment->value.get()) : nullptr;
+		return literal ? literal->value.str() : "(not folded)";
+	}
+}
+
+CHERIE_TEST(strings_join_lazily_and_intern)
+{
+	using cherie::compiler::rope;
+	const rope hello("Hello ");
+	const auto joined = hello + rope("wor") + rope("ld");
+	CHERIE_CHECK_EQUAL(joined.size(), 11u);
+	CHERIE_CHECK_EQUAL(joined.str(), "Hello world");
+	CHERIE_CHECK(joined == rope("Hello world"));
+	CHERIE_CHECK(joined != hello);
+
+	// equal text shares one interned buffer
+	const rope other("Hello " + std::string("world"));
+	CHERIE_CHECK_EQUAL(static_cast<const void*>(joined.c_str()), static_cast<const void*>(other.c_str()));
+	CHERIE_CHECK(rope().empty());
+	CHERIE_CHECK_EQUAL((rope() + hello).str(), "Hello ");
+
+	// a long chain only links nodes until it is read
+	rope chain;
+	for (auto index = 0; index < 100000; index++)
+	{
+		chain = chain + rope(index % 2 ? "b" : "a");
+	}
+	CHERIE_CHECK_EQUAL(chain.size(), 100000u);
+	CHERIE_CHECK_EQUAL(chain.str().substr(0, 4), "abab");
+
+	// and is released without recursing through every link, read or not
+	{
+		rope unread;
+		for (auto index = 0; index < 1000000; index++)
+		{
+			unread = unread + rope("c");
+		}
+		CHERIE_CHECK_EQUAL(unread.size(), 1000000u);
+	}
+	chain = chain + rope("a");
+	CHERIE_CHECK_EQUAL(chain.size(), 100001u);
+	CHERIE_CHECK_EQUAL(chain.str().substr(99998), "aba");
+}
+
+CHERIE_TEST(strings_fold_at_compile_time)
+{
+	CHERIE_CHECK_EQUAL(folded("let s = \"Hello \" + \"world\" + \"!\";"), "Hello world!");
+	CHERIE_CHECK_EQUAL(folded("let s = \"Hello \" + \"world\";", false), "(not folded)");
+
+	std::string source = "let s = \"\"";
+	for (auto index = 0; index < 2000; index++)
+	{
+		source += " + \"ab\"";
+	}
+	CHERIE_CHECK_EQUAL(folded(source + ";").size(), 4000u);
+
+	// the VM has no string values, folded or not the script is refused the same way
+	const char* const script = "let n = 1;\nlet s = \"a\" + \"b\";";
+	CHERIE_CHECK_EQUAL(cherie::test::run(script, {}).error, "string values are not supported by the VM yet (line 2)");
+	CHERIE_CHECK_SAME(script, { "n" });
+}
@@ -0,0 +1,57 @@
+/*
+ * File Name: telemetry.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for the VM execution counters.
+ */
+
+#include "test.h"
+
+namespace
+{
+	const char* const recursion = R"(
+		fn deep(n) { if (n) { return 1 + deep(n - 1); } return 0; }
+		let r = deep(50) + deep(10);
+	)";
+}
+
+CHERIE_TEST(telemetry_counts_calls_and_their_depth)
+{
+	const auto result = cherie::test::run(recursion, { "r" }, cherie::test::unoptimised());
+	CHERIE_CHECK_EQUAL(result.integer("r"), 60);
+
+	const auto counters = result.state->telemetry();
+#ifdef CHERIE_TELEMETRY
+	CHERIE_CHECK_EQUAL(counters.runs, 1u);
+	CHERIE_CHECK_EQUAL(counters.calls, 51u + 11u);
+	CHERIE_CHECK_EQUAL(counters.max_call_depth, 51u);
+	CHERIE_CHECK_EQUAL(counters.max_stack_depth, 0u); // nothing is pushed on the operand stack
+	CHERIE_CHECK(counters.instructions_retired > counters.calls);
+
+	std::uint64_t retired = 0;
+	for (const auto count : counters.opcode_counts)
+	{
+		retired += count;
+	}
+	CHERIE_CHECK_EQUAL(retired, counters.instructions_retired);
+	CHERIE_CHECK_EQUAL(counters.opcode_counts[static_cast<size_t>(cherie::vm::opcode::call)], 62u);
+#else
+	CHERIE_CHECK_EQUAL(counters.runs, 0u);
+	CHERIE_CHECK_EQUAL(counters.instructions_retired, 0u);
+#endif
+}
+
+CHERIE_TEST(telemetry_adds_up_over_runs)
+{
+	auto state = std::make_unique<cherie::state_raw>();
+	state->load(recursion, cherie::test::unoptimised());
+	state->run();
+	state->run();
+#ifdef CHERIE_TELEMETRY
+	CHERIE_CHECK_EQUAL(state->telemetry().runs, 2u);
+	CHERIE_CHECK_EQUAL(state->telemetry().calls, 2u * 62u);
+	CHERIE_CHECK_EQUAL(state->telemetry().max_call_depth, 51u);
+#else
+	CHERIE_CHECK_EQUAL(state->telemetry().calls, 0u);
+#endif
+}
@@ -1,49 +1,205 @@
-#include <iostream>
-#include <compilation/lexer.h>
+/*
+ * File Name: test.cpp
+ * Author(s): P. Kamara
+ *
+ * Behaviour tests.
+ */
 
+#include "test.h"
 
-#include "state.h"
-#include "compilation/parser.h"
-#include "compilation/ast/visitors/print_visitor.h"
-#include "vm/instruction.h"
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <utility>
 
-int main()
+namespace cherie::test
 {
-	/*auto lexer = std::make_unique<cherie::compiler::lexer>(std::wstring(LR"(
-fn hello(a: int) -> ([text] string, [random]? int) {
-	return "World!", a;
-}
+	namespace
+	{
+		struct test_case
+		{
+			const char* name;
+			void (*body)();
+		};
 
-print("Hello " + hello(0).text);
-	)"));*/
+		std::vector<test_case>& tests()
+		{
+			static std::vector<test_case> registered;
+			return registered;
+		}
 
-	/*auto state = std::make_unique<cherie::state_raw>();
-	state->program = instrs;
-	state->run();
+		size_t failures = 0;
+
+		bool is_heap_value(const vm::value_type tag)
+		{
+			return tag != vm::value_type::integer && tag != vm::value_type::floating && tag != vm::value_type::boolean;
+		}
+	}
 
-	std::cout << sizeof(cherie::vm::instruction) << std::endl;
-	*/
-	// 2 + (2 + 1) / 3 * 2 - a
-	try
+	registration::registration(const char* name, void (*body)())
 	{
-		const auto lexer = std::make_unique<cherie::compiler::lexer>(R"(
-			let a = 1;
-			print(a + 2);
-		)");
+		tests().push_back({ name, body });
+	}
 
-		auto* p = new cherie::compiler::parser(lexer.get());
-		auto* vis = new cherie::compiler::ast::print_visitor();
-		p->parse()->accept(vis);
+	void fail(const char* file, const int line, const std::string& message)
+	{
+		failures++;
+		std::printf("    %s(%d): %s\n", file, line, message.c_str());
 	}
-	catch (std::exception& exception)
+
+	compiler::options unoptimised()
 	{
-		std::cout << exception.what() << std::endl;
+		compiler::options options;
+		options.lazy_functions = false;
+		options.parallel = false;
+		options.inlining = false;
+		options.constant_folding = false;
+		options.copy_propagation = false;
+		options.common_subexpression_elimination = false;
+		options.global_value_numbering = false;
+		options.dead_code_elimination = false;
+		options.loop_invariant_code_motion = false;
+		options.strength_reduction = false;
+		options.loop_unrolling = false;
+		options.peephole = false;
+		return options;
 	}
-	/*auto token = lexer->next_token();
-	while(token != cherie::compiler::token_type::EOF)
+
+	vm::tagged_value outcome::value(const std::string& name) const
 	{
-		x->body.pop_back();
-		printf("[ID: %d] %s\n", token, cherie::compiler::get_token_str(token));
-		token = lexer->next_token();
-	}*/
+		try
+		{
+			return state->global(name);
+		}
+		catch (std::exception& exception)
+		{
+			fail(__FILE__, __LINE__, exception.what());
+			return { 0, vm::value_type::integer };
+		}
+	}
+
+	std::int64_t outcome::integer(const std::string& name) const
+	{
+		const auto global = value(name);
+		if (global.tag != vm::value_type::integer)
+		{
+			fail(__FILE__, __LINE__, "'" + name + "' is not an integer");
+			return 0;
+		}
+		return global.value;
+	}
+
+	double outcome::floating(const std::string& name) const
+	{
+		const auto global = value(name);
+		if (global.tag != vm::value_type::floating)
+		{
+			fail(__FILE__, __LINE__, "'" + name + "' is not a double");
+			return 0;
+		}
+		double result;
+		std::memcpy(&result, &global.value, sizeof(result));
+		return result;
+	}
+
+	bool outcome::boolean(const std::string& name) const
+	{
+		const auto global = value(name);
+		if (global.tag != vm::value_type::boolean)
+		{
+			fail(__FILE__, __LINE__, "'" + name + "' is not a boolean");
+			return false;
+		}
+		return global.value != 0;
+	}
+
+	outcome run(const std::string& source, const std::vector<std::string>& globals, const compiler::options& options, void (*configure)(state_raw&))
+	{
+		auto script = source;
+		if (!globals.empty())
+		{
+			script += "\nfn keep_globals() { return ";
+			for (size_t index = 0; index < globals.size(); index++)
+			{
+				script += (index ? ", " : "") + globals[index];
+			}
+			script += "; }";
+		}
+
+		auto state = std::make_unique<state_raw>();
+		if (configure)
+		{
+			configure(*state);
+		}
+		try
+		{
+			state->load(script, options);
+		}
+		catch (std::exception& exception)
+		{
+			return { std::move(state), exception.what() };
+		}
+		return run(std::move(state));
+	}
+
+	outcome run(std::unique_ptr<state_raw> state)
+	{
+		outcome result{ std::move(state), {} };
+		try
+		{
+			result.state->run();
+		}
+		catch (std::exception& exception)
+		{
+			result.error = exception.what();
+		}
+		return result;
+	}
+
+	void same_results(const char* file, const int line, const std::string& source, const std::vector<std::string>& globals)
+	{
+		const auto optimised = run(source, globals);
+		const auto plain = run(source, globals, unoptimised());
+		if (optimised.error != plain.error)
+		{
+			fail(file, line, "optimised run ended with [" + optimised.error + "], unoptimised with [" + plain.error + "]");
+			return;
+		}
+		if (!optimised.error.empty())
+		{
+			return;
+		}
+
+		for (const auto& name : globals)
+		{
+			const auto lhs = optimised.value(name);
+			const auto rhs = plain.value(name);
+			if (lhs.tag != rhs.tag || (!is_heap_value(lhs.tag) && lhs.value != rhs.value))
+			{
+				fail(file, line, "'" + name + "' is " + std::to_string(lhs.value) + " optimised and " + std::to_string(rhs.value) + " unoptimised");
+			}
+		}
+	}
+}
+
+int main()
+{
+	size_t failed = 0;
+	for (const auto& [name, body] : cherie::test::tests())
+	{
+		cherie::test::failures = 0;
+		try
+		{
+			body();
+		}
+		catch (std::exception& exception)
+		{
+			cherie::test::fail(__FILE__, __LINE__, std::string("uncaught exception: ") + exception.what());
+		}
+		std::printf("%s %s\n", cherie::test::failures ? "FAILED" : "ok    ", name);
+		failed += cherie::test::failures != 0;
+	}
+
+	std::printf("%zu of %zu tests failed\n", failed, cherie::test::tests().size());
+	return failed != 0;
 }
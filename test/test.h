@@ -0,0 +1,79 @@
+/*
+ * File Name: test.h
+ * Author(s): P. Kamara
+ *
+ * Behaviour tests.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "state.h"
+
+namespace cherie::test
+{
+	/* adds a test to the ones main runs, in the order the files were linked */
+	struct registration
+	{
+		registration(const char* name, void (*body)());
+	};
+
+	/* marks the running test as failed and says why, it goes on to its next check */
+	void fail(const char* file, int line, const std::string& message);
+
+	/* every optimisation off and every function compiled up front, what optimised runs are compared against */
+	[[nodiscard]] compiler::options unoptimised();
+
+	/* a finished run, error holds what it threw, if anything */
+	struct outcome
+	{
+		std::unique_ptr<state_raw> state;
+		std::string error;
+
+		/* a global's value, a failed check and 0 when it is missing or of another type */
+		[[nodiscard]] std::int64_t integer(const std::string& name) const;
+		[[nodiscard]] double floating(const std::string& name) const;
+		[[nodiscard]] bool boolean(const std::string& name) const;
+		[[nodiscard]] vm::tagged_value value(const std::string& name) const;
+	};
+
+	/**
+	 * Loads source into a new state and runs it. A function that reads each
+	 * of the names is appended to the script, so they stay globals however
+	 * the compiler would have kept them otherwise. configure, if given, gets
+	 * the state before it loads.
+	 */
+	outcome run(const std::string& source, const std::vector<std::string>& globals, const compiler::options& options = {}, void (*configure)(state_raw&) = nullptr);
+
+	/* runs an image or program already loaded into the state the same way */
+	outcome run(std::unique_ptr<state_raw> state);
+
+	/* runs source optimised and unoptimised, a failed check unless they end with the same error or the same bits and tags in every global */
+	void same_results(const char* file, int line, const std::string& source, const std::vector<std::string>& globals);
+
+	template <typename Actual, typename Expected>
+	void equal(const char* file, const int line, const char* expression, const Actual& actual, const Expected& expected)
+	{
+		if (!(actual == expected))
+		{
+			std::ostringstream message;
+			message.precision(17);
+			message << expression << " is " << actual << ", not " << expected;
+			fail(file, line, message.str());
+		}
+	}
+}
+
+#define CHERIE_TEST(name) \
+	static void name(); \
+	static const cherie::test::registration name##_registration(#name, name); \
+	static void name()
+
+#define CHERIE_CHECK(condition) ((condition) ? void() : cherie::test::fail(__FILE__, __LINE__, #condition))
+#define CHERIE_CHECK_EQUAL(actual, expected) cherie::test::equal(__FILE__, __LINE__, #actual, (actual), (expected))
+#define CHERIE_CHECK_SAME(source, ...) cherie::test::same_results(__FILE__, __LINE__, (source), __VA_ARGS__)
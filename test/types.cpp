@@ -0,0 +1,90 @@
+/*
+ * File Name: types.cpp
+ * Author(s): P. Kamara
+ *
+ * Tests for type inference and the opcodes specialised by it.
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include "test.h"
+
+namespace
+{
+	const char* const mixed = R"(
+		fn ints() { let s = 0; let i = 0; while (10 - i) { s += 3 * i - 1; i += 1; } return s; }
+		fn floats(x) { let y = x * 0.5 + 1.25; return -y / 2.0; }
+		fn joined(c) { let x = 1; if (c) { x = 2.5; } return x + 1; }
+		let r = ints();
+		let f = floats(3.0);
+		let g = floats(7);
+		let j = joined(1);
+		let k = joined(0);
+	)";
+
+	/* generic opcodes between the function's entry and the next one */
+	size_t generic_opcodes(const cherie::compiler::ir::bytecode& code, const std::string& name)
+	{
+		const auto function = std::find_if(code.functions.begin(), code.functions.end(), [&](const cherie::vm::function_info& info)
+		{
+			return info.name == name;
+		});
+		if (function == code.functions.end())
+		{
+			return std::numeric_limits<size_t>::max();
+		}
+
+		auto end = code.program.size();
+		for (const auto& other : code.functions)
+		{
+			if (other.entry > function->entry && other.entry < end)
+			{
+				end = other.entry;
+			}
+		}
+
+		size_t generic = 0;
+		for (auto pc = function->entry; pc < end; pc++)
+		{
+			const auto op = code.program[pc].op;
+			generic += op >= cherie::vm::opcode::addv && op <= cherie::vm::opcode::lnotv;
+		}
+		return generic;
+	}
+}
+
+CHERIE_TEST(types_pick_specialised_opcodes)
+{
+	const auto code = cherie::compiler::compile(mixed, cherie::test::unoptimised());
+	CHERIE_CHECK_EQUAL(generic_opcodes(code, "ints"), 0u);
+	CHERIE_CHECK(generic_opcodes(code, "floats") > 0); // parameters can be of any type
+	CHERIE_CHECK(generic_opcodes(code, "joined") > 0); // x is an integer or a float after the if
+}
+
+CHERIE_TEST(types_keep_values_and_tags)
+{
+	const auto result = cherie::test::run(mixed, { "r", "f", "g", "j", "k" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), 3 * 45 - 10);
+	CHERIE_CHECK_EQUAL(result.floating("f"), -1.375);
+	CHERIE_CHECK_EQUAL(result.floating("g"), -2.375);
+	CHERIE_CHECK_EQUAL(result.floating("j"), 3.5);
+	CHERIE_CHECK_EQUAL(result.integer("k"), 2);
+	CHERIE_CHECK_SAME(mixed, { "r", "f", "g", "j", "k" });
+}
+
+CHERIE_TEST(types_wrap_integers_and_mix_in_floats)
+{
+	const char* const source = R"(
+		fn wrap(n) { return n * 4 + 9223372036854775807; }
+		let r = wrap(1);
+		let t = 9223372036854775807 + 1;
+		let f = 1 / 2.0 + 1 / 2;
+		let b = !0;
+	)";
+	const auto result = cherie::test::run(source, { "r", "t", "f", "b" });
+	CHERIE_CHECK_EQUAL(result.integer("r"), std::numeric_limits<std::int64_t>::min() + 3);
+	CHERIE_CHECK_EQUAL(result.integer("t"), std::numeric_limits<std::int64_t>::min());
+	CHERIE_CHECK_EQUAL(result.floating("f"), 0.5);
+	CHERIE_CHECK_SAME(source, { "r", "t", "f", "b" });
+}
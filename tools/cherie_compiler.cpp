@@ -0,0 +1,126 @@
+/*
+ * File Name: cherie_compiler.cpp
+ * Author(s): P. Kamara
+ *
+ * Compiles a script into a bytecode image, or into C++.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "compilation/compiler.h"
+
+namespace
+{
+	int usage()
+	{
+		std::cerr << "usage: cherie_compiler [-O0] [-cpp symbol] [-o output] script\n"
+			"  -O0          no optimisations\n"
+			"  -cpp symbol  write C++ defining a vm::native_program called symbol instead of an image\n"
+			"  -o output    file to write, the script name with .chbc or .cpp by default\n";
+		return 2;
+	}
+}
+
+int main(const int argc, char** argv)
+{
+	cherie::compiler::options options;
+	std::string input;
+	std::string output;
+	std::string symbol;
+	for (auto index = 1; index < argc; index++)
+	{
+		if (std::strcmp(argv[index], "-O0") == 0)
+		{
+			options.inlining = false;
+			options.constant_folding = false;
+			options.copy_propagation = false;
+			options.common_subexpression_elimination = false;
+			options.global_value_numbering = false;
+			options.dead_code_elimination = false;
+			options.loop_invariant_code_motion = false;
+			options.strength_reduction = false;
+			options.loop_unrolling = false;
+			options.peephole = false;
+		}
+		else if (std::strcmp(argv[index], "-cpp") == 0 && index + 1 < argc)
+		{
+			symbol = argv[++index];
+		}
+		else if (std::strcmp(argv[index], "-o") == 0 && index + 1 < argc)
+		{
+			output = argv[++index];
+		}
+		else if (argv[index][0] != '-' && input.empty())
+		{
+			input = argv[index];
+		}
+		else
+		{
+			return usage();
+		}
+	}
+	if (input.empty())
+	{
+		return usage();
+	}
+	if (output.empty())
+	{
+		const auto dot = input.find_last_of('.');
+		const auto slash = input.find_last_of("/\\");
+		output = (dot != std::string::npos && (slash == std::string::npos || dot > slash) ? input.substr(0, dot) : input) + (symbol.empty() ? ".chbc" : ".cpp");
+	}
+
+	std::ifstream script(input, std::ios::binary);
+	if (!script)
+	{
+		std::cerr << "cherie_compiler: cannot read " << input << "\n";
+		return 1;
+	}
+	std::stringstream source;
+	source << script.rdbuf();
+
+	try
+	{
+		const auto code = cherie::compiler::compile(source.str(), options);
+
+		// written next to the target and renamed over it, so a process mapping the old image keeps a whole file
+		const auto temporary = output + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			if (symbol.empty())
+			{
+				cherie::compiler::write_image(file, code);
+			}
+			else
+			{
+				cherie::compiler::write_native(file, code, symbol);
+			}
+			if (!file.flush())
+			{
+				std::cerr << "cherie_compiler: cannot write " << temporary << "\n";
+				return 1;
+			}
+		}
+		auto renamed = std::rename(temporary.c_str(), output.c_str()) == 0;
+		if (!renamed) // Windows will not rename over an existing file
+		{
+			std::remove(output.c_str());
+			renamed = std::rename(temporary.c_str(), output.c_str()) == 0;
+		}
+		if (!renamed)
+		{
+			std::cerr << "cherie_compiler: cannot write " << output << "\n";
+			return 1;
+		}
+	}
+	catch (const std::exception& exception)
+	{
+		std::cerr << input << ": " << exception.what() << "\n";
+		return 1;
+	}
+	return 0;
+}